@@ -0,0 +1,30 @@
+#ifndef bench_h
+#define bench_h
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** **************************************
+ * File system calls of the benchmark suite.
+ * ***************************************/
+/* Calls follow POSIX conventions (-1 and errno on error), whichever file system serves them:
+ * the mounted one (posix_fs), or LFS in process (inproc_fs, see embed.h). */
+struct bench_fs {
+    int (*mkdir)(const char* path, mode_t mode);
+    int (*rmdir)(const char* path);
+    int (*open)(const char* path, int flags, mode_t mode);
+    int (*close)(int fd);
+    ssize_t (*pread)(int fd, void* buf, size_t size, off_t offset);
+    ssize_t (*pwrite)(int fd, const void* buf, size_t size, off_t offset);
+    int (*fsync)(int fd);
+    int (*stat)(const char* path, struct stat* st);
+    int (*unlink)(const char* path);
+};
+
+extern const bench_fs posix_fs;
+extern const bench_fs inproc_fs;
+
+void inproc_mount();
+void inproc_unmount();
+
+#endif
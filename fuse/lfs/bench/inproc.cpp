@@ -0,0 +1,133 @@
+/* In-process backend of the benchmark suite: calls the operations of LFS directly (see embed.h),
+ * with a table of open files in place of file descriptors. */
+#include "bench.h"
+
+#include "../index.h"
+#include "../embed.h"
+#include "../logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+
+struct inproc_file {
+    std::string path;
+    struct fuse_file_info fi;
+};
+
+std::mutex inproc_files_lock;
+std::deque<inproc_file> inproc_files;       // Indexed by descriptor (elements never move).
+std::vector<int> inproc_free_fds;
+
+/** Mount LFS in process, on the disk file (lfs.data) in the working directory. */
+void inproc_mount() {
+    set_log_level(ERROR);
+    set_log_output(stderr);
+    start_log_flusher();
+    embed_mount("lfsbench.mnt");
+}
+
+void inproc_unmount() {
+    embed_unmount();
+}
+
+/** (for internal uses only) Turn a result of LFS into a POSIX one. */
+int inproc_result(int ret) {
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return ret;
+}
+
+/** (for internal uses only) Retrieve an open file. */
+inproc_file* inproc_get_file(int fd) {
+    std::lock_guard<std::mutex> guard(inproc_files_lock);
+    return &inproc_files[fd];
+}
+
+int inproc_mkdir(const char* path, mode_t mode) {
+    embed_attach_thread();
+    return inproc_result(ops.mkdir(path, mode));
+}
+
+int inproc_rmdir(const char* path) {
+    embed_attach_thread();
+    return inproc_result(ops.rmdir(path));
+}
+
+/** Open a file, creating it first (as the kernel would) if O_CREAT is given and it does not exist. */
+int inproc_open(const char* path, int flags, mode_t mode) {
+    embed_attach_thread();
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    fi.flags = flags;
+
+    struct stat st;
+    int ret;
+    if ((flags & O_CREAT) && (ops.getattr(path, &st, NULL) == -ENOENT))
+        ret = ops.create(path, mode | S_IFREG, &fi);
+    else
+        ret = ops.open(path, &fi);
+    if (ret < 0)
+        return inproc_result(ret);
+
+    std::lock_guard<std::mutex> guard(inproc_files_lock);
+    int fd;
+    if (inproc_free_fds.empty()) {
+        fd = inproc_files.size();
+        inproc_files.push_back(inproc_file());
+    } else {
+        fd = inproc_free_fds.back();
+        inproc_free_fds.pop_back();
+    }
+    inproc_files[fd].path = path;
+    inproc_files[fd].fi = fi;
+    return fd;
+}
+
+int inproc_close(int fd) {
+    embed_attach_thread();
+    inproc_file* file = inproc_get_file(fd);
+    int ret = ops.flush(file->path.c_str(), &file->fi);
+    ops.release(file->path.c_str(), &file->fi);
+
+    std::lock_guard<std::mutex> guard(inproc_files_lock);
+    inproc_free_fds.push_back(fd);
+    return inproc_result(ret);
+}
+
+ssize_t inproc_pread(int fd, void* buf, size_t size, off_t offset) {
+    embed_attach_thread();
+    inproc_file* file = inproc_get_file(fd);
+    return inproc_result(ops.read(file->path.c_str(), (char*) buf, size, offset, &file->fi));
+}
+
+ssize_t inproc_pwrite(int fd, const void* buf, size_t size, off_t offset) {
+    embed_attach_thread();
+    inproc_file* file = inproc_get_file(fd);
+    return inproc_result(ops.write(file->path.c_str(), (const char*) buf, size, offset, &file->fi));
+}
+
+int inproc_fsync(int fd) {
+    embed_attach_thread();
+    inproc_file* file = inproc_get_file(fd);
+    return inproc_result(ops.fsync(file->path.c_str(), 0, &file->fi));
+}
+
+int inproc_stat(const char* path, struct stat* st) {
+    embed_attach_thread();
+    return inproc_result(ops.getattr(path, st, NULL));
+}
+
+int inproc_unlink(const char* path) {
+    embed_attach_thread();
+    return inproc_result(ops.unlink(path));
+}
+
+const bench_fs inproc_fs = {inproc_mkdir, inproc_rmdir, inproc_open, inproc_close, inproc_pread,
+                            inproc_pwrite, inproc_fsync, inproc_stat, inproc_unlink};
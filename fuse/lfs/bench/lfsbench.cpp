@@ -0,0 +1,433 @@
+/* LFS benchmark suite.
+ * Runs file system workloads in a directory (usually the mount point of LFS), and reports one JSON
+ * object per workload and thread count on stdout, so that builds can be compared:
+ *   {"workload": "seq_write_64k", "threads": 4, "ops": 512, "bytes": 33554432, "seconds": 0.21,
+ *    "ops_per_sec": 2438.1, "mb_per_sec": 152.4, "p50_us": 310.2, "p99_us": 1204.7, "p999_us": 2210.9}
+ * Latencies are measured per operation (a file for small-file workloads, a request otherwise).
+ *
+ * Usage: lfsbench [-i] [-t 1,2,4,8] [-s scale] [-f fill_mb] <dir> [workload ...]
+ *   -i: serve LFS in process (see embed.h), with its disk file (lfs.data) in the working directory;
+ *       <dir> is then a directory inside LFS (e.g. "/"). No FUSE mount is needed.
+ *   -t: thread counts to run each workload with (N-thread scaling; each thread works in its own directory).
+ *   -s: multiplier of the number of operations (default 1).
+ *   -f: data written by gc_overwrite in total (default 48 MB), overwritten 4 times.
+ *   -l: list workloads.
+ * Built by "scons bench". Reads through a mount may be served by the kernel page cache: mount with
+ * "-o direct_io" (or remount between runs), or use -i, to measure LFS itself. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <functional>
+
+#include "bench.h"
+
+/* The mounted file system. */
+static int posix_open(const char* path, int flags, mode_t mode) { return open(path, flags, mode); }
+static int posix_stat(const char* path, struct stat* st) { return stat(path, st); }
+
+const bench_fs posix_fs = {mkdir, rmdir, posix_open, close, pread, pwrite, fsync, posix_stat, unlink};
+const bench_fs* fs = &posix_fs;
+
+/** Abort the benchmark on a failed call. */
+#define SYS_CHECK(call) \
+    do { \
+        if ((call) < 0) { \
+            fprintf(stderr, "[ERROR] %s failed (%s:%d): %s\n", #call, __FILE__, __LINE__, strerror(errno)); \
+            exit(1); \
+        } \
+    } while (0)
+
+
+/** **************************************
+ * Workloads.
+ * ***************************************/
+const int SMALL_FILES      = 1000;      // Files per thread (small-file workloads).
+const int SMALL_FILE_SIZE  = 1024;
+const int RW_FILE_SIZE     = 8 << 20;   // File size per thread (sequential / random workloads).
+const int FSYNC_COMMITS    = 500;
+const int FSYNC_SIZE       = 4096;
+const int GC_CHUNK_SIZE    = 1 << 20;
+const int GC_ROUNDS        = 4;
+const int DEEP_PATH_DEPTH  = 32;
+const int DEEP_LOOKUPS     = 5000;
+
+int scale = 1;
+int gc_fill_mb = 48;
+
+/* State of a benchmark thread. */
+struct bench_thread {
+    int id, num_threads;
+    std::string dir;                    // Private directory of the thread.
+    std::vector<char> buf;
+    std::vector<uint64_t> latencies;    // In nanoseconds, one per operation.
+    uint64_t bytes;
+    unsigned int seed;
+    uint64_t stamp;                     // Last stamp of written data.
+};
+
+struct workload {
+    const char* name;
+    int io_size;
+    void (*setup)(bench_thread &t, int io_size);       // Not timed.
+    void (*run)(bench_thread &t, int io_size);         // Timed.
+    void (*teardown)(bench_thread &t, int io_size);    // Not timed.
+};
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/** Run an operation, and record its latency. */
+template <typename F>
+void timed(bench_thread &t, F op) {
+    uint64_t start = now_ns();
+    op();
+    t.latencies.push_back(now_ns() - start);
+}
+
+/** Make data to be written unique (otherwise LFS shares identical blocks instead of writing them). */
+void stamp_data(bench_thread &t, int size) {
+    const int STAMP_INTERVAL = 512;     // Smaller than any block size.
+    for (int pos=0; pos+(int)sizeof(uint64_t)<=size; pos+=STAMP_INTERVAL) {
+        uint64_t stamp = ((uint64_t) t.id << 48) | ++t.stamp;
+        memcpy(t.buf.data() + pos, &stamp, sizeof(stamp));
+    }
+}
+
+std::string file_path(bench_thread &t, const char* prefix, int i) {
+    return t.dir + "/" + prefix + std::to_string(i);
+}
+
+/** Create a file of the given size (written by io_size requests). */
+void fill_file(bench_thread &t, const std::string &path, int size, int io_size) {
+    int fd = fs->open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    SYS_CHECK(fd);
+    for (int pos=0; pos<size; pos+=io_size) {
+        stamp_data(t, io_size);
+        SYS_CHECK(fs->pwrite(fd, t.buf.data(), io_size, pos));
+    }
+    SYS_CHECK(fs->close(fd));
+}
+
+void no_op(bench_thread &t, int io_size) {}
+
+
+/* Small files: create (with 1 KB of data), stat, and delete. */
+void small_create(bench_thread &t, int io_size) {
+    for (int i=0; i<SMALL_FILES*scale; i++) {
+        std::string path = file_path(t, "s", i);
+        stamp_data(t, SMALL_FILE_SIZE);
+        timed(t, [&] {
+            int fd = fs->open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+            SYS_CHECK(fd);
+            SYS_CHECK(fs->pwrite(fd, t.buf.data(), SMALL_FILE_SIZE, 0));
+            SYS_CHECK(fs->close(fd));
+        });
+        t.bytes += SMALL_FILE_SIZE;
+    }
+}
+
+void small_setup(bench_thread &t, int io_size) {
+    for (int i=0; i<SMALL_FILES*scale; i++)
+        fill_file(t, file_path(t, "s", i), SMALL_FILE_SIZE, SMALL_FILE_SIZE);
+}
+
+void small_stat(bench_thread &t, int io_size) {
+    struct stat st;
+    for (int pass=0; pass<3; pass++)
+        for (int i=0; i<SMALL_FILES*scale; i++) {
+            std::string path = file_path(t, "s", i);
+            timed(t, [&] { SYS_CHECK(fs->stat(path.c_str(), &st)); });
+        }
+}
+
+void small_delete(bench_thread &t, int io_size) {
+    for (int i=0; i<SMALL_FILES*scale; i++) {
+        std::string path = file_path(t, "s", i);
+        timed(t, [&] { SYS_CHECK(fs->unlink(path.c_str())); });
+    }
+}
+
+void small_teardown(bench_thread &t, int io_size) {
+    for (int i=0; i<SMALL_FILES*scale; i++)
+        SYS_CHECK(fs->unlink(file_path(t, "s", i).c_str()));
+}
+
+
+/* Sequential and random reads / writes of a file, by io_size requests. */
+int rw_file_size() {
+    return RW_FILE_SIZE * scale;
+}
+
+void rw_setup(bench_thread &t, int io_size) {
+    fill_file(t, file_path(t, "rw", 0), rw_file_size(), GC_CHUNK_SIZE);
+}
+
+void rw_teardown(bench_thread &t, int io_size) {
+    SYS_CHECK(fs->unlink(file_path(t, "rw", 0).c_str()));
+}
+
+/** Offsets of requests: in order, or shuffled (each aligned block once). */
+std::vector<off_t> rw_offsets(bench_thread &t, int io_size, bool is_random) {
+    std::vector<off_t> offsets;
+    for (off_t pos=0; pos<rw_file_size(); pos+=io_size)
+        offsets.push_back(pos);
+    if (is_random)
+        for (int i=offsets.size()-1; i>0; i--)
+            std::swap(offsets[i], offsets[rand_r(&t.seed) % (i + 1)]);
+    return offsets;
+}
+
+void rw_run(bench_thread &t, int io_size, bool is_write, bool is_random) {
+    std::string path = file_path(t, "rw", 0);
+    int fd = fs->open(path.c_str(), is_write ? (O_CREAT | O_WRONLY) : O_RDONLY, 0644);
+    SYS_CHECK(fd);
+    for (off_t pos : rw_offsets(t, io_size, is_random)) {
+        if (is_write) {
+            stamp_data(t, io_size);
+            timed(t, [&] { SYS_CHECK(fs->pwrite(fd, t.buf.data(), io_size, pos)); });
+        } else {
+            timed(t, [&] { SYS_CHECK(fs->pread(fd, t.buf.data(), io_size, pos)); });
+        }
+        t.bytes += io_size;
+    }
+    SYS_CHECK(fs->close(fd));
+}
+
+void seq_write(bench_thread &t, int io_size)  { rw_run(t, io_size, true, false); }
+void seq_read(bench_thread &t, int io_size)   { rw_run(t, io_size, false, false); }
+void rand_write(bench_thread &t, int io_size) { rw_run(t, io_size, true, true); }
+void rand_read(bench_thread &t, int io_size)  { rw_run(t, io_size, false, true); }
+
+
+/* Commits: append a record, and fsync it. */
+void fsync_commit(bench_thread &t, int io_size) {
+    std::string path = file_path(t, "journal", 0);
+    int fd = fs->open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    SYS_CHECK(fd);
+    for (int i=0; i<FSYNC_COMMITS*scale; i++) {
+        stamp_data(t, FSYNC_SIZE);
+        timed(t, [&] {
+            SYS_CHECK(fs->pwrite(fd, t.buf.data(), FSYNC_SIZE, (off_t) i * FSYNC_SIZE));
+            SYS_CHECK(fs->fsync(fd));
+        });
+        t.bytes += FSYNC_SIZE;
+    }
+    SYS_CHECK(fs->close(fd));
+}
+
+void fsync_teardown(bench_thread &t, int io_size) {
+    SYS_CHECK(fs->unlink(file_path(t, "journal", 0).c_str()));
+}
+
+
+/* GC pressure: fill the file system, then overwrite all data several times (1 MB requests). */
+int gc_chunks(bench_thread &t) {
+    return std::max(1, gc_fill_mb / t.num_threads);
+}
+
+void gc_setup(bench_thread &t, int io_size) {
+    fill_file(t, file_path(t, "gc", 0), gc_chunks(t) * GC_CHUNK_SIZE, GC_CHUNK_SIZE);
+}
+
+void gc_overwrite(bench_thread &t, int io_size) {
+    std::string path = file_path(t, "gc", 0);
+    int fd = fs->open(path.c_str(), O_WRONLY, 0644);
+    SYS_CHECK(fd);
+    for (int round=0; round<GC_ROUNDS; round++)
+        for (int i=0; i<gc_chunks(t); i++) {
+            stamp_data(t, GC_CHUNK_SIZE);
+            timed(t, [&] { SYS_CHECK(fs->pwrite(fd, t.buf.data(), GC_CHUNK_SIZE, (off_t) i * GC_CHUNK_SIZE)); });
+            t.bytes += GC_CHUNK_SIZE;
+        }
+    SYS_CHECK(fs->close(fd));
+}
+
+void gc_teardown(bench_thread &t, int io_size) {
+    SYS_CHECK(fs->unlink(file_path(t, "gc", 0).c_str()));
+}
+
+
+/* Lookups of a deep path (DEEP_PATH_DEPTH directories). */
+std::string deep_dir(bench_thread &t, int depth) {
+    std::string path = t.dir;
+    for (int i=0; i<depth; i++)
+        path += "/d" + std::to_string(i);
+    return path;
+}
+
+void deep_setup(bench_thread &t, int io_size) {
+    for (int i=1; i<=DEEP_PATH_DEPTH; i++)
+        SYS_CHECK(fs->mkdir(deep_dir(t, i).c_str(), 0755));
+    fill_file(t, deep_dir(t, DEEP_PATH_DEPTH) + "/leaf", SMALL_FILE_SIZE, SMALL_FILE_SIZE);
+}
+
+void deep_lookup(bench_thread &t, int io_size) {
+    std::string path = deep_dir(t, DEEP_PATH_DEPTH) + "/leaf";
+    struct stat st;
+    for (int i=0; i<DEEP_LOOKUPS*scale; i++)
+        timed(t, [&] { SYS_CHECK(fs->stat(path.c_str(), &st)); });
+}
+
+void deep_teardown(bench_thread &t, int io_size) {
+    SYS_CHECK(fs->unlink((deep_dir(t, DEEP_PATH_DEPTH) + "/leaf").c_str()));
+    for (int i=DEEP_PATH_DEPTH; i>=1; i--)
+        SYS_CHECK(fs->rmdir(deep_dir(t, i).c_str()));
+}
+
+
+const workload workloads[] = {
+    {"small_create",   0,       no_op,       small_create, small_teardown},
+    {"small_stat",     0,       small_setup, small_stat,   small_teardown},
+    {"small_delete",   0,       small_setup, small_delete, no_op},
+    {"seq_write_4k",   4 << 10, no_op,       seq_write,    rw_teardown},
+    {"seq_write_64k",  64 << 10, no_op,      seq_write,    rw_teardown},
+    {"seq_write_1m",   1 << 20, no_op,       seq_write,    rw_teardown},
+    {"seq_read_4k",    4 << 10, rw_setup,    seq_read,     rw_teardown},
+    {"seq_read_64k",   64 << 10, rw_setup,   seq_read,     rw_teardown},
+    {"seq_read_1m",    1 << 20, rw_setup,    seq_read,     rw_teardown},
+    {"rand_write_4k",  4 << 10, rw_setup,    rand_write,   rw_teardown},
+    {"rand_write_64k", 64 << 10, rw_setup,   rand_write,   rw_teardown},
+    {"rand_read_4k",   4 << 10, rw_setup,    rand_read,    rw_teardown},
+    {"rand_read_64k",  64 << 10, rw_setup,   rand_read,    rw_teardown},
+    {"fsync_commit",   0,       no_op,       fsync_commit, fsync_teardown},
+    {"gc_overwrite",   0,       gc_setup,    gc_overwrite, gc_teardown},
+    {"deep_lookup",    0,       deep_setup,  deep_lookup,  deep_teardown},
+};
+
+
+/** **************************************
+ * Driver.
+ * ***************************************/
+
+/** Run a phase of a workload on all threads at once.
+ * @return seconds: wall-clock time of the phase. */
+double run_phase(std::vector<bench_thread> &threads, void (*phase)(bench_thread&, int), int io_size) {
+    uint64_t start = now_ns();
+    std::vector<std::thread> workers;
+    for (bench_thread &t : threads)
+        workers.push_back(std::thread(phase, std::ref(t), io_size));
+    for (std::thread &worker : workers)
+        worker.join();
+    return (now_ns() - start) / 1e9;
+}
+
+/** Latency percentile (in microseconds) of sorted latencies. */
+double percentile_us(const std::vector<uint64_t> &sorted, double p) {
+    if (sorted.empty())
+        return 0;
+    size_t rank = (size_t) (p * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)] / 1e3;
+}
+
+void run_workload(const char* root, const workload &w, int num_threads) {
+    std::vector<bench_thread> threads(num_threads);
+    for (int i=0; i<num_threads; i++) {
+        bench_thread &t = threads[i];
+        t.id = i;
+        t.num_threads = num_threads;
+        t.dir = std::string(root) + "/lfsbench." + w.name + "." + std::to_string(i);
+        t.buf.resize(std::max(w.io_size, GC_CHUNK_SIZE));
+        for (size_t k=0; k<t.buf.size(); k++)
+            t.buf[k] = (char) (k * 131 + i);
+        t.bytes = 0;
+        t.seed = i + 1;
+        t.stamp = 0;
+        SYS_CHECK(fs->mkdir(t.dir.c_str(), 0755));
+    }
+
+    run_phase(threads, w.setup, w.io_size);
+    double seconds = run_phase(threads, w.run, w.io_size);
+    run_phase(threads, w.teardown, w.io_size);
+
+    std::vector<uint64_t> latencies;
+    uint64_t bytes = 0;
+    for (bench_thread &t : threads) {
+        SYS_CHECK(fs->rmdir(t.dir.c_str()));
+        latencies.insert(latencies.end(), t.latencies.begin(), t.latencies.end());
+        bytes += t.bytes;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{\"workload\": \"%s\", \"threads\": %d, \"ops\": %lu, \"bytes\": %lu, \"seconds\": %.6f, "
+           "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f}\n",
+           w.name, num_threads, latencies.size(), bytes, seconds,
+           latencies.size() / seconds, bytes / seconds / (1 << 20),
+           percentile_us(latencies, 0.5), percentile_us(latencies, 0.99), percentile_us(latencies, 0.999));
+    fflush(stdout);
+}
+
+void usage(const char* prog) {
+    fprintf(stderr, "usage: %s [-i] [-t 1,2,4,8] [-s scale] [-f fill_mb] [-l] <dir> [workload ...]\n", prog);
+    exit(2);
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> thread_counts;
+    bool in_process = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "it:s:f:l")) != -1) {
+        switch (opt) {
+            case 'i':
+                in_process = true;
+                break;
+            case 't':
+                for (char* tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ","))
+                    thread_counts.push_back(std::max(1, atoi(tok)));
+                break;
+            case 's':
+                scale = std::max(1, atoi(optarg));
+                break;
+            case 'f':
+                gc_fill_mb = std::max(1, atoi(optarg));
+                break;
+            case 'l':
+                for (const workload &w : workloads)
+                    printf("%s\n", w.name);
+                return 0;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+    if (thread_counts.empty())
+        thread_counts.push_back(1);
+
+    // Paths are built as root + "/name": drop trailing slashes (the root directory becomes "").
+    std::string root = argv[optind];
+    while (!root.empty() && (root.back() == '/'))
+        root.pop_back();
+    std::vector<std::string> selected(argv + optind + 1, argv + argc);
+    for (const std::string &name : selected)
+        if (std::none_of(std::begin(workloads), std::end(workloads), [&name](const workload &w) { return name == w.name; })) {
+            fprintf(stderr, "[ERROR] Unknown workload: %s (see -l).\n", name.c_str());
+            return 2;
+        }
+
+    if (in_process) {
+        fs = &inproc_fs;
+        inproc_mount();
+    }
+    for (const workload &w : workloads) {
+        if (!selected.empty() && (std::find(selected.begin(), selected.end(), w.name) == selected.end()))
+            continue;
+        for (int num_threads : thread_counts)
+            run_workload(root.c_str(), w, num_threads);
+    }
+    if (in_process)
+        inproc_unmount();
+    return 0;
+}
@@ -13,14 +13,38 @@
 #include <time.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <thread>
+#include <vector>
 #include <fuse.h>
 #include "wbcache.h"
+#include "compress.h"
+#include "dedup.h"
+#include "device.h"
+#include "metrics.h"
 
 /** Retrieve block according to the block address.
  * @param  data: pointer of return data.
  * @param  block_addr: block address.
  * Note that the block may be in segment buffer, or in disk file. */
 void get_block(void* data, int block_addr) {
+    block_ref ref;
+    acquire_block(ref, block_addr);
+    memcpy(data, ref.data, BLOCK_SIZE);
+    release_block(ref);
+}
+
+/** (for internal uses only) Wait until no block of the segment buffer is being rewritten in place.
+ * A rewrite never waits for anything (see rewrite_in_place()), so this is always short.
+ * @return the (even) value of buffer_seq, to validate a read from the segment buffer. */
+unsigned int wait_buffer_rewrite() {
+    unsigned int rewrite_seq;
+    while ((rewrite_seq = buffer_seq.load(std::memory_order_acquire)) & 1)
+        std::this_thread::yield();
+    return rewrite_seq;
+}
+
+/** (for internal uses only) Copy a block out, waiting for the segment lock if necessary. */
+void copy_block(void* data, int block_addr) {
     if (GC_CONCURRENCY && is_doing_gc) { 
         // When doing GC, retrieve from either disk file (addr > 0) or pending buffer (addr <= -3).
         // Note that GC is only triggered when segment buffer is empty, and when cache is disabled.
@@ -35,11 +59,37 @@ void get_block(void* data, int block_addr) {
         return;
     }
 
-    acquire_segment_lock();
-        // When not doing GC, retrieve from either segment buffer or disk file (maybe through cache).
-        int segment = block_addr / BLOCKS_IN_SEGMENT;
-        int block = block_addr % BLOCKS_IN_SEGMENT;
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    int block = block_addr % BLOCKS_IN_SEGMENT;
+
+    // When not doing GC, retrieve from either segment buffer or disk file (maybe through cache).
+    // Appends never touch blocks that are already addressable, so the read is consistent
+    // unless the segment buffer is sealed and replaced meanwhile (detected by segment_seq),
+    // or the block is rewritten in place (detected by buffer_seq, for the segment buffer only).
+    for (int attempt=0; attempt<SEGMENT_READ_RETRIES; attempt++) {
+        unsigned int seq = segment_seq.load(std::memory_order_acquire);
+        if (seq & 1) break;     // A segment switch (or GC) is in progress.
+
+        bool in_buffer = (segment == cur_segment);
+        unsigned int rewrite_seq = 0;
+        if (in_buffer) {    // Data in segment buffer.
+            rewrite_seq = wait_buffer_rewrite();
+            memcpy(data, segment_buffer + block * BLOCK_SIZE, BLOCK_SIZE);
+        } else {    // Data in a sealed segment (disk file, maybe through cache).
+            if (USE_CACHE)
+                read_block_through_cache(data, block_addr);
+            else
+                read_block(data, block_addr);
+        }
 
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((segment_seq.load(std::memory_order_relaxed) == seq)
+            && (!in_buffer || (buffer_seq.load(std::memory_order_relaxed) == rewrite_seq)))
+            return;
+    }
+
+    // Slow path: wait for the writer to finish switching segments.
+    acquire_segment_lock();
         if (segment == cur_segment) {    // Data in segment buffer.
             int buffer_offset = block * BLOCK_SIZE;
 
@@ -53,6 +103,194 @@ void get_block(void* data, int block_addr) {
     release_segment_lock();
 }
 
+
+std::atomic<int> block_refs(0);         // References in segment buffer or cache (all threads).
+std::atomic<int> buffer_refs(0);        // References in segment buffer only (all threads).
+thread_local std::vector<struct block_ref*> held_refs;     // References held by the current thread.
+thread_local int held_buffer_refs = 0;  // Those of them in segment buffer.
+
+/* Times a block retrieval: a hit, unless the thread reads a device meanwhile (see metrics.h). */
+struct block_timer {
+    uint64_t start = USE_STATS ? metric_clock() : 0;
+    uint64_t disk_reads = local_counter(COUNT_DISK_READS);
+
+    ~block_timer() {
+        if (USE_STATS)
+            record_metric((local_counter(COUNT_DISK_READS) == disk_reads) ? STAGE_GET_BLOCK_HIT : STAGE_GET_BLOCK_MISS,
+                          metric_clock() - start);
+    }
+};
+
+/** (for internal uses only) Point a reference into the segment buffer (counted in buffer_refs).
+ * The reference is registered before buffer_seq is checked: a rewrite that has not checked
+ * buffer_refs yet will see it, and an on-going one is waited for (see rewrite_in_place()). */
+const char* pin_buffer_block(int block, struct block_ref &ref) {
+    while (1) {
+        buffer_refs.fetch_add(1);
+        unsigned int rewrite_seq = buffer_seq.load();
+        if (((rewrite_seq & 1) == 0) || (held_buffer_refs > 0)) {
+            // No rewrite is on-going, or it is blocked by the references we already hold.
+            ref.in_buffer = true;
+            return segment_buffer + block * BLOCK_SIZE;
+        }
+        buffer_refs.fetch_sub(1);
+        wait_buffer_rewrite();
+    }
+}
+
+/** Acquire a read-only reference to a block.
+ * @param  ref: return variable; ref.data points to the block until release_block(ref).
+ * @param  block_addr: block address. */
+void acquire_block(struct block_ref &ref, int block_addr) {
+    block_timer timer;
+    ref.data = NULL;
+    ref.cacheline = -1;
+    ref.pinned = false;
+    ref.in_buffer = false;
+    if ((GC_CONCURRENCY && is_doing_gc) || (block_addr < 0)) {
+        copy_block(ref.local, block_addr);
+        ref.data = ref.local;
+        return;
+    }
+
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    int block = block_addr % BLOCKS_IN_SEGMENT;
+
+    // Register the reference first: a segment switch that has not passed drain_block_refs() yet
+    // will wait for it, so the segment buffer cannot be reset under our feet.
+    block_refs.fetch_add(1);
+    unsigned int seq = segment_seq.load();
+    if (((seq & 1) == 0) || !held_refs.empty()) {
+        // Either no switch is on-going, or one is blocked by the references we already hold.
+        if (segment == cur_segment)
+            ref.data = pin_buffer_block(block, ref);
+        else if (USE_CACHE)
+            ref.data = pin_block_through_cache(block_addr, ref.cacheline);
+
+        // Without other references, the position is only trusted if no switch started meanwhile.
+        if ((ref.data != NULL) && (!held_refs.empty() || (segment_seq.load() == seq))) {
+            ref.pinned = true;
+            held_refs.push_back(&ref);
+            if (ref.in_buffer)
+                held_buffer_refs++;
+            return;
+        }
+        if (ref.cacheline >= 0)
+            unpin_cacheline(ref.cacheline);
+        if (ref.in_buffer)
+            buffer_refs.fetch_sub(1);
+        ref.cacheline = -1;
+        ref.in_buffer = false;
+    }
+    block_refs.fetch_sub(1);
+
+    // Fall back to a private copy (the thread holds no reference, so it may wait).
+    copy_block(ref.local, block_addr);
+    ref.data = ref.local;
+}
+
+void release_block(struct block_ref &ref) {
+    if (ref.cacheline >= 0)
+        unpin_cacheline(ref.cacheline);
+    if (ref.pinned) {
+        for (int i = held_refs.size() - 1; i >= 0; i--)
+            if (held_refs[i] == &ref) {
+                held_refs.erase(held_refs.begin() + i);
+                break;
+            }
+        block_refs.fetch_sub(1);
+        if (ref.in_buffer) {
+            buffer_refs.fetch_sub(1);
+            held_buffer_refs--;
+        }
+    }
+    ref.cacheline = -1;
+    ref.pinned = false;
+    ref.in_buffer = false;
+    ref.data = NULL;
+}
+
+/** (for internal uses only) Turn the references of the current thread into private copies:
+ * it cannot wait for them to be released (e.g. when it appends while holding them). */
+void copy_held_refs() {
+    for (struct block_ref* ref : held_refs) {
+        memcpy(ref->local, ref->data, BLOCK_SIZE);
+        ref->data = ref->local;
+        if (ref->cacheline >= 0)
+            unpin_cacheline(ref->cacheline);
+        ref->cacheline = -1;
+        ref->pinned = false;
+        block_refs.fetch_sub(1);
+        if (ref->in_buffer)
+            buffer_refs.fetch_sub(1);
+        ref->in_buffer = false;
+    }
+    held_refs.clear();
+    held_buffer_refs = 0;
+}
+
+/** Wait until all block references are released (before the segment buffer or cache is reset).
+ * References of the current thread are copied instead (see block_ref). */
+void drain_block_refs() {
+    copy_held_refs();
+    while (block_refs.load() > 0)
+        std::this_thread::yield();
+}
+
+/** Wait (briefly) until the references into the segment buffer are released, before a block of it
+ * changes in place (references into the cache are unaffected).
+ * @return flag: false if references remain (held by the current thread, or by another one for more
+ *         than BLOCK_REF_SPINS attempts): the block should be appended anew instead. */
+bool try_drain_buffer_refs() {
+    if (held_buffer_refs > 0)
+        return false;
+    for (int attempt=0; attempt<BLOCK_REF_SPINS; attempt++) {
+        if (buffer_refs.load() == 0)
+            return true;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+/** Retrieve a block only if it is held in memory (segment buffer or cache), without blocking.
+ * Blocks that are not in memory are up-to-date in the disk file, so that they can be spliced
+ * (except for compressed blocks, which are decompressed into data instead).
+ * @param  file_pos: return variable, offset of the block in the disk file (if flag = 0).
+ * @return flag: 1 if copied into data, 0 if the block is on disk (data untouched),
+ *               and -1 if undecidable now (a segment switch, a rewrite in place or GC is on-going). */
+int get_block_in_memory(void* data, int block_addr, off_t &file_pos) {
+    if (is_doing_gc || (block_addr < 0))
+        return -1;
+
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    int block = block_addr % BLOCKS_IN_SEGMENT;
+    for (int attempt=0; attempt<SEGMENT_READ_RETRIES; attempt++) {
+        unsigned int seq = segment_seq.load(std::memory_order_acquire);
+        if (seq & 1) return -1;
+
+        int flag = 1;
+        bool in_buffer = (segment == cur_segment);
+        unsigned int rewrite_seq = 0;
+        if (in_buffer) {
+            rewrite_seq = buffer_seq.load(std::memory_order_acquire);
+            if (rewrite_seq & 1) return -1;
+            memcpy(data, segment_buffer + block * BLOCK_SIZE, BLOCK_SIZE);
+        } else if (!USE_CACHE || !read_block_if_cached(data, block_addr)) {
+            file_pos = block_file_offset(block_addr);
+            if (file_pos < 0)
+                read_block(data, block_addr);
+            else
+                flag = 0;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((segment_seq.load(std::memory_order_relaxed) == seq)
+            && (!in_buffer || (buffer_seq.load(std::memory_order_relaxed) == rewrite_seq)))
+            return flag;
+    }
+    return -1;
+}
+
 /** Retrieve block according to the i_number of inode block.
  * @param  inode_data: pointer of returned inode.
  * @param  i_number: i_number of block.
@@ -208,7 +446,8 @@ void get_next_free_segment() {
             return;
         }
         
-        // Initialize segment buffer.
+        // Initialize segment buffer (once no reference points into it).
+        drain_block_refs();
         memset(segment_buffer, 0, sizeof(segment_buffer));
         cur_segment     = next_free_segment;
         cur_block       = 0;
@@ -216,6 +455,40 @@ void get_next_free_segment() {
     }
 }
 
+/** (for internal uses only) Flush the segment buffer to disk file, and move to the next free segment. */
+void seal_segment() {
+    metric_timer timer(STAGE_SEGMENT_SEAL);
+    add_segbuf_metadata();
+    if (USE_CACHE)
+        write_segment_through_cache(segment_buffer, cur_segment);
+    else
+        write_segment(segment_buffer, cur_segment);
+    segment_bitmap[cur_segment] = 1;
+
+    // Blocks of the sealed segment are read from the segment buffer until it is reused:
+    // readers only retry across the switch itself (not across the write and compression above).
+    begin_segment_switch();
+    get_next_free_segment();
+    segment_bitmap[cur_segment] = 1;
+    end_segment_switch();
+}
+
+/** Start a log unit: make room in the segment buffer for an operation appending up to num_blocks
+ * blocks and num_imap imap entries, so that all its changes are sealed in the same segment
+ * (which is written at once). The segment is sealed early if the unit may not fit.
+ * This is best effort: concurrent writers may still fill the segment meanwhile. */
+void reserve_segment_space(int num_blocks, int num_imap) {
+    if (GC_CONCURRENCY && is_doing_gc)
+        return;
+
+    if (allow_gc) acquire_segment_lock();
+        bool is_empty = (cur_block == 0) && (next_imap_index == 0);
+        if (!is_full && !is_empty && ((cur_block + num_blocks >= DATA_BLOCKS_IN_SEGMENT-1)
+                                      || (next_imap_index + num_imap > DATA_BLOCKS_IN_SEGMENT)))
+            seal_segment();
+    if (allow_gc) release_segment_lock();
+}
+
 /** Increment cur_block, and flush segment buffer if it is full. */
 void move_to_segment() {
     if (is_full) {
@@ -226,15 +499,7 @@ void move_to_segment() {
 
     if (cur_block == DATA_BLOCKS_IN_SEGMENT-1 || next_imap_index == DATA_BLOCKS_IN_SEGMENT) {
         // Segment buffer is full, and should be flushed to disk file.
-        add_segbuf_metadata();
-        if (USE_CACHE)
-            write_segment_through_cache(segment_buffer, cur_segment);
-        else
-            write_segment(segment_buffer, cur_segment);
-        segment_bitmap[cur_segment] = 1;
-
-        get_next_free_segment();
-        segment_bitmap[cur_segment] = 1;
+        seal_segment();
     } else {    // Segment buffer is not full yet.
         cur_block++;
     }
@@ -244,10 +509,11 @@ void move_to_segment() {
  * @param  data: pointer of data to be appended.
  * @param  data_inode: inode that the data belongs to (may be head or non-head inodes).
  * @param  direct_index: the index of direct[] in that inode, pointing to the new block.
+ * @param  dedup: whether the block is file data, which may share an identical block (see dedup.h).
  * Note that when the segment buffer is full, we have to write it back into disk file. 
  * This function does not return block_addr, because block_addr should be updated before
  * potential garbage collection triggered by move_to_segment(), where addresses are changed. */
-void new_data_block(void* data, struct inode* data_inode, int direct_index) {
+void new_data_block(void* data, struct inode* data_inode, int direct_index, bool dedup) {
     if (GC_CONCURRENCY && is_doing_gc) {
         // When doing GC, we should redirect the writing request to pending block buffer.
         struct pending_block pblock;
@@ -262,6 +528,12 @@ void new_data_block(void* data, struct inode* data_inode, int direct_index) {
     }
 
     if (allow_gc) acquire_segment_lock();
+        dedup &= USE_DEDUP && !is_full;
+        if (dedup && dedup_data_block(data, data_inode, direct_index)) {
+            if (allow_gc) release_segment_lock();
+            return;
+        }
+
         // When not doing GC, we should write to segment buffer as normal.
         int i_number = data_inode->i_number;
         int buffer_offset = cur_block * BLOCK_SIZE;
@@ -277,6 +549,8 @@ void new_data_block(void* data, struct inode* data_inode, int direct_index) {
             // Append segment summary for this block.
             add_segbuf_summary(cur_block, i_number, direct_index);
             data_inode->direct[direct_index] = block_addr;
+            if (dedup)
+                index_data_block(data, block_addr);
             
             // Write back segment buffer if necessary.
             move_to_segment();
@@ -284,6 +558,158 @@ void new_data_block(void* data, struct inode* data_inode, int direct_index) {
     if (allow_gc) release_segment_lock();
 }
 
+/** Point a data block of a file to a block of another file (or another block of the same file),
+ * without writing any data: the block gets an extra owner (see dedup.h), and is copied on write
+ * by the next new_data_block() of either owner.
+ * @param  data_inode: inode that the block belongs to (may be head or non-head inodes).
+ * @param  direct_index: the index of direct[] in that inode, pointing to the block.
+ * @param  src_inode: inode pointing to the source block.
+ * @param  src_index: the index of direct[] in src_inode, pointing to the source block.
+ * The source address is read under the segment lock, as garbage collection may move the block. */
+void new_shared_block(struct inode* data_inode, int direct_index, const struct inode* src_inode, int src_index) {
+    if (!USE_DEDUP || (GC_CONCURRENCY && is_doing_gc)) {
+        // Owners cannot be tracked: copy the block instead.
+        block data;
+        get_block(&data, src_inode->direct[src_index]);
+        new_data_block(&data, data_inode, direct_index);
+        return;
+    }
+
+    if (allow_gc) acquire_segment_lock();
+        if (!is_full)
+            share_block(data_inode, direct_index, src_inode->direct[src_index]);
+    if (allow_gc) release_segment_lock();
+}
+
+
+/** **************************************
+ * Compact inodes (see INODES_PER_PACK).
+ * ***************************************/
+// Inode pack that is still being filled in the segment buffer (-1 if none).
+int open_inode_pack = -1;
+int open_inode_pack_used = 0;
+
+/** Encode an inode into a packed slot, if its used direct[] prefix fits.
+ * Unused entries of direct[] are -1 (or 0 for inline data), and are restored by unpack_inode().
+ * @param  data: the inode to be encoded.
+ * @param  packed: slot of PACKED_INODE_SIZE bytes.
+ * @return whether the inode fits in a slot. */
+bool pack_inode(const struct inode* data, char* packed) {
+    int fill = has_inline_data(data) ? 0 : -1;
+    int used = NUM_INODE_DIRECT;
+    while (used > 0 && data->direct[used-1] == fill)
+        --used;
+    if (used > PACKED_INODE_DIRECT)
+        return false;
+
+    int* tail = (int*) (packed + PACKED_INODE_HEAD);
+    memset(packed, 0, PACKED_INODE_SIZE);
+    memcpy(packed, data, PACKED_INODE_HEAD);
+    tail[0] = data->next_indirect;
+    tail[1] = used;
+    tail[2] = fill;
+    memcpy(tail + 3, data->direct, used * sizeof(int));
+    return true;
+}
+
+/** Decode a packed slot into a whole inode.
+ * @param  packed: slot of PACKED_INODE_SIZE bytes.
+ * @param  data: the decoded inode. */
+void unpack_inode(const char* packed, struct inode* data) {
+    const int* tail = (const int*) (packed + PACKED_INODE_HEAD);
+    memset(data, 0, sizeof(struct inode));
+    memcpy(data, packed, PACKED_INODE_HEAD);
+    data->next_indirect = tail[0];
+    for (int i = 0; i < NUM_INODE_DIRECT; ++i)
+        data->direct[i] = (i < tail[1]) ? tail[3+i] : tail[2];
+}
+
+/** Read an inode from disk file (or segment buffer), whether it is packed or not.
+ * @param  data: the inode that is read.
+ * @param  inode_addr: address of the inode (from inode_table or an imap). */
+void get_inode_block(struct inode* data, int inode_addr) {
+    if (!is_packed_inode(inode_addr)) {
+        get_block(data, inode_addr);
+        return;
+    }
+    block pack;
+    get_block(&pack, inode_pack_block(inode_addr));
+    unpack_inode(pack + inode_pack_slot(inode_addr) * PACKED_INODE_SIZE, data);
+}
+
+/** Forget the inode pack being filled (e.g. after the segment buffer is replaced by GC). */
+void reset_inode_pack() {
+    open_inode_pack = -1;
+    open_inode_pack_used = 0;
+}
+
+/** (for internal uses only) Whether a block is in the segment buffer, which is not sealed yet. */
+bool in_open_segment(int block_addr) {
+    return (block_addr / BLOCKS_IN_SEGMENT == cur_segment) && (block_addr % BLOCKS_IN_SEGMENT < cur_block);
+}
+
+/** (for internal uses only) Change an addressable block of the segment buffer (with segment lock held).
+ * Readers may hold references into the segment buffer without inode locks (e.g. locate()), so the
+ * block changes under buffer_seq: new readers of the segment buffer wait, and existing references
+ * into it are drained. Readers of sealed segments (and references into the cache) are unaffected.
+ * @param  block_addr: the block, in the segment buffer.
+ * @param  data, offset, size: the new content of bytes [offset, offset + size) of the block.
+ * @return whether the block is changed (otherwise, references remain: append a new copy instead). */
+bool rewrite_in_place(int block_addr, const void* data, int offset, int size) {
+    begin_buffer_rewrite();
+    bool drained = try_drain_buffer_refs();
+    if (drained)
+        memcpy(segment_buffer + (block_addr % BLOCKS_IN_SEGMENT) * BLOCK_SIZE + offset, data, size);
+    end_buffer_rewrite();
+    return drained;
+}
+
+/** (for internal uses only) Write a packed inode into the segment buffer (with segment lock held).
+ * An inode whose previous copy is still in the segment buffer is rewritten in place: the log only
+ * receives its latest version when the segment is sealed, without another slot or imap entry.
+ * A pack that is already addressable changes through rewrite_in_place(), so that no reader copies
+ * a torn slot; if it cannot (references remain), the inode goes to a new pack instead. */
+void new_packed_inode(struct inode* data, const char* packed) {
+    int i_number = data->i_number;
+    int inode_addr = inode_table[i_number];
+    bool new_pack = false;
+
+    bool in_pack = is_packed_inode(inode_addr) && in_open_segment(inode_pack_block(inode_addr));
+    if (!in_pack) {
+        if (open_inode_pack >= 0 && in_open_segment(open_inode_pack) && open_inode_pack_used < INODES_PER_PACK)
+            inode_addr = packed_inode_addr(open_inode_pack, open_inode_pack_used);
+        else
+            inode_addr = -1;
+    }
+    if ((inode_addr < 0) || !rewrite_in_place(inode_pack_block(inode_addr), packed,
+                                              inode_pack_slot(inode_addr) * PACKED_INODE_SIZE, PACKED_INODE_SIZE)) {
+        // Start a new inode pack (not addressable before move_to_segment()).
+        open_inode_pack = cur_segment * BLOCKS_IN_SEGMENT + cur_block;
+        open_inode_pack_used = 0;
+        memset(segment_buffer + cur_block * BLOCK_SIZE, 0, BLOCK_SIZE);
+        add_segbuf_summary(cur_block, 0, SUMMARY_INODE_PACK);
+        memcpy(segment_buffer + cur_block * BLOCK_SIZE, packed, PACKED_INODE_SIZE);
+        inode_addr = packed_inode_addr(open_inode_pack, 0);
+        in_pack = false;
+        new_pack = true;
+    }
+    if (!in_pack) {
+        ++open_inode_pack_used;
+        add_segbuf_imap(i_number, inode_addr);
+    }
+    inode_table[i_number] = inode_addr;
+    memcpy(cached_inode_array+i_number, data, sizeof(struct inode));
+
+    if (DEBUG_BLOCKIO)
+        logger(DEBUG, "Add inode #%d at (block %d, slot %d).\n", i_number, inode_pack_block(inode_addr), inode_pack_slot(inode_addr));
+
+    // Write back segment buffer if necessary.
+    if (new_pack)
+        move_to_segment();
+    else if (next_imap_index == DATA_BLOCKS_IN_SEGMENT)
+        seal_segment();
+}
+
 
 /** Create a new inode block into the segment buffer.
  * @param  data: pointer of the inode to be appended.
@@ -321,6 +747,22 @@ void new_inode_block(struct inode* data) {
             return;
         }
 
+        char packed[PACKED_INODE_SIZE];
+        if (USE_COMPACT_INODES && pack_inode(data, packed)) {
+            new_packed_inode(data, packed);
+            if (allow_gc) release_segment_lock();
+            return;
+        }
+
+        int old_addr = inode_table[i_number];
+        if (USE_INPLACE_METADATA && (old_addr >= 0) && !is_packed_inode(old_addr) && in_open_segment(old_addr)
+            && rewrite_in_place(old_addr, data, 0, BLOCK_SIZE)) {
+            // The last copy of the inode is not sealed yet: it is rewritten in place (see file_rewrite()).
+            memcpy(cached_inode_array+i_number, data, sizeof(struct inode));
+            if (allow_gc) release_segment_lock();
+            return;
+        }
+
         if (!is_full) {
             // Append inode block.
             memcpy(segment_buffer + buffer_offset, data, BLOCK_SIZE);
@@ -403,6 +845,7 @@ void file_initialize(struct inode* &cur_inode, int _mode, int _permission) {
         count_inode++;
         cur_inode = cached_inode_array + count_inode;
         cur_inode->i_number = count_inode;
+        inode_generation[count_inode]++;    // Tells the kernel apart from any earlier object of this i_number.
 
         // "-2" means a transient state, where an inode is created but not yet written to disk.
         // Note that this will never appear on disk (if LFS crashes before commitment, the inode is lost).
@@ -419,7 +862,7 @@ void file_initialize(struct inode* &cur_inode, int _mode, int _permission) {
         memset(cur_inode->direct, -1, sizeof(cur_inode->direct));
         cur_inode->next_indirect = 0;
 
-        struct fuse_context* user_info = fuse_get_context();  // Get information (uid, gid) of the user who calls LFS interface.
+        struct fuse_context* user_info = get_caller_context();  // Get information (uid, gid) of the user who calls LFS interface.
         cur_inode->perm_uid     = user_info->uid;
         cur_inode->perm_gid     = user_info->gid;
 
@@ -434,31 +877,49 @@ void file_initialize(struct inode* &cur_inode, int _mode, int _permission) {
 }
 
 
+/** (for internal uses only) Chain a new (pseudo) inode to a full inode, and commit the full one.
+ * @param  cur_inode: the full inode, replaced by the new one. */
+void file_next_inode(struct inode* &cur_inode) {
+    // Create the next inode.
+    struct inode* next_inode;
+    file_initialize(next_inode, MODE_MID_INODE, cur_inode->permission);
+    
+    // Update current inode and commit it.
+    struct timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+    cur_inode->atime = cur_time;
+    cur_inode->mtime = cur_time;
+    cur_inode->ctime = cur_time;
+
+    cur_inode->next_indirect = next_inode->i_number;
+    new_inode_block(cur_inode);
+
+    // Release current inode by replacing the pointer.
+    cur_inode = next_inode;
+}
+
+
 /** Append to the new file by adding new data blocks (possibly storing full inodes in log).
  * @param  cur_inode: struct for the file inode.
  * @param  data: buffer for the file data block to be appended. */
 void file_add_data(struct inode* &cur_inode, void* data) {
     // If the file is too large, another (pseudo) inode is necessary.
-    if (cur_inode->num_direct == NUM_INODE_DIRECT) {
-        // Create the next inode.
-        struct inode* next_inode;
-        file_initialize(next_inode, MODE_MID_INODE, cur_inode->permission);
-        
-        // Update current inode and commit it.
-        struct timespec cur_time;
-        clock_gettime(CLOCK_REALTIME, &cur_time);
-        cur_inode->atime = cur_time;
-        cur_inode->mtime = cur_time;
-        cur_inode->ctime = cur_time;
+    if (cur_inode->num_direct == NUM_INODE_DIRECT)
+        file_next_inode(cur_inode);
 
-        cur_inode->next_indirect = next_inode->i_number;
-        new_inode_block(cur_inode);
+    new_data_block(data, cur_inode, cur_inode->num_direct, true);
+    cur_inode->fsize_block++;
+    cur_inode->num_direct++;
+}
 
-        // Release current inode by replacing the pointer.
-        cur_inode = next_inode;
-    }
+/** Append to a file a block shared with another file (see new_shared_block()).
+ * @param  cur_inode: struct for the file inode.
+ * @param  src_inode, src_index: the source block (w.r.t. direct[] of src_inode). */
+void file_add_shared(struct inode* &cur_inode, const struct inode* src_inode, int src_index) {
+    if (cur_inode->num_direct == NUM_INODE_DIRECT)
+        file_next_inode(cur_inode);
 
-    new_data_block(data, cur_inode, cur_inode->num_direct);
+    new_shared_block(cur_inode, cur_inode->num_direct, src_inode, src_index);
     cur_inode->fsize_block++;
     cur_inode->num_direct++;
 }
@@ -474,7 +935,48 @@ void file_modify(struct inode* cur_inode, int direct_index, void* data) {
         logger(ERROR, "[ERROR] Cannot modify a block that does not exist yet. Request ind: %d\n", direct_index);
     }
     
-    new_data_block(data, cur_inode, direct_index);
+    new_data_block(data, cur_inode, direct_index, true);
+}
+
+/** Modify an existing file by sharing a block of another file at given index (see new_shared_block()).
+ * @param  cur_inode: existing struct for the file inode.
+ * @param  direct_index: index of the modification (w.r.t. direct[] of the inode).
+ * @param  src_inode, src_index: the source block (w.r.t. direct[] of src_inode). */
+void file_share(struct inode* cur_inode, int direct_index, const struct inode* src_inode, int src_index) {
+    if (direct_index >= cur_inode->num_direct) {
+        logger(ERROR, "[ERROR] Cannot modify a block that does not exist yet. Request ind: %d\n", direct_index);
+    }
+
+    new_shared_block(cur_inode, direct_index, src_inode, src_index);
+}
+
+/** Replace a metadata (directory) block of an inode, in place if it is not sealed yet.
+ * Namespace operations rewrite the same directory blocks over and over: while the current copy
+ * of a block is still in the segment buffer, it is overwritten there, so that a burst of creates
+ * or unlinks in a directory reaches the log as one block (per segment) instead of one per operation.
+ * Readers may hold references into the segment buffer without inode locks (e.g. locate()): the block
+ * is appended anew if they are not released soon (see rewrite_in_place()).
+ * @param  cur_inode: inode holding the block (head or non-head inode).
+ * @param  direct_index: index of the block (w.r.t. direct[] of the inode).
+ * @param  data: the new content of the block. */
+void file_rewrite(struct inode* cur_inode, int direct_index, void* data) {
+    if (!USE_INPLACE_METADATA || (GC_CONCURRENCY && is_doing_gc)) {
+        new_data_block(data, cur_inode, direct_index);
+        return;
+    }
+
+    bool in_place = false;
+    if (allow_gc) acquire_segment_lock();
+        int block_addr = cur_inode->direct[direct_index];
+        if (!is_full && (block_addr >= 0) && in_open_segment(block_addr) && !is_shared_block(block_addr)) {
+            if (DEBUG_BLOCKIO)
+                logger(DEBUG, "Rewrite block %d (direct[%d] of inode #%d) in place.\n", block_addr, direct_index, cur_inode->i_number);
+            in_place = rewrite_in_place(block_addr, data, 0, BLOCK_SIZE);
+        }
+    if (allow_gc) release_segment_lock();
+
+    if (!in_place)
+        new_data_block(data, cur_inode, direct_index);
 }
 
 
@@ -507,23 +1009,15 @@ void remove_inode(int i_number) {
         
         // Imap modification may also trigger segment writeback.
         // If segment buffer is full, it should be flushed to disk file.
-        if (cur_block == DATA_BLOCKS_IN_SEGMENT-1 || next_imap_index == DATA_BLOCKS_IN_SEGMENT) {
-            add_segbuf_metadata();
-            if (USE_CACHE)
-                write_segment_through_cache(segment_buffer, cur_segment);
-            else
-                write_segment(segment_buffer, cur_segment);
-            segment_bitmap[cur_segment] = 1;
-
-            get_next_free_segment();
-            segment_bitmap[cur_segment] = 1;
-        }
+        if (cur_block == DATA_BLOCKS_IN_SEGMENT-1 || next_imap_index == DATA_BLOCKS_IN_SEGMENT)
+            seal_segment();
     if (allow_gc) release_segment_lock();
 }
 
 
 /** Generate a checkpoint and save it to disk file. */
 void generate_checkpoint() {
+    metric_timer timer(STAGE_CHECKPOINT);
     checkpoints ckpt;
     read_checkpoints(&ckpt);
 
@@ -539,6 +1033,11 @@ void generate_checkpoint() {
     ckpt[next_checkpoint].timestamp_sec     = cur_time.tv_sec;
     ckpt[next_checkpoint].timestamp_nsec    = cur_time.tv_nsec;
 
+    // Segments referenced by the checkpoint must reach disk first.
+    if (drain_segment_writes() < 0) {
+        logger(ERROR, "[ERROR] Fail to generate a checkpoint: some segments could not be written.\n");
+        return;
+    }
     write_checkpoints(&ckpt);
     next_checkpoint = 1 - next_checkpoint;
 
@@ -1,19 +1,53 @@
 #ifndef blockio_h
 #define blockio_h
 
+#include "utility.h"
+
 const long USER_DEVICE = 0;
+const int SEGMENT_READ_RETRIES = 4;     // Lock-free attempts of get_block() before taking the segment lock.
+const int BLOCK_REF_SPINS      = 64;    // Attempts to drain block references before a block is appended anew.
 
 /* High-level functions should ONLY call these interfaces for data transfer. */
 void get_block(void* data, int block_addr);
+int get_block_in_memory(void* data, int block_addr, off_t &file_pos);
+
+/** Pinned block reference: read-only access to a block in place (segment buffer or cache).
+ * The block stays valid until release_block(); blocks that cannot be pinned (e.g. during
+ * a segment switch) are copied into the private buffer of the reference instead.
+ * [CAUTION] Avoid appending blocks (or waiting for the segment lock) while holding a reference:
+ *           a segment switch waits for all references to be released. The references of the
+ *           appending thread are turned into private copies (re-read ref.data after appending),
+ *           and blocks it would change in place are appended anew. */
+struct block_ref {
+    const char* data;               // Read-only pointer to the block.
+    int cacheline;                  // Pinned cacheline (-1 if none).
+    bool pinned;                    // Whether the reference is counted in block_refs.
+    bool in_buffer;                 // Whether it points into the segment buffer (counted in buffer_refs).
+    char local[BLOCK_SIZE];         // Private copy, if the block cannot be pinned.
+};
+void acquire_block(struct block_ref &ref, int block_addr);
+void release_block(struct block_ref &ref);
+void drain_block_refs();
+bool try_drain_buffer_refs();
 void get_inode_from_inum(struct inode* &data, int i_number);
 
 void get_next_free_segment();
-void new_data_block(void* data, struct inode* data_inode, int direct_index);
+void reserve_segment_space(int num_blocks, int num_imap);
+void new_data_block(void* data, struct inode* data_inode, int direct_index, bool dedup = false);
+void new_shared_block(struct inode* data_inode, int direct_index, const struct inode* src_inode, int src_index);
 void new_inode_block(struct inode* data);
 
+bool pack_inode(const struct inode* data, char* packed);
+void unpack_inode(const char* packed, struct inode* data);
+void get_inode_block(struct inode* data, int inode_addr);
+void reset_inode_pack();
+
 void file_initialize(struct inode* &cur_inode, int _mode, int _permission);
 void file_add_data(struct inode* &cur_inode, void* data);
+void file_add_shared(struct inode* &cur_inode, const struct inode* src_inode, int src_index);
 void file_modify(struct inode* cur_inode, int direct_index, void* data);
+void file_share(struct inode* cur_inode, int direct_index, const struct inode* src_inode, int src_index);
+void file_rewrite(struct inode* cur_inode, int direct_index, void* data);
 
 void remove_inode(int i_number);
 
@@ -1,6 +1,7 @@
 #include "buffer.h"
 
 #include "logger.h"
+#include "metrics.h"
 #include "print.h"
 #include "utility.h"
 #include "blockio.h"
@@ -15,6 +16,8 @@
 int o_flush(const char* path, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "FLUSH, %s, %p\n", resolve_prefix(path).c_str(), fi);
+
+    metric_timer timer(OP_FLUSH);
     return 0;
 }
 
@@ -44,7 +47,9 @@ int o_fsync(const char* path, int isdatasync, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "FSYNC, %s, %d, %p\n",
                resolve_prefix(path).c_str(), isdatasync, fi);
-    
+
+    metric_timer timer(OP_FSYNC);
+
     manually_synchronize();
     
     return 0;
@@ -54,7 +59,9 @@ int o_fsyncdir(const char* path, int isdatasync, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "FSYNCDIR, %s, %d, %p\n",
                resolve_prefix(path).c_str(), isdatasync, fi);
-    
+
+    metric_timer timer(OP_FSYNCDIR);
+
     manually_synchronize();
     
     return 0;
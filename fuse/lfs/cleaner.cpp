@@ -5,6 +5,11 @@
 #include "utility.h"
 #include "blockio.h"
 #include "wbcache.h"
+#include "notify.h"
+#include "compress.h"
+#include "dedup.h"
+#include "device.h"
+#include "metrics.h"
 
 #include <stdio.h>
 #include <fcntl.h>
@@ -13,6 +18,11 @@
 #include <time.h>
 #include <algorithm>
 #include <set>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 
 bool _clean_thoroughly;
@@ -27,6 +37,8 @@ char gc_segment_buffer[SEGMENT_SIZE], gc_segment_bitmap[TOT_SEGMENTS];
 int gc_inode_table[MAX_NUM_INODE];
 inode gc_cached_inode_array[MAX_NUM_INODE]; 
 char gc_file_buffer[FILE_SIZE];
+int gc_inode_pack, gc_inode_pack_used;      // Inode pack being filled in GC buffer (see INODES_PER_PACK).
+char gc_raw_segment[TOT_SEGMENTS];          // Segments written by GC, not compressed yet.
 
 
 /** Append a segment summary entry for a given block (in GC buffer). */
@@ -81,35 +93,42 @@ int gc_get_next_free_segment() {
     }
 }
 
-/** Write to segment buffer (in cache). */
+/** Write to segment buffer (in cache). It is compressed on write-back, as it would be by
+ * write_segment(), by all GC workers at once (see gc_compress_segments()). */
 void gc_write_segment(void* buf, int segment_addr) {
     int file_offset = segment_addr * SEGMENT_SIZE;
     memcpy(gc_file_buffer+file_offset, buf, SEGMENT_SIZE);
+    gc_raw_segment[segment_addr] = 1;
+}
+
+/** Flush GC buffer to file buffer, and move to the next free segment. */
+void gc_seal_segment() {
+    gc_add_segbuf_metadata();
+    gc_write_segment(gc_segment_buffer, gc_cur_segment);
+    gc_segment_bitmap[gc_cur_segment] = 1;
+
+    int gc_next_segment = gc_get_next_free_segment();
+    if (gc_next_segment == -1) {
+        logger(WARN, "[WARNING] The file system is highly utilized, so that normal garbage collection fails.\n");
+        logger(WARN, "[INFO] We will try to perform a thorough garbage collection.\n");
+        /* Throw an exception: we should perform thorough GC. */
+        throw ((int) -1);
+    } else {
+        memset(gc_segment_buffer, 0, sizeof(gc_segment_buffer));
+        gc_cur_segment = gc_next_segment;
+        gc_cur_block = 0;
+        gc_next_imap_index = 0;
+    }
+
+    if (DEBUG_GARBAGE_COL)
+        logger(DEBUG, "* Start dumping GC buffer to segment %d.\n", gc_next_segment);
 }
 
 /** Increment cur_block, and flush GC buffer if it is full. */
 void gc_move_to_segment() {
     if (gc_cur_block == DATA_BLOCKS_IN_SEGMENT-1 || gc_next_imap_index == DATA_BLOCKS_IN_SEGMENT) {
         // Segment buffer is full, and should be flushed to disk buffer.
-        gc_add_segbuf_metadata();
-        gc_write_segment(gc_segment_buffer, gc_cur_segment);
-        gc_segment_bitmap[gc_cur_segment] = 1;
-
-        int gc_next_segment = gc_get_next_free_segment();
-        if (gc_next_segment == -1) {
-            logger(WARN, "[WARNING] The file system is highly utilized, so that normal garbage collection fails.\n");
-            logger(WARN, "[INFO] We will try to perform a thorough garbage collection.\n");
-            /* Throw an exception: we should perform thorough GC. */
-            throw ((int) -1);
-        } else {
-            memset(gc_segment_buffer, 0, sizeof(gc_segment_buffer));
-            gc_cur_segment = gc_next_segment;
-            gc_cur_block = 0;
-            gc_next_imap_index = 0;
-        }
-
-        if (DEBUG_GARBAGE_COL)
-            logger(DEBUG, "* Start dumping GC buffer to segment %d.\n", gc_next_segment);
+        gc_seal_segment();
     } else {    // Segment buffer is not full yet.
         gc_cur_block++;
     }
@@ -130,9 +149,35 @@ int gc_new_data_block(void* data, int i_number, int direct_index) {
     return block_addr;
 }
 
-/** Create a new inode block into GC buffer. */
+/** Create a new inode into GC buffer (packed with others if it fits in a slot).
+ * @return inode address (block address, or packed address). */
 int gc_new_inode_block(struct inode* data) {
     int i_number = data->i_number;
+    char packed[PACKED_INODE_SIZE];
+    if (USE_COMPACT_INODES && pack_inode(data, packed)) {
+        bool new_pack = false;
+        if (gc_inode_pack < 0 || gc_inode_pack / BLOCKS_IN_SEGMENT != gc_cur_segment || gc_inode_pack_used == INODES_PER_PACK) {
+            gc_inode_pack = gc_cur_segment * BLOCKS_IN_SEGMENT + gc_cur_block;
+            gc_inode_pack_used = 0;
+            gc_add_segbuf_summary(gc_cur_block, 0, SUMMARY_INODE_PACK);
+            new_pack = true;
+        }
+        int slot = gc_inode_pack_used++;
+        int inode_addr = packed_inode_addr(gc_inode_pack, slot);
+        int buffer_offset = (gc_inode_pack % BLOCKS_IN_SEGMENT) * BLOCK_SIZE + slot * PACKED_INODE_SIZE;
+
+        if (DEBUG_GC_BLOCKIO)
+            logger(DEBUG, "(GC) add inode #%d at (block %d, slot %d). Write to imap: #%d.\n", i_number, gc_inode_pack, slot, gc_next_imap_index);
+
+        memcpy(gc_segment_buffer + buffer_offset, packed, PACKED_INODE_SIZE);
+        gc_add_segbuf_imap(i_number, inode_addr);
+        if (new_pack)
+            gc_move_to_segment();
+        else if (gc_next_imap_index == DATA_BLOCKS_IN_SEGMENT)
+            gc_seal_segment();
+        return inode_addr;
+    }
+
     int buffer_offset = gc_cur_block * BLOCK_SIZE;
     int block_addr = gc_cur_segment * BLOCKS_IN_SEGMENT + gc_cur_block;
 
@@ -158,28 +203,8 @@ void gc_remove_inode(int i_number) {
     
     // Imap modification may also trigger GC segment writeback.
     // If GC segment buffer is full, it should be flushed to GC file buffer.
-    if (gc_cur_block == DATA_BLOCKS_IN_SEGMENT-1 || gc_next_imap_index == DATA_BLOCKS_IN_SEGMENT) {
-        // Segment buffer is full, and should be flushed to disk file.
-        gc_add_segbuf_metadata();
-        gc_write_segment(gc_segment_buffer, gc_cur_segment);
-        gc_segment_bitmap[gc_cur_segment] = 1;
-
-        int gc_next_segment = gc_get_next_free_segment();
-        if (gc_next_segment == -1) {
-            logger(WARN, "[WARNING] The file system is highly utilized, so that normal garbage collection fails.\n");
-            logger(WARN, "[INFO] We will try to perform a thorough garbage collection.\n");
-            /* Throw an exception: copy the back-up memory into disk file, and perform thorough gc. */
-            throw ((int) -1);
-        } else {
-            memset(gc_segment_buffer, 0, sizeof(gc_segment_buffer));
-            gc_cur_segment = gc_next_segment;
-            gc_cur_block = 0;
-            gc_next_imap_index = 0;
-        }
-
-        if (DEBUG_GARBAGE_COL)
-            logger(DEBUG, "* Start dumping GC buffer to segment %d.\n", gc_next_segment);
-    }
+    if (gc_cur_block == DATA_BLOCKS_IN_SEGMENT-1 || gc_next_imap_index == DATA_BLOCKS_IN_SEGMENT)
+        gc_seal_segment();
 }
 
 /* Compare functions for segment statistics structures. */
@@ -192,57 +217,240 @@ bool _time_compare(struct time_entry &a, struct time_entry &b) {
 }
 
 
-/** A variant of "get_lock(data, block_addr)" that does not acquire lock. */
-void gc_get_block(void* data, int block_addr) {
+/** A variant of "get_block(data, block_addr)" for consecutive blocks, that does not acquire lock.
+ * @param  num_blocks: number of blocks (within the data region of the same segment). */
+void gc_get_blocks(void* data, int block_addr, int num_blocks) {
     int segment = block_addr / BLOCKS_IN_SEGMENT;
     int block = block_addr % BLOCKS_IN_SEGMENT;
 
     if (segment == cur_segment) {    // Data in segment buffer.
         int buffer_offset = block * BLOCK_SIZE;
-        memcpy(data, segment_buffer + buffer_offset, BLOCK_SIZE);
+        memcpy(data, segment_buffer + buffer_offset, num_blocks * BLOCK_SIZE);
     } else {    // Data in disk file.
-        int file_handle = open(lfs_path, O_RDWR);
-        int file_offset = block_addr * BLOCK_SIZE;
-        int read_length = pread(file_handle, data, BLOCK_SIZE, file_offset);
-        close(file_handle);
+        read_data_blocks(data, block_addr, num_blocks);
     }
 }
 
-/* Compact data blocks within a segment */
-void gc_compact_data_blocks(summary_entry* seg_sum, int seg, std::set<int> &modified_inum) {
-    block data;
+
+/** **************************************
+ * Parallel cleaning of victim segments.
+ * ***************************************/
+/* Victim segments are scanned by GC workers in parallel: each scan finds the live blocks of a
+ * segment (with all files pointing to them) and reads them, a run of consecutive blocks at a time.
+ * The GC log head then appends the scanned victims one by one, in the same order as a sequential
+ * cleaner would, and merges the updates of inode pointers. Scans only read the inode array, the
+ * disk file and the GC inode table, none of which is changed by the log head while scanning. */
+
+/* A live data block of a victim segment. */
+struct gc_live_block {
+    int block_addr;
+    std::vector<block_owner> owners;    // Files pointing to the block (its summary entry first, if alive).
+};
+
+/* A scanned victim segment. */
+struct gc_victim {
+    int segment;
+    std::vector<gc_live_block> blocks;
+    std::vector<char> data;             // Contents of the live blocks, in order.
+    std::vector<int> inodes;            // Inodes to be rewritten (or removed again) by the log head.
+    bool is_scanned = false;
+};
+
+/** Number of GC workers (one per core, up to GC_WORKERS). */
+int gc_num_workers() {
+    int num_cores = std::thread::hardware_concurrency();
+    return std::max(1, std::min(GC_WORKERS, num_cores));
+}
+
+/** Find the live blocks of a victim segment, and read them (run by GC workers).
+ * @param  record_removed: whether to record inodes removed in the segment (to be removed again). */
+void gc_scan_segment(gc_victim &victim, bool record_removed) {
+    metric_timer timer(STAGE_GC_SCAN);
+    int seg = victim.segment;
+    const summary_entry* seg_sum = cached_segsum[seg];
     struct inode* cur_inode;
+    std::vector<block_owner> owners;
+    block data;
     for (int j=0; j<DATA_BLOCKS_IN_SEGMENT; j++) {
         int i_number = seg_sum[j].i_number;
         int dir_index = seg_sum[j].direct_index;
         int block_addr = seg*BLOCKS_IN_SEGMENT + j;
 
         // Caution: use a stronger test criterion for validity.
-        // Note that segment summary may be wrong sometimes.
-        if ((i_number <= 0) || (i_number >= MAX_NUM_INODE) || (gc_inode_table[i_number] == -1)) continue;
-        
-        if (gc_inode_table[i_number] == -2) {
-            // Block j is a data block, but its inode is in transient state.
-            // Caution: no on-disk inode block can ever be in transient state!
-            get_inode_from_inum(cur_inode, i_number);
-            if (cur_inode->direct[dir_index] == block_addr) {
-                // Do not add a transient inode to modified_inum, but update the datablock only.
-                gc_get_block(&data, block_addr);
-                gc_cached_inode_array[i_number].direct[dir_index] = gc_new_data_block(&data, i_number, dir_index);
+        // Note that segment summary may be wrong sometimes, and direct[] of inline files holds data.
+        bool is_valid = (i_number > 0) && (i_number < MAX_NUM_INODE) && (gc_inode_table[i_number] != -1);
+
+        if ((dir_index >= 0) && is_shared_block(block_addr)) {
+            live_block_owners(block_addr, owners);
+            if (!owners.empty()) {  // Moved once for all its owners (see dedup.h).
+                if (is_valid) {
+                    get_inode_from_inum(cur_inode, i_number);
+                    if (!has_inline_data(cur_inode) && (cur_inode->direct[dir_index] == block_addr))
+                        owners.insert(owners.begin(), {i_number, dir_index});
+                }
+                victim.blocks.push_back({block_addr, owners});
+                continue;
+            }
+        }
+
+        if (dir_index == SUMMARY_INODE_PACK) {  // Block j is an inode pack: rewrite its live inodes.
+            gc_get_blocks(&data, block_addr, 1);
+            for (int slot=0; slot<INODES_PER_PACK; slot++) {
+                int slot_inum = *((int*) (data + slot*PACKED_INODE_SIZE));
+                if ((slot_inum > 0) && (slot_inum < MAX_NUM_INODE) && (gc_inode_table[slot_inum] == packed_inode_addr(block_addr, slot)))
+                    victim.inodes.push_back(slot_inum);
             }
-        } else if (dir_index == -1) {  // Block j is an inode block.
+            continue;
+        }
+
+        if (!is_valid) continue;
+
+        if (dir_index == -1) {  // Block j is an inode block.
+            // Caution: no on-disk inode block can ever be in transient state!
             if (gc_inode_table[i_number] == block_addr)
-                modified_inum.insert(i_number);
-        } else {                      // Block j is a data block.
+                victim.inodes.push_back(i_number);
+        } else {                // Block j is a data block (its inode may be in transient state).
             get_inode_from_inum(cur_inode, i_number);
-            if (cur_inode->direct[dir_index] == block_addr) {
-                modified_inum.insert(i_number);
+            if (!has_inline_data(cur_inode) && (cur_inode->direct[dir_index] == block_addr))
+                victim.blocks.push_back({block_addr, {{i_number, dir_index}}});
+        }
+    }
+
+    // Read live blocks, a run of consecutive blocks at a time.
+    victim.data.resize(victim.blocks.size() * BLOCK_SIZE);
+    for (size_t k=0; k<victim.blocks.size(); ) {
+        int run = 1;
+        while ((k + run < victim.blocks.size()) && (victim.blocks[k+run].block_addr == victim.blocks[k].block_addr + run))
+            run++;
+        gc_get_blocks(victim.data.data() + k*BLOCK_SIZE, victim.blocks[k].block_addr, run);
+        k += run;
+    }
 
-                gc_get_block(&data, block_addr);
-                gc_cached_inode_array[i_number].direct[dir_index] = gc_new_data_block(&data, i_number, dir_index);
+    if (record_removed) {
+        inode_map seg_imap;
+        read_segment_imap(&seg_imap, seg);
+        for (int j=0; j<DATA_BLOCKS_IN_SEGMENT; j++) {
+            if (seg_imap[j].inode_block == -1)
+                victim.inodes.push_back(seg_imap[j].i_number);
+        }
+    }
+}
+
+/** Append the live blocks of a scanned victim into GC buffer, and update all their owners. */
+void gc_append_victim(const gc_victim &victim, std::set<int> &modified_inum) {
+    metric_timer timer(STAGE_GC_APPEND);
+    count_metric(COUNT_GC_VICTIMS);
+    count_metric(COUNT_GC_LIVE_BLOCKS, victim.blocks.size());
+    for (size_t k=0; k<victim.blocks.size(); k++) {
+        const std::vector<block_owner> &owners = victim.blocks[k].owners;
+        int new_addr = gc_new_data_block((void*) (victim.data.data() + k*BLOCK_SIZE),
+                                         owners[0].i_number, owners[0].direct_index);
+        for (const block_owner &owner : owners) {
+            gc_cached_inode_array[owner.i_number].direct[owner.direct_index] = new_addr;
+            if (gc_inode_table[owner.i_number] != -2)  // Transient inodes are written by their users.
+                modified_inum.insert(owner.i_number);
+        }
+    }
+    modified_inum.insert(victim.inodes.begin(), victim.inodes.end());
+}
+
+/** Clean victim segments: GC workers scan them ahead, while live blocks are appended in order.
+ * @param  segments: victim segments, in the order of cleaning.
+ * @param  is_normal: whether it is a normal GC (removed inodes are recorded, and victims are evicted).
+ * @param  modified_inum: return variable (inodes to be written back after all data blocks). */
+void gc_clean_segments(const std::vector<int> &segments, bool is_normal, std::set<int> &modified_inum) {
+    int num_victims = segments.size();
+    int num_workers = gc_num_workers();
+    std::vector<gc_victim> victims(num_victims);
+    std::mutex scan_lock;
+    std::condition_variable scan_cond;
+    int next_scan = 0, next_append = 0;
+    bool is_aborted = false;
+
+    // Scans stay a few victims ahead of the log head, so that at most a few segments are held in memory.
+    auto scan_victims = [&]() {
+        std::unique_lock<std::mutex> guard(scan_lock);
+        while (true) {
+            scan_cond.wait(guard, [&] {
+                return is_aborted || (next_scan == num_victims) || (next_scan < next_append + 2*num_workers);
+            });
+            if (is_aborted || (next_scan == num_victims))
+                return;
+            gc_victim &victim = victims[next_scan++];
+            guard.unlock();
+            gc_scan_segment(victim, is_normal);
+            guard.lock();
+            victim.is_scanned = true;
+            scan_cond.notify_all();
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i=0; i<num_victims; i++)
+        victims[i].segment = segments[i];
+    for (int i=0; i<num_workers; i++)
+        workers.push_back(std::thread(scan_victims));
+
+    try {
+        for (int i=0; i<num_victims; i++) {
+            {
+                std::unique_lock<std::mutex> guard(scan_lock);
+                scan_cond.wait(guard, [&] { return victims[i].is_scanned; });
+            }
+            int seg = victims[i].segment;
+            if (DEBUG_GARBAGE_COL)
+                logger(DEBUG, ">>> Cleaning segment %d.\n", seg);
+
+            // Compact live data blocks.
+            gc_append_victim(victims[i], modified_inum);
+            victims[i] = gc_victim();
+
+            // Evict the segment (in GC buffer), so that it can hold the following live blocks.
+            // In thorough mode, there is no need to append deleted blocks or clean segments,
+            // since all deleted data automatically vanish from the GC buffer.
+            if (is_normal) {
+                memset(gc_file_buffer + seg*SEGMENT_SIZE, 0, SEGMENT_SIZE);
+                gc_segment_bitmap[seg] = 0;
+                gc_raw_segment[seg] = 0;
             }
+
+            std::lock_guard<std::mutex> guard(scan_lock);
+            next_append = i + 1;
+            scan_cond.notify_all();
         }
+    } catch (...) {     // The disk is full: stop scanning, and let the caller retry a thorough GC.
+        {
+            std::lock_guard<std::mutex> guard(scan_lock);
+            is_aborted = true;
+            scan_cond.notify_all();
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        throw;
     }
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+/** Compress the segments written by GC in place (as write_segment() would), by all GC workers. */
+void gc_compress_segments() {
+    if (!USE_COMPRESSION)
+        return;
+
+    std::atomic<int> next_segment(0);
+    std::vector<std::thread> workers;
+    for (int i=0; i<gc_num_workers(); i++)
+        workers.push_back(std::thread([&next_segment]() {
+            std::vector<char> image(SEGMENT_SIZE);
+            for (int seg=next_segment++; seg<TOT_SEGMENTS; seg=next_segment++) {
+                if (!gc_raw_segment[seg] || !gc_segment_bitmap[seg])
+                    continue;
+                char* raw = gc_file_buffer + (off_t) seg * SEGMENT_SIZE;
+                compress_segment(raw, image.data());
+                memcpy(raw, image.data(), SEGMENT_SIZE);
+            }
+        }));
+    for (std::thread &worker : workers)
+        worker.join();
 }
 
 
@@ -250,9 +458,24 @@ void gc_compact_data_blocks(summary_entry* seg_sum, int seg, std::set<int> &modi
 // * Read data using non-GC APIs (from the original file or cache).
 // * Write data to GC data structures only (especially, never change global cache).
 void collect_garbage(bool clean_thoroughly) {
+    metric_timer gc_timer(STAGE_GC);
+    metric_timer phase_timer(STAGE_GC_LOAD);
+
+    // Segments could not be written: do not rewrite the disk file any further (see device.h).
+    if (has_write_errors()) {
+        logger(ERROR, "[ERROR] Skip garbage collection: some segments could not be written.\n");
+        return;
+    }
+
     // When entering GC, first set a flag, and then release segment lock.
     is_doing_gc = true;
 
+    // The disk file, cache and segment buffer are rewritten below:
+    // wait for pending splice replies and block references.
+    drain_block_splices();
+    drain_block_refs();
+    drain_segment_writes();
+
     // Must flush and re-initialize cache in the first hand.
     flush_cache();
     init_cache();
@@ -270,7 +493,8 @@ void collect_garbage(bool clean_thoroughly) {
             tot_blocks   : BLOCKS_IN_SEGMENT * TOT_SEGMENTS,
             tot_segments : TOT_SEGMENTS,
             block_size   : BLOCK_SIZE,
-            segment_size : SEGMENT_SIZE
+            segment_size : SEGMENT_SIZE,
+            num_devices  : num_devices
         };
         memcpy(gc_file_buffer+SUPERBLOCK_ADDR, &init_sblock, SUPERBLOCK_SIZE);
 
@@ -278,25 +502,37 @@ void collect_garbage(bool clean_thoroughly) {
         read_checkpoints(&ckpt);
         memcpy(gc_file_buffer+CHECKPOINT_ADDR, &ckpt, CHECKPOINT_SIZE);
     } else {
-        /* Load data from disk file. */
-        int file_handle = open(lfs_path, O_RDWR);
-        int read_length = pread(file_handle, gc_file_buffer, FILE_SIZE, 0);
-        close(file_handle);
+        /* Load data from disk file (free segments are not read, see release_disk_range()).
+         * Each device reads its own segments, in parallel. */
+        for_each_device([](int device) {
+            for (int seg=device; seg<TOT_SEGMENTS; seg+=num_devices) {
+                off_t file_offset = (off_t) seg * SEGMENT_SIZE;
+                if (segment_bitmap[seg])
+                    disk_pread(gc_file_buffer + file_offset, SEGMENT_SIZE, file_offset);
+                else
+                    memset(gc_file_buffer + file_offset, 0, SEGMENT_SIZE);
+            }
+        });
+        disk_pread(gc_file_buffer + SUPERBLOCK_ADDR, FILE_SIZE - SUPERBLOCK_ADDR, SUPERBLOCK_ADDR);
 
         memcpy(gc_segment_bitmap, segment_bitmap, sizeof(segment_bitmap));
     }
     
+    phase_timer.lap(STAGE_GC_SELECT);
+
     /* Copy a GC version of all cached data in memory. */
     memset(gc_segment_buffer, 0, sizeof(gc_segment_buffer));
+    memset(gc_raw_segment, 0, sizeof(gc_raw_segment));
     gc_cur_segment     = 0;
     gc_cur_block       = 0;
     gc_next_imap_index = 0;
+    gc_inode_pack      = -1;
+    gc_inode_pack_used = 0;
     memcpy(gc_inode_table, inode_table, sizeof(inode_table));
     memcpy(gc_cached_inode_array, cached_inode_array, sizeof(cached_inode_array));
 
     segment_summary seg_sum;
     struct inode* cur_inode;
-    inode_map seg_imap;
 
     /* Initialize segment statistics for garbage collection. */
     util_entry utilization[TOT_SEGMENTS];
@@ -307,6 +543,13 @@ void collect_garbage(bool clean_thoroughly) {
 
     /* Calculate segment utilization (only for normal garbage collection). */
     if (!_clean_thoroughly) {
+        // Inode packs holding at least one live inode.
+        std::vector<block_owner> owners;
+        std::set<int> live_packs;
+        for (int i=1; i<MAX_NUM_INODE; i++)
+            if (is_packed_inode(gc_inode_table[i]))
+                live_packs.insert(inode_pack_block(gc_inode_table[i]));
+
         for (int i=0; i<TOT_SEGMENTS; i++) {
             utilization[i].segment_number = i;
             if (segment_bitmap[i] == 0) {  // Free blocks are marked with -1 utilization.
@@ -318,6 +561,19 @@ void collect_garbage(bool clean_thoroughly) {
                     int dir_index = seg_sum[j].direct_index;
                     int block_addr = i*BLOCKS_IN_SEGMENT + j;
 
+                    if (dir_index == SUMMARY_INODE_PACK) {  // Block j is an inode pack.
+                        if (live_packs.count(block_addr))
+                            utilization[i].count++;
+                        continue;
+                    }
+                    if ((dir_index >= 0) && is_shared_block(block_addr)) {
+                        live_block_owners(block_addr, owners);
+                        if (!owners.empty()) {  // Live through another file (see dedup.h).
+                            utilization[i].count++;
+                            continue;
+                        }
+                    }
+
                     // Caution: use a stronger test criterion for validity.
                     // Note that segment summary may be wrong sometimes.
                     if ((i_number <= 0) || (i_number >= MAX_NUM_INODE) || (gc_inode_table[i_number] == -1)) continue;
@@ -327,7 +583,7 @@ void collect_garbage(bool clean_thoroughly) {
                             utilization[i].count++;
                     } else {                // Block j is a data block.
                         get_inode_from_inum(cur_inode, i_number);
-                        if (cur_inode->direct[dir_index] == block_addr)
+                        if (!has_inline_data(cur_inode) && (cur_inode->direct[dir_index] == block_addr))
                             utilization[i].count++;
                     }
                 }
@@ -368,26 +624,11 @@ void collect_garbage(bool clean_thoroughly) {
 
         // Step 1: identify all live data blocks, and record inodes to be updated.
         // After compaction, mark the segment to be empty.
-        for (int i=i_st; i<i_ed; i++) {
-            int seg = utilization[i].segment_number;
-            memcpy(&seg_sum, &cached_segsum[seg], sizeof(seg_sum));
-            if (DEBUG_GARBAGE_COL)
-                logger(DEBUG, ">>> Cleaning segment %d.\n", seg);
-
-            // Compact live data blocks.
-            gc_compact_data_blocks(seg_sum, seg, modified_inum);
-
-            // Record deleted inodes.
-            read_segment_imap(&seg_imap, seg);
-            for (int j=0; j<DATA_BLOCKS_IN_SEGMENT; j++) {
-                if (seg_imap[j].inode_block == -1)
-                    modified_inum.insert(seg_imap[j].i_number);
-            }
-
-            // Evict the segment (in GC buffer).
-            memset(gc_file_buffer + seg*SEGMENT_SIZE, 0, SEGMENT_SIZE);
-            gc_segment_bitmap[seg] = 0;
-        }
+        std::vector<int> victims;
+        for (int i=i_st; i<i_ed; i++)
+            victims.push_back(utilization[i].segment_number);
+        phase_timer.lap(STAGE_GC_CLEAN);
+        gc_clean_segments(victims, true, modified_inum);
 
         // Step 2: write back cached inodes after updating all data blocks.
         std::set<int>::iterator iter = modified_inum.begin();
@@ -395,6 +636,7 @@ void collect_garbage(bool clean_thoroughly) {
             int i_number = *iter;
             if (gc_inode_table[i_number] == -1) {
                 gc_remove_inode(i_number);
+                notify_inode(i_number);     // Its last copy is reclaimed: drop any stale kernel attributes.
             } else {
                 cur_inode = &gc_cached_inode_array[i_number];
                 gc_inode_table[i_number] = gc_new_inode_block(cur_inode);
@@ -432,19 +674,11 @@ void collect_garbage(bool clean_thoroughly) {
 
         // Step 1: identify all live data blocks, and record inodes to be updated.
         // Note that deleted inodes may need to be re-deleted.
-        for (int i=0; i<TOT_SEGMENTS; i++) {
-            int seg = timestamp[i].segment_number;
-            memcpy(&seg_sum, &cached_segsum[seg], sizeof(seg_sum));
-            if (DEBUG_GARBAGE_COL)
-                logger(DEBUG, ">>> Cleaning segment %d.\n", seg);
-
-            // Compact live data blocks.
-            gc_compact_data_blocks(seg_sum, seg, modified_inum);
-
-            // There is no need to append deleted blocks or clean segments, 
-            // since all deleted data automatically vanish from the GC buffer.
-            // Remember that we start from an empty file buffer in thorough mode.
-        }
+        std::vector<int> victims;
+        for (int i=0; i<TOT_SEGMENTS; i++)
+            victims.push_back(timestamp[i].segment_number);
+        phase_timer.lap(STAGE_GC_CLEAN);
+        gc_clean_segments(victims, false, modified_inum);
 
         // Step 2: write back cached inodes after updating all data blocks.
         std::set<int>::iterator iter = modified_inum.begin();
@@ -453,6 +687,8 @@ void collect_garbage(bool clean_thoroughly) {
             if (gc_inode_table[i_number] != -1) {    // Only append undeleted inodes.
                 cur_inode = &gc_cached_inode_array[i_number];
                 gc_inode_table[i_number] = gc_new_inode_block(cur_inode);
+            } else {
+                notify_inode(i_number);     // Its last copy is reclaimed: drop any stale kernel attributes.
             }
             iter++;
         }
@@ -461,6 +697,7 @@ void collect_garbage(bool clean_thoroughly) {
     }
 
     /* Write back to disk file */
+    phase_timer.lap(STAGE_GC_WRITEBACK);
     // (0) We should set the flag "is_doing_gc" first, since we want to use blockio.h.
     // This should not be problematic, because we have acquired the segment lock.
     is_doing_gc = false;
@@ -472,11 +709,21 @@ void collect_garbage(bool clean_thoroughly) {
 
     // (2) replace segment bitmap with its GC version (checkpoint is generated later).
     memcpy(segment_bitmap, gc_segment_bitmap, sizeof(segment_bitmap));
-
-    // (3) Write the cleaned data back to file.
-    int file_handle = open(lfs_path, O_RDWR);
-    int write_length = pwrite(file_handle, gc_file_buffer, FILE_SIZE, 0);
-    close(file_handle);
+    gc_compress_segments();
+
+    // (3) Write the cleaned data back to file: segments in use, and the superblock and checkpoints.
+    //     Free segments are released, so that the disk file only holds live data.
+    //     Each device writes its own segments, in parallel.
+    for_each_device([](int device) {
+        for (int seg=device; seg<TOT_SEGMENTS; seg+=num_devices) {
+            if (gc_segment_bitmap[seg])
+                write_segment_image(gc_file_buffer + (off_t) seg * SEGMENT_SIZE, seg);
+            else
+                release_segment(seg);
+        }
+    });
+    disk_pwrite(gc_file_buffer + SUPERBLOCK_ADDR, FILE_SIZE - SUPERBLOCK_ADDR, SUPERBLOCK_ADDR);
+    forget_segment_extents();
 
 
     /* Update all GC version of temporary buffers by copying back. */
@@ -485,6 +732,7 @@ void collect_garbage(bool clean_thoroughly) {
     cur_segment     = gc_cur_segment;
     cur_block       = gc_cur_block;
     next_imap_index = gc_next_imap_index;
+    reset_inode_pack();
 
     // (2) update GC versions of cached (latest) inode information.
     memcpy(inode_table, gc_inode_table, sizeof(inode_table));
@@ -496,6 +744,10 @@ void collect_garbage(bool clean_thoroughly) {
         memcpy(&cached_segsum[seg], &seg_sum, sizeof(seg_sum));
     }
 
+    // (4) addresses of data blocks changed: find shared blocks again.
+    forget_dedup_index();
+    rebuild_shared_blocks();
+
     if (DEBUG_GARBAGE_COL)
         logger(DEBUG, "* Current buffer pointer at (segment %d, block %d), with next_imap_index = %d.\n", cur_segment, cur_block, next_imap_index);
     
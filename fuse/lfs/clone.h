@@ -0,0 +1,27 @@
+#ifndef clone_h
+#define clone_h
+
+#include <stdint.h>
+#include <linux/ioctl.h>
+
+/** **************************************
+ * Clones of file ranges (reflinks).
+ * ***************************************/
+/* copy_file_range(2) between files of LFS is served inside the file system: whole blocks at the
+ * same offset within a block are not copied, but shared between both files (see dedup.h), so
+ * that cloning a file appends no data block at all. A shared block is copied on write, since an
+ * overwrite always appends a new block for the writer only.
+ *
+ * FICLONE / FICLONERANGE name the source by a file descriptor of the caller, which cannot be
+ * resolved through FUSE: the same clone is requested by LFS_IOC_CLONE_RANGE on the destination
+ * file, naming the source by its inode number (st_ino). This header is shared with user programs. */
+struct lfs_clone_range {
+    uint64_t src_ino;               // st_ino of the source file (may be the destination itself).
+    uint64_t src_offset;            // Start of the source range (multiple of the block size).
+    uint64_t src_length;            // Length of the range (0: up to the end of the source).
+    uint64_t dest_offset;           // Start of the destination range (multiple of the block size).
+};
+
+#define LFS_IOC_CLONE_RANGE _IOW('L', 1, struct lfs_clone_range)
+
+#endif
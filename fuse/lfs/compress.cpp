@@ -0,0 +1,334 @@
+#include "compress.h"
+
+#include "logger.h"
+#include "device.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+
+const int LZ_MIN_MATCH      = 4;
+const int LZ_LAST_LITERALS  = 5;    // The last bytes of the input are always literals (LZ4 rule).
+const int LZ_MATCH_LIMIT    = 12;   // No match starts within the last bytes of the input (LZ4 rule).
+const int LZ_MAX_OFFSET     = 65535;
+const int LZ_HASH_BITS      = 12;
+
+const char EXTENTS_UNKNOWN      = 0;
+const char EXTENTS_RAW          = 1;
+const char EXTENTS_COMPRESSED   = 2;
+
+std::mutex extent_lock;
+char extent_state[TOT_SEGMENTS];                            // Whether extents of a segment are loaded.
+int segment_extents[TOT_SEGMENTS][DATA_BLOCKS_IN_SEGMENT];  // Extent tables of compressed segments.
+
+
+/** **************************************
+ * LZ4 block format.
+ * ***************************************/
+/** (for internal uses only) Read 4 bytes (as a hash key). */
+uint32_t lz_read32(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/** (for internal uses only) Append a length in the LZ4 style (255-byte continuation).
+ * @return pos: position after the length, or -1 if dst is too small. */
+int lz_put_length(unsigned char* dst, int pos, int dst_cap, int len) {
+    for (; len >= 255; len -= 255) {
+        if (pos >= dst_cap) return -1;
+        dst[pos++] = 255;
+    }
+    if (pos >= dst_cap) return -1;
+    dst[pos++] = len;
+    return pos;
+}
+
+/** (for internal uses only) Read a length in the LZ4 style (255-byte continuation).
+ * @return pos: position after the length, or -1 if src ends first. */
+int lz_get_length(const unsigned char* src, int pos, int src_len, int &len) {
+    unsigned char byte;
+    do {
+        if (pos >= src_len) return -1;
+        byte = src[pos++];
+        len += byte;
+    } while (byte == 255);
+    return pos;
+}
+
+/** (for internal uses only) Append a sequence (literals, then a match unless match_len = 0).
+ * @return pos: position after the sequence, or -1 if dst is too small. */
+int lz_put_sequence(unsigned char* dst, int pos, int dst_cap, const unsigned char* literals,
+                    int num_literals, int offset, int match_len) {
+    if (pos >= dst_cap) return -1;
+    int token_pos = pos++;
+    int lit_code = (num_literals < 15) ? num_literals : 15;
+    int match_code = (match_len == 0) ? 0 : ((match_len - LZ_MIN_MATCH < 15) ? match_len - LZ_MIN_MATCH : 15);
+    dst[token_pos] = (lit_code << 4) | match_code;
+
+    if ((lit_code == 15) && ((pos = lz_put_length(dst, pos, dst_cap, num_literals - 15)) < 0))
+        return -1;
+    if (pos + num_literals > dst_cap) return -1;
+    memcpy(dst + pos, literals, num_literals);
+    pos += num_literals;
+    if (match_len == 0)
+        return pos;
+
+    if (pos + 2 > dst_cap) return -1;
+    dst[pos++] = offset & 0xff;
+    dst[pos++] = offset >> 8;
+    if ((match_code == 15) && ((pos = lz_put_length(dst, pos, dst_cap, match_len - LZ_MIN_MATCH - 15)) < 0))
+        return -1;
+    return pos;
+}
+
+/** Compress a buffer (LZ4 block format, greedy matching on a small hash table).
+ * @param  src, src_len: data to be compressed.
+ * @param  dst, dst_cap: output buffer and its capacity.
+ * @return length: compressed length, or -1 if it does not fit into dst_cap bytes. */
+int lz_compress(const char* src, int src_len, char* dst, int dst_cap) {
+    const unsigned char* in = (const unsigned char*) src;
+    unsigned char* out = (unsigned char*) dst;
+    int table[1 << LZ_HASH_BITS];
+    memset(table, -1, sizeof(table));
+
+    int pos = 0, anchor = 0, cur = 0;
+    while (cur + LZ_MATCH_LIMIT <= src_len) {
+        uint32_t seq = lz_read32(in + cur);
+        int h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        int ref = table[h];
+        table[h] = cur;
+        if ((ref < 0) || (cur - ref > LZ_MAX_OFFSET) || (lz_read32(in + ref) != seq)) {
+            cur++;
+            continue;
+        }
+
+        int len = LZ_MIN_MATCH;
+        while ((cur + len < src_len - LZ_LAST_LITERALS) && (in[ref + len] == in[cur + len]))
+            len++;
+        pos = lz_put_sequence(out, pos, dst_cap, in + anchor, cur - anchor, cur - ref, len);
+        if (pos < 0)
+            return -1;
+        cur += len;
+        anchor = cur;
+    }
+    return lz_put_sequence(out, pos, dst_cap, in + anchor, src_len - anchor, 0, 0);
+}
+
+/** Decompress a buffer (LZ4 block format).
+ * @param  src, src_len: compressed data.
+ * @param  dst, dst_len: output buffer and its capacity.
+ * @return length: decompressed length, or -1 if src is corrupt. */
+int lz_decompress(const char* src, int src_len, char* dst, int dst_len) {
+    const unsigned char* in = (const unsigned char*) src;
+    unsigned char* out = (unsigned char*) dst;
+    int pos = 0, cur = 0;
+    while (pos < src_len) {
+        int token = in[pos++];
+        int num_literals = token >> 4;
+        if ((num_literals == 15) && ((pos = lz_get_length(in, pos, src_len, num_literals)) < 0))
+            return -1;
+        if ((pos + num_literals > src_len) || (cur + num_literals > dst_len))
+            return -1;
+        memcpy(out + cur, in + pos, num_literals);
+        pos += num_literals;
+        cur += num_literals;
+        if (pos == src_len)     // The last sequence has no match.
+            break;
+
+        if (pos + 2 > src_len) return -1;
+        int offset = in[pos] | (in[pos+1] << 8);
+        pos += 2;
+        int match_len = token & 15;
+        if ((match_len == 15) && ((pos = lz_get_length(in, pos, src_len, match_len)) < 0))
+            return -1;
+        match_len += LZ_MIN_MATCH;
+        if ((offset == 0) || (offset > cur) || (cur + match_len > dst_len))
+            return -1;
+        for (int k=0; k<match_len; k++)     // Matches may overlap their own output.
+            out[cur + k] = out[cur - offset + k];
+        cur += match_len;
+    }
+    return cur;
+}
+
+
+
+/** **************************************
+ * Compressed segments.
+ * ***************************************/
+/** (for internal uses only) Whether a block only holds zeros (e.g. unused blocks of a segment). */
+bool is_zero_block(const char* data) {
+    static const char zeros[BLOCK_SIZE] = {0};
+    return memcmp(data, zeros, BLOCK_SIZE) == 0;
+}
+
+/** (for internal uses only) Decompress the payload of a block according to its extent length.
+ * @return flag: true on success, false if the payload is corrupt (data is zeroed). */
+bool expand_block(const char* payload, int length, char* data) {
+    if (length == 0) {
+        memset(data, 0, BLOCK_SIZE);
+    } else if (length == BLOCK_SIZE) {
+        memcpy(data, payload, BLOCK_SIZE);
+    } else if (lz_decompress(payload, length, data, BLOCK_SIZE) != BLOCK_SIZE) {
+        logger(ERROR, "[ERROR] Corrupt file system: cannot decompress a block (%d bytes).\n", length);
+        memset(data, 0, BLOCK_SIZE);
+        return false;
+    }
+    return true;
+}
+
+/** Build the on-disk image of a segment: compress its data blocks, and copy its metadata.
+ * @param  raw: segment buffer (SEGMENT_SIZE bytes, with metadata already added).
+ * @param  image: return variable (SEGMENT_SIZE bytes).
+ * @return size: bytes used in the data region of the image, or 0 if the segment is stored raw. */
+int compress_segment(const char* raw, char* image) {
+    const int data_region = DATA_BLOCKS_IN_SEGMENT * BLOCK_SIZE;
+    int* extents = (int*) image;
+    int pos = EXTENT_TABLE_SIZE;
+    char packed[BLOCK_SIZE];
+    for (int i=0; i<DATA_BLOCKS_IN_SEGMENT; i++) {
+        const char* data = raw + i * BLOCK_SIZE;
+        int length = 0;
+        const char* payload = packed;
+        if (!is_zero_block(data)) {
+            length = lz_compress(data, BLOCK_SIZE, packed, BLOCK_SIZE - 1);
+            if (length < 0) {   // Incompressible: store it raw.
+                length = BLOCK_SIZE;
+                payload = data;
+            }
+        }
+        if (pos + length > data_region) {
+            pos = 0;
+            break;
+        }
+        memcpy(image + pos, payload, length);
+        extents[i] = (pos << EXTENT_LEN_BITS) | length;
+        pos += length;
+    }
+
+    if (pos == 0) {     // Not smaller than the raw data region.
+        memcpy(image, raw, SEGMENT_SIZE);
+    } else {
+        memset(image + pos, 0, data_region - pos);
+        memcpy(image + data_region, raw + data_region, SEGMENT_SIZE - data_region);
+    }
+    ((struct segment_metadata*) (image + SEGMETA_OFFSET))->compressed_size = pos;
+    return pos;
+}
+
+/** Turn the on-disk image of a segment back into a segment buffer (in place). */
+void expand_segment(char* image) {
+    int size = ((struct segment_metadata*) (image + SEGMETA_OFFSET))->compressed_size;
+    if (size == 0)
+        return;
+
+    std::vector<char> region(image, image + size);
+    const int* extents = (const int*) region.data();
+    for (int i=0; i<DATA_BLOCKS_IN_SEGMENT; i++)
+        expand_block(region.data() + (extents[i] >> EXTENT_LEN_BITS), extents[i] & EXTENT_LEN_MASK,
+                     image + i * BLOCK_SIZE);
+    ((struct segment_metadata*) (image + SEGMETA_OFFSET))->compressed_size = 0;
+}
+
+
+/** (for internal uses only) Load the extent table of a segment, unless known already.
+ * [CAUTION] The caller should hold extent_lock. */
+void load_segment_extents(int segment_addr) {
+    if (extent_state[segment_addr] != EXTENTS_UNKNOWN)
+        return;
+
+    struct segment_metadata seg_metadata;
+    read_segment_metadata(&seg_metadata, segment_addr);
+    if (seg_metadata.compressed_size == 0) {
+        extent_state[segment_addr] = EXTENTS_RAW;
+        return;
+    }
+
+    disk_pread(segment_extents[segment_addr], EXTENT_TABLE_SIZE, (off_t) segment_addr * SEGMENT_SIZE);
+    extent_state[segment_addr] = EXTENTS_COMPRESSED;
+}
+
+/** Whether a segment is stored compressed in the disk file. */
+bool is_compressed_segment(int segment_addr) {
+    if (!USE_COMPRESSION)
+        return false;
+    std::lock_guard<std::mutex> guard(extent_lock);
+    load_segment_extents(segment_addr);
+    return extent_state[segment_addr] == EXTENTS_COMPRESSED;
+}
+
+/** Record the extent table of a segment image that has just been written to disk. */
+void remember_segment_extents(int segment_addr, const char* image) {
+    std::lock_guard<std::mutex> guard(extent_lock);
+    if (((const struct segment_metadata*) (image + SEGMETA_OFFSET))->compressed_size == 0) {
+        extent_state[segment_addr] = EXTENTS_RAW;
+    } else {
+        memcpy(segment_extents[segment_addr], image, EXTENT_TABLE_SIZE);
+        extent_state[segment_addr] = EXTENTS_COMPRESSED;
+    }
+}
+
+/** Drop all extent tables (after the disk file is replaced, e.g. by mounting or GC). */
+void forget_segment_extents() {
+    std::lock_guard<std::mutex> guard(extent_lock);
+    memset(extent_state, EXTENTS_UNKNOWN, sizeof(extent_state));
+}
+
+/** Read consecutive blocks of a segment from the disk file, decompressing them if necessary.
+ * Payloads of consecutive blocks are consecutive, so that a single (shorter) read is issued.
+ * @param  buf: return variable (num_blocks * BLOCK_SIZE bytes).
+ * @param  block_addr: address of the first block.
+ * @param  num_blocks: number of blocks (within the same segment).
+ * @return length: num_blocks * BLOCK_SIZE on success; -1 on error. */
+int read_data_blocks(void* buf, int block_addr, int num_blocks) {
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    int block = block_addr % BLOCKS_IN_SEGMENT;
+    std::vector<int> extents;
+    if (USE_COMPRESSION && (block + num_blocks <= DATA_BLOCKS_IN_SEGMENT)) {
+        std::lock_guard<std::mutex> guard(extent_lock);
+        load_segment_extents(segment);
+        if (extent_state[segment] == EXTENTS_COMPRESSED)
+            extents.assign(segment_extents[segment] + block, segment_extents[segment] + block + num_blocks);
+    }
+
+    if (extents.empty())    // Metadata blocks, or a raw segment.
+        return disk_pread(buf, num_blocks * BLOCK_SIZE, (off_t) block_addr * BLOCK_SIZE);
+
+    int start = extents.front() >> EXTENT_LEN_BITS;
+    int end = (extents.back() >> EXTENT_LEN_BITS) + (extents.back() & EXTENT_LEN_MASK);
+    std::vector<char> payload(end - start);
+    int read_length = disk_pread(payload.data(), end - start, (off_t) segment * SEGMENT_SIZE + start);
+    if (read_length != end - start)
+        return -1;
+
+    bool success = true;
+    for (int i=0; i<num_blocks; i++)
+        success &= expand_block(payload.data() + (extents[i] >> EXTENT_LEN_BITS) - start,
+                                extents[i] & EXTENT_LEN_MASK, (char*) buf + i * BLOCK_SIZE);
+    return success ? (num_blocks * BLOCK_SIZE) : -1;
+}
+
+/** Locate the raw copy of a block in the disk file (e.g. to be spliced).
+ * @return offset: offset of the block in the disk image (see device_offset()),
+ *         or -1 if it is stored compressed, or its segment is not written yet. */
+off_t block_file_offset(int block_addr) {
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    int block = block_addr % BLOCKS_IN_SEGMENT;
+    if (USE_WRITE_QUEUES && is_segment_queued(segment))
+        return -1;
+    if (!USE_COMPRESSION || (block >= DATA_BLOCKS_IN_SEGMENT))
+        return (off_t) block_addr * BLOCK_SIZE;
+
+    std::lock_guard<std::mutex> guard(extent_lock);
+    load_segment_extents(segment);
+    if (extent_state[segment] != EXTENTS_COMPRESSED)
+        return (off_t) block_addr * BLOCK_SIZE;
+    int extent = segment_extents[segment][block];
+    if ((extent & EXTENT_LEN_MASK) != BLOCK_SIZE)
+        return -1;
+    return (off_t) segment * SEGMENT_SIZE + (extent >> EXTENT_LEN_BITS);
+}
@@ -0,0 +1,36 @@
+#ifndef compress_h
+#define compress_h
+
+#include "utility.h"
+
+/** **************************************
+ * Segment compression.
+ * ***************************************/
+/* With USE_COMPRESSION, a segment is compressed whenever it is written to disk (sealed or synced).
+ * Each data block is compressed on its own (LZ4 block format), and the results are stored back
+ * to back in the data region of the segment, behind an extent table:
+ *     [extent table (one int per data block)][payload of block 0][payload of block 1]...
+ * An extent is (offset in the segment << EXTENT_LEN_BITS) | length, where a length of BLOCK_SIZE
+ * stands for a block stored raw (incompressible), and a length of 0 for a block of zeros.
+ * The imap, summary and metadata regions keep their fixed offsets and are never compressed;
+ * segment_metadata.compressed_size tells compressed segments from raw ones (0). A segment whose
+ * compressed data region would not fit is stored raw.
+ * Block addresses are unchanged: read_block(), read_segment() and the cache decompress blocks,
+ * and replies only splice blocks stored raw from the disk file (see block_file_offset()). */
+const int EXTENT_LEN_BITS   = 11;
+const int EXTENT_LEN_MASK   = (1 << EXTENT_LEN_BITS) - 1;
+const int EXTENT_TABLE_SIZE = DATA_BLOCKS_IN_SEGMENT * sizeof(int);
+
+int lz_compress(const char* src, int src_len, char* dst, int dst_cap);
+int lz_decompress(const char* src, int src_len, char* dst, int dst_len);
+
+int compress_segment(const char* raw, char* image);
+void expand_segment(char* image);
+
+bool is_compressed_segment(int segment_addr);
+void remember_segment_extents(int segment_addr, const char* image);
+void forget_segment_extents();
+int read_data_blocks(void* buf, int block_addr, int num_blocks);
+off_t block_file_offset(int block_addr);
+
+#endif
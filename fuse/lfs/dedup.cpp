@@ -0,0 +1,167 @@
+#include "dedup.h"
+
+#include "logger.h"
+#include "blockio.h"
+
+#include <string.h>
+#include <stdint.h>
+#include <list>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+
+typedef std::list<std::pair<uint64_t, int> > fingerprint_list;
+
+fingerprint_list dedup_lru;                                             // Most recently used first.
+std::unordered_map<uint64_t, fingerprint_list::iterator> dedup_index;   // Fingerprint -> entry in dedup_lru.
+std::unordered_map<int, std::vector<block_owner> > shared_blocks;      // Block address -> extra owners.
+
+
+/** (for internal uses only) Fingerprint of a block (64-bit multiplicative hash over words). */
+uint64_t block_fingerprint(const void* data) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL;
+    for (int i=0; i<BLOCK_SIZE; i+=sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, (const char*) data + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+/** (for internal uses only) Drop a fingerprint from the index. */
+void drop_fingerprint(uint64_t fingerprint) {
+    auto it = dedup_index.find(fingerprint);
+    if (it == dedup_index.end())
+        return;
+    dedup_lru.erase(it->second);
+    dedup_index.erase(it);
+}
+
+/** (for internal uses only) Whether an owner still points to a block. */
+bool owns_block(const block_owner &owner, int block_addr) {
+    if ((owner.i_number <= 0) || (owner.i_number >= MAX_NUM_INODE) || (inode_table[owner.i_number] == -1))
+        return false;
+    const struct inode* cur_inode = cached_inode_array + owner.i_number;
+    return (cur_inode->i_number == owner.i_number) && !has_inline_data(cur_inode)
+           && (cur_inode->direct[owner.direct_index] == block_addr);
+}
+
+
+/** Point a file to an identical block already in the log, instead of appending its data.
+ * [CAUTION] The caller should hold the segment lock.
+ * @param  data: content of the new block.
+ * @param  data_inode: inode that the data belongs to (may be head or non-head inodes).
+ * @param  direct_index: the index of direct[] in that inode, pointing to the block.
+ * @return whether an identical block is found (and data_inode updated). */
+bool dedup_data_block(const void* data, struct inode* data_inode, int direct_index) {
+    uint64_t fingerprint = block_fingerprint(data);
+    auto it = dedup_index.find(fingerprint);
+    if (it == dedup_index.end())
+        return false;
+
+    // Verify the candidate: fingerprints may collide, and its segment may have been rewritten.
+    int block_addr = it->second->second;
+    int segment = block_addr / BLOCKS_IN_SEGMENT;
+    block candidate;
+    if ((segment != cur_segment) && (segment_bitmap[segment] == 0)) {
+        drop_fingerprint(fingerprint);
+        return false;
+    }
+    get_block(&candidate, block_addr);
+    if (memcmp(candidate, data, BLOCK_SIZE) != 0) {
+        drop_fingerprint(fingerprint);
+        return false;
+    }
+    dedup_lru.splice(dedup_lru.begin(), dedup_lru, it->second);
+
+    share_block(data_inode, direct_index, block_addr);
+    return true;
+}
+
+/** Point a file to a block of file data already in the log (of the same or another file),
+ * recording the file as an extra owner of the block.
+ * [CAUTION] The caller should hold the segment lock.
+ * @param  data_inode: inode that the data belongs to (may be head or non-head inodes).
+ * @param  direct_index: the index of direct[] in that inode, pointing to the block.
+ * @param  block_addr: address of the shared block. */
+void share_block(struct inode* data_inode, int direct_index, int block_addr) {
+    if (data_inode->direct[direct_index] == block_addr)
+        return;
+    data_inode->direct[direct_index] = block_addr;
+
+    // Record the new owner (and forget those that moved away meanwhile).
+    std::vector<block_owner> &owners = shared_blocks[block_addr];
+    owners.erase(std::remove_if(owners.begin(), owners.end(),
+                                [block_addr](const block_owner &o) { return !owns_block(o, block_addr); }),
+                 owners.end());
+    owners.push_back({data_inode->i_number, direct_index});
+
+    if (DEBUG_BLOCKIO)
+        logger(DEBUG, "Share block %d as direct[%d] of inode #%d.\n", block_addr, direct_index, data_inode->i_number);
+}
+
+/** Add a newly appended block of file data to the fingerprint index (evicting the oldest entry).
+ * [CAUTION] The caller should hold the segment lock. */
+void index_data_block(const void* data, int block_addr) {
+    uint64_t fingerprint = block_fingerprint(data);
+    drop_fingerprint(fingerprint);
+    if (dedup_index.size() >= DEDUP_INDEX_ENTRIES) {
+        dedup_index.erase(dedup_lru.back().first);
+        dedup_lru.pop_back();
+    }
+    dedup_lru.push_front(std::make_pair(fingerprint, block_addr));
+    dedup_index[fingerprint] = dedup_lru.begin();
+}
+
+/** Drop the fingerprint index and the extra owners (block addresses are changed by GC,
+ * or unknown before mounting); the extra owners should be rebuilt afterwards. */
+void forget_dedup_index() {
+    dedup_index.clear();
+    dedup_lru.clear();
+    shared_blocks.clear();
+}
+
+
+/** Whether a block may have more than one owner (it should not be rewritten in place then).
+ * [CAUTION] The caller should hold the segment lock. */
+bool is_shared_block(int block_addr) {
+    return USE_DEDUP && (shared_blocks.count(block_addr) > 0);
+}
+
+/** Retrieve the extra owners (besides the one in the segment summary) still pointing to a block.
+ * Owners are checked against the inode array (not the GC copy), as the cleaner does.
+ * @param  block_addr: address of a data block.
+ * @param  owners: return variable. */
+void live_block_owners(int block_addr, std::vector<block_owner> &owners) {
+    owners.clear();
+    auto it = shared_blocks.find(block_addr);
+    if (it == shared_blocks.end())
+        return;
+    for (const block_owner &owner : it->second)
+        if (owns_block(owner, block_addr))
+            owners.push_back(owner);
+}
+
+/** Rebuild the extra owners of all blocks from the inode array and the segment summaries. */
+void rebuild_shared_blocks() {
+    shared_blocks.clear();
+    if (!USE_DEDUP)
+        return;
+
+    for (int i=1; i<MAX_NUM_INODE; i++) {
+        const struct inode* cur_inode = cached_inode_array + i;
+        if ((inode_table[i] == -1) || (cur_inode->i_number != i) || has_inline_data(cur_inode))
+            continue;
+        for (int k=0; k<NUM_INODE_DIRECT; k++) {
+            int block_addr = cur_inode->direct[k];
+            if ((block_addr < 0) || (block_addr >= INODE_PACK_BASE))
+                continue;
+            const summary_entry &entry = cached_segsum[block_addr / BLOCKS_IN_SEGMENT][block_addr % BLOCKS_IN_SEGMENT];
+            if ((entry.i_number != i) || (entry.direct_index != k))
+                shared_blocks[block_addr].push_back({i, k});
+        }
+    }
+    if (!shared_blocks.empty())
+        logger(DEBUG, "[INFO] %lu data block(s) are shared between files.\n", shared_blocks.size());
+}
@@ -0,0 +1,38 @@
+#ifndef dedup_h
+#define dedup_h
+
+#include "utility.h"
+
+/** **************************************
+ * Deduplication of file data blocks.
+ * ***************************************/
+/* With USE_DEDUP, a block of file data is not appended if an identical block is already in the
+ * log: the file points to the existing block instead. Candidates are found through an in-memory
+ * fingerprint index (64-bit hash -> block address, verified by comparing contents), bounded to
+ * DEDUP_INDEX_ENTRIES with LRU eviction. The index is dropped whenever addresses change (GC, mount).
+ *
+ * A shared block is owned by the (i_number, direct_index) recorded in its segment summary, plus
+ * extra owners kept in a reverse map. It is live as long as any owner still points to it, so that
+ * reference counts are implicit: owners that moved away (overwrite, truncation, removal) are
+ * skipped, and pruned lazily. Extra owners are exactly the pointers that disagree with the
+ * summary, so they are not persisted but rebuilt from the inode array (on mount and after GC).
+ * The cleaner moves a shared block once and updates all its owners. Clones (copy_file_range and
+ * LFS_IOC_CLONE_RANGE, see clone.h) share blocks the same way, without looking at their contents.
+ * [CAUTION] The index and the reverse map are protected by the segment lock. */
+const int DEDUP_INDEX_ENTRIES = 65536;      // Fingerprints kept in memory (about 3 MB).
+
+struct block_owner {
+    int i_number;                   // Inode pointing to the block (head or non-head inode).
+    int direct_index;               // The index of direct[] in that inode.
+};
+
+bool dedup_data_block(const void* data, struct inode* data_inode, int direct_index);
+void share_block(struct inode* data_inode, int direct_index, int block_addr);
+void index_data_block(const void* data, int block_addr);
+void forget_dedup_index();
+
+bool is_shared_block(int block_addr);
+void live_block_owners(int block_addr, std::vector<block_owner> &owners);
+void rebuild_shared_blocks();
+
+#endif
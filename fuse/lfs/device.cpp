@@ -0,0 +1,276 @@
+#include "device.h"
+
+#include "logger.h"
+#include "metrics.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+struct segment_write {
+    int segment_addr;
+    std::vector<char> image;            // Segment image, as laid out on disk.
+};
+
+struct device_queue {
+    std::mutex lock;
+    std::condition_variable cond;       // Signals new images (to the writer) and progress (to others).
+    std::deque<segment_write> writes;   // The front one is being written.
+    std::deque<segment_write> failed;   // Images that could not be written (still served to reads).
+    bool running = false;
+    std::thread writer;
+};
+
+int num_devices = 1;
+std::vector<std::string> device_paths;
+std::vector<int> device_fds(MAX_DEVICES, -1);
+device_queue device_queues[MAX_DEVICES];
+std::atomic<int> failed_writes(0);      // Segment images that could not be written since mounting.
+
+
+/** Set the backing files / devices, instead of lfs.data in the working directory.
+ * @param  paths: paths separated by ':' (in the same order on every mount). */
+void set_device_paths(const char* paths) {
+    device_paths.clear();
+    std::string list = paths;
+    size_t start = 0;
+    while (start < list.size()) {
+        size_t end = list.find(':', start);
+        if (end == std::string::npos)
+            end = list.size();
+        if (end > start)
+            device_paths.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    if (device_paths.size() > MAX_DEVICES) {
+        logger(ERROR, "[FATAL ERROR] Too many devices (%lu): at most %d are supported.\n", device_paths.size(), MAX_DEVICES);
+        exit(-1);
+    }
+}
+
+/** (for internal uses only) Number of segments stored on a device. */
+int device_segments(int device) {
+    return (TOT_SEGMENTS - device + num_devices - 1) / num_devices;
+}
+
+/** (for internal uses only) Write the queued segment images of a device, in order. */
+void device_writer(int device) {
+    device_queue &queue = device_queues[device];
+    std::unique_lock<std::mutex> guard(queue.lock);
+    while (true) {
+        queue.cond.wait(guard, [&queue] { return !queue.writes.empty() || !queue.running; });
+        if (queue.writes.empty())
+            return;
+
+        // The image stays queued (and readable) until it is completely written.
+        segment_write &front = queue.writes.front();
+        guard.unlock();
+        int write_length = write_segment_image(front.image.data(), front.segment_addr);
+        guard.lock();
+        if (write_length < 0) {
+            // Keep the image readable, and stop writing: no checkpoint may refer to the segment.
+            logger(ERROR, "[ERROR] Fail to write segment %d to device %d: the file system is read-only from now on.\n",
+                   front.segment_addr, device);
+            queue.failed.push_back(segment_write());
+            queue.failed.back().segment_addr = front.segment_addr;
+            queue.failed.back().image.swap(front.image);
+            failed_writes++;
+            is_full = true;
+        }
+        queue.writes.pop_front();
+        queue.cond.notify_all();
+    }
+}
+
+/** Open (or create) all backing devices, and start their writers.
+ * @param  default_path: the only device, if none is set by set_device_paths().
+ * @return whether the first device is newly created (so that it should be formatted). */
+bool open_devices(const char* default_path) {
+    if (device_paths.empty())
+        device_paths.push_back(default_path);
+    num_devices = device_paths.size();
+    lfs_path = (char*) device_paths[0].c_str();
+
+    bool is_new = (access(lfs_path, F_OK) != 0);
+    for (int i=0; i<num_devices; i++) {
+        device_fds[i] = open(device_paths[i].c_str(), O_RDWR | O_CREAT, 0777);
+        if (device_fds[i] < 0) {
+            logger(ERROR, "[FATAL ERROR] Fail to open device #%d (%s).\n", i, device_paths[i].c_str());
+            exit(-1);
+        }
+        device_queues[i].running = true;
+        device_queues[i].writer = std::thread(device_writer, i);
+    }
+    return is_new;
+}
+
+/** Write back all queued segments, stop the writers and close all devices. */
+void close_devices() {
+    for (int i=0; i<num_devices; i++) {
+        {
+            std::lock_guard<std::mutex> guard(device_queues[i].lock);
+            device_queues[i].running = false;
+            device_queues[i].cond.notify_all();
+        }
+        if (device_queues[i].writer.joinable())
+            device_queues[i].writer.join();
+        device_queues[i].failed.clear();
+        close(device_fds[i]);
+        device_fds[i] = -1;
+    }
+    failed_writes = 0;
+}
+
+/** Size all devices for a new file system (see format_disk_file()).
+ * @return 0 on success, -1 on error. */
+int format_devices() {
+    for (int i=0; i<num_devices; i++) {
+        off_t size = (off_t) device_segments(i) * SEGMENT_SIZE;
+        if (i == 0)
+            size += FILE_SIZE - SUPERBLOCK_ADDR;
+        if (format_disk_file(device_fds[i], size) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+
+/** Locate a position of the disk image on its device.
+ * @param  file_offset: offset in the disk image (as if it were a single file).
+ * @param  device: return variable (index of the device).
+ * @return offset: offset on the device. */
+off_t device_offset(off_t file_offset, int &device) {
+    if (file_offset >= SUPERBLOCK_ADDR) {
+        device = 0;
+        return (off_t) device_segments(0) * SEGMENT_SIZE + (file_offset - SUPERBLOCK_ADDR);
+    }
+    int segment = file_offset / SEGMENT_SIZE;
+    device = segment % num_devices;
+    return (off_t) (segment / num_devices) * SEGMENT_SIZE + file_offset % SEGMENT_SIZE;
+}
+
+/** File descriptor of a device (e.g. to splice blocks from it), or -1 if not mounted. */
+int device_fd(int device) {
+    return device_fds[device];
+}
+
+/** Run a function for each device, in parallel if there are several of them. */
+void for_each_device(const std::function<void(int)> &func) {
+    if (num_devices == 1) {
+        func(0);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int i=0; i<num_devices; i++)
+        workers.push_back(std::thread(func, i));
+    for (auto &worker : workers)
+        worker.join();
+}
+
+
+/** **************************************
+ * Reads / writes of the disk image.
+ * @param  file_offset: offset in the disk image (the range should not cross segments).
+ * @return length: actual length of reading / writing; -1 on error.
+ * ****************************************/
+
+/** Read from the disk image (or from the queued image of a segment not written yet). */
+int disk_pread(void* buf, size_t len, off_t file_offset) {
+    int device;
+    off_t pos = device_offset(file_offset, device);
+    if (file_offset < SUPERBLOCK_ADDR) {
+        int segment = file_offset / SEGMENT_SIZE;
+        device_queue &queue = device_queues[device];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        for (auto it = queue.writes.rbegin(); it != queue.writes.rend(); it++)
+            if (it->segment_addr == segment) {
+                memcpy(buf, it->image.data() + file_offset % SEGMENT_SIZE, len);
+                return len;
+            }
+        for (auto &write : queue.failed)
+            if (write.segment_addr == segment) {
+                memcpy(buf, write.image.data() + file_offset % SEGMENT_SIZE, len);
+                return len;
+            }
+    }
+    count_metric(COUNT_DISK_READS);
+    count_metric(COUNT_DISK_READ_BYTES, len);
+    return pread(device_fds[device], buf, len, pos);
+}
+
+/** Write into the disk image directly. */
+int disk_pwrite(const void* buf, size_t len, off_t file_offset) {
+    int device;
+    off_t pos = device_offset(file_offset, device);
+    count_metric(COUNT_DISK_WRITES);
+    count_metric(COUNT_DISK_WRITE_BYTES, len);
+    return pwrite(device_fds[device], buf, len, pos);
+}
+
+/** Release a range of the disk image (see release_disk_range()). */
+int disk_release(off_t file_offset, off_t len, bool must_zero) {
+    int device;
+    off_t pos = device_offset(file_offset, device);
+    return release_disk_range(device_fds[device], pos, len, must_zero);
+}
+
+/** Flush all devices to stable storage. */
+void sync_devices() {
+    for (int i=0; i<num_devices; i++)
+        fsync(device_fds[i]);
+}
+
+
+/** **************************************
+ * Writeback queues.
+ * ****************************************/
+
+/** Queue a segment image to be written by the writer of its device (waiting while the queue is full).
+ * @param  segment_addr: segment address (= seg).
+ * @param  image: the segment image (taken over: left empty). */
+void queue_segment_write(int segment_addr, std::vector<char> &image) {
+    device_queue &queue = device_queues[segment_addr % num_devices];
+    std::unique_lock<std::mutex> guard(queue.lock);
+    queue.cond.wait(guard, [&queue] { return queue.writes.size() < DEVICE_QUEUE_DEPTH; });
+    queue.writes.push_back(segment_write());
+    queue.writes.back().segment_addr = segment_addr;
+    queue.writes.back().image.swap(image);
+    queue.cond.notify_all();
+}
+
+/** Whether a segment still has an image waiting to be written (or that could not be written). */
+bool is_segment_queued(int segment_addr) {
+    device_queue &queue = device_queues[segment_addr % num_devices];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    for (auto &write : queue.writes)
+        if (write.segment_addr == segment_addr)
+            return true;
+    for (auto &write : queue.failed)
+        if (write.segment_addr == segment_addr)
+            return true;
+    return false;
+}
+
+/** Whether a segment image could not be written since mounting (the file system is read-only then). */
+bool has_write_errors() {
+    return failed_writes.load() > 0;
+}
+
+/** Wait until all queued segments are written.
+ * @return flag: 0 on success, -EIO if a segment could not be written (since mounting). */
+int drain_segment_writes() {
+    for (int i=0; i<num_devices; i++) {
+        device_queue &queue = device_queues[i];
+        std::unique_lock<std::mutex> guard(queue.lock);
+        queue.cond.wait(guard, [&queue] { return queue.writes.empty(); });
+    }
+    return has_write_errors() ? -EIO : 0;
+}
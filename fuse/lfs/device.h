@@ -0,0 +1,49 @@
+#ifndef device_h
+#define device_h
+
+#include "utility.h"
+
+#include <functional>
+#include <vector>
+
+/** **************************************
+ * Backing devices (segment striping).
+ * ***************************************/
+/* The disk image (FILE_SIZE bytes: TOT_SEGMENTS segments, then the superblock and checkpoints)
+ * is striped over num_devices backing files or block devices, one segment at a time:
+ * segment s is stored on device (s % num_devices), at offset (s / num_devices) * SEGMENT_SIZE.
+ * The superblock and checkpoints follow the last segment of device 0; the superblock records
+ * the number of devices (which should be given in the same order on every mount).
+ * With a single device (by default, lfs.data in the working directory), the layout is unchanged.
+ *
+ * Segments are written by one writer thread per device, from a bounded queue of segment images,
+ * so that consecutive segments (on different devices) are written in parallel. Until an image
+ * reaches its device, reads of the segment are served from the image. Queues are drained before
+ * checkpoints, garbage collection and unmounting.
+ * An image that cannot be written stays readable, and turns the file system read-only (is_full):
+ * checkpoints are no longer written, so that none refers to a segment missing on disk. */
+const int MAX_DEVICES        = 16;
+const int DEVICE_QUEUE_DEPTH = 4;       // Segment images queued per device (1 MB each).
+
+extern int num_devices;
+
+void set_device_paths(const char* paths);
+bool open_devices(const char* default_path);
+void close_devices();
+int format_devices();
+
+off_t device_offset(off_t file_offset, int &device);
+int device_fd(int device);
+void for_each_device(const std::function<void(int)> &func);
+
+int disk_pread(void* buf, size_t len, off_t file_offset);
+int disk_pwrite(const void* buf, size_t len, off_t file_offset);
+int disk_release(off_t file_offset, off_t len, bool must_zero = true);
+void sync_devices();
+
+void queue_segment_write(int segment_addr, std::vector<char> &image);
+bool is_segment_queued(int segment_addr);
+bool has_write_errors();
+int drain_segment_writes();
+
+#endif
@@ -1,10 +1,18 @@
 #include "dir.h"
 
 #include "logger.h"
+#include "metrics.h"
+#include "statsfile.h"
 #include "print.h"
 #include "path.h"
+#include "metadata.h"
 #include "utility.h"
 #include "blockio.h"
+#include "dirindex.h"
+#include "notify.h"
+#include "dirhash.h"
+#include "reclaim.h"
+#include "device.h"
 #include "errno.h"
 
 #include <string.h>
@@ -19,7 +27,13 @@ int o_opendir(const char* path, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "OPENDIR, %s, %p\n", resolve_prefix(path).c_str(), fi);
 
-    int fh;
+    metric_timer timer(OP_OPENDIR);
+
+    int fh = stats_path_inode(path);
+    if (fh != 0) {
+        fi->fh = fh;
+        return (fh == STATS_DIR_INUM) ? 0 : -ENOTDIR;
+    }
     int locate_err = locate(path, fh);
     fi->fh = fh;
     if (locate_err != 0) {
@@ -28,15 +42,25 @@ int o_opendir(const char* path, struct fuse_file_info* fi) {
         return locate_err;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[fh]);
+    int flag = open_directory(fh);
+    if (flag == 0)
+        hold_inode(fh);     // Dropped on releasedir.
+    return flag;
+}
+
+/** Verify that an i_number refers to a directory.
+ * @param  i_number: i_number of the directory.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int open_directory(int i_number) {
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
 
     inode* block_inode;
-    get_inode_from_inum(block_inode, fh);
+    get_inode_from_inum(block_inode, i_number);
     if (block_inode->mode != MODE_DIR) {
         if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] %s is not a directory.\n", path);
+            logger(ERROR, "[ERROR] Inode #%d is not a directory.\n", i_number);
         return -ENOTDIR;
     }
     return 0;
@@ -46,6 +70,9 @@ int o_releasedir(const char* path, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "RELEASEDIR, %s, %p\n", resolve_prefix(path).c_str(), fi);
 
+    metric_timer timer(OP_RELEASEDIR);
+
+    drop_inode(fi->fh);     // (Virtual inodes take no reference.)
     fi->fh = 0;
     return 0;
 }
@@ -56,11 +83,10 @@ int o_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
         logger(DEBUG, "READDIR, %s, %p, %p, %d, %p, %d\n",
                resolve_prefix(path).c_str(), buf, &filler, offset, fi, flags);
 
-    /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    metric_timer timer(OP_READDIR);
 
-    int fh;
-    int locate_err = locate(path, fh);
+    int fh = stats_path_inode(path);
+    int locate_err = (fh != 0) ? 0 : locate(path, fh);
     fi->fh = fh;
     if (locate_err != 0) {
         if (ERROR_DIRECTORY)
@@ -68,35 +94,123 @@ int o_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
         return locate_err;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[fh]);
-    /* This will be automatically released on each exit path. */
+    // Entries are passed with their offsets, so that a listing is resumed where the buffer got full.
+    // Attributes (for readdirplus) are filled after the directory lock is released.
+    while (true) {
+        std::vector<dir_batch_entry> batch;
+        int flag = read_directory_batch(fh, offset, READDIR_BATCH, batch);
+        if (flag != 0)
+            return flag;
+        for (auto &ent : batch) {
+            struct stat sbuf;
+            memset(&sbuf, 0, sizeof(sbuf));
+            sbuf.st_ino = ent.i_number;
+            sbuf.st_mode = entry_type(ent.i_number);
+            enum fuse_fill_dir_flags fill_flags = (fuse_fill_dir_flags) 0;
+            if ((flags & FUSE_READDIR_PLUS) && (ent.i_number > 0) && (get_attributes(ent.i_number, &sbuf) == 0))
+                fill_flags = FUSE_FILL_DIR_PLUS;
+            if (filler(buf, ent.name.c_str(), &sbuf, ent.next_offset, fill_flags) != 0)
+                return 0;   // The buffer is full.
+        }
+        if (batch.size() < READDIR_BATCH)
+            return 0;
+        offset = batch.back().next_offset;
+    }
+}
+
+struct read_batch_args {
+    size_t max_entries;
+    std::vector<dir_batch_entry>* entries;
+};
+
+/** (for internal uses only) Collect directory entries into a vector. */
+bool read_batch_collector(void* ctx, const char* name, int i_number, off_t next_offset) {
+    read_batch_args* args = (read_batch_args*) ctx;
+    args->entries->push_back({name, i_number, next_offset});
+    return args->entries->size() >= args->max_entries;
+}
 
-    filler(buf, ".", NULL, 0, (fuse_fill_dir_flags) 0);
-    filler(buf, "..", NULL, 0, (fuse_fill_dir_flags) 0);
+/** List at most max_entries entries of a directory, starting after a given offset.
+ * Unlike visitors of read_directory(), the caller may inspect the entries with their own locks.
+ * @param  entries: return variable (entries with the offsets to resume after them).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int read_directory_batch(int i_number, off_t offset, size_t max_entries, std::vector<struct dir_batch_entry> &entries) {
+    read_batch_args args = {max_entries, &entries};
+    if (is_stats_inode(i_number))
+        return read_stats_directory(offset, read_batch_collector, &args);
+    return read_directory(i_number, offset, read_batch_collector, &args);
+}
+
+/** File type (S_IFDIR / S_IFREG) of a directory entry, reported as d_type by readdir. */
+mode_t entry_type(int i_number) {
+    if (is_stats_inode(i_number))
+        return (i_number == STATS_DIR_INUM) ? S_IFDIR : S_IFREG;
+    if ((i_number <= 0) || (i_number >= MAX_NUM_INODE))
+        return S_IFDIR;     // ".." is reported without i_number.
+    struct inode* cur_inode;
+    get_inode_from_inum(cur_inode, i_number);
+    return (cur_inode->mode == MODE_DIR) ? S_IFDIR : S_IFREG;
+}
+
+/** List the entries of a directory, starting after a given offset.
+ * Entry offsets are stable positions: 1 for ".", 2 for "..", and 3 + (slot index) for
+ * the slots of directory blocks, so a listing can be resumed from any returned offset.
+ * @param  i_number: i_number of the directory.
+ * @param  offset: offset returned with the last entry already consumed (0 to start over).
+ * @param  visit: callback for each entry; returns true to stop (e.g. when a buffer is full).
+ * @param  ctx: opaque argument passed to the callback.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int read_directory(int i_number, off_t offset, dir_visitor_t visit, void* ctx) {
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(i_number));
+    /* This will be automatically released on each exit path. */
 
     inode* block_inode; inode* head_inode;
-    get_inode_from_inum(head_inode, fi->fh);
+    get_inode_from_inum(head_inode, i_number);
+    if (head_inode->mode != MODE_DIR) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Inode #%d is not a directory.\n", i_number);
+        return -ENOTDIR;
+    }
     if (!verify_permission(PERM_READ, head_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to read.\n");
         return -EACCES;
     }
 
+    if ((offset < 1) && visit(ctx, ".", i_number, 1))
+        return 0;
+    if ((offset < 2) && visit(ctx, "..", 0, 2))
+        return 0;
+
+    // Hashed directories are visited in hash order (offset = 3 + hash of the next entry).
+    bool hashed = is_hashed_dir(head_inode);
+    bool accessed = hashed, stopped = hashed && hashed_dir_iterate(head_inode, offset, visit, ctx);
+
     block_inode = head_inode;
-    bool accessed = false;
-    while (1) {
-        for (int i = 0; i < NUM_INODE_DIRECT; ++i) {
+    off_t slot_base = 3;
+    while (!hashed && !stopped) {
+        for (int i = 0; i < NUM_INODE_DIRECT && !stopped; ++i, slot_base += MAX_DIR_ENTRIES) {
             if (block_inode->direct[i] == -1)
                 continue;
-            directory block_dir;
-            get_block(&block_dir, block_inode->direct[i]);
+            if (slot_base + MAX_DIR_ENTRIES <= offset)
+                continue;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[i]);
+            const dir_entry* block_dir = (const dir_entry*) ref.data;
             accessed = true;
             for (int j = 0; j < MAX_DIR_ENTRIES; ++j) {
-                if (block_dir[j].i_number == 0)
+                if ((block_dir[j].i_number == 0) || (slot_base + j < offset))
                     continue;
-                filler(buf, block_dir[j].filename, NULL, 0, (fuse_fill_dir_flags) 0);
+                if (visit(ctx, block_dir[j].filename, block_dir[j].i_number, slot_base + j + 1)) {
+                    stopped = true;
+                    break;
+                }
             }
+            release_block(ref);
         }
         if (block_inode->next_indirect == 0)
             break;
@@ -111,6 +225,11 @@ int o_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
         }
         struct timespec cur_time;
         clock_gettime(CLOCK_REALTIME, &cur_time);
+        guard.unlock();
+        std::lock_guard <std::shared_mutex> atime_guard(inode_lock(i_number));
+        // The directory may have been removed while no lock was held.
+        if (!is_live_inode(i_number) || (head_inode->mode != MODE_DIR) || !atime_needs_update(head_inode, cur_time))
+            return 0;
         update_atime(head_inode, cur_time);
         new_inode_block(head_inode);
     }
@@ -128,8 +247,56 @@ int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int
     struct timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
 
-    bool rec_avail_for_ins = false, accessed = false, firblk = true, afi_firblk, tail_firblk;
-    inode* avail_for_ins; inode* tail_inode;
+    if (is_hashed_dir(head_inode)) {
+        int flag = hashed_dir_insert(head_inode, new_name, new_inum);
+        if (flag != 0)
+            return flag;
+        if (FUNC_ATIME_DIR)
+            update_atime(head_inode, cur_time);
+        if (FUNC_TIMESTAMPS)
+            head_inode->mtime = head_inode->ctime = cur_time;
+        new_inode_block(head_inode);
+        return 0;
+    }
+    if (strlen(new_name) >= MAX_FILENAME_LEN)
+        return -ENAMETOOLONG;
+
+    // With the directory index, a free slot is found without reading any directory block.
+    bool scan_blocks = true;
+    if (USE_DIR_INDEX) {
+        dir_slot slot;
+        if (dir_index_take_free_slot(head_inode, slot)) {
+            get_inode_from_inum(block_inode, slot.block_inum);
+            directory block_dir;
+            get_block(block_dir, block_inode->direct[slot.direct_index]);
+            block_dir[slot.slot].i_number = new_inum;
+            memcpy(block_dir[slot.slot].filename, new_name, strlen(new_name) * sizeof(char));
+            file_rewrite(block_inode, slot.direct_index, &block_dir);
+
+            if (block_inode == head_inode) {
+                if (FUNC_ATIME_DIR)
+                    update_atime(block_inode, cur_time);
+
+                if (FUNC_TIMESTAMPS)
+                    block_inode->mtime = block_inode->ctime = cur_time;
+            } else if (FUNC_TIMESTAMPS) {
+                if (FUNC_ATIME_DIR)
+                    update_atime(head_inode, cur_time);
+
+                head_inode->mtime = head_inode->ctime = cur_time;
+                new_inode_block(head_inode);
+            }
+            new_inode_block(block_inode);
+
+            slot.i_number = new_inum;
+            dir_index_insert(head_inode->i_number, new_name, slot);
+            return 0;
+        }
+        scan_blocks = false;    // All existing directory blocks are full.
+    }
+
+    bool rec_avail_for_ins = false, accessed = false, firblk = true, afi_firblk = false, tail_firblk = false;
+    inode* avail_for_ins = NULL; inode* tail_inode = head_inode;
     while (1) {
         for (int i = 0; i < NUM_INODE_DIRECT; ++i) {
             if (block_inode->direct[i] == -1) {
@@ -140,33 +307,44 @@ int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int
                 }
                 continue;
             }
-            directory block_dir;
-            get_block(&block_dir, block_inode->direct[i]);
-            accessed = true;
+            if (!scan_blocks)
+                continue;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[i]);
+            int free_slot = -1;
             for (int j = 0; j < MAX_DIR_ENTRIES; ++j)
-                if (block_dir[j].i_number == 0) {
-                    block_dir[j].i_number = new_inum;
-                    memcpy(block_dir[j].filename, new_name, strlen(new_name) * sizeof(char));
-                    new_data_block(&block_dir, block_inode, i);
+                if (((const dir_entry*) ref.data)[j].i_number == 0) {
+                    free_slot = j;
+                    break;
+                }
+            accessed = true;
+            if (free_slot >= 0) {
+                directory block_dir;    // Only copy the block if it is modified.
+                memcpy(block_dir, ref.data, BLOCK_SIZE);
+                release_block(ref);
+                block_dir[free_slot].i_number = new_inum;
+                memcpy(block_dir[free_slot].filename, new_name, strlen(new_name) * sizeof(char));
+                file_rewrite(block_inode, i, &block_dir);
+                
+                if (firblk) {
+                    if (FUNC_ATIME_DIR)
+                        update_atime(block_inode, cur_time);
                     
-                    if (firblk) {
+                    if (FUNC_TIMESTAMPS)
+                        block_inode->mtime = block_inode->ctime = cur_time;
+                } else {
+                    if (FUNC_TIMESTAMPS) {
                         if (FUNC_ATIME_DIR)
-                            update_atime(block_inode, cur_time);
+                            update_atime(head_inode, cur_time);
                         
-                        if (FUNC_TIMESTAMPS)
-                            block_inode->mtime = block_inode->ctime = cur_time;
-                    } else {
-                        if (FUNC_TIMESTAMPS) {
-                            if (FUNC_ATIME_DIR)
-                                update_atime(head_inode, cur_time);
-                            
-                            head_inode->mtime = head_inode->ctime = cur_time;
-                            new_inode_block(head_inode);
-                        }
+                        head_inode->mtime = head_inode->ctime = cur_time;
+                        new_inode_block(head_inode);
                     }
-                    new_inode_block(block_inode);
-                    return 0;
                 }
+                new_inode_block(block_inode);
+                return 0;
+            }
+            release_block(ref);
         }
         tail_inode = block_inode;
         tail_firblk = firblk;
@@ -202,6 +380,7 @@ int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int
                     }
                 }
                 new_inode_block(avail_for_ins);
+                dir_index_add_block(head_inode->i_number, avail_for_ins->i_number, i, new_name, new_inum);
                 return 0;
             }
     }
@@ -211,6 +390,7 @@ int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int
     new_data_block(&block_dir, append_inode, 0);
     append_inode->num_direct = 1;
     new_inode_block(append_inode);
+    dir_index_add_block(head_inode->i_number, append_inode->i_number, 0, new_name, new_inum);
     tail_inode->next_indirect = append_inode->i_number;
     if (FUNC_TIMESTAMPS) {
         if (tail_firblk)
@@ -230,21 +410,40 @@ int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int
  * @return bool: whether the removal is successful.
  * [CAUTION] block_inode may be modified as the search procedure advances. */
 bool remove_parent_dir_entry(struct inode* block_inode, int del_inum)  {
+    if (is_hashed_dir(block_inode)) {
+        // Find the name of the entry first.
+        std::pair<int, std::string> target(del_inum, "");
+        hashed_dir_iterate(block_inode, 0, [](void* ctx, const char* name, int i_number, off_t) {
+            auto target = (std::pair<int, std::string>*) ctx;
+            if (i_number != target->first)
+                return false;
+            target->second = name;
+            return true;
+        }, &target);
+        return !target.second.empty() && remove_parent_dir_entry(block_inode, del_inum, target.second.c_str());
+    }
+
+    int dir_inum = block_inode->i_number;
     bool find = false;
     directory block_dir;
     while (true) {
         for (int i = 0; i < NUM_INODE_DIRECT; i++) {
             if (block_inode->direct[i] != -1) {
-                get_block(block_dir, block_inode->direct[i]);
+                block_ref ref;
+                acquire_block(ref, block_inode->direct[i]);
+                const dir_entry* scan_dir = (const dir_entry*) ref.data;
                 for (int j = 0; j < MAX_DIR_ENTRIES; j++)
-                    if (block_dir[j].i_number == del_inum) {
+                    if (scan_dir[j].i_number == del_inum) {
                         find = true;
+                        dir_index_erase(dir_inum, scan_dir[j].filename, true);
+                        memcpy(block_dir, ref.data, BLOCK_SIZE);
                         block_dir[j].i_number = 0;
                         memset(block_dir[j].filename, 0, sizeof(block_dir[j].filename));
                         break;
                     }
+                release_block(ref);
                 if (find == true) {
-                    file_modify(block_inode, i, block_dir);
+                    file_rewrite(block_inode, i, block_dir);
                     break;
                 }
             }
@@ -266,21 +465,49 @@ bool remove_parent_dir_entry(struct inode* block_inode, int del_inum)  {
  * @return bool: whether the removal is successful.
  * [CAUTION] block_inode may be modified as the search procedure advances. */
 bool remove_parent_dir_entry(struct inode* block_inode, int del_inum, const char* del_name)  {
+    if (is_hashed_dir(block_inode)) {
+        bool find = hashed_dir_remove(block_inode, del_name, del_inum);
+        if (find)
+            new_inode_block(block_inode);
+        return find;
+    }
+
+    if (USE_DIR_INDEX) {
+        int dir_inum = block_inode->i_number;
+        dir_slot slot;
+        if (!dir_index_lookup(block_inode, del_name, slot) || (slot.i_number != del_inum))
+            return false;
+
+        get_inode_from_inum(block_inode, slot.block_inum);
+        directory block_dir;
+        get_block(block_dir, block_inode->direct[slot.direct_index]);
+        block_dir[slot.slot].i_number = 0;
+        memset(block_dir[slot.slot].filename, 0, sizeof(block_dir[slot.slot].filename));
+        file_rewrite(block_inode, slot.direct_index, block_dir);
+        new_inode_block(block_inode);
+        dir_index_erase(dir_inum, del_name, true);
+        return true;
+    }
+
     bool find = false;
     directory block_dir;
     while (true) {
         for (int i = 0; i < NUM_INODE_DIRECT; i++) {
             if (block_inode->direct[i] != -1) {
-                get_block(block_dir, block_inode->direct[i]);
+                block_ref ref;
+                acquire_block(ref, block_inode->direct[i]);
+                const dir_entry* scan_dir = (const dir_entry*) ref.data;
                 for (int j = 0; j < MAX_DIR_ENTRIES; j++)
-                    if (block_dir[j].i_number == del_inum && !strcmp(del_name, block_dir[j].filename)) {
+                    if (scan_dir[j].i_number == del_inum && !strcmp(del_name, scan_dir[j].filename)) {
                         find = true;
+                        memcpy(block_dir, ref.data, BLOCK_SIZE);
                         block_dir[j].i_number = 0;
                         memset(block_dir[j].filename, 0, sizeof(block_dir[j].filename));
                         break;
                     }
+                release_block(ref);
                 if (find == true) {
-                    file_modify(block_inode, i, block_dir);
+                    file_rewrite(block_inode, i, block_dir);
                     break;
                 }
             }
@@ -295,10 +522,96 @@ bool remove_parent_dir_entry(struct inode* block_inode, int del_inum, const char
     return find;
 }
 
+/** Point an existing entry of a directory at another inode, in place (e.g. for renames).
+ * @param  head_inode: first i_node of the directory.
+ * @param  name: name of the entry.
+ * @param  old_inum: i_number the entry should currently refer to.
+ * @param  new_inum: i_number the entry refers to afterwards.
+ * @return bool: whether the entry is found (and replaced).
+ * [CAUTION] The caller commits head_inode (new_inode_block), e.g. after updating timestamps. */
+bool replace_parent_dir_entry(struct inode* head_inode, const char* name, int old_inum, int new_inum) {
+    if (is_hashed_dir(head_inode))
+        return hashed_dir_replace(head_inode, name, old_inum, new_inum);
+
+    if (USE_DIR_INDEX) {
+        dir_slot slot;
+        if (!dir_index_lookup(head_inode, name, slot) || (slot.i_number != old_inum))
+            return false;
+
+        inode* block_inode;
+        get_inode_from_inum(block_inode, slot.block_inum);
+        directory block_dir;
+        get_block(block_dir, block_inode->direct[slot.direct_index]);
+        block_dir[slot.slot].i_number = new_inum;
+        file_rewrite(block_inode, slot.direct_index, block_dir);
+        if (block_inode != head_inode)
+            new_inode_block(block_inode);
+
+        slot.i_number = new_inum;
+        dir_index_insert(head_inode->i_number, name, slot);
+        return true;
+    }
+
+    inode* block_inode = head_inode;
+    while (true) {
+        for (int i = 0; i < NUM_INODE_DIRECT; i++) {
+            if (block_inode->direct[i] == -1)
+                continue;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[i]);
+            int match = -1;
+            for (int j = 0; j < MAX_DIR_ENTRIES; j++) {
+                const dir_entry &entry = ((const dir_entry*) ref.data)[j];
+                if ((entry.i_number == old_inum) && !strcmp(entry.filename, name)) {
+                    match = j;
+                    break;
+                }
+            }
+            if (match >= 0) {
+                directory block_dir;
+                memcpy(block_dir, ref.data, BLOCK_SIZE);
+                release_block(ref);
+                block_dir[match].i_number = new_inum;
+                file_rewrite(block_inode, i, block_dir);
+                if (block_inode != head_inode)
+                    new_inode_block(block_inode);
+                return true;
+            }
+            release_block(ref);
+        }
+        if (block_inode->next_indirect == 0)
+            return false;
+        get_inode_from_inum(block_inode, block_inode->next_indirect);
+    }
+}
+
+
 int o_mkdir(const char* path, mode_t mode) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "MKDIR, %s, %o\n", resolve_prefix(path).c_str(), mode);
-    
+
+    metric_timer timer(OP_MKDIR);
+
+    int par_inum;
+    std::string dirname;
+    int locate_err = locate_parent(path, par_inum, dirname);
+    if (locate_err != 0) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Cannot open the parent directory of %s (error #%d).\n", path, locate_err);
+        return locate_err;
+    }
+
+    int new_inum;
+    return make_directory(par_inum, dirname.c_str(), mode, new_inum);
+}
+
+/** Create a new (empty) directory.
+ * @param  par_inum: i_number of the parent directory.
+ * @param  name: name of the new directory.
+ * @param  mode: permission of the new directory.
+ * @param  new_inum: return variable (i_number of the new directory).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int make_directory(int par_inum, const char* name, mode_t mode, int &new_inum) {
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
         logger(WARN, "====> Cannot proceed to create a new directory.\n");
@@ -306,80 +619,233 @@ int o_mkdir(const char* path, mode_t mode) {
     }
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
 
     mode &= 0777;
 
-    std::string tmp = relative_to_absolute(path, "../", 0);
-    char* parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(parent_dir, tmp.c_str());
-
-    tmp = current_fname(path);
-    char* dirname = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(dirname, tmp.c_str());
+    /* The inode-level fine-grained lock is added by a lock_guard. */
+    std::lock_guard <std::shared_mutex> guard(inode_lock(par_inum));
+    /* This will be automatically released on each exit path. */
 
-    if (strlen(dirname) >= MAX_FILENAME_LEN) {
-        if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] Directory name too long: length %d > %d.\n", strlen(dirname), MAX_FILENAME_LEN);
-        free(parent_dir); free(dirname);
-        return -ENAMETOOLONG;
-    }
-    int par_inum;
-    int locate_err = locate(parent_dir, par_inum);
-    if (locate_err != 0) {
-        if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] Cannot open the parent directory of %s (error #%d).\n", path, locate_err);
-        free(parent_dir); free(dirname);
-        return locate_err;
-    }
-    
     inode* head_inode;
     get_inode_from_inum(head_inode, par_inum);
     if (!verify_permission(PERM_WRITE, head_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
-        free(parent_dir); free(dirname);
         return -EACCES;
     }
 
     if (head_inode->mode != MODE_DIR) {
         if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] %s is not a directory.\n", parent_dir);
-        free(parent_dir); free(dirname);
+            logger(ERROR, "[ERROR] Inode #%d is not a directory.\n", par_inum);
         return -ENOTDIR;
     }
+    if (head_inode->num_links == 0) {   // Removed, but still referenced (see reclaim.h).
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Directory #%d is removed.\n", par_inum);
+        return -ENOENT;
+    }
+
+    if (strlen(name) >= max_name_length(head_inode)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Directory name too long: length %d > %d.\n", strlen(name), max_name_length(head_inode));
+        return -ENAMETOOLONG;
+    }
 
     int tmp_inum;
-    locate_err = locate(path, tmp_inum);
-    if (locate_err == 0) {
+    if (search_directory(head_inode, name, tmp_inum)) {
         inode* tmp_inode;
         get_inode_from_inum(tmp_inode, tmp_inum);
         if ((tmp_inode->mode == MODE_FILE) && ERROR_DIRECTORY)
             logger(ERROR, "[ERROR] Duplicated name: there exists a file with the same name.\n");
         if ((tmp_inode->mode == MODE_DIR) && ERROR_DIRECTORY)
             logger(ERROR, "[ERROR] Duplicated name: there exists a directory with the same name.\n");
-        free(parent_dir); free(dirname);
         return -EEXIST;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[par_inum]);
-    /* This will be automatically released on each exit path. */
+    inode* dir_inode = NULL;
+    file_initialize(dir_inode, MODE_DIR, mode);
+    if (dir_inode == NULL)      // No free i_number left.
+        return -ENOSPC;
+    new_inum = dir_inode->i_number;
+    if (USE_HASHED_DIR)
+        hashed_dir_init(dir_inode);
+
+    // The inode is written only once its entry exists: otherwise, it is dropped unreferenced.
+    int flag = append_parent_dir_entry(head_inode, name, dir_inode->i_number);
+    if (flag != 0) {
+        remove_inode(dir_inode->i_number);
+        return flag;
+    }
+    new_inode_block(dir_inode);
+    return 0;
+}
 
-    if (!verify_permission(PERM_WRITE, head_inode, user_info, ENABLE_PERMISSION)) {
-        if (ERROR_PERM)
-            logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
-        free(parent_dir); free(dirname);
-        return -EACCES;
+/** Check whether a directory has no entries (in either directory format). */
+bool directory_is_empty(struct inode* head_inode) {
+    if (is_hashed_dir(head_inode))
+        return !hashed_dir_iterate(head_inode, 0, [](void*, const char*, int, off_t) { return true; }, NULL);
+
+    struct inode* block_inode = head_inode;
+    while (1) {
+        for (int l = 0; l < NUM_INODE_DIRECT; ++l) {
+            if (block_inode->direct[l] == -1)
+                continue;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[l]);
+            bool empty = true;
+            for (int s = 0; s < MAX_DIR_ENTRIES; ++s)
+                empty &= (((const dir_entry*) ref.data)[s].i_number == 0);
+            release_block(ref);
+            if (!empty)
+                return false;
+        }
+        if (block_inode->next_indirect == 0)
+            break;
+        get_inode_from_inum(block_inode, block_inode->next_indirect);
     }
+    return true;
+}
 
-    inode* dir_inode;
-    file_initialize(dir_inode, MODE_DIR, mode);
-    new_inode_block(dir_inode);
+/** Verify that the object of a directory entry can be removed (before the entry itself is removed).
+ * @param  del_inum: i_number of the object.
+ * @param  del_mode: whether to delete a file-link (MODE_FILE) or a directory (MODE_DIR).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int check_removable(int del_inum, const char* del_name, int del_mode, struct timespec cur_time) {
+    inode* tmp_head_inode;
+    get_inode_from_inum(tmp_head_inode, del_inum);
 
-    int flag = append_parent_dir_entry(head_inode, dirname, dir_inode->i_number);
-    free(parent_dir); free(dirname);
-    return flag;
+    // Verify del_name refers to an expected type of object.
+    if ((del_mode == MODE_DIR) && (tmp_head_inode->mode != MODE_DIR)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] %s is not a directory.\n", del_name);
+        return -ENOTDIR;
+    } else if ((del_mode == MODE_FILE) && (tmp_head_inode->mode != MODE_FILE)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] %s is not a file.\n", del_name);
+        return -EISDIR;
+    }
+
+    // Ensure empty directories: "rmdir" only works for empty directories.
+    if ((del_mode == MODE_DIR) && !directory_is_empty(tmp_head_inode)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Directory %s is not empty.\n", del_name);
+        if (FUNC_ATIME_DIR && FUNC_TIMESTAMPS) {
+            update_atime(tmp_head_inode, cur_time);
+            new_inode_block(tmp_head_inode);
+        }
+        return -ENOTEMPTY;
+    }
+    return 0;
+}
+
+/** Drop a link of an object, once its directory entry is removed (see check_removable()).
+ * The last link of a file (or a directory) releases the object: it is freed as soon as no
+ * reference (kernel lookup or open handle) remains, see release_unlinked().
+ * @param  del_inum: i_number of the object. */
+void release_object(int del_inum, struct timespec cur_time) {
+    inode* tmp_head_inode;
+    get_inode_from_inum(tmp_head_inode, del_inum);
+    if (FUNC_TIMESTAMPS)
+        tmp_head_inode->ctime = cur_time;
+    if ((tmp_head_inode->mode == MODE_DIR) || (tmp_head_inode->num_links <= 1)) {
+        release_unlinked(tmp_head_inode);
+    } else {
+        tmp_head_inode->num_links--;
+        new_inode_block(tmp_head_inode);
+    }
+
+    // The object may still be cached by the kernel (through other links or open files).
+    notify_inode(del_inum);
+}
+
+/** Remove an object whose entry is found in a directory block (helper of remove_object()).
+ * The entry is removed before the object is released, so that no entry ever refers to a freed object.
+ * @param  head_inode: first i_node of the parent directory.
+ * @param  block_inode: i_node (head or indirect) holding the directory block in direct[i].
+ * @param  block_dir: copy of the directory block, whose entry block_dir[match] is removed.
+ * @param  tail_inode: predecessor of block_inode in the chain of the parent directory.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int remove_object_at(struct inode* head_inode, struct inode* block_inode, int i, struct dir_entry* block_dir, int match,
+                     struct inode* tail_inode, const char* del_name, int del_mode, struct timespec cur_time) {
+    int del_inum = block_dir[match].i_number;
+    int flag = check_removable(del_inum, del_name, del_mode, cur_time);
+    if (flag != 0)
+        return flag;
+
+    // Remove parent directory entry: discard empty inodes.
+    int cnt = 0;
+    for (int k = 0; k < MAX_DIR_ENTRIES; ++k)
+        cnt += (block_dir[k].i_number != 0);
+    if (cnt == 1) {
+        dir_index_erase(head_inode->i_number, del_name, false);
+        dir_index_drop_block(head_inode->i_number, block_inode->i_number, i);
+        if (block_inode->num_direct != 1 || block_inode->mode == MODE_DIR) {
+            --block_inode->num_direct;
+            block_inode->direct[i] = -1;
+            if (block_inode == head_inode) {
+                if (FUNC_ATIME_DIR)
+                    update_atime(block_inode, cur_time);
+                
+                if (FUNC_TIMESTAMPS)
+                    block_inode->mtime = block_inode->ctime = cur_time;
+            } else {
+                if (FUNC_TIMESTAMPS) {
+                    if (FUNC_ATIME_DIR)
+                        update_atime(head_inode, cur_time);
+                    
+                    
+                    head_inode->mtime = head_inode->ctime = cur_time;
+                    new_inode_block(head_inode);
+                }
+            }
+            new_inode_block(block_inode);
+        } else {
+            int del_inode_number = tail_inode->next_indirect;
+            tail_inode->next_indirect = block_inode->next_indirect;
+            remove_inode(del_inode_number);
+            if (tail_inode == head_inode) {
+                if (FUNC_ATIME_DIR)
+                    update_atime(tail_inode, cur_time);
+                
+                if (FUNC_TIMESTAMPS)
+                    tail_inode->mtime = tail_inode->ctime = cur_time;
+            } else {
+                if (FUNC_TIMESTAMPS) {
+                    if (FUNC_ATIME_DIR)
+                        update_atime(head_inode, cur_time);
+                    
+                    head_inode->mtime = head_inode->ctime = cur_time;
+                    new_inode_block(head_inode);
+                }
+            }
+            new_inode_block(tail_inode);
+        }
+    } else {
+        block_dir[match].i_number = 0;
+        memset(block_dir[match].filename, 0, sizeof(block_dir[match].filename));
+        file_rewrite(block_inode, i, block_dir);
+        dir_index_erase(head_inode->i_number, del_name, true);
+
+        if (block_inode == head_inode) {
+            if (FUNC_ATIME_DIR)
+                update_atime(block_inode, cur_time);
+            
+            if (FUNC_TIMESTAMPS)
+                block_inode->mtime = block_inode->ctime = cur_time;
+        } else {
+            if (FUNC_TIMESTAMPS) {
+                if (FUNC_ATIME_DIR)
+                    update_atime(head_inode, cur_time);
+                
+                head_inode->mtime = head_inode->ctime = cur_time;
+                new_inode_block(head_inode);
+            }
+        }
+        new_inode_block(block_inode);
+    }
+    release_object(del_inum, cur_time);
+    return 0;
 }
 
 /** Remove a file / directory from LFS, and the corresponding entry in its parent directory.
@@ -393,148 +859,68 @@ int remove_object(struct inode* head_inode, const char* del_name, int del_mode)
     struct timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
 
-    bool accessed = false, firblk = true, tail_firblk;
-    inode* tail_inode;
-    while (1) {
+    bool hashed = is_hashed_dir(head_inode);
+    if (hashed) {
+        int del_inum;
+        if (hashed_dir_lookup(head_inode, del_name, del_inum)) {
+            int flag = check_removable(del_inum, del_name, del_mode, cur_time);
+            if (flag != 0)
+                return flag;
+            if (!hashed_dir_remove(head_inode, del_name, del_inum))
+                return -EIO;
+            if (FUNC_ATIME_DIR)
+                update_atime(head_inode, cur_time);
+            if (FUNC_TIMESTAMPS)
+                head_inode->mtime = head_inode->ctime = cur_time;
+            new_inode_block(head_inode);
+            release_object(del_inum, cur_time);
+            return 0;
+        }
+    } else if (USE_DIR_INDEX) {
+        dir_slot slot;
+        if (dir_index_lookup(head_inode, del_name, slot)) {
+            // Locate the block and its predecessor in the inode chain (no other block is read).
+            inode* tail_inode = head_inode;
+            get_inode_from_inum(block_inode, slot.block_inum);
+            while ((tail_inode->next_indirect != 0) && (tail_inode->next_indirect != slot.block_inum))
+                get_inode_from_inum(tail_inode, tail_inode->next_indirect);
+
+            directory block_dir;
+            get_block(block_dir, block_inode->direct[slot.direct_index]);
+            return remove_object_at(head_inode, block_inode, slot.direct_index, block_dir, slot.slot,
+                                    tail_inode, del_name, del_mode, cur_time);
+        }
+    }
+
+    // Without the directory index, scan all directory blocks.
+    bool scan_blocks = !hashed && !USE_DIR_INDEX;
+    bool accessed = !scan_blocks;
+    inode* tail_inode = NULL;
+    while (scan_blocks) {
         for (int i = 0; i < NUM_INODE_DIRECT; ++i) {
             if (block_inode->direct[i] == -1)
                 continue;
-            directory block_dir;
-            get_block(&block_dir, block_inode->direct[i]);
-            accessed = true;
-            for (int j = 0; j < MAX_DIR_ENTRIES; ++j)
-                if (block_dir[j].i_number && !strcmp(block_dir[j].filename, del_name)) {
-                    inode* tmp_inode; inode* tmp_head_inode;
-                    get_inode_from_inum(tmp_head_inode, block_dir[j].i_number);
-
-                    // Verify del_name refers to an expected type of object.
-                    if ((del_mode == MODE_DIR) && (tmp_head_inode->mode != MODE_DIR)) {
-                        if (ERROR_DIRECTORY)
-                            logger(ERROR, "[ERROR] %s is not a directory.\n", del_name);
-                        return -ENOTDIR;
-                    } else if ((del_mode == MODE_FILE) && (tmp_head_inode->mode != MODE_FILE)) {
-                        if (ERROR_FILE)
-                            logger(ERROR, "[ERROR] %s is not a file.\n", del_name);
-                        return -EISDIR;
-                    }
-
-                    // Ensure empty directories: "rmdir" only works for empty directories.
-                    if (del_mode == MODE_DIR) {
-                        tmp_inode = tmp_head_inode;
-                        while (1) {
-                            for (int l = 0; l < NUM_INODE_DIRECT; ++l) {
-                                if (tmp_inode->direct[l] == -1)
-                                    continue;
-                                directory tmp_dir;
-                                get_block(&tmp_dir, tmp_inode->direct[l]);
-                                for (int s = 0; s < MAX_DIR_ENTRIES; ++s)
-                                    if (tmp_dir[s].i_number != 0) {
-                                        if (ERROR_DIRECTORY)
-                                            logger(ERROR, "[ERROR] Directory %s is not empty.\n", del_name);
-                                        if (FUNC_ATIME_DIR && FUNC_TIMESTAMPS) {
-                                            update_atime(tmp_head_inode, cur_time);
-                                            new_inode_block(tmp_head_inode);
-                                        }
-                                        return -ENOTEMPTY;
-                                    }
-                            }
-                            if (tmp_inode->next_indirect == 0)
-                                break;
-                            get_inode_from_inum(tmp_inode, tmp_inode->next_indirect);
-                        }
-                    }
-
-                    // Remove file (with only 1 hard link) / directory.
-                    if (del_mode == MODE_DIR || tmp_head_inode->num_links == 1) {
-                        struct inode* cur_inode;
-                        int cur_inum = block_dir[j].i_number;
-                        do {
-                            get_inode_from_inum(cur_inode, cur_inum);
-                            int next_inum = cur_inode->next_indirect;
-                            remove_inode(cur_inum);
-                            cur_inum = next_inum;
-                        } while (cur_inum != 0);
-                    } else {
-                        tmp_head_inode->num_links--;
-                        if (FUNC_TIMESTAMPS)
-                            tmp_head_inode->ctime = cur_time;
-                        new_inode_block(tmp_head_inode);
-                    }
-
-                    // Remove parent directory entry: discard empty inodes.
-                    int cnt = 0;
-                    for (int k = 0; k < MAX_DIR_ENTRIES; ++k)
-                        cnt += (block_dir[k].i_number != 0);
-                    if (cnt == 1) {
-                        if (block_inode->num_direct != 1 || block_inode->mode == MODE_DIR) {
-                            --block_inode->num_direct;
-                            block_inode->direct[i] = -1;
-                            if (firblk) {
-                                if (FUNC_ATIME_DIR)
-                                    update_atime(block_inode, cur_time);
-                                
-                                if (FUNC_TIMESTAMPS)
-                                    block_inode->mtime = block_inode->ctime = cur_time;
-                            } else {
-                                if (FUNC_TIMESTAMPS) {
-                                    if (FUNC_ATIME_DIR)
-                                        update_atime(head_inode, cur_time);
-                                    
-                                    
-                                    head_inode->mtime = head_inode->ctime = cur_time;
-                                    new_inode_block(head_inode);
-                                }
-                            }
-                            new_inode_block(block_inode);
-                        } else {
-                            int del_inode_number = tail_inode->next_indirect;
-                            tail_inode->next_indirect = block_inode->next_indirect;
-                            remove_inode(del_inode_number);
-                            if (tail_firblk) {
-                                if (FUNC_ATIME_DIR)
-                                    update_atime(tail_inode, cur_time);
-                                
-                                if (FUNC_TIMESTAMPS)
-                                    tail_inode->mtime = tail_inode->ctime = cur_time;
-                            } else {
-                                if (FUNC_TIMESTAMPS) {
-                                    if (FUNC_ATIME_DIR)
-                                        update_atime(head_inode, cur_time);
-                                    
-                                    head_inode->mtime = head_inode->ctime = cur_time;
-                                    new_inode_block(head_inode);
-                                }
-                            }
-                            new_inode_block(tail_inode);
-                        }
-                    } else {
-                        block_dir[j].i_number = 0;
-                        memset(block_dir[j].filename, 0, sizeof(block_dir[j].filename));
-                        new_data_block(&block_dir, block_inode, i);
-
-                        if (firblk) {
-                            if (FUNC_ATIME_DIR)
-                                update_atime(block_inode, cur_time);
-                            
-                            if (FUNC_TIMESTAMPS)
-                                block_inode->mtime = block_inode->ctime = cur_time;
-                        } else {
-                            if (FUNC_TIMESTAMPS) {
-                                if (FUNC_ATIME_DIR)
-                                    update_atime(head_inode, cur_time);
-                                
-                                head_inode->mtime = head_inode->ctime = cur_time;
-                                new_inode_block(head_inode);
-                            }
-                        }
-                        new_inode_block(block_inode);
-                    }
-                    return 0;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[i]);
+            int match = -1;
+            for (int j = 0; j < MAX_DIR_ENTRIES; ++j) {
+                const dir_entry &entry = ((const dir_entry*) ref.data)[j];
+                if (entry.i_number && !strcmp(entry.filename, del_name)) {
+                    match = j;
+                    break;
                 }
+            }
+            accessed = true;
+            if (match >= 0) {
+                directory block_dir;    // Only copy the block if it is modified.
+                memcpy(block_dir, ref.data, BLOCK_SIZE);
+                release_block(ref);
+                return remove_object_at(head_inode, block_inode, i, block_dir, match,
+                                        tail_inode, del_name, del_mode, cur_time);
+            }
+            release_block(ref);
         }
         tail_inode = block_inode;
-        tail_firblk = firblk;
-        firblk = false;
         if (block_inode->next_indirect == 0)
             break;
         get_inode_from_inum(block_inode, block_inode->next_indirect);
@@ -555,80 +941,73 @@ int remove_object(struct inode* head_inode, const char* del_name, int del_mode)
 int o_rmdir(const char* path) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "RMDIR, %s\n", resolve_prefix(path).c_str());
-    
+
+    metric_timer timer(OP_RMDIR);
+
+    int par_inum;
+    std::string dirname;
+    int locate_err = locate_parent(path, par_inum, dirname);
+    if (locate_err != 0) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Cannot open the parent directory of %s (error #%d).\n", path, locate_err);
+        return locate_err;
+    }
+
+    return remove_directory(par_inum, dirname.c_str());
+}
+
+/** Remove an (empty) directory.
+ * @param  par_inum: i_number of the parent directory.
+ * @param  name: name of the directory.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int remove_directory(int par_inum, const char* name) {
     if (is_full) {
         if (next_imap_index == BLOCKS_IN_SEGMENT) {
             logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
             logger(WARN, "====> Cannot proceed to remove the directory.\n");
             return -ENOSPC;
         } else {
-            // The disk remains full is no more inode is available.
-            is_full = (count_inode >= MAX_NUM_INODE-1);
+            // The disk remains full is no more inode is available (or after a write error).
+            is_full = (count_inode >= MAX_NUM_INODE-1) || has_write_errors();
         }
     }
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
-
-    struct timespec cur_time;
-    clock_gettime(CLOCK_REALTIME, &cur_time);
-
-    std::string tmp = relative_to_absolute(path, "../", 0);
-    char* parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(parent_dir, tmp.c_str());
-
-    tmp = current_fname(path);
-    char* dirname = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(dirname, tmp.c_str());
+    struct fuse_context* user_info = get_caller_context();
 
-    int par_inum;
-    int locate_err = locate(parent_dir, par_inum);
-    if (locate_err != 0) {
-        if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] Cannot open the parent directory of %s (error #%d).\n", path, locate_err);
-        free(parent_dir); free(dirname);
-        return locate_err;
-    }
-
-    tmp = relative_to_absolute(path, "./", 0);
-    char* delete_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(delete_dir, tmp.c_str());
+    inode* head_inode;
+    get_inode_from_inum(head_inode, par_inum);
     int delete_inum;
-    locate_err = locate(delete_dir, delete_inum);
+    bool found = (head_inode->mode == MODE_DIR) && search_directory(head_inode, name, delete_inum);
 
     /* The inode-level fine-grained lock is added manually. */
     std::set <int> get_inodes;
     get_inodes.insert(par_inum);
-    get_inodes.insert(delete_inum);
-
-    for (auto it:get_inodes)
-        inode_lock[it].lock();
+    if (found)
+        get_inodes.insert(delete_inum);
 
+    acquire_inode_locks(get_inodes);
     /* This has to be manually released on each exit path. */
 
-    inode* head_inode;
     get_inode_from_inum(head_inode, par_inum);
     if (!verify_permission(PERM_WRITE, head_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
-        free(parent_dir); free(dirname);
         /* Manually release inode locks */
-        for (auto it:get_inodes) inode_lock[it].unlock();
+        release_inode_locks(get_inodes);
         return -EACCES;
     }
 
     if (head_inode->mode != MODE_DIR) {
         if (ERROR_DIRECTORY)
-            logger(ERROR, "[ERROR] %s is not a directory.\n", parent_dir);
-        free(parent_dir); free(dirname);
+            logger(ERROR, "[ERROR] Inode #%d is not a directory.\n", par_inum);
         /* Manually release inode locks */
-        for (auto it:get_inodes) inode_lock[it].unlock();
+        release_inode_locks(get_inodes);
         return -ENOTDIR;
     }
 
-    int flag = remove_object(head_inode, dirname, MODE_DIR);
-    free(parent_dir); free(dirname);
+    int flag = remove_object(head_inode, name, MODE_DIR);
     /* Manually release inode locks */
-    for (auto it:get_inodes) inode_lock[it].unlock();
+    release_inode_locks(get_inodes);
     return flag;
 }
@@ -3,6 +3,8 @@
 
 #include <fuse.h>
 #include <sys/stat.h>
+#include <string>
+#include <vector>
 
 int o_opendir(const char*, struct fuse_file_info*);
 int o_releasedir(const char*, struct fuse_file_info*);
@@ -10,10 +12,33 @@ int o_readdir(const char*, void*, fuse_fill_dir_t, off_t, struct fuse_file_info*
 int o_mkdir(const char*, mode_t);
 int o_rmdir(const char*);
 
+/** Directory visitor: receives each entry name, its i_number and the offset of the next entry.
+ * Returns true to stop the iteration. */
+typedef bool (*dir_visitor_t)(void* ctx, const char* name, int i_number, off_t next_offset);
+
+/** Directory entry collected by read_directory_batch(). */
+struct dir_batch_entry {
+    std::string name;
+    int i_number;
+    off_t next_offset;
+};
+const int READDIR_BATCH = 256;  // Entries collected at a time by the high-level readdir.
+
+// Inode-based implementations (shared by the high-level and low-level interfaces).
+int open_directory(int i_number);
+int read_directory(int i_number, off_t offset, dir_visitor_t visit, void* ctx);
+int read_directory_batch(int i_number, off_t offset, size_t max_entries, std::vector<struct dir_batch_entry> &entries);
+mode_t entry_type(int i_number);
+int make_directory(int par_inum, const char* name, mode_t mode, int &new_inum);
+int remove_directory(int par_inum, const char* name);
+
 // Universal utility functions for file and directory operations.
 int append_parent_dir_entry(struct inode* head_inode, const char* new_name, int new_inum);
 bool remove_parent_dir_entry(struct inode* block_inode, int del_inum);
 bool remove_parent_dir_entry(struct inode* block_inode, int del_inum, const char* del_name);
+bool replace_parent_dir_entry(struct inode* head_inode, const char* name, int old_inum, int new_inum);
+int check_removable(int del_inum, const char* del_name, int del_mode, struct timespec cur_time);
+void release_object(int del_inum, struct timespec cur_time);
 int remove_object(struct inode* head_inode, const char* del_name, int del_mode);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,613 @@
+#include "dirhash.h"
+
+#include "logger.h"
+#include "blockio.h"
+
+#include <string.h>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include <vector>
+
+/* Format of each directory, cached so that old-format directories do not read block 0 every time. */
+const char DIR_FORMAT_UNKNOWN   = 0;
+const char DIR_FORMAT_OLD       = 1;
+const char DIR_FORMAT_HASHED    = 2;
+std::atomic<char> dir_formats[MAX_NUM_INODE];
+
+
+/** Whether a directory is in the hashed format (otherwise, it is in the old directory[] format). */
+bool is_hashed_dir(struct inode* head_inode) {
+    if (head_inode->mode != MODE_DIR)
+        return false;
+    char format = dir_formats[head_inode->i_number].load();
+    if (format == DIR_FORMAT_UNKNOWN) {
+        format = DIR_FORMAT_OLD;
+        if (head_inode->direct[0] >= 0) {
+            block_ref ref;
+            acquire_block(ref, head_inode->direct[0]);
+            if (memcmp(ref.data, HTREE_MAGIC, sizeof(HTREE_MAGIC)) == 0)
+                format = DIR_FORMAT_HASHED;
+            release_block(ref);
+        }
+        dir_formats[head_inode->i_number].store(format);
+    }
+    return format == DIR_FORMAT_HASHED;
+}
+
+/** Forget the cached format of a directory (when it is removed). */
+void forget_dir_format(int i_number) {
+    dir_formats[i_number].store(DIR_FORMAT_UNKNOWN);
+}
+
+/** Forget the cached formats of all directories (on mount / unmount). */
+void clear_dir_formats() {
+    for (int i = 0; i < MAX_NUM_INODE; i++)
+        dir_formats[i].store(DIR_FORMAT_UNKNOWN);
+}
+
+/** Upper bound (exclusive) of the name length of entries in a directory. */
+int max_name_length(struct inode* head_inode) {
+    return is_hashed_dir(head_inode) ? MAX_NAME_LEN : MAX_FILENAME_LEN;
+}
+
+
+/** **************************************
+ * Hashes and records.
+ * ***************************************/
+/** Hash key of a name: the major hash (31 bits) orders the htree, the minor hash (31 bits) breaks ties.
+ * Keys are also used as (stable) readdir offsets. */
+unsigned long long name_hash(const char* name, int name_len) {
+    // FNV-1a, followed by a 64-bit finalizer (for well-mixed high bits).
+    unsigned long long h = 14695981039346656037ULL;
+    for (int i = 0; i < name_len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return ((h >> 33) << 32) | (h & 0x7fffffff);
+}
+
+inline unsigned int major_hash(unsigned long long key) {
+    return (unsigned int) (key >> 32);
+}
+
+inline int record_length(int name_len) {
+    return (sizeof(struct dir_record) + name_len + 3) & ~3;
+}
+
+inline const char* record_name(const struct dir_record* rec) {
+    return (const char*) (rec + 1);
+}
+
+inline unsigned long long record_hash(const struct dir_record* rec) {
+    return name_hash(record_name(rec), rec->name_len);
+}
+
+/** Find a record in a leaf.
+ * @param  del_inum: if positive, the record should also refer to this i_number.
+ * @return offset of the record within leaf->records, or -1 if there is none. */
+int find_record(const struct dir_leaf* leaf, const char* name, int name_len, int del_inum) {
+    for (int pos = 0; pos < leaf->used; ) {
+        const struct dir_record* rec = (const struct dir_record*) (leaf->records + pos);
+        if ((rec->name_len == name_len) && (memcmp(record_name(rec), name, name_len) == 0)
+            && ((del_inum <= 0) || (rec->i_number == del_inum)))
+            return pos;
+        pos += rec->rec_len;
+    }
+    return -1;
+}
+
+/** Write a record at a given position of a buffer. */
+void put_record(char* buf, const char* name, int name_len, int i_number) {
+    struct dir_record* rec = (struct dir_record*) buf;
+    memset(buf, 0, record_length(name_len));
+    rec->i_number = i_number;
+    rec->rec_len = record_length(name_len);
+    rec->name_len = name_len;
+    memcpy(buf + sizeof(struct dir_record), name, name_len);
+}
+
+/** Insert a record into a leaf (which has enough free space), keeping records in hash order. */
+void insert_record(struct dir_leaf* leaf, unsigned long long key, const char* name, int name_len, int i_number) {
+    int pos = 0;
+    while (pos < leaf->used) {
+        const struct dir_record* rec = (const struct dir_record*) (leaf->records + pos);
+        if (record_hash(rec) > key)
+            break;
+        pos += rec->rec_len;
+    }
+    int rec_len = record_length(name_len);
+    memmove(leaf->records + pos + rec_len, leaf->records + pos, leaf->used - pos);
+    put_record(leaf->records + pos, name, name_len, i_number);
+    leaf->used += rec_len;
+    leaf->count++;
+}
+
+/** Remove the record at a given offset of a leaf. */
+void remove_record(struct dir_leaf* leaf, int pos) {
+    int rec_len = ((const struct dir_record*) (leaf->records + pos))->rec_len;
+    memmove(leaf->records + pos, leaf->records + pos + rec_len, leaf->used - pos - rec_len);
+    leaf->used -= rec_len;
+    leaf->count--;
+    memset(leaf->records + leaf->used, 0, rec_len);
+}
+
+
+/** **************************************
+ * Logical blocks of a hashed directory.
+ * ***************************************/
+/** Locate a logical block of a directory.
+ * @param  block_inode: return variable (inode whose direct[] holds the block).
+ * @param  direct_index: return variable (index w.r.t. direct[] of block_inode).
+ * @return block address (-1 if the block does not exist). */
+int dir_block_addr(struct inode* head_inode, int lblock, struct inode* &block_inode, int &direct_index) {
+    block_inode = head_inode;
+    while (lblock >= NUM_INODE_DIRECT) {
+        if (block_inode->next_indirect == 0)
+            return -1;
+        get_inode_from_inum(block_inode, block_inode->next_indirect);
+        lblock -= NUM_INODE_DIRECT;
+    }
+    direct_index = lblock;
+    return block_inode->direct[lblock];
+}
+
+/** Acquire a reference to a logical block (returns false if the directory is corrupt). */
+bool acquire_dir_block(struct inode* head_inode, int lblock, struct block_ref &ref) {
+    struct inode* block_inode; int direct_index;
+    int block_addr = dir_block_addr(head_inode, lblock, block_inode, direct_index);
+    if ((block_addr < 0) || (block_addr >= TOT_SEGMENTS * BLOCKS_IN_SEGMENT)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Corrupt hashed directory #%d: invalid logical block %d.\n", head_inode->i_number, lblock);
+        return false;
+    }
+    acquire_block(ref, block_addr);
+    return true;
+}
+
+bool read_dir_block(struct inode* head_inode, int lblock, void* data) {
+    block_ref ref;
+    if (!acquire_dir_block(head_inode, lblock, ref))
+        return false;
+    memcpy(data, ref.data, BLOCK_SIZE);
+    release_block(ref);
+    return true;
+}
+
+/** Record a modified (non-head) inode, to be committed once at the end of the operation. */
+void mark_dir_inode(struct inode* head_inode, struct inode* block_inode, std::vector<struct inode*> &dirty) {
+    if ((block_inode != head_inode) && (std::find(dirty.begin(), dirty.end(), block_inode) == dirty.end()))
+        dirty.push_back(block_inode);
+}
+
+/** Write a logical block of a directory (its inode is recorded in dirty).
+ * @return flag: 0 on success, or -EIO if the directory is corrupt. */
+int write_dir_block(struct inode* head_inode, int lblock, void* data, std::vector<struct inode*> &dirty) {
+    struct inode* block_inode; int direct_index;
+    int block_addr = dir_block_addr(head_inode, lblock, block_inode, direct_index);
+    if (block_addr < 0) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Corrupt hashed directory #%d: invalid logical block %d.\n", head_inode->i_number, lblock);
+        return -EIO;
+    }
+    file_rewrite(block_inode, direct_index, data);
+    mark_dir_inode(head_inode, block_inode, dirty);
+    return 0;
+}
+
+/** Append a logical block to a directory.
+ * @return the new logical block, or -ENOSPC. */
+int append_dir_block(struct inode* head_inode, void* data, std::vector<struct inode*> &dirty) {
+    struct inode* tail_inode = head_inode;
+    while (tail_inode->next_indirect != 0)
+        get_inode_from_inum(tail_inode, tail_inode->next_indirect);
+
+    if (tail_inode->num_direct == NUM_INODE_DIRECT) {
+        struct inode* next_inode;
+        if (is_full)
+            return -ENOSPC;
+        file_initialize(next_inode, MODE_MID_INODE, head_inode->permission);
+        if (is_full)
+            return -ENOSPC;
+        tail_inode->next_indirect = next_inode->i_number;
+        mark_dir_inode(head_inode, tail_inode, dirty);
+        tail_inode = next_inode;
+    }
+
+    new_data_block(data, tail_inode, tail_inode->num_direct);
+    tail_inode->num_direct++;
+    mark_dir_inode(head_inode, tail_inode, dirty);
+
+    int lblock = head_inode->fsize_block++;
+    head_inode->fsize_byte = head_inode->fsize_block * BLOCK_SIZE;
+    return lblock;
+}
+
+void commit_dir_inodes(std::vector<struct inode*> &dirty) {
+    for (auto it : dirty)
+        new_inode_block(it);
+    dirty.clear();
+}
+
+
+/** **************************************
+ * Hashed tree index.
+ * ***************************************/
+/** Index of the last entry whose hash is not larger than major (entries[0] covers all hashes). */
+int search_entries(const struct htree_entry* entries, int count, unsigned int major) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (entries[mid].hash <= major)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+void insert_entry(struct htree_entry* entries, int &count, int pos, struct htree_entry entry) {
+    memmove(entries + pos + 1, entries + pos, (count - pos) * sizeof(struct htree_entry));
+    entries[pos] = entry;
+    count++;
+}
+
+/* Position of a leaf in the htree. */
+struct htree_path {
+    int root_index;                 // Entry in the root.
+    int node_block;                 // Logical block of the index node (-1 with depth 0).
+    int node_index;                 // Entry in the index node.
+    int leaf_block;                 // Logical block of the leaf.
+};
+
+/** Descend the htree to the leaf covering a major hash.
+ * @return false if the directory has no leaf yet (or is corrupt). */
+bool find_leaf(struct inode* head_inode, unsigned int major, struct htree_path &path) {
+    block_ref ref;
+    if (!acquire_dir_block(head_inode, 0, ref))
+        return false;
+    const struct htree_root* root = (const struct htree_root*) ref.data;
+    int depth = root->depth;
+    if (root->count == 0) {
+        release_block(ref);
+        return false;
+    }
+    path.root_index = search_entries(root->entries, root->count, major);
+    int child = root->entries[path.root_index].block;
+    release_block(ref);
+
+    path.node_block = path.node_index = -1;
+    if (depth == 1) {
+        if (!acquire_dir_block(head_inode, child, ref))
+            return false;
+        const struct htree_node* node = (const struct htree_node*) ref.data;
+        path.node_block = child;
+        path.node_index = search_entries(node->entries, node->count, major);
+        child = node->entries[path.node_index].block;
+        release_block(ref);
+    }
+    path.leaf_block = child;
+    return true;
+}
+
+/** Insert the entry of a new leaf (or of the upper half of a split leaf) into the htree.
+ * Called after the capacity is verified by htree_has_room(). */
+int insert_leaf_entry(struct inode* head_inode, const struct htree_path &path, struct htree_entry entry,
+                      std::vector<struct inode*> &dirty) {
+    struct htree_root root;
+    if (!read_dir_block(head_inode, 0, &root))
+        return -EIO;
+
+    if (root.depth == 0) {
+        if (root.count < HTREE_ROOT_ENTRIES) {
+            insert_entry(root.entries, root.count, path.root_index + 1, entry);
+            return write_dir_block(head_inode, 0, &root, dirty);
+        }
+        // The root is full: move its entries to an index node (depth 0 -> 1).
+        struct htree_node node;
+        memset(&node, 0, sizeof(node));
+        memcpy(node.entries, root.entries, root.count * sizeof(struct htree_entry));
+        node.count = root.count;
+        insert_entry(node.entries, node.count, path.root_index + 1, entry);
+        int node_block = append_dir_block(head_inode, &node, dirty);
+        if (node_block < 0)
+            return node_block;
+        memset(root.entries, 0, sizeof(root.entries));
+        root.depth = 1;
+        root.count = 1;
+        root.entries[0].hash = 0;
+        root.entries[0].block = node_block;
+        return write_dir_block(head_inode, 0, &root, dirty);
+    }
+
+    struct htree_node node;
+    if (!read_dir_block(head_inode, path.node_block, &node))
+        return -EIO;
+    if (node.count < HTREE_NODE_ENTRIES) {
+        insert_entry(node.entries, node.count, path.node_index + 1, entry);
+        return write_dir_block(head_inode, path.node_block, &node, dirty);
+    }
+
+    // The index node is full: split it in two halves.
+    struct htree_entry all[HTREE_NODE_ENTRIES + 1];
+    int count = node.count;
+    memcpy(all, node.entries, count * sizeof(struct htree_entry));
+    insert_entry(all, count, path.node_index + 1, entry);
+
+    int half = count / 2;
+    struct htree_node upper;
+    memset(&upper, 0, sizeof(upper));
+    upper.count = count - half;
+    memcpy(upper.entries, all + half, upper.count * sizeof(struct htree_entry));
+    memset(node.entries, 0, sizeof(node.entries));
+    node.count = half;
+    memcpy(node.entries, all, half * sizeof(struct htree_entry));
+
+    int upper_block = append_dir_block(head_inode, &upper, dirty);
+    if (upper_block < 0)
+        return upper_block;
+    int flag = write_dir_block(head_inode, path.node_block, &node, dirty);
+    if (flag != 0)
+        return flag;
+    struct htree_entry upper_entry = {upper.entries[0].hash, upper_block};
+    insert_entry(root.entries, root.count, path.root_index + 1, upper_entry);
+    return write_dir_block(head_inode, 0, &root, dirty);
+}
+
+/** Whether the htree can take one more leaf (false if the directory is corrupt). */
+bool htree_has_room(struct inode* head_inode, const struct htree_path &path) {
+    struct htree_root root;
+    if (!read_dir_block(head_inode, 0, &root))
+        return false;
+    if ((root.depth == 0) || (root.count < HTREE_ROOT_ENTRIES))
+        return true;
+    struct htree_node node;
+    if (!read_dir_block(head_inode, path.node_block, &node))
+        return false;
+    return node.count < HTREE_NODE_ENTRIES;
+}
+
+
+/** **************************************
+ * Directory operations.
+ * ***************************************/
+/** Initialize a new directory in the hashed format (the caller commits dir_inode). */
+void hashed_dir_init(struct inode* dir_inode) {
+    struct htree_root root;
+    memset(&root, 0, sizeof(root));
+    memcpy(root.magic, HTREE_MAGIC, sizeof(HTREE_MAGIC));
+
+    new_data_block(&root, dir_inode, 0);
+    dir_inode->num_direct = 1;
+    dir_inode->fsize_block = 1;
+    dir_inode->fsize_byte = BLOCK_SIZE;
+    dir_formats[dir_inode->i_number].store(DIR_FORMAT_HASHED);
+}
+
+/** Search a hashed directory for an entry: reads O(depth) blocks.
+ * @param  i_number: return variable (unchanged if the entry does not exist).
+ * @return bool: whether the entry is found. */
+bool hashed_dir_lookup(struct inode* head_inode, const char* name, int &i_number) {
+    int name_len = strlen(name);
+    if (name_len >= MAX_NAME_LEN)
+        return false;
+    htree_path path;
+    if (!find_leaf(head_inode, major_hash(name_hash(name, name_len)), path))
+        return false;
+
+    block_ref ref;
+    if (!acquire_dir_block(head_inode, path.leaf_block, ref))
+        return false;
+    const struct dir_leaf* leaf = (const struct dir_leaf*) ref.data;
+    int pos = find_record(leaf, name, name_len, 0);
+    if (pos >= 0)
+        i_number = ((const struct dir_record*) (leaf->records + pos))->i_number;
+    release_block(ref);
+    return pos >= 0;
+}
+
+/** Insert an entry into a hashed directory (splitting its leaf if full).
+ * [CAUTION] The caller commits head_inode (new_inode_block), e.g. after updating timestamps.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int hashed_dir_insert(struct inode* head_inode, const char* name, int i_number) {
+    int name_len = strlen(name);
+    if (name_len >= MAX_NAME_LEN)
+        return -ENAMETOOLONG;
+    unsigned long long key = name_hash(name, name_len);
+    int rec_len = record_length(name_len);
+    std::vector<struct inode*> dirty;
+
+    htree_path path;
+    if (!find_leaf(head_inode, major_hash(key), path)) {
+        // The first entry: create the first leaf.
+        struct htree_root root;
+        if (!read_dir_block(head_inode, 0, &root))
+            return -EIO;
+        struct dir_leaf leaf;
+        memset(&leaf, 0, sizeof(leaf));
+        insert_record(&leaf, key, name, name_len, i_number);
+        int leaf_block = append_dir_block(head_inode, &leaf, dirty);
+        if (leaf_block < 0)
+            return leaf_block;
+        root.count = 1;
+        root.entries[0].hash = 0;
+        root.entries[0].block = leaf_block;
+        int flag = write_dir_block(head_inode, 0, &root, dirty);
+        commit_dir_inodes(dirty);
+        return flag;
+    }
+
+    struct dir_leaf leaf;
+    if (!read_dir_block(head_inode, path.leaf_block, &leaf))
+        return -EIO;
+    if (leaf.used + rec_len <= DIR_LEAF_SPACE) {
+        insert_record(&leaf, key, name, name_len, i_number);
+        int flag = write_dir_block(head_inode, path.leaf_block, &leaf, dirty);
+        commit_dir_inodes(dirty);
+        return flag;
+    }
+
+    // The leaf is full: split its records (with the new one) by hash into two leaves.
+    if (!htree_has_room(head_inode, path)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Hashed directory #%d is full.\n", head_inode->i_number);
+        return -ENOSPC;
+    }
+    char all[DIR_LEAF_SPACE + MAX_NAME_LEN + sizeof(struct dir_record)];
+    memcpy(all, leaf.records, leaf.used);
+    put_record(all + leaf.used, name, name_len, i_number);
+
+    std::vector<std::pair<unsigned long long, int>> order;     // (key, offset in all[]).
+    for (int pos = 0; pos < leaf.used + rec_len; pos += ((const struct dir_record*) (all + pos))->rec_len)
+        order.push_back(std::make_pair(record_hash((const struct dir_record*) (all + pos)), pos));
+    std::sort(order.begin(), order.end());
+
+    // Split near the middle (in bytes), but never between records with the same major hash.
+    int n = order.size(), half = (leaf.used + rec_len) / 2, split = 0;
+    for (int bytes = 0; (split < n) && (bytes < half); split++)
+        bytes += ((const struct dir_record*) (all + order[split].second))->rec_len;
+    int split_up = split, split_down = split;
+    while ((split_up < n) && (major_hash(order[split_up].first) == major_hash(order[split_up-1].first)))
+        split_up++;
+    while ((split_down > 0) && (major_hash(order[split_down].first) == major_hash(order[split_down-1].first)))
+        split_down--;
+    split = (split_up < n) ? split_up : split_down;
+    if ((split == 0) || (split == n)) {
+        if (ERROR_DIRECTORY)
+            logger(ERROR, "[ERROR] Cannot split a leaf of hashed directory #%d (hash collisions).\n", head_inode->i_number);
+        return -ENOSPC;
+    }
+
+    struct dir_leaf lower, upper;
+    memset(&lower, 0, sizeof(lower));
+    memset(&upper, 0, sizeof(upper));
+    for (int k = 0; k < n; k++) {
+        const struct dir_record* rec = (const struct dir_record*) (all + order[k].second);
+        struct dir_leaf* dest = (k < split) ? &lower : &upper;
+        if (dest->used + rec->rec_len > DIR_LEAF_SPACE) {
+            if (ERROR_DIRECTORY)
+                logger(ERROR, "[ERROR] Cannot split a leaf of hashed directory #%d (hash collisions).\n", head_inode->i_number);
+            return -ENOSPC;
+        }
+        memcpy(dest->records + dest->used, rec, rec->rec_len);
+        dest->used += rec->rec_len;
+        dest->count++;
+    }
+
+    int upper_block = append_dir_block(head_inode, &upper, dirty);
+    if (upper_block < 0)
+        return upper_block;
+    int flag = write_dir_block(head_inode, path.leaf_block, &lower, dirty);
+    if (flag == 0) {
+        struct htree_entry entry = {major_hash(order[split].first), upper_block};
+        flag = insert_leaf_entry(head_inode, path, entry, dirty);
+    }
+    commit_dir_inodes(dirty);
+    return flag;
+}
+
+/** Remove an entry from a hashed directory (the caller commits head_inode).
+ * @param  del_inum: if positive, the entry should also refer to this i_number.
+ * @return bool: whether the entry is found (and removed). */
+bool hashed_dir_remove(struct inode* head_inode, const char* name, int del_inum) {
+    int name_len = strlen(name);
+    if (name_len >= MAX_NAME_LEN)
+        return false;
+    htree_path path;
+    if (!find_leaf(head_inode, major_hash(name_hash(name, name_len)), path))
+        return false;
+
+    struct dir_leaf leaf;
+    if (!read_dir_block(head_inode, path.leaf_block, &leaf))
+        return false;
+    int pos = find_record(&leaf, name, name_len, del_inum);
+    if (pos < 0)
+        return false;
+    remove_record(&leaf, pos);
+
+    std::vector<struct inode*> dirty;
+    bool written = (write_dir_block(head_inode, path.leaf_block, &leaf, dirty) == 0);
+    commit_dir_inodes(dirty);
+    return written;
+}
+
+/** Point an entry of a hashed directory at another inode (the caller commits head_inode).
+ * @param  old_inum: the entry should currently refer to this i_number.
+ * @return bool: whether the entry is found (and replaced). */
+bool hashed_dir_replace(struct inode* head_inode, const char* name, int old_inum, int new_inum) {
+    int name_len = strlen(name);
+    if (name_len >= MAX_NAME_LEN)
+        return false;
+    htree_path path;
+    if (!find_leaf(head_inode, major_hash(name_hash(name, name_len)), path))
+        return false;
+
+    struct dir_leaf leaf;
+    if (!read_dir_block(head_inode, path.leaf_block, &leaf))
+        return false;
+    int pos = find_record(&leaf, name, name_len, old_inum);
+    if (pos < 0)
+        return false;
+    ((struct dir_record*) (leaf.records + pos))->i_number = new_inum;
+
+    std::vector<struct inode*> dirty;
+    bool written = (write_dir_block(head_inode, path.leaf_block, &leaf, dirty) == 0);
+    commit_dir_inodes(dirty);
+    return written;
+}
+
+/** Visit the records of a leaf whose hash key is not smaller than from.
+ * @return bool: whether the visitor stops the iteration. */
+bool visit_leaf(struct inode* head_inode, int leaf_block, unsigned long long from, dir_visitor_t visit, void* ctx) {
+    block_ref ref;
+    if (!acquire_dir_block(head_inode, leaf_block, ref))
+        return false;
+    const struct dir_leaf* leaf = (const struct dir_leaf*) ref.data;
+    char name[MAX_NAME_LEN];
+    bool stopped = false;
+    for (int pos = 0; (pos < leaf->used) && !stopped; ) {
+        const struct dir_record* rec = (const struct dir_record*) (leaf->records + pos);
+        pos += rec->rec_len;
+        unsigned long long key = record_hash(rec);
+        if (key < from)
+            continue;
+        memcpy(name, record_name(rec), rec->name_len);
+        name[rec->name_len] = '\0';
+        stopped = visit(ctx, name, rec->i_number, (off_t) key + 4);
+    }
+    release_block(ref);
+    return stopped;
+}
+
+/** Iterate the entries of a hashed directory in hash order.
+ * @param  offset: readdir offset (3 + hash key of the first entry to visit, or less than 3 for all).
+ * @return bool: whether the visitor stops the iteration.
+ * [CAUTION] The visitor should not append blocks: it is called with a pinned leaf. */
+bool hashed_dir_iterate(struct inode* head_inode, off_t offset, dir_visitor_t visit, void* ctx) {
+    unsigned long long from = (offset > 3) ? (unsigned long long) (offset - 3) : 0;
+    unsigned int major = major_hash(from);
+
+    struct htree_root root;
+    if (!read_dir_block(head_inode, 0, &root) || (root.count == 0))
+        return false;
+    bool first = true;
+    for (int r = search_entries(root.entries, root.count, major); r < root.count; r++, first = false) {
+        if (root.depth == 0) {
+            if (visit_leaf(head_inode, root.entries[r].block, from, visit, ctx))
+                return true;
+            continue;
+        }
+        struct htree_node node;
+        if (!read_dir_block(head_inode, root.entries[r].block, &node))
+            return false;
+        for (int k = first ? search_entries(node.entries, node.count, major) : 0; k < node.count; k++)
+            if (visit_leaf(head_inode, node.entries[k].block, from, visit, ctx))
+                return true;
+    }
+    return false;
+}
@@ -0,0 +1,69 @@
+#ifndef dirhash_h
+#define dirhash_h
+
+#include "utility.h"
+#include "dir.h"
+
+/** **************************************
+ * Hashed directory format.
+ * ***************************************/
+/* A hashed directory is a sequence of logical blocks (in the direct[] chain of its inodes):
+ * - Block 0 is the root of a hashed tree index (htree): sorted (hash, block) pairs.
+ *   With depth 1, the root points to index nodes, which point to leaves.
+ * - Leaves hold variable-length records, sorted by name hash.
+ * Blocks are never discarded, so logical block n is direct[n % NUM_INODE_DIRECT] of the
+ * (n / NUM_INODE_DIRECT)-th inode of the chain.
+ * Directories in the old format (directory[] blocks) are still served by dir.cpp. */
+const char HTREE_MAGIC[4]   = {'/', 'H', 'T', '1'};    // '/' is never a valid first filename character.
+const int MAX_NAME_LEN      = 256;                      // Including the trailing '\0'.
+
+struct htree_entry {
+    unsigned int hash;              // Lowest (major) hash covered by the block.
+    int block;                      // Logical block of the child (leaf or index node).
+};
+const int HTREE_ROOT_ENTRIES = (BLOCK_SIZE - 16) / sizeof(struct htree_entry);
+const int HTREE_NODE_ENTRIES = (BLOCK_SIZE - 8) / sizeof(struct htree_entry);
+
+struct htree_root {
+    char magic[4];                  // HTREE_MAGIC.
+    int depth;                      // 0: entries point to leaves; 1: entries point to index nodes.
+    int count;                      // Number of valid entries.
+    int reserved;
+    struct htree_entry entries[HTREE_ROOT_ENTRIES];
+};
+
+struct htree_node {
+    int count;                      // Number of valid entries.
+    int reserved;
+    struct htree_entry entries[HTREE_NODE_ENTRIES];
+};
+
+struct dir_record {
+    int i_number;                   // Inode number.
+    unsigned short rec_len;         // Length of the record (header + name, 4-byte aligned).
+    unsigned char name_len;         // Length of the name (no trailing '\0' on disk).
+    unsigned char reserved;
+    // Followed by the name (name_len bytes).
+};
+const int DIR_LEAF_SPACE = BLOCK_SIZE - 8;
+
+struct dir_leaf {
+    int used;                       // Bytes used by records.
+    int count;                      // Number of records.
+    char records[DIR_LEAF_SPACE];
+};
+
+
+bool is_hashed_dir(struct inode* head_inode);
+void forget_dir_format(int i_number);
+void clear_dir_formats();
+int max_name_length(struct inode* head_inode);
+
+void hashed_dir_init(struct inode* dir_inode);
+bool hashed_dir_lookup(struct inode* head_inode, const char* name, int &i_number);
+int hashed_dir_insert(struct inode* head_inode, const char* name, int i_number);
+bool hashed_dir_remove(struct inode* head_inode, const char* name, int del_inum);
+bool hashed_dir_replace(struct inode* head_inode, const char* name, int old_inum, int new_inum);
+bool hashed_dir_iterate(struct inode* head_inode, off_t offset, dir_visitor_t visit, void* ctx);
+
+#endif
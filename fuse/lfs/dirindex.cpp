@@ -0,0 +1,174 @@
+#include "dirindex.h"
+
+#include "logger.h"
+#include "blockio.h"
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+struct dir_index {
+    std::mutex lock;
+    bool built = false;
+    std::unordered_map<std::string, dir_slot> names;    // Name -> slot of each entry.
+    std::vector<dir_slot> free_slots;                   // Free slots in existing directory blocks.
+};
+
+std::mutex dir_index_table_lock;
+std::shared_ptr<dir_index> dir_indexes[MAX_NUM_INODE];
+
+
+/** Retrieve the index of a directory.
+ * @param  dir_inum: i_number of the directory (head inode).
+ * @param  create: whether to allocate an (unbuilt) index if there is none.
+ * @return the index, or NULL if there is none and create is false. */
+std::shared_ptr<dir_index> get_dir_index(int dir_inum, bool create) {
+    std::lock_guard <std::mutex> guard(dir_index_table_lock);
+    if (!dir_indexes[dir_inum] && create)
+        dir_indexes[dir_inum] = std::make_shared<dir_index>();
+    return dir_indexes[dir_inum];
+}
+
+/** Build the index by scanning all directory blocks (the caller holds index->lock). */
+void build_dir_index(struct inode* head_inode, dir_index* index) {
+    struct inode* block_inode = head_inode;
+    while (true) {
+        for (int i = 0; i < NUM_INODE_DIRECT; i++) {
+            if ((block_inode->direct[i] <= -1) || (block_inode->direct[i] >= TOT_SEGMENTS * BLOCKS_IN_SEGMENT))
+                continue;
+            block_ref ref;
+            acquire_block(ref, block_inode->direct[i]);
+            const dir_entry* block_dir = (const dir_entry*) ref.data;
+            for (int j = 0; j < MAX_DIR_ENTRIES; j++) {
+                dir_slot slot = {block_dir[j].i_number, block_inode->i_number, i, j};
+                if (block_dir[j].i_number == 0)
+                    index->free_slots.push_back(slot);
+                else if ((block_dir[j].i_number > 0) && (block_dir[j].i_number <= MAX_NUM_INODE))
+                    index->names.emplace(std::string(block_dir[j].filename, strnlen(block_dir[j].filename, MAX_FILENAME_LEN)), slot);
+            }
+            release_block(ref);
+        }
+        if (block_inode->next_indirect == 0)
+            break;
+        get_inode_from_inum(block_inode, block_inode->next_indirect);
+    }
+    index->built = true;
+
+    if (DEBUG_DIRECTORY)
+        logger(DEBUG, "[INFO] Built index of directory #%d: %lu entries, %lu free slots.\n",
+               head_inode->i_number, index->names.size(), index->free_slots.size());
+}
+
+
+/** Look up a name in a directory (building its index if necessary).
+ * @param  head_inode: first i_node of the directory.
+ * @param  name: name of the entry.
+ * @param  slot: return variable (location and i_number of the entry).
+ * @return bool: whether the entry exists. */
+bool dir_index_lookup(struct inode* head_inode, const char* name, struct dir_slot &slot) {
+    std::shared_ptr<dir_index> index = get_dir_index(head_inode->i_number, true);
+    std::lock_guard <std::mutex> guard(index->lock);
+    if (!index->built)
+        build_dir_index(head_inode, index.get());
+
+    auto it = index->names.find(name);
+    if (it == index->names.end())
+        return false;
+    slot = it->second;
+    return true;
+}
+
+/** Take a free slot in the existing blocks of a directory (building its index if necessary).
+ * @param  head_inode: first i_node of the directory.
+ * @param  slot: return variable (location of the free slot).
+ * @return bool: false if all directory blocks are full. */
+bool dir_index_take_free_slot(struct inode* head_inode, struct dir_slot &slot) {
+    std::shared_ptr<dir_index> index = get_dir_index(head_inode->i_number, true);
+    std::lock_guard <std::mutex> guard(index->lock);
+    if (!index->built)
+        build_dir_index(head_inode, index.get());
+
+    if (index->free_slots.empty())
+        return false;
+    slot = index->free_slots.back();
+    index->free_slots.pop_back();
+    return true;
+}
+
+/** Record a new entry written into a slot (taken by dir_index_take_free_slot). */
+void dir_index_insert(int dir_inum, const char* name, const struct dir_slot &slot) {
+    std::shared_ptr<dir_index> index = get_dir_index(dir_inum, false);
+    if (!index)
+        return;
+    std::lock_guard <std::mutex> guard(index->lock);
+    if (index->built)
+        index->names[name] = slot;
+}
+
+/** Forget an entry removed from a directory.
+ * @param  free_slot: whether the slot is reusable (false if its block is dropped as well). */
+void dir_index_erase(int dir_inum, const char* name, bool free_slot) {
+    std::shared_ptr<dir_index> index = get_dir_index(dir_inum, false);
+    if (!index)
+        return;
+    std::lock_guard <std::mutex> guard(index->lock);
+    if (!index->built)
+        return;
+    auto it = index->names.find(name);
+    if (it == index->names.end())
+        return;
+    if (free_slot) {
+        dir_slot slot = it->second;
+        slot.i_number = 0;
+        index->free_slots.push_back(slot);
+    }
+    index->names.erase(it);
+}
+
+/** Record a new directory block, whose first slot holds the entry (name, i_number). */
+void dir_index_add_block(int dir_inum, int block_inum, int direct_index, const char* name, int i_number) {
+    std::shared_ptr<dir_index> index = get_dir_index(dir_inum, false);
+    if (!index)
+        return;
+    std::lock_guard <std::mutex> guard(index->lock);
+    if (!index->built)
+        return;
+    index->names[name] = {i_number, block_inum, direct_index, 0};
+    for (int j = MAX_DIR_ENTRIES-1; j > 0; j--)
+        index->free_slots.push_back({0, block_inum, direct_index, j});
+}
+
+/** Forget the free slots of a directory block that is discarded. */
+void dir_index_drop_block(int dir_inum, int block_inum, int direct_index) {
+    std::shared_ptr<dir_index> index = get_dir_index(dir_inum, false);
+    if (!index)
+        return;
+    std::lock_guard <std::mutex> guard(index->lock);
+    std::vector<dir_slot> &free_slots = index->free_slots;
+    for (size_t k = 0; k < free_slots.size(); ) {
+        if ((free_slots[k].block_inum == block_inum) && (free_slots[k].direct_index == direct_index)) {
+            free_slots[k] = free_slots.back();
+            free_slots.pop_back();
+        } else {
+            k++;
+        }
+    }
+}
+
+
+/** Release the index of a directory (when the directory is removed, or evicted by the kernel).
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the directory. */
+void evict_dir_index(int dir_inum) {
+    std::lock_guard <std::mutex> guard(dir_index_table_lock);
+    dir_indexes[dir_inum].reset();
+}
+
+/** Release all directory indexes (on mount / unmount). */
+void clear_dir_indexes() {
+    std::lock_guard <std::mutex> guard(dir_index_table_lock);
+    for (int i = 0; i < MAX_NUM_INODE; i++)
+        dir_indexes[i].reset();
+}
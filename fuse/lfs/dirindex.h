@@ -0,0 +1,28 @@
+#ifndef dirindex_h
+#define dirindex_h
+
+#include "utility.h"
+
+/** In-memory directory index: name -> slot, plus the free slots of existing directory blocks.
+ * An index is built lazily from the directory blocks on first use, and afterwards kept coherent
+ * by the functions in dir.cpp that modify directory blocks. It is released when the directory is
+ * removed, or evicted by the kernel (see drop_inode()), so that only directories in use are indexed.
+ * [CAUTION] Modifiers should hold the (exclusive) inode lock of the directory. */
+struct dir_slot {
+    int i_number;                   // Inode number of the entry (0 for free slots).
+    int block_inum;                 // Inode (head or indirect) whose direct[] holds the block.
+    int direct_index;               // Index of the block w.r.t. direct[] of that inode.
+    int slot;                       // Index of the entry within the directory block.
+};
+
+bool dir_index_lookup(struct inode* head_inode, const char* name, struct dir_slot &slot);
+bool dir_index_take_free_slot(struct inode* head_inode, struct dir_slot &slot);
+void dir_index_insert(int dir_inum, const char* name, const struct dir_slot &slot);
+void dir_index_erase(int dir_inum, const char* name, bool free_slot);
+void dir_index_add_block(int dir_inum, int block_inum, int direct_index, const char* name, int i_number);
+void dir_index_drop_block(int dir_inum, int block_inum, int direct_index);
+
+void evict_dir_index(int dir_inum);
+void clear_dir_indexes();
+
+#endif
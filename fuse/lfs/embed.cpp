@@ -0,0 +1,33 @@
+#include "embed.h"
+
+#include "system.h"
+#include "utility.h"
+#include "path.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+mode_t embed_umask = 022;
+
+
+/** Mount LFS in process (kernel notifications are not started, as there is no kernel).
+ * @param  mount_point: where LFS would be mounted (only used to resolve paths; it need not exist). */
+void embed_mount(const char* mount_point) {
+    embed_umask = umask(0);     // The umask can only be read by setting it.
+    umask(embed_umask);
+
+    generate_prefix(mount_point);
+    embed_attach_thread();
+    mount_lfs();
+}
+
+/** Save LFS to the disk file. */
+void embed_unmount() {
+    embed_attach_thread();
+    unmount_lfs();
+}
+
+/** Act as the current process (with its umask) in operations called by this thread. */
+void embed_attach_thread() {
+    set_caller_context(getuid(), getgid(), getpid(), embed_umask);
+}
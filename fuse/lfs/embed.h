@@ -0,0 +1,18 @@
+#ifndef embed_h
+#define embed_h
+
+/** **************************************
+ * In-process use (without FUSE).
+ * ***************************************/
+/* LFS is also built as a static library (liblfs.a), to be served in process: mount it by
+ * embed_mount(), then call the operations of "ops" (see index.h) directly, with paths relative
+ * to the root ("/dir/file") and fuse_file_info handles, as the high-level FUSE library would.
+ * No kernel (nor /dev/fuse) is involved, so that microbenchmarks and profilers (perf, callgrind)
+ * only see the file system code. The disk file is lfs.data in the working directory (or the
+ * devices given by set_device_paths()). Operations take the caller from a synthetic context
+ * (see set_caller_context()), which embed_attach_thread() sets for the calling thread. */
+void embed_mount(const char* mount_point);
+void embed_unmount();
+void embed_attach_thread();
+
+#endif
@@ -1,11 +1,18 @@
 #include "file.h"
 
 #include "logger.h"
+#include "metrics.h"
+#include "statsfile.h"
 #include "print.h"
 #include "path.h"
 #include "dir.h"
 #include "index.h"
 #include "blockio.h"
+#include "dirhash.h"
+#include "notify.h"
+#include "reclaim.h"
+#include "clone.h"
+#include "device.h"
 #include "utility.h"
 
 #include <string.h>
@@ -17,11 +24,14 @@
 const int SC = sizeof(char);
 
 /** (for internal uses only) Set direct[block_ind:] in cur_inode to -1.
+ * The rest of the inode chain is detached, and reclaimed in the background.
  * @param  cur_inode: the inode to be operated on.
  * @param  block_ind: the start position of truncation.
  * [CAUTION] Since num_direct = block_ind + 1, we allow block_ind to be -1. */
 void truncate_inode(inode* cur_inode, int block_ind) {
     cur_inode->num_direct = block_ind + 1;
+    if (USE_DEFERRED_RECLAIM && (cur_inode->next_indirect != 0))
+        orphan_chain(cur_inode->next_indirect);
     cur_inode->next_indirect = 0;
     for (int i = cur_inode->num_direct; i < NUM_INODE_DIRECT; i++) {
         cur_inode->direct[i] = -1;
@@ -30,26 +40,25 @@ void truncate_inode(inode* cur_inode, int block_ind) {
 
 
 /** (for internal uses only) Write the specified segment of file.
+ * @param  inode_num: i_number of the file (the caller should hold its lock).
  * @param  ...: please refer to standard ".write" interface. */
-int write_in_file(const char* path, const char* buf, size_t size,
-                  off_t offset, struct fuse_file_info* fi) {
+int write_in_file(int inode_num, const char* buf, size_t size, off_t offset) {
     timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
     
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
     
-    int inode_num = fi->fh;
     inode* cur_inode;
     get_inode_from_inum(cur_inode, inode_num);
     if (cur_inode->mode != MODE_FILE) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] %s is not a file.\n", path);
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
         return 0;
     }
     
-    // Write permission control.
-    if (!verify_permission(PERM_WRITE, cur_inode, user_info, ENABLE_PERMISSION)) {
+    // Write permission control (on open only, with the writeback cache).
+    if (!verify_permission(PERM_WRITE, cur_inode, user_info, ENABLE_PERMISSION && !writeback_cache)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
         return 0;
@@ -85,15 +94,20 @@ int write_in_file(const char* path, const char* buf, size_t size,
     if (is_end == false) {
         int cur_file_blksize = ((int) (len+BLOCK_SIZE-1) / BLOCK_SIZE) * BLOCK_SIZE;
         while (cur_buf_pos < size && cur_buf_pos + offset < cur_file_blksize) {
-            get_block(loader, cur_inode->direct[cur_block_ind]);
-
             // Copy a block: copy_size = min(BLOCK_SIZE-cur_block_offset, size-cur_buf_pos).
             copy_size = BLOCK_SIZE - cur_block_offset;
             if (size - cur_buf_pos < copy_size)
                 copy_size = size - cur_buf_pos;
-            memcpy(loader + cur_block_offset, buf + cur_buf_pos, copy_size);
-            file_modify(cur_inode, cur_block_ind, loader);
-            get_block(loader, cur_inode->direct[cur_block_ind]);
+
+            if (copy_size == BLOCK_SIZE) {
+                // A whole block is overwritten: append it from the user buffer directly.
+                file_modify(cur_inode, cur_block_ind, (void*) (buf + cur_buf_pos));
+            } else {
+                // Read-modify-write of a partial block.
+                get_block(loader, cur_inode->direct[cur_block_ind]);
+                memcpy(loader + cur_block_offset, buf + cur_buf_pos, copy_size);
+                file_modify(cur_inode, cur_block_ind, loader);
+            }
 
             // Update buffer pointer and block pointer.
             cur_buf_pos += copy_size;
@@ -164,9 +178,13 @@ int write_in_file(const char* path, const char* buf, size_t size,
         if (size - cur_buf_pos < copy_size)
             copy_size = size - cur_buf_pos;
         
-        memset(loader, 0, sizeof(loader));
-        memcpy(loader, buf + cur_buf_pos, copy_size);
-        file_add_data(cur_inode, loader);
+        if (copy_size == BLOCK_SIZE) {
+            file_add_data(cur_inode, (void*) (buf + cur_buf_pos));
+        } else {
+            memset(loader, 0, sizeof(loader));
+            memcpy(loader, buf + cur_buf_pos, copy_size);
+            file_add_data(cur_inode, loader);
+        }
 
         cur_buf_pos += copy_size;
         len += copy_size;
@@ -190,8 +208,14 @@ int o_open(const char* path, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "OPEN, %s, %p\n", resolve_prefix(path).c_str(), fi);
 
-    timespec cur_time;
-    clock_gettime(CLOCK_REALTIME, &cur_time);
+    metric_timer timer(OP_OPEN);
+
+    int stats_inum = stats_path_inode(path);
+    if (stats_inum != 0) {
+        fi->direct_io = 1;      // Reads go up to the end of the snapshot, whatever the file size.
+        return open_stats_file(stats_inum, fi->flags, fi->fh);
+    }
+
     int inode_num;
     int flag = locate(path, inode_num);
     if (flag != 0) {
@@ -200,13 +224,35 @@ int o_open(const char* path, struct fuse_file_info* fi) {
         return flag;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inode_num]);
+    flag = open_file(inode_num, fi->flags);
+    if (flag == 0) {
+        hold_inode(inode_num);              // Dropped on release.
+        fi->fh = file_handle(inode_num, fi->flags);    // Return file handle if the user has due permission.
+    }
+    return flag;
+}
+
+/** Verify permissions to open a file, and handle the O_TRUNC flag.
+ * @param  inode_num: i_number of the file.
+ * @param  flags: open flags.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int open_file(int inode_num, int flags) {
+    timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+
+    /* The inode-level fine-grained lock is shared (read-only access), unless the file is truncated:
+     * then it is exclusive from the start, so that the checks below still hold when truncating. */
+    bool truncating = (flags & O_TRUNC) && (flags & O_ACCMODE);
+    std::shared_lock <std::shared_mutex> guard(inode_lock(inode_num), std::defer_lock);
+    std::unique_lock <std::shared_mutex> trunc_guard(inode_lock(inode_num), std::defer_lock);
+    if (truncating)
+        trunc_guard.lock();
+    else
+        guard.lock();
     /* This will be automatically released on each exit path. */
 
-    // Retrieve open flags, the inode and current user info.
-    int flags = fi -> flags;
-    struct fuse_context* user_info = fuse_get_context();
+    // Retrieve the inode and current user info.
+    struct fuse_context* user_info = get_caller_context();
     inode* cur_inode;
     get_inode_from_inum(cur_inode, inode_num);
 
@@ -222,17 +268,21 @@ int o_open(const char* path, struct fuse_file_info* fi) {
             logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
         return -EACCES;
     }
-    
-    // Return file handle if the user has due permission.
-    fi->fh = (uint64_t) inode_num;
 
     // Handle O_TRUNC flag.
-    if ((flags & O_TRUNC) && (flags & O_ACCMODE)) {
+    if (truncating) {
         if (is_full) {
             logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
             logger(WARN, "====> Cannot proceed to truncate the file: flag O_TRUNC is omitted.\n");
             return 0;
         }
+        if (!is_live_inode(inode_num))
+            return -ENOENT;
+        if (cur_inode->mode != MODE_FILE) {
+            if (ERROR_FILE)
+                logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
+            return -EISDIR;
+        }
 
         truncate_inode(cur_inode, -1);
         cur_inode->fsize_block = cur_inode->fsize_byte = 0;
@@ -247,6 +297,12 @@ int o_release(const char* path, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "RELEASE, %s, %p\n", resolve_prefix(path).c_str(), fi);
 
+    metric_timer timer(OP_RELEASE);
+
+    if (stats_path_inode(path) != 0)
+        release_stats_file(fi->fh);
+    else
+        drop_inode(handle_inode(fi->fh));
     fi->fh = 0;
 
     return 0;
@@ -257,11 +313,12 @@ int o_read(const char* path, char *buf, size_t size, off_t offset, struct fuse_f
         logger(DEBUG, "READ, %s, %p, %d, %d, %p\n",
                resolve_prefix(path).c_str(), buf, size, offset, fi);
 
-    /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    metric_timer timer(OP_READ);
+
+    if (stats_path_inode(path) != 0)
+        return read_stats_file(fi->fh, buf, size, offset);
 
     // In case the file is not open yet.
-    size_t len;
     if (fi->fh == 0) {
         int first_flag = 0, fh = 0;
         first_flag = locate(path, fh);
@@ -272,36 +329,57 @@ int o_read(const char* path, char *buf, size_t size, off_t offset, struct fuse_f
             return 0;
         }
     }
-    int inode_num = fi->fh;
-    
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inode_num]);
+
+    int read_len = read_file(handle_inode(fi->fh), buf, size, offset);
+    if (read_len < 0)
+        return 0;
+    count_metric(COUNT_BYTES_READ, read_len);
+    return read_len;
+}
+
+/** Read the specified segment of a file.
+ * @param  inode_num: i_number of the file.
+ * @param  ...: please refer to standard ".read" interface.
+ * @return length: number of bytes read, or standard negative error codes on error. */
+int read_file(int inode_num, char* buf, size_t size, off_t offset) {
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(inode_num));
     /* This will be automatically released on each exit path. */
     
     inode* cur_inode;
     get_inode_from_inum(cur_inode, inode_num);
-    if (!verify_permission(PERM_READ, cur_inode, user_info, ENABLE_PERMISSION)) {
+    if (!verify_permission(PERM_READ, cur_inode, user_info, ENABLE_PERMISSION && !writeback_cache)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to read.\n");
-        return 0;
+        return -EACCES;
     }
     
-    len = cur_inode->fsize_byte;
+    size_t len = cur_inode->fsize_byte;
     int t_offset = offset;
     if (cur_inode->mode != MODE_FILE) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] %s is not a file.\n", path);
-        return 0;
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
+        return -EISDIR;
     }
     if (offset < len) {
         if (offset + size > len)
             size = len - offset;
     } else {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Cannot read from an offset larger than file length.\n", path);
+        // Reading at (or beyond) the end of file is not an error: nothing is read.
         return 0;
     }
 
+    // Small files are read from the inode itself.
+    if (has_inline_data(cur_inode)) {
+        memcpy(buf, (const char*) cur_inode->direct + offset, size);
+        guard.unlock();
+        access_file(inode_num);
+        return size;
+    }
+
     // Locate the start inode.
     while (t_offset > 0) {
         if (t_offset < cur_inode->num_direct * BLOCK_SIZE) {
@@ -319,15 +397,21 @@ int o_read(const char* path, char *buf, size_t size, off_t offset, struct fuse_f
     // Copy data to buffer.
     int cur_buf_pos = 0;
     int copy_size = BLOCK_SIZE;
-    char loader[BLOCK_SIZE + 10];
     while (cur_buf_pos < size) {
-        get_block(loader, cur_inode->direct[cur_block_ind]);
-
         // Copy a block: copy_size = min(BLOCK_SIZE-cur_block_offset, size-cur_buf_pos).
         copy_size = BLOCK_SIZE - cur_block_offset;
         if (size - cur_buf_pos < copy_size)
             copy_size = size - cur_buf_pos;
-        memcpy(buf + cur_buf_pos, loader + cur_block_offset, copy_size);
+        if (copy_size == BLOCK_SIZE) {
+            // Whole blocks are retrieved into the user buffer directly.
+            get_block(buf + cur_buf_pos, cur_inode->direct[cur_block_ind]);
+        } else {
+            // Partial blocks are copied from a pinned reference (no intermediate copy).
+            block_ref ref;
+            acquire_block(ref, cur_inode->direct[cur_block_ind]);
+            memcpy(buf + cur_buf_pos, ref.data + cur_block_offset, copy_size);
+            release_block(ref);
+        }
         
         // Update buffer pointer and block pointer.
         cur_buf_pos += copy_size;
@@ -345,17 +429,162 @@ int o_read(const char* path, char *buf, size_t size, off_t offset, struct fuse_f
         }
     }
 
-    // Update access time.
+    guard.unlock();
+    access_file(inode_num);
+    return size;
+}
+
+/** Update the access time of a file after it has been read.
+ * The inode is only written back when its atime changes, since this requires the exclusive lock.
+ * @param  inode_num: i_number of the file. */
+void access_file(int inode_num) {
+    timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+
+    inode* cur_inode;
+    get_inode_from_inum(cur_inode, inode_num);
+    {
+        std::shared_lock <std::shared_mutex> guard(inode_lock(inode_num));
+        if (!atime_needs_update(cur_inode, cur_time))
+            return;
+    }
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
         logger(WARN, "====> Cannot proceed to update timestamps, but the file is still accessible.\n");
+        return;
+    }
+
+    // The shared lock is released meanwhile: the file may have been removed, or its atime updated.
+    std::lock_guard <std::shared_mutex> guard(inode_lock(inode_num));
+    if (!is_live_inode(inode_num) || (cur_inode->mode != MODE_FILE) || !atime_needs_update(cur_inode, cur_time))
+        return;
+    update_atime(cur_inode, cur_time);
+    new_inode_block(cur_inode);
+}
+
+/** Read the specified segment of a file into a buffer vector, without copying on-disk blocks:
+ * they are referenced by file descriptor (of their device) so that the kernel can splice them,
+ * while blocks held in memory (segment buffer or cache) are copied into mem once.
+ * [CAUTION] The caller should pin the disk file by begin_block_splice() until the reply is sent,
+ *           and then call access_file() to update timestamps.
+ * @param  inode_num: i_number of the file.
+ * @param  size, offset: please refer to standard ".read" interface.
+ * @param  bufv: return variable (to be freed by the caller; referencing mem and device files).
+ * @param  mem: buffer of at least size bytes, for blocks held in memory.
+ * @return length: number of bytes read, -EAGAIN if the blocks cannot be referenced now
+ *         (so that the caller should fall back to read_file), or other negative error codes. */
+int read_file_buf(int inode_num, size_t size, off_t offset, struct fuse_bufvec* &bufv, char* mem) {
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(inode_num));
+    /* This will be automatically released on each exit path. */
+
+    bufv = NULL;
+    inode* cur_inode;
+    get_inode_from_inum(cur_inode, inode_num);
+    if (!verify_permission(PERM_READ, cur_inode, user_info, ENABLE_PERMISSION && !writeback_cache)) {
+        if (ERROR_PERM)
+            logger(ERROR, "[ERROR] Permission denied: not allowed to read.\n");
+        return -EACCES;
+    }
+    if (cur_inode->mode != MODE_FILE) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
+        return -EISDIR;
+    }
+
+    size_t len = cur_inode->fsize_byte;
+    if (offset >= len)
+        size = 0;
+    else if (offset + size > len)
+        size = len - offset;
+
+    // At most one buffer per block (plus one, for an unaligned start).
+    int max_bufs = size / BLOCK_SIZE + 2;
+    bufv = (struct fuse_bufvec*) calloc(1, sizeof(struct fuse_bufvec) + max_bufs * sizeof(struct fuse_buf));
+    if (size == 0) {
+        bufv->count = 1;
+        bufv->buf[0].mem = mem;
         return 0;
-    } else {
-        timespec cur_time;
-        clock_gettime(CLOCK_REALTIME, &cur_time);
+    }
+    if (has_inline_data(cur_inode)) {
+        memcpy(mem, (const char*) cur_inode->direct + offset, size);
+        bufv->count = 1;
+        bufv->buf[0].mem = mem;
+        bufv->buf[0].size = size;
+        bufv->buf[0].fd = -1;
+        return size;
+    }
 
-        update_atime(cur_inode, cur_time);
-        new_inode_block(cur_inode);
+    // Locate the start inode and block.
+    int t_offset = offset;
+    while (t_offset > 0) {
+        if (t_offset < cur_inode->num_direct * BLOCK_SIZE)
+            break;
+        t_offset -= cur_inode->num_direct * BLOCK_SIZE;
+        get_inode_from_inum(cur_inode, cur_inode->next_indirect);
+    }
+    int cur_block_ind = t_offset / BLOCK_SIZE;
+    int cur_block_offset = t_offset - cur_block_ind * BLOCK_SIZE;
+
+    int cur_buf_pos = 0;
+    int copy_size;
+    char loader[BLOCK_SIZE + 10];
+    struct fuse_buf* last = NULL;
+    while (cur_buf_pos < size) {
+        copy_size = BLOCK_SIZE - cur_block_offset;
+        if (size - cur_buf_pos < copy_size)
+            copy_size = size - cur_buf_pos;
+
+        int block_addr = cur_inode->direct[cur_block_ind];
+        char* dest = (copy_size == BLOCK_SIZE) ? (mem + cur_buf_pos) : loader;
+        off_t block_pos;
+        int in_memory = get_block_in_memory(dest, block_addr, block_pos);
+        if (in_memory < 0) {
+            free(bufv);
+            bufv = NULL;
+            return -EAGAIN;
+        }
+
+        if (in_memory) {
+            if (dest == loader)
+                memcpy(mem + cur_buf_pos, loader + cur_block_offset, copy_size);
+            if (last && !(last->flags & FUSE_BUF_IS_FD) && ((char*) last->mem + last->size == mem + cur_buf_pos)) {
+                last->size += copy_size;
+            } else {
+                last = &bufv->buf[bufv->count++];
+                last->mem = mem + cur_buf_pos;
+                last->size = copy_size;
+                last->fd = -1;
+            }
+        } else {
+            int device;
+            off_t file_pos = device_offset(block_pos + cur_block_offset, device);
+            int fd = device_fd(device);
+            if (last && (last->flags & FUSE_BUF_IS_FD) && (last->fd == fd) && (last->pos + (off_t) last->size == file_pos)) {
+                last->size += copy_size;    // Blocks appended in a row are (mostly) contiguous in the disk file.
+            } else {
+                last = &bufv->buf[bufv->count++];
+                last->flags = (enum fuse_buf_flags) (FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK);
+                last->fd = fd;
+                last->pos = file_pos;
+                last->size = copy_size;
+            }
+        }
+
+        cur_buf_pos += copy_size;
+        cur_block_offset += copy_size;
+        if (cur_block_offset == BLOCK_SIZE && cur_buf_pos < size) {
+            if (cur_block_ind + 1 == cur_inode->num_direct) {
+                get_inode_from_inum(cur_inode, cur_inode->next_indirect);
+                cur_block_ind = cur_block_offset = 0;
+            } else {
+                cur_block_ind += 1;
+                cur_block_offset = 0;
+            }
+        }
     }
     return size;
 }
@@ -364,18 +593,14 @@ int o_write(const char* path, const char* buf, size_t size, off_t offset, struct
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "WRITE, %s, %p, %d, %d, %p\n",
                resolve_prefix(path).c_str(), buf, size, offset, fi);
-    
-    if (is_full) {
-        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
-        logger(WARN, "====> Cannot proceed to write into the file.\n");
-        return -ENOSPC;
-    }
 
-    /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    metric_timer timer(OP_WRITE);
+
+    int stats_inum = stats_path_inode(path);
+    if (stats_inum != 0)
+        return write_stats_file(stats_inum, size);
 
     // In case the file is not open yet.
-    size_t len;
     if (fi->fh == 0) {
         int first_flag = 0, fh = 0;
         first_flag = locate(path, fh);
@@ -386,380 +611,818 @@ int o_write(const char* path, const char* buf, size_t size, off_t offset, struct
             return 0;
         }
     }
-    int inode_num = fi->fh;
+
+    int write_len = write_file(handle_inode(fi->fh), buf, size, offset);
+    if (write_len > 0)
+        count_metric(COUNT_BYTES_WRITTEN, write_len);
+    return (write_len == -ENOSPC) ? write_len : ((write_len < 0) ? 0 : write_len);
+}
+
+/** (for internal uses only) Fill the gap between the end of a file and a later offset with 0.
+ * The kernel writes back cached pages in any order, so the gap may be large: it is padded by chunks.
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the file. */
+void pad_file(int inode_num, size_t len, off_t offset) {
+    static const char padding_buf[MAX_REQUEST_SIZE] = {0};
+    while (offset > len) {
+        size_t pad_len = ((size_t) (offset - len) < sizeof(padding_buf)) ? (offset - len) : sizeof(padding_buf);
+        write_in_file(inode_num, padding_buf, pad_len, len);
+        len += pad_len;
+    }
+}
+
+/** (for internal uses only) Write into a file stored inline (or empty so far), within INLINE_DATA_SIZE.
+ * The whole write costs a single inode block, and no data block.
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the file.
+ * @return length: number of bytes written. */
+int write_inline(struct inode* cur_inode, const char* buf, size_t size, off_t offset) {
+    timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+
+    char* data = (char*) cur_inode->direct;
+    if (!has_inline_data(cur_inode))
+        memset(data, 0, INLINE_DATA_SIZE);      // Empty file: direct[] only holds -1 so far.
+    memcpy(data + offset, buf, size);           // Bytes past the end are 0, so gaps need no padding.
+
+    if (offset + size > cur_inode->fsize_byte)
+        cur_inode->fsize_byte = offset + size;
+    cur_inode->fsize_block = 0;
+    update_atime(cur_inode, cur_time);
+    if (FUNC_TIMESTAMPS)
+        cur_inode->mtime = cur_time;
+    new_inode_block(cur_inode);
+    return size;
+}
+
+/** (for internal uses only) Move the data of an inline file into data blocks (before it outgrows the inode).
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the file. */
+void expand_inline(int inode_num, struct inode* cur_inode) {
+    char data[INLINE_DATA_SIZE];
+    int len = cur_inode->fsize_byte;
+    memcpy(data, cur_inode->direct, len);
+
+    truncate_inode(cur_inode, -1);
+    cur_inode->fsize_byte = cur_inode->fsize_block = 0;
+    write_in_file(inode_num, data, len, 0);
+}
+
+/** Write the specified segment of a file (padding 0 if offset exceeds its length).
+ * @param  inode_num: i_number of the file.
+ * @param  ...: please refer to standard ".write" interface.
+ * @return length: number of bytes written, or standard negative error codes on error. */
+int write_file(int inode_num, const char* buf, size_t size, off_t offset) {
+    if (is_full) {
+        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
+        logger(WARN, "====> Cannot proceed to write into the file.\n");
+        return -ENOSPC;
+    }
+
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
 
     /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inode_num]);
+    std::lock_guard <std::shared_mutex> guard(inode_lock(inode_num));
     /* This will be automatically released on each exit path. */
 
     inode* cur_inode;
-    int perm_flag = 0;
     get_inode_from_inum(cur_inode, inode_num);
-    if (!verify_permission(PERM_WRITE, cur_inode, user_info, ENABLE_PERMISSION)) {
+    if (!verify_permission(PERM_WRITE, cur_inode, user_info, ENABLE_PERMISSION && !writeback_cache)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
-        return 0;
+        return -EACCES;
+    }
+    if (cur_inode->mode != MODE_FILE) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
+        return -EISDIR;
+    }
+
+    // Small files are kept in the inode, until they grow beyond it.
+    if (cur_inode->num_direct == 0) {
+        if (USE_INLINE_DATA && (offset + size <= INLINE_DATA_SIZE))
+            return write_inline(cur_inode, buf, size, offset);
+        if (has_inline_data(cur_inode))
+            expand_inline(inode_num, cur_inode);
     }
 
     // If offset exceeds current length, pad 0 in the gap.
-    len = cur_inode->fsize_byte;
-    if (offset > len) {
-        char padding_buf[offset - len + 1];
-        memset(padding_buf, 0, sizeof(padding_buf));
-        write_in_file(path, padding_buf, offset - len, len, fi);
+    size_t len = cur_inode->fsize_byte;
+    if (offset > len)
+        pad_file(inode_num, len, offset);
+
+    int write_length = write_in_file(inode_num, buf, size, offset);
+    // A segment could not be written meanwhile: the rest of the data is not stored (see device.h).
+    if (has_write_errors())
+        return -EIO;
+    return write_length;
+}
+
+ssize_t o_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                          const char* path_out, struct fuse_file_info* fi_out, off_t offset_out, size_t size, int flags) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "COPY_FILE_RANGE, %s, %p, %d, %s, %p, %d, %d, %d\n",
+               resolve_prefix(path_in).c_str(), fi_in, offset_in,
+               resolve_prefix(path_out).c_str(), fi_out, offset_out, size, flags);
+
+    metric_timer timer(OP_COPY_FILE_RANGE);
+
+    int src_inum, dst_inum;
+    int locate_err = locate(path_in, src_inum);
+    if (locate_err == 0)
+        locate_err = locate(path_out, dst_inum);
+    if (locate_err != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the file. \n");
+        return locate_err;
     }
+    if (!(fi_out->fh & FH_WRITABLE))
+        return -EBADF;
 
-    int write_len = write_in_file(path, buf, size, offset, fi);
-    return write_len;
+    return copy_file(src_inum, offset_in, dst_inum, offset_out, size);
 }
 
-int o_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+int o_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi, unsigned int flags, void* data) {
     if (DEBUG_PRINT_COMMAND)
-        logger(DEBUG, "CREATE, %s, %o, %p\n",
-               resolve_prefix(path).c_str(), mode, fi);
-    
+        logger(DEBUG, "IOCTL, %s, %x, %p, %p, %u, %p\n",
+               resolve_prefix(path).c_str(), cmd, arg, fi, flags, data);
+
+    metric_timer timer(OP_IOCTL);
+
+    int inode_num;
+    int locate_err = locate(path, inode_num);
+    if (locate_err != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the file. \n");
+        return locate_err;
+    }
+
+    return file_ioctl(inode_num, cmd, data, fi->fh & FH_WRITABLE);
+}
+
+/** (for internal uses only) Copy a range of a file through read_file() and write_file().
+ * @return length: number of bytes copied, or standard negative error codes on error. */
+ssize_t copy_file_data(int src_inum, off_t src_off, int dst_inum, off_t dst_off, size_t len) {
+    char* buf = (char*) malloc(MAX_REQUEST_SIZE);
+    if (buf == NULL)
+        return -ENOMEM;
+
+    ssize_t copied = 0;
+    while (copied < len) {
+        size_t chunk = (len - copied < MAX_REQUEST_SIZE) ? (len - copied) : MAX_REQUEST_SIZE;
+        int read_len = read_file(src_inum, buf, chunk, src_off + copied);
+        if (read_len <= 0) {
+            if ((read_len < 0) && (copied == 0))
+                copied = read_len;
+            break;
+        }
+        int write_len = write_file(dst_inum, buf, read_len, dst_off + copied);
+        if (write_len <= 0) {
+            if ((write_len < 0) && (copied == 0))
+                copied = write_len;
+            break;
+        }
+        copied += write_len;
+        if (read_len < chunk)
+            break;
+    }
+
+    free(buf);
+    return copied;
+}
+
+/** (for internal uses only) Locate a block of a file in its inode chain.
+ * @param  cur_inode: the head inode, replaced by the inode holding the block.
+ * @param  block_ind: index of the block in the whole file.
+ * @return direct_index: index of the block w.r.t. direct[] of that inode
+ *         (num_direct of the last inode, if the block is right after the end of file). */
+int locate_file_block(inode* &cur_inode, int block_ind) {
+    while ((block_ind >= cur_inode->num_direct) && (cur_inode->next_indirect != 0)) {
+        block_ind -= cur_inode->num_direct;
+        get_inode_from_inum(cur_inode, cur_inode->next_indirect);
+    }
+    return block_ind;
+}
+
+/** Share whole blocks of a file with another file (or another range of the same file).
+ * Blocks of the destination in the range are replaced, and the destination is extended if needed
+ * (padding 0 up to dst_off first). No data block is appended: only the inodes are rewritten.
+ * @param  src_inum: i_number of the source file.
+ * @param  src_off: start of the source range (multiple of BLOCK_SIZE).
+ * @param  dst_inum: i_number of the destination file.
+ * @param  dst_off: start of the destination range (multiple of BLOCK_SIZE).
+ * @param  len: length of the range (only whole blocks within the source are shared).
+ * @return length: number of bytes shared (a multiple of BLOCK_SIZE), -EOPNOTSUPP if blocks
+ *         cannot be shared (the range should be copied then), or other negative error codes. */
+ssize_t clone_file_range(int src_inum, off_t src_off, int dst_inum, off_t dst_off, size_t len) {
+    if ((src_off % BLOCK_SIZE != 0) || (dst_off % BLOCK_SIZE != 0) || !USE_DEDUP)
+        return -EOPNOTSUPP;
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
-        logger(WARN, "====> Cannot proceed to create a new file.\n");
+        logger(WARN, "====> Cannot proceed to clone the file.\n");
         return -ENOSPC;
     }
-    
+
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
 
-    mode &= 0777;
-    
-    std::string tmp = relative_to_absolute(path, "../", 0);
-    char* parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(parent_dir, tmp.c_str());
+    timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+
+    /* The inode-level fine-grained lock is added manually. */
+    std::set <int> get_inodes;
+    get_inodes.insert(src_inum);
+    get_inodes.insert(dst_inum);
 
-    tmp = current_fname(path);
-    char* dirname = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(dirname, tmp.c_str());
+    acquire_inode_locks(get_inodes);
+    /* This has to be manually released on each exit path. */
 
-    if (strlen(dirname) >= MAX_FILENAME_LEN) {
+    inode *src_inode, *dst_head;
+    get_inode_from_inum(src_inode, src_inum);
+    get_inode_from_inum(dst_head, dst_inum);
+    int flag = 0;
+    if ((src_inode->mode != MODE_FILE) || (dst_head->mode != MODE_FILE)) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Directory name too long: length %d > %d.\n", strlen(dirname), MAX_FILENAME_LEN);
-        free(parent_dir); free(dirname);
-        return -ENAMETOOLONG;
+            logger(ERROR, "[ERROR] Inode #%d or #%d is not a file.\n", src_inum, dst_inum);
+        flag = -EISDIR;
+    } else if (!verify_permission(PERM_READ, src_inode, user_info, ENABLE_PERMISSION)
+               || !verify_permission(PERM_WRITE, dst_head, user_info, ENABLE_PERMISSION)) {
+        if (ERROR_PERM)
+            logger(ERROR, "[ERROR] Permission denied: not allowed to clone.\n");
+        flag = -EACCES;
+    } else if (has_inline_data(src_inode)) {
+        flag = -EOPNOTSUPP;     // Inline data has no blocks to share.
+    }
+    if (flag != 0) {
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return flag;
+    }
+
+    // Only whole blocks of the source are shared.
+    size_t src_len = src_inode->fsize_byte;
+    int num_blocks = 0;
+    if (src_off < src_len)
+        num_blocks = ((len < src_len - src_off) ? len : (src_len - src_off)) / BLOCK_SIZE;
+    if (num_blocks == 0) {
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return 0;
     }
+
+    // The destination holds blocks up to dst_off, so that the range can be shared in place.
+    if ((dst_head->num_direct == 0) && has_inline_data(dst_head))
+        expand_inline(dst_inum, dst_head);
+    if (dst_off > dst_head->fsize_byte)
+        pad_file(dst_inum, dst_head->fsize_byte, dst_off);
+
+    inode* dst_inode = dst_head;
+    int src_ind = locate_file_block(src_inode, src_off / BLOCK_SIZE);
+    int dst_ind = locate_file_block(dst_inode, dst_off / BLOCK_SIZE);
+    for (int i = 0; i < num_blocks; i++) {
+        if (src_ind == src_inode->num_direct) {
+            get_inode_from_inum(src_inode, src_inode->next_indirect);
+            src_ind = 0;
+        }
+        if (dst_ind < dst_inode->num_direct) {
+            file_share(dst_inode, dst_ind, src_inode, src_ind);
+            dst_ind += 1;
+        } else {
+            file_add_shared(dst_inode, src_inode, src_ind);
+            dst_ind = dst_inode->num_direct;
+        }
+        src_ind += 1;
+
+        // Existing blocks of the destination continue in the next inode.
+        if ((dst_ind == dst_inode->num_direct) && (dst_inode->next_indirect != 0)) {
+            new_inode_block(dst_inode);
+            get_inode_from_inum(dst_inode, dst_inode->next_indirect);
+            dst_ind = 0;
+        }
+    }
+    if (dst_inode != dst_head)
+        new_inode_block(dst_inode);
+
+    // Update the size and timestamps of the destination.
+    size_t end = dst_off + (size_t) num_blocks * BLOCK_SIZE;
+    if (end > dst_head->fsize_byte) {
+        dst_head->fsize_byte = end;
+        dst_head->fsize_block = (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+    update_atime(dst_head, cur_time);
+    if (FUNC_TIMESTAMPS)
+        dst_head->mtime = cur_time;
+    new_inode_block(dst_head);
+
+    /* Manually release inode locks */
+    release_inode_locks(get_inodes);
+    access_file(src_inum);
+    return (ssize_t) num_blocks * BLOCK_SIZE;
+}
+
+/** (for internal uses only) Verify that the caller may read (or write) a file copied from (or into).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int verify_copy_permission(int inode_num, int perm) {
+    if ((inode_num <= 0) || (inode_num >= MAX_NUM_INODE) || !is_live_inode(inode_num))
+        return -EBADF;
+
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    /* The inode-level fine-grained lock is added by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(inode_num));
+    /* This will be automatically released on each exit path. */
+
+    inode* cur_inode;
+    get_inode_from_inum(cur_inode, inode_num);
+    if (cur_inode->mode != MODE_FILE) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
+        return -EISDIR;
+    }
+    if (!verify_permission(perm, cur_inode, user_info, ENABLE_PERMISSION)) {
+        if (ERROR_PERM)
+            logger(ERROR, "[ERROR] Permission denied: not allowed to copy.\n");
+        return -EACCES;
+    }
+    return 0;
+}
+
+/** Copy a range of a file into another file (or elsewhere in the same file), as copy_file_range(2).
+ * Whole blocks at the same offset within a block are shared by clone_file_range(); the partial
+ * blocks around them (or the whole range, if the offsets are not congruent) are copied.
+ * @param  src_inum, src_off: the source file and the start of the range.
+ * @param  dst_inum, dst_off: the destination file and the start of the range.
+ * @param  len: length of the range (the copy stops at the end of the source).
+ * @return length: number of bytes copied, or standard negative error codes on error. */
+ssize_t copy_file(int src_inum, off_t src_off, int dst_inum, off_t dst_off, size_t len) {
+    if ((src_inum == dst_inum) && (src_off < dst_off + (off_t) len) && (dst_off < src_off + (off_t) len)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot copy overlapping ranges of a file.\n");
+        return -EINVAL;
+    }
+
+    // read_file() and write_file() may skip permission checks (with the writeback cache): check them here.
+    int flag = verify_copy_permission(src_inum, PERM_READ);
+    if (flag == 0)
+        flag = verify_copy_permission(dst_inum, PERM_WRITE);
+    if (flag != 0)
+        return flag;
+
+    ssize_t copied = 0;
+    size_t head = (BLOCK_SIZE - src_off % BLOCK_SIZE) % BLOCK_SIZE;
+    if ((src_off % BLOCK_SIZE == dst_off % BLOCK_SIZE) && (len >= head + BLOCK_SIZE)) {
+        if (head > 0) {
+            copied = copy_file_data(src_inum, src_off, dst_inum, dst_off, head);
+            if (copied < (ssize_t) head)
+                return copied;
+        }
+        ssize_t cloned = clone_file_range(src_inum, src_off + head, dst_inum, dst_off + head,
+                                          (len - head) / BLOCK_SIZE * BLOCK_SIZE);
+        if ((cloned < 0) && (cloned != -EOPNOTSUPP))
+            return (copied > 0) ? copied : cloned;
+        if (cloned > 0)
+            copied += cloned;
+    }
+
+    ssize_t rest = copy_file_data(src_inum, src_off + copied, dst_inum, dst_off + copied, len - copied);
+    if (rest < 0)
+        return (copied > 0) ? copied : rest;
+    return copied + rest;
+}
+
+/** Handle an ioctl() on a file (only LFS_IOC_CLONE_RANGE is supported, see clone.h).
+ * @param  inode_num: i_number of the file (the destination of a clone).
+ * @param  cmd: the ioctl command.
+ * @param  data: input buffer of the command.
+ * @param  writable: whether the file is open for writing (see file_handle()).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int file_ioctl(int inode_num, int cmd, const void* data, bool writable) {
+    if ((unsigned int) cmd != LFS_IOC_CLONE_RANGE)
+        return -ENOTTY;
+    if (!writable)
+        return -EBADF;      // As FICLONERANGE, on a destination not open for writing.
+
+    struct lfs_clone_range range;
+    memcpy(&range, data, sizeof(range));
+    if ((range.src_ino >= MAX_NUM_INODE) || !is_live_inode(range.src_ino))
+        return -EBADF;
+    if ((range.src_offset % BLOCK_SIZE != 0) || (range.dest_offset % BLOCK_SIZE != 0))
+        return -EINVAL;
+
+    // A length of 0 clones up to the end of the source.
+    size_t len = range.src_length;
+    if (len == 0) {
+        std::shared_lock <std::shared_mutex> guard(inode_lock(range.src_ino));
+        inode* src_inode;
+        get_inode_from_inum(src_inode, range.src_ino);
+        if (range.src_offset < src_inode->fsize_byte)
+            len = src_inode->fsize_byte - range.src_offset;
+    }
+
+    ssize_t copied = copy_file(range.src_ino, range.src_offset, inode_num, range.dest_offset, len);
+    return (copied < 0) ? copied : 0;
+}
+
+int o_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "CREATE, %s, %o, %p\n",
+               resolve_prefix(path).c_str(), mode, fi);
+
+    metric_timer timer(OP_CREATE);
+
     int par_inum;
-    int locate_err = locate(parent_dir, par_inum);
+    std::string file_name;
+    int locate_err = locate_parent(path, par_inum, file_name);
     if (locate_err != 0) {
         if (ERROR_FILE)
             logger(ERROR, "[ERROR] Cannot open the parent directory of %s (error #%d).\n", path, locate_err);
-        free(parent_dir); free(dirname);
         return locate_err;
     }
 
+    int new_inum;
+    int flag = create_file(par_inum, file_name.c_str(), mode, new_inum);
+    if (flag == 0) {
+        hold_inode(new_inum);               // Dropped on release.
+        fi->fh = file_handle(new_inum, fi->flags);
+    }
+    return flag;
+}
+
+/** Create a new (empty) file in a directory.
+ * @param  par_inum: i_number of the parent directory.
+ * @param  name: name of the new file.
+ * @param  mode: permission of the new file.
+ * @param  new_inum: return variable (i_number of the new file).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int create_file(int par_inum, const char* name, mode_t mode, int &new_inum) {
+    if (is_full) {
+        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
+        logger(WARN, "====> Cannot proceed to create a new file.\n");
+        return -ENOSPC;
+    }
+    
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    mode &= 0777;
+
+    /* The inode-level fine-grained lock is added by a lock_guard. */
+    std::lock_guard <std::shared_mutex> guard(inode_lock(par_inum));
+    /* This will be automatically released on each exit path. */
+
     inode* head_inode;
     get_inode_from_inum(head_inode, par_inum);
     if (!verify_permission(PERM_WRITE, head_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
-            logger(ERROR, "[ERROR] Permission denied: not allowed to read.\n");
-        free(parent_dir); free(dirname);
+            logger(ERROR, "[ERROR] Permission denied: not allowed to write.\n");
         return -EACCES;
     }
 
     if (head_inode->mode != MODE_DIR) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] %s is not a directory.\n", parent_dir);
-        free(parent_dir); free(dirname);
+            logger(ERROR, "[ERROR] Inode #%d is not a directory.\n", par_inum);
         return -ENOTDIR;
     }
+    if (head_inode->num_links == 0) {   // Removed, but still referenced (see reclaim.h).
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Directory #%d is removed.\n", par_inum);
+        return -ENOENT;
+    }
+
+    if (strlen(name) >= max_name_length(head_inode)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] File name too long: length %d > %d.\n", strlen(name), max_name_length(head_inode));
+        return -ENAMETOOLONG;
+    }
     
     int tmp_inum;
-    locate_err = locate(path, tmp_inum);
-    if (locate_err == 0) {
+    if (search_directory(head_inode, name, tmp_inum)) {
         inode* tmp_inode;
         get_inode_from_inum(tmp_inode, tmp_inum);
         if ((tmp_inode->mode == MODE_FILE) && ERROR_FILE)
             logger(ERROR, "[ERROR] Duplicated name: there is a file with the same name.\n");
         if ((tmp_inode->mode == MODE_DIR) && ERROR_FILE)
             logger(ERROR, "[ERROR] Duplicated name: directory already exists.\n");
-        free(parent_dir); free(dirname);
         return -EEXIST;
     }
-
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[par_inum]);
-    /* This will be automatically released on each exit path. */
     
-    inode* file_inode;
+    inode* file_inode = NULL;
     file_initialize(file_inode, MODE_FILE, mode);
-    fi->fh = file_inode->i_number;
+    if (file_inode == NULL)     // No free i_number left.
+        return -ENOSPC;
+    new_inum = file_inode->i_number;
     
-    int flag = append_parent_dir_entry(head_inode, dirname, file_inode->i_number);
+    // The inode is written only once its entry exists: otherwise, it is dropped unreferenced.
+    int flag = append_parent_dir_entry(head_inode, name, file_inode->i_number);
+    if (flag != 0) {
+        remove_inode(file_inode->i_number);
+        return flag;
+    }
     new_inode_block(file_inode);
-    free(parent_dir); free(dirname);
-    return flag;
+    return 0;
 }
 
 int o_rename(const char* from, const char* to, unsigned int flags) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "RENAME, %s, %s, %d\n",
                resolve_prefix(from).c_str(), resolve_prefix(to).c_str(), flags);
-    
+
+    metric_timer timer(OP_RENAME);
+
+    int from_par_inum, to_par_inum;
+    std::string from_name, to_name;
+    int locate_err;
+    locate_err = locate_parent(from, from_par_inum, from_name);
+    if (locate_err != 0) {
+        logger(ERROR, "[ERROR] Fail to locate source parent directory.\n");
+        return locate_err;
+    }
+    if (relative_to_absolute(from, "../", 0) == relative_to_absolute(to, "../", 0)) {
+        // Renaming within a directory (the common case): resolve the parent only once.
+        to_par_inum = from_par_inum;
+        to_name = current_fname(to);
+    } else {
+        locate_err = locate_parent(to, to_par_inum, to_name);
+        if (locate_err != 0) {
+            logger(ERROR, "[ERROR] Fail to locate destination parent directory.\n");
+            return locate_err;
+        }
+    }
+
+    int flag = rename_file(from_par_inum, from_name.c_str(), to_par_inum, to_name.c_str(), flags);
+    if (flag == 0) {
+        notify_path(from);
+        notify_path(to);
+    }
+    return flag;
+}
+
+/** (for internal uses only) Notify the kernel of the entries and inodes changed by a rename.
+ * @param  to_inum: i_number of the object moved to the source name (on exchange), or 0. */
+void notify_rename(int from_par_inum, const char* from_name, int from_inum,
+                   int to_par_inum, const char* to_name, int to_inum) {
+    notify_entry(from_par_inum, from_name);
+    notify_entry(to_par_inum, to_name);
+    notify_inode(from_inum);
+    if (to_inum != 0)
+        notify_inode(to_inum);
+}
+
+/** Rename (move) a file / directory.
+ * Each name is resolved again once the inode locks are held, and the directory entries are changed
+ * in place where possible (the destination entry is re-pointed rather than removed and appended again).
+ * All changes are made within one log unit (see reserve_segment_space()), so that they are
+ * sealed in the same segment; the new name is always written before the old one is removed.
+ * @param  from_par_inum, from_name: source parent directory and name.
+ * @param  to_par_inum, to_name: destination parent directory and name.
+ * @param  flags: 0, RENAME_NOREPLACE or RENAME_EXCHANGE.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int rename_file(int from_par_inum, const char* from_name, int to_par_inum, const char* to_name, unsigned int flags) {
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
         logger(WARN, "====> Cannot proceed to rename the file.\n");
         return -ENOSPC;
     }
+    if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) || (flags == (RENAME_NOREPLACE | RENAME_EXCHANGE)))
+        return -EINVAL;
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
     
     timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
-    
-    std::string tmp = relative_to_absolute(from, "../", 0);
-    char* from_parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(from_parent_dir, tmp.c_str());
-
-    tmp = relative_to_absolute(to, "../", 0);
-    char* to_parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(to_parent_dir, tmp.c_str());
-
-    tmp = current_fname(from);
-    char* from_name = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(from_name, tmp.c_str());
-
-    tmp = current_fname(to);
-    char* to_name = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(to_name, tmp.c_str());
-
-    int from_inum, to_inum, from_par_inum, to_par_inum;
-    if (strlen(to_name) >= MAX_FILENAME_LEN) {
-        logger(ERROR, "[ERROR] Directory name too long: length %d > %d.\n", strlen(to_name), MAX_FILENAME_LEN);
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        return -ENAMETOOLONG;
-    }
 
-    int locate_err;
-    locate_err = locate(from_parent_dir, from_par_inum);
-    if (locate_err != 0) {
-        logger(ERROR, "[ERROR] Fail to locate source parent directory.\n");
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        return locate_err;
-    }
-    locate_err = locate(to_parent_dir, to_par_inum);
-    if (locate_err != 0) {
-        logger(ERROR, "[ERROR] Fail to locate destination parent directory.\n");
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        return locate_err;
-    }
-    locate_err = locate(from, from_inum);
-    if (locate_err != 0) {
-        logger(ERROR, "[ERROR] Source file does not exist.\n");
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        return locate_err;
+    /* Resolve both parent directories. */
+    inode* from_par_inode;
+    inode* to_par_inode;
+    get_inode_from_inum(from_par_inode, from_par_inum);
+    get_inode_from_inum(to_par_inode, to_par_inum);
+    if (strlen(to_name) >= max_name_length(to_par_inode)) {
+        logger(ERROR, "[ERROR] Directory name too long: length %d > %d.\n", strlen(to_name), max_name_length(to_par_inode));
+        return -ENAMETOOLONG;
     }
 
-    locate_err = locate(to, to_inum);  // This is not necessarily an error.
-
     /* The inode-level fine-grained lock is added manually. */
+    // The locks cover the objects both names refer to, so the names are resolved before they are
+    // taken; they are resolved again once held, and the locks re-taken if either entry changed meanwhile.
+    int from_inum, to_inum;
     std::set <int> get_inodes;
-    get_inodes.insert(from_par_inum);
-    get_inodes.insert(to_par_inum);
-    get_inodes.insert(from_inum);
-    if (locate_err == 0)
-        get_inodes.insert(to_inum);
+    while (1) {
+        to_inum = 0;
+        if (!search_directory(from_par_inode, from_name, from_inum)) {
+            logger(ERROR, "[ERROR] Source file does not exist.\n");
+            return -ENOENT;
+        }
+        search_directory(to_par_inode, to_name, to_inum);   // A missing destination is not necessarily an error.
+
+        get_inodes.clear();
+        get_inodes.insert(from_par_inum);
+        get_inodes.insert(to_par_inum);
+        get_inodes.insert(from_inum);
+        if (to_inum != 0)
+            get_inodes.insert(to_inum);
+        acquire_inode_locks(get_inodes);
+        /* This has to be manually released on each exit path. */
+
+        int locked_from_inum = 0, locked_to_inum = 0;
+        search_directory(from_par_inode, from_name, locked_from_inum);
+        search_directory(to_par_inode, to_name, locked_to_inum);
+        if ((locked_from_inum == from_inum) && (locked_to_inum == to_inum))
+            break;
+        release_inode_locks(get_inodes);
+    }
 
-    for (auto it:get_inodes)
-        inode_lock[it].lock();
-    /* This has to be manually released on each exit path. */
+    if ((to_inum != 0) && (flags == RENAME_NOREPLACE)) {
+        logger(ERROR, "[ERROR] Destination file already exists, and cannot be overwritten.\n");
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -EEXIST;
+    }
+    if ((to_inum == 0) && (flags == RENAME_EXCHANGE)) {
+        logger(ERROR, "[ERROR] Destination file does not exist, and cannot be exchanged.\n");
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -ENOENT;
+    }
+    if (to_inum == from_inum) { // Both names already refer to the same object.
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return 0;
+    }
 
-    if (locate_err == 0) {  // Destination file already exists.
-        if (flags == RENAME_NOREPLACE) {
-            logger(ERROR, "[ERROR] Destination file already exists, and cannot be overwritten.\n");
-            free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-            /* Manually release inode locks */
-            for (auto it:get_inodes) inode_lock[it].unlock();
-            return -EEXIST;
-        }
+    if (!verify_permission(PERM_WRITE | PERM_READ, from_par_inode, user_info, ENABLE_PERMISSION)
+        || !verify_permission(PERM_WRITE | PERM_READ, to_par_inode, user_info, ENABLE_PERMISSION)) {
+        if (ERROR_PERM)
+            logger(ERROR, "[ERROR] Permission denied: not allowed to write source or dest dir inode.\n");
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -EACCES;
+    }
 
-        inode* from_inode;
-        get_inode_from_inum(from_inode, from_inum);
-
-        inode* from_par_inode;
-        get_inode_from_inum(from_par_inode, from_par_inum);
-        if (!verify_permission(PERM_WRITE | PERM_READ, from_par_inode, user_info, ENABLE_PERMISSION)) {
-            if (ERROR_PERM)
-                logger(ERROR, "[ERROR] Permission denied: not allowed to write source dir inode.\n");
-            free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-            /* Manually release inode locks */
-            for (auto it:get_inodes) inode_lock[it].unlock();
-            return -EACCES;
-        }
+    if (to_par_inode->num_links == 0) {     // Removed, but still referenced (see reclaim.h).
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -ENOENT;
+    }
 
-        inode* to_inode;
+    inode* from_inode;
+    inode* to_inode = NULL;
+    get_inode_from_inum(from_inode, from_inum);
+    if (to_inum != 0)
         get_inode_from_inum(to_inode, to_inum);
+    if ((to_inode != NULL) && (flags != RENAME_EXCHANGE) && (to_inode->mode != from_inode->mode)) {
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return (to_inode->mode == MODE_DIR) ? -EISDIR : -ENOTDIR;
+    }
 
-        inode* to_par_inode;
-        get_inode_from_inum(to_par_inode, to_par_inum);
-        if (!verify_permission(PERM_WRITE | PERM_READ, to_par_inode, user_info, ENABLE_PERMISSION)) {
-            if (ERROR_PERM)
-                logger(ERROR, "[ERROR] Permission denied: not allowed to write dest dir inode.\n");
-            free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-            /* Manually release inode locks */
-            for (auto it:get_inodes) inode_lock[it].unlock();
-            return -EACCES;
+    // Up to 4 inodes, a few directory blocks, and index nodes or mid inodes if directories grow.
+    reserve_segment_space(16, 8);
+
+    int flag = 0;
+    if (flags == RENAME_EXCHANGE) {
+        // Exchange: re-point both entries in place (the first one is restored if the second fails).
+        if (!replace_parent_dir_entry(to_par_inode, to_name, to_inum, from_inum)) {
+            flag = -EIO;
+        } else if (!replace_parent_dir_entry(from_par_inode, from_name, from_inum, to_inum)) {
+            replace_parent_dir_entry(to_par_inode, to_name, from_inum, to_inum);
+            flag = -EIO;
+        } else {
+            if (FUNC_TIMESTAMPS)
+                to_inode->ctime = cur_time;
+            new_inode_block(to_inode);
         }
-        
-        // Update timestamps.
-        if (FUNC_TIMESTAMPS) {
-            to_par_inode->mtime = cur_time;
-            from_par_inode->mtime = cur_time;
-            to_par_inode->ctime = cur_time;
-            from_par_inode->ctime = cur_time;
+    } else if (to_inode != NULL) {
+        // Overwrite: re-point the destination entry, then release the object it referred to.
+        flag = check_removable(to_inum, to_name, to_inode->mode, cur_time);
+        if ((flag == 0) && !replace_parent_dir_entry(to_par_inode, to_name, to_inum, from_inum))
+            flag = -EIO;
+        if (flag == 0) {
+            remove_parent_dir_entry(from_par_inode, from_inum, from_name);
+            release_object(to_inum, cur_time);
         }
-        new_inode_block(to_par_inode);
-        new_inode_block(from_par_inode);
-        
-        
-        // Conflict case 1: exchange files.
-        if (flags == RENAME_EXCHANGE) {
-            // Remove destination directory entry.
-            remove_parent_dir_entry(to_par_inode, to_inum, to_name);
-
-            // On exchange, remove source directory entry as well.
+    } else {
+        // Base case: the destination does not exist.
+        flag = append_parent_dir_entry(to_par_inode, to_name, from_inum);
+        if (flag == 0)
             remove_parent_dir_entry(from_par_inode, from_inum, from_name);
+    }
 
-            // Update timestamps.
-            if (FUNC_TIMESTAMPS) {
-                to_inode->ctime = cur_time;
-                new_inode_block(to_inode);
-            }
-
-            inode* head_inode;
-            get_inode_from_inum(head_inode, to_par_inum);
-            append_parent_dir_entry(head_inode, from_name, from_inum);
-
-            get_inode_from_inum(head_inode, from_par_inum);
-            int flag = append_parent_dir_entry(head_inode, to_name, to_inum);
-            free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-            /* Manually release inode locks */
-            for (auto it:get_inodes) inode_lock[it].unlock();
-            return flag;
+    if (flag == 0) {
+        // Commit each modified inode once.
+        if (FUNC_TIMESTAMPS) {
+            from_par_inode->mtime = from_par_inode->ctime = cur_time;
+            to_par_inode->mtime = to_par_inode->ctime = cur_time;
+            from_inode->ctime = cur_time;
         }
-        
-        remove_object(to_par_inode, to_name, to_inode->mode);
-    } 
-    
-    // Conflict case 2: overwrite destination file.
-    // Base case: destination file does not exist.
-    inode* from_inode;
-    get_inode_from_inum(from_inode, from_inum);
-    inode* from_par_inode;
-    get_inode_from_inum(from_par_inode, from_par_inum);
-    if (!verify_permission(PERM_WRITE | PERM_READ, from_par_inode, user_info, ENABLE_PERMISSION)) {
-        if (ERROR_PERM)
-            logger(ERROR, "[ERROR] Permission denied: not allowed to write source dir inode.\n");
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        /* Manually release inode locks */
-        for (auto it:get_inodes) inode_lock[it].unlock();
-        return -EACCES;
-    }
-    
-    // Update timestamps.
-    if (FUNC_TIMESTAMPS) {
-        from_par_inode->mtime = cur_time;
-        from_inode->ctime = cur_time;
+        new_inode_block(from_par_inode);
+        if (to_par_inode != from_par_inode)
+            new_inode_block(to_par_inode);
+        new_inode_block(from_inode);
     }
-    new_inode_block(from_par_inode);
-    new_inode_block(from_inode);
-
-    // Remove source directory entry.
-    remove_parent_dir_entry(from_par_inode, from_inum, from_name);
 
-    inode* head_inode;
-    get_inode_from_inum(head_inode, to_par_inum);
-    if (!verify_permission(PERM_WRITE | PERM_READ, head_inode, user_info, ENABLE_PERMISSION)) {
-        if (ERROR_PERM)
-            logger(ERROR, "[ERROR] Permission denied: not allowed to dest dir inode.\n");
-        free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
-        /* Manually release inode locks */
-        for (auto it:get_inodes) inode_lock[it].unlock();
-        return -EACCES;
-    }
-    int flag = append_parent_dir_entry(head_inode, to_name, from_inum);
-    free(from_parent_dir); free(to_parent_dir); free(from_name); free(to_name);
     /* Manually release inode locks */
-    for (auto it:get_inodes) inode_lock[it].unlock();
+    release_inode_locks(get_inodes);
+    if (flag == 0)
+        notify_rename(from_par_inum, from_name, from_inum, to_par_inum, to_name, (flags == RENAME_EXCHANGE) ? to_inum : 0);
     return flag;
 }
 
 int o_unlink(const char* path) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "UNLINK, %s\n", resolve_prefix(path).c_str());
-    
+
+    metric_timer timer(OP_UNLINK);
+
+    int par_inum;
+    std::string file_name;
+    int locate_err = locate_parent(path, par_inum, file_name);
+    if (locate_err != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the file (error #%d).\n", locate_err);
+        return locate_err;
+    }
+
+    return unlink_file(par_inum, file_name.c_str());
+}
+
+/** Remove a (hard link of a) file from a directory.
+ * @param  par_inum: i_number of the parent directory.
+ * @param  name: name of the file.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int unlink_file(int par_inum, const char* name) {
     if (is_full) {
         if (next_imap_index == BLOCKS_IN_SEGMENT) {
             logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
             logger(WARN, "====> Cannot proceed to unlink the file.\n");
             return -ENOSPC;
         } else {
-            // The disk remains full is no more inode is available.
-            is_full = (count_inode >= MAX_NUM_INODE-1);
+            // The disk remains full is no more inode is available (or after a write error).
+            is_full = (count_inode >= MAX_NUM_INODE-1) || has_write_errors();
         }
     }
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
-    
-    std::string tmp = relative_to_absolute(path, "../", 0);
-    char* parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(parent_dir, tmp.c_str());
-
-    tmp = current_fname(path);
-    char* file_name = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(file_name, tmp.c_str());
-
-    int par_inum, file_inum;
-    locate(parent_dir, par_inum);
-    int locate_err = locate(path, file_inum);
-    if (locate_err != 0) {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Cannot open the file (error #%d).\n", locate_err);
-        free(parent_dir); free(file_name);
-        return locate_err;
-    }
+    struct fuse_context* user_info = get_caller_context();
 
     inode* head_inode;
     get_inode_from_inum(head_inode, par_inum);
     if (!verify_permission(PERM_WRITE | PERM_READ, head_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to access parent directory.\n");
-        free(parent_dir); free(file_name);
         return -EACCES;
     }
 
-    tmp = relative_to_absolute(path, "./", 0);
-    char* delete_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(delete_dir, tmp.c_str());
     int delete_inum;
-    locate_err = locate(delete_dir, delete_inum);
+    if (!search_directory(head_inode, name, delete_inum)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the file (error #%d).\n", -ENOENT);
+        return -ENOENT;
+    }
 
     /* The inode-level fine-grained lock is added manually. */
     std::set <int> get_inodes;
     get_inodes.insert(par_inum);
     get_inodes.insert(delete_inum);
 
-    for (auto it:get_inodes)
-        inode_lock[it].lock();
+    acquire_inode_locks(get_inodes);
     /* This has to be manually released on each exit path. */
 
-    int flag = remove_object(head_inode, file_name, MODE_FILE);
-    free(parent_dir); free(file_name);
+    int flag = remove_object(head_inode, name, MODE_FILE);
     /* Manually release inode locks */
-    for (auto it:get_inodes) inode_lock[it].unlock();
+    release_inode_locks(get_inodes);
     return flag;
 }
 
 int o_link(const char* src, const char* dest) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "LINK, %s, %s\n", resolve_prefix(src).c_str(), resolve_prefix(dest).c_str());
-    
+
+    metric_timer timer(OP_LINK);
+
+    int src_inum, dest_par_inum;
+    std::string dest_name;
+    int locate_err = locate(src, src_inum);
+    if (locate_err != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open source file (error #%d).\n", locate_err);
+        return locate_err;
+    }
+    locate_err = locate_parent(dest, dest_par_inum, dest_name);
+    if (locate_err != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the destination directory (error #%d).\n", locate_err);
+        return locate_err;
+    }
+
+    return link_file(src_inum, dest_par_inum, dest_name.c_str());
+}
+
+/** Create a hard link to an existing file.
+ * @param  src_inum: i_number of the file.
+ * @param  dest_par_inum: i_number of the destination directory.
+ * @param  dest_name: name of the new link.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int link_file(int src_inum, int dest_par_inum, const char* dest_name) {
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
         logger(WARN, "====> Cannot proceed to create a hard link.\n");
@@ -767,97 +1430,68 @@ int o_link(const char* src, const char* dest) {
     }
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
     
     timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
-    
-    std::string tmp = relative_to_absolute(src, "../", 0);
-    char* src_parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(src_parent_dir, tmp.c_str());
 
-    tmp = relative_to_absolute(dest, "../", 0);
-    char* dest_parent_dir = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(dest_parent_dir, tmp.c_str());
-
-    tmp = current_fname(src);
-    char* src_name = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(src_name, tmp.c_str());
-
-    tmp = current_fname(dest);
-    char* dest_name = (char*) malloc((tmp.length() + 1) * SC);
-    strcpy(dest_name, tmp.c_str());
-
-    if (strlen(src_name) >= MAX_FILENAME_LEN || strlen(dest_name) >= MAX_FILENAME_LEN) {
+    inode* dest_par_head;
+    get_inode_from_inum(dest_par_head, dest_par_inum);
+    if (strlen(dest_name) >= max_name_length(dest_par_head)) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Name too long: length %d or %d > %d.\n", strlen(src_name), strlen(dest_name), MAX_FILENAME_LEN);
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
+            logger(ERROR, "[ERROR] Name too long: length %d > %d.\n", strlen(dest_name), max_name_length(dest_par_head));
         return -ENAMETOOLONG;
     }
 
-    int src_par_inum, dest_par_inum;
-    int src_inum, dest_inum;
     inode* src_inode;
-
-    int locate_err = locate(src, src_inum);
-    if (locate_err != 0) {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Cannot open source file (error #%d).\n", locate_err);
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
-        return locate_err;
-    }
     get_inode_from_inum(src_inode, src_inum);
     if (src_inode->mode != MODE_FILE) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] %s is not a file.\n", src_name);
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", src_inum);
         return -EISDIR;
     }
 
-    locate_err = locate(dest_parent_dir, dest_par_inum);
-    if (locate_err != 0) {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Cannot open the destination directory (error #%d).\n", locate_err);
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
-        return locate_err;
-    }
-    locate_err = locate(dest, dest_inum);
-    if (locate_err == 0) {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Duplicated name: there exists a file / directory with the same name.\n");
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
-        return -EEXIST;
-    }
-
     /* The inode-level fine-grained lock is added manually. */
     std::set <int> get_inodes;
     get_inodes.insert(dest_par_inum);
-    get_inodes.insert(dest_inum);
     get_inodes.insert(src_inum);
 
-    for (auto it:get_inodes)
-        inode_lock[it].lock();
+    acquire_inode_locks(get_inodes);
     /* This has to be manually released on each exit path. */
 
     inode* dest_par_inode;
     get_inode_from_inum(dest_par_inode, dest_par_inum);
+    if ((src_inode->num_links == 0) || (dest_par_inode->num_links == 0)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot link: the file or the directory is removed.\n");
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -ENOENT;
+    }
+    int dest_inum;
+    if (search_directory(dest_par_inode, dest_name, dest_inum)) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Duplicated name: there exists a file / directory with the same name.\n");
+        /* Manually release inode locks */
+        release_inode_locks(get_inodes);
+        return -EEXIST;
+    }
     if (!verify_permission(PERM_WRITE | PERM_READ, dest_par_inode, user_info, ENABLE_PERMISSION)) {
         if (ERROR_PERM)
             logger(ERROR, "[ERROR] Permission denied: not allowed to write dest directory.\n");
-        free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
         /* Manually release inode locks */
-        for (auto it:get_inodes) inode_lock[it].unlock();
+        release_inode_locks(get_inodes);
         return -EACCES;
     }
     int flag = append_parent_dir_entry(dest_par_inode, dest_name, src_inum);
-
-    src_inode->num_links += 1;
-    if (FUNC_TIMESTAMPS)
-        src_inode->ctime = cur_time;
-    new_inode_block(src_inode);
-    free(src_parent_dir); free(dest_parent_dir); free(src_name); free(dest_name);
+    if (flag == 0) {
+        src_inode->num_links += 1;
+        if (FUNC_TIMESTAMPS)
+            src_inode->ctime = cur_time;
+        new_inode_block(src_inode);
+    }
     /* Manually release inode locks */
-    for (auto it:get_inodes) inode_lock[it].unlock();
+    release_inode_locks(get_inodes);
     return flag;
 }
 
@@ -865,7 +1499,29 @@ int o_truncate(const char* path, off_t size, struct fuse_file_info *fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "TRUNCATE, %s, %d, %p\n",
                resolve_prefix(path).c_str(), size, fi);
-    
+
+    metric_timer timer(OP_TRUNCATE);
+
+    int stats_inum = stats_path_inode(path);
+    if (stats_inum != 0)    // Statistics files are truncated on open for writing: nothing to do.
+        return (stats_inum == STATS_DIR_INUM) ? -EISDIR : check_stats_access(stats_inum, W_OK);
+
+    int inode_num;
+    int first_flag = locate(path, inode_num);
+    if (first_flag != 0) {
+        if (ERROR_FILE)
+            logger(ERROR, "[ERROR] Cannot open the file. \n");
+        return first_flag;
+    }
+
+    return truncate_file(inode_num, size);
+}
+
+/** Resize a file: shrink it, or extend it with 0.
+ * @param  inode_num: i_number of the file.
+ * @param  size: new size of the file (in bytes).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int truncate_file(int inode_num, off_t size) {
     if (is_full) {
         logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
         logger(WARN, "====> Cannot proceed to truncate the file.\n");
@@ -873,21 +1529,13 @@ int o_truncate(const char* path, off_t size, struct fuse_file_info *fi) {
     }
 
     /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
     
     timespec cur_time;
     clock_gettime(CLOCK_REALTIME, &cur_time);
-
-    int inode_num;
-    int first_flag = locate(path, inode_num);
-    if (first_flag != 0) {
-        if (ERROR_FILE)
-            logger(ERROR, "[ERROR] Cannot open the file. \n");
-        return first_flag;
-    }
     
     /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inode_num]);
+    std::lock_guard <std::shared_mutex> guard(inode_lock(inode_num));
     /* This will be automatically released on each exit path. */
 
     inode* cur_inode;
@@ -899,12 +1547,43 @@ int o_truncate(const char* path, off_t size, struct fuse_file_info *fi) {
     }
     if (cur_inode->mode == MODE_DIR) {
         if (ERROR_FILE)
-            logger(ERROR, "[ERROR] %s is not a file.\n", path);
+            logger(ERROR, "[ERROR] Inode #%d is not a file.\n", inode_num);
         return -EISDIR;
     }
     
     int len = cur_inode->fsize_byte;
-    if (size >= len) {    // Do not need to truncate.
+    if (size == len) {    // Do not need to truncate.
+        return 0;
+    }
+
+    // Small (inline or empty) files are resized within the inode.
+    if (cur_inode->num_direct == 0) {
+        if (size == 0) {
+            truncate_inode(cur_inode, -1);
+            cur_inode->fsize_byte = cur_inode->fsize_block = 0;
+        } else if ((size <= INLINE_DATA_SIZE) && (USE_INLINE_DATA || has_inline_data(cur_inode))) {
+            char* data = (char*) cur_inode->direct;
+            if (!has_inline_data(cur_inode))
+                memset(data, 0, INLINE_DATA_SIZE);
+            else if (size < len)
+                memset(data + size, 0, len - size);     // Keep bytes past the end 0.
+            cur_inode->fsize_byte = size;
+            cur_inode->fsize_block = 0;
+        } else {
+            if (has_inline_data(cur_inode))
+                expand_inline(inode_num, cur_inode);
+            pad_file(inode_num, cur_inode->fsize_byte, size);
+            return 0;
+        }
+        update_atime(cur_inode, cur_time);
+        if (FUNC_TIMESTAMPS)
+            cur_inode->mtime = cur_time;
+        new_inode_block(cur_inode);
+        return 0;
+    }
+
+    if (size > len) {     // Extend the file with 0 (e.g. the kernel sets the size it owns with writeback cache).
+        pad_file(inode_num, len, size);
         return 0;
     }
     
@@ -925,7 +1604,8 @@ int o_truncate(const char* path, off_t size, struct fuse_file_info *fi) {
     int cur_block_offset = t_offset, cur_block_ind;
     cur_block_ind = t_offset / BLOCK_SIZE;
     cur_block_offset -= cur_block_ind * BLOCK_SIZE;
-    truncate_inode(cur_inode, cur_block_ind);
+    // A block starting exactly at the new size is dropped as well (so that a file truncated to 0 has no blocks).
+    truncate_inode(cur_inode, (cur_block_offset == 0) ? cur_block_ind - 1 : cur_block_ind);
     new_inode_block(cur_inode);
     return 0;
-}
\ No newline at end of file
+}
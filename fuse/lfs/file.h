@@ -3,6 +3,20 @@
 
 #include <fuse.h> /* fuse_file_info */
 #include <unistd.h> /* uid_t gid_t */
+#include <fcntl.h> /* O_ACCMODE */
+#include <stdint.h>
+
+/* The handle of an open file is its i_number, with FH_WRITABLE set if it is open for writing
+ * (a clone may only target a file open for writing, see file_ioctl()). */
+const uint64_t FH_WRITABLE = 1ULL << 32;
+
+inline uint64_t file_handle(int inode_num, int flags) {
+    return (uint64_t) inode_num | (((flags & O_ACCMODE) != O_RDONLY) ? FH_WRITABLE : 0);
+}
+
+inline int handle_inode(uint64_t fh) {
+    return (int) (fh & (FH_WRITABLE - 1));
+}
 
 int o_open(const char*, struct fuse_file_info*);
 int o_release(const char*, struct fuse_file_info*);
@@ -13,5 +27,22 @@ int o_rename(const char*, const char*, unsigned int);
 int o_unlink(const char* path);
 int o_link(const char*, const char*);
 int o_truncate(const char* path, off_t size, struct fuse_file_info *fi);
+ssize_t o_copy_file_range(const char*, struct fuse_file_info*, off_t, const char*, struct fuse_file_info*, off_t, size_t, int);
+int o_ioctl(const char*, int, void*, struct fuse_file_info*, unsigned int, void*);
+
+// Inode-based implementations (shared by the high-level and low-level interfaces).
+int open_file(int inode_num, int flags);
+int read_file(int inode_num, char* buf, size_t size, off_t offset);
+int read_file_buf(int inode_num, size_t size, off_t offset, struct fuse_bufvec* &bufv, char* mem);
+void access_file(int inode_num);
+int write_file(int inode_num, const char* buf, size_t size, off_t offset);
+int create_file(int par_inum, const char* name, mode_t mode, int &new_inum);
+int rename_file(int from_par_inum, const char* from_name, int to_par_inum, const char* to_name, unsigned int flags);
+int unlink_file(int par_inum, const char* name);
+int link_file(int src_inum, int dest_par_inum, const char* dest_name);
+int truncate_file(int inode_num, off_t size);
+ssize_t clone_file_range(int src_inum, off_t src_off, int dst_inum, off_t dst_off, size_t len);
+ssize_t copy_file(int src_inum, off_t src_off, int dst_inum, off_t dst_off, size_t len);
+int file_ioctl(int inode_num, int cmd, const void* data, bool writable);
 
 #endif
@@ -2,7 +2,8 @@
 
 #include "system.h"     /* o_init, o_destroy */
 #include "metadata.h"   /* o_getattr, o_access */
-#include "file.h"       /* o_open, o_release, o_read, o_write, o_create, o_rename, o_unlink, o_link, o_truncate */
+#include "file.h"       /* o_open, o_release, o_read, o_write, o_create, o_rename, o_unlink, o_link, o_truncate,
+                           o_ioctl, o_copy_file_range */
 #include "dir.h"        /* o_opendir, o_releasedir, o_readdir, o_mkdir, o_rmdir */
 #include "perm.h"       /* o_chmod, o_chown */
 #include "stats.h"      /* o_statfs, o_utimens */
@@ -37,4 +38,6 @@ struct fuse_operations ops = {
     .access     = o_access,
     .create     = o_create,
     .utimens    = o_utimens,
+    .ioctl      = o_ioctl,
+    .copy_file_range = o_copy_file_range,
 };
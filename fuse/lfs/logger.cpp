@@ -3,33 +3,447 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-FILE *OUTPUT = NULL;
+FILE *LOG_OUTPUT = NULL;
 log_level LOG_LEVEL = ERROR;
 
-void set_log_level(log_level level) {
-    LOG_LEVEL = level;
+/* Header of a record; the encoded arguments follow (8-byte words, or length-prefixed strings). */
+struct log_header {
+    uint32_t size;              // Size of the record (a multiple of 8).
+    uint16_t level;
+    uint16_t truncated;         // Whether some arguments did not fit into LOG_MAX_RECORD.
+    uint64_t seq;               // Global order of records.
+    const char* format;
+};
+
+/* Ring buffer of a thread: single producer (the thread), single consumer (the flusher). */
+struct log_ring {
+    char data[LOG_RING_SIZE];
+    std::atomic<uint64_t> head;     // Bytes ever written (by the producer).
+    std::atomic<uint64_t> tail;     // Bytes ever read (by the consumer).
+    std::atomic<uint64_t> dropped;
+    std::atomic<bool> orphaned;     // Whether its thread has exited.
+};
+
+std::atomic<uint64_t> log_seq(0);
+thread_local log_ring* local_ring = NULL;
+pthread_key_t ring_key;             // Orphans the ring of an exiting thread.
+
+std::mutex flush_lock;              // Serializes consumers (and the list of rings).
+std::vector<log_ring*> log_rings;
+unsigned long total_dropped = 0, reported_dropped = 0;
+
+std::once_flag flusher_once;
+std::atomic<bool> is_async(false);
+std::thread flusher;
+
+
+/** **************************************
+ * Conversion specifications (shared by producers and the flusher).
+ * ****************************************/
+struct log_spec {
+    const char* start;          // The '%' of the specification.
+    int length;                 // Length of the specification.
+    int stars;                  // Number of '*' (int arguments for width / precision).
+    char modifier;              // 0, 'H' (hh), 'h', 'l', 'L' (ll / q), 'D' (long double), 'j', 'z', 't'.
+    char conversion;
+};
+
+/** (for internal uses only) Find the next conversion specification of a format.
+ * @return pointer: the text after it, or NULL if there is none left ("%%" is skipped as text). */
+const char* next_spec(const char* p, log_spec &spec) {
+    while (true) {
+        p = strchr(p, '%');
+        if (p == NULL)
+            return NULL;
+        if (p[1] != '%')
+            break;
+        p += 2;
+    }
+    spec.start = p++;
+    spec.stars = 0;
+    spec.modifier = 0;
+    while ((*p != '\0') && (strchr("-+ #0'", *p) != NULL))
+        p++;
+    for (; (*p == '*') || ((*p >= '0') && (*p <= '9')) || (*p == '.'); p++)
+        spec.stars += (*p == '*');
+    if ((p[0] == 'h') && (p[1] == 'h')) {
+        spec.modifier = 'H';
+        p += 2;
+    } else if ((p[0] == 'l') && (p[1] == 'l')) {
+        spec.modifier = 'L';
+        p += 2;
+    } else if (*p == 'q') {
+        spec.modifier = 'L';
+        p++;
+    } else if (*p == 'L') {
+        spec.modifier = 'D';
+        p++;
+    } else if ((*p != '\0') && (strchr("hljzt", *p) != NULL)) {
+        spec.modifier = *p++;
+    }
+    spec.conversion = *p;
+    if (*p != '\0')
+        p++;
+    spec.length = p - spec.start;
+    return p;
 }
 
-void set_log_output(FILE *target) {
-    OUTPUT = target;
+/** (for internal uses only) Whether a conversion consumes an integer / a floating-point number. */
+bool is_int_conversion(char conversion) {
+    return (conversion != '\0') && (strchr("diouxXc", conversion) != NULL);
 }
 
-void logger(log_level level, char *s, ...) {
-    if (level == OFF)
-        return;
+bool is_float_conversion(char conversion) {
+    return (conversion != '\0') && (strchr("eEfFgGaA", conversion) != NULL);
+}
 
-    if (level == DEBUG && LOG_LEVEL != DEBUG)
-        return;
-    
-    if (level == WARN && (LOG_LEVEL != WARN && LOG_LEVEL != DEBUG))
+
+/** **************************************
+ * Producers.
+ * ****************************************/
+
+/** (for internal uses only) Orphan the ring of an exiting thread: the flusher frees it once drained. */
+void orphan_ring(void* ring) {
+    ((log_ring*) ring)->orphaned.store(true, std::memory_order_release);
+}
+
+/** (for internal uses only) Ring of the calling thread (registered on its first record). */
+log_ring* get_ring() {
+    if (local_ring != NULL)
+        return local_ring;
+    log_ring* ring = new log_ring;
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->dropped.store(0);
+    ring->orphaned.store(false);
+    {
+        std::lock_guard<std::mutex> guard(flush_lock);
+        log_rings.push_back(ring);
+    }
+    pthread_setspecific(ring_key, ring);
+    local_ring = ring;
+    return ring;
+}
+
+/** (for internal uses only) Append a word to a record being encoded. */
+bool put_word(char* record, size_t &pos, uint64_t word) {
+    if (pos + sizeof(word) > LOG_MAX_RECORD)
+        return false;
+    memcpy(record + pos, &word, sizeof(word));
+    pos += sizeof(word);
+    return true;
+}
+
+/** (for internal uses only) Append a string (length first, padded to 8 bytes), truncated if necessary. */
+bool put_string(char* record, size_t &pos, const char* str) {
+    if (str == NULL)
+        str = "(null)";
+    if (pos + 8 > LOG_MAX_RECORD)
+        return false;
+    uint32_t len = std::min(strlen(str), LOG_MAX_RECORD - pos - 8);
+    memcpy(record + pos, &len, sizeof(len));
+    memcpy(record + pos + 8, str, len);
+    pos += 8 + ((len + 7) & ~7);
+    return true;
+}
+
+/** Log a message (through the logger() macro, which tests the level first).
+ * @param  format: a string literal (only its address is recorded), as for printf(). */
+void log_record(log_level level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    if (!is_async.load(std::memory_order_acquire)) {
+        // Before the flusher starts (or after it stops on exit), messages are written right away.
+        std::lock_guard<std::mutex> guard(flush_lock);
+        if (LOG_OUTPUT != NULL) {
+            vfprintf(LOG_OUTPUT, format, args);
+            fflush(LOG_OUTPUT);
+        }
+        va_end(args);
         return;
-    
-    if (OUTPUT == NULL)
+    }
+
+    alignas(8) char record[LOG_MAX_RECORD];
+    size_t pos = sizeof(log_header);
+    bool fits = true;
+    log_spec spec;
+    for (const char* p = next_spec(format, spec); fits && (p != NULL); p = next_spec(p, spec)) {
+        for (int i=0; fits && (i<spec.stars); i++)
+            fits = put_word(record, pos, (int64_t) va_arg(args, int));
+        if (!fits)
+            break;
+
+        char c = spec.conversion;
+        if (is_int_conversion(c)) {
+            bool is_signed = (c == 'd') || (c == 'i');
+            uint64_t word;
+            switch (spec.modifier) {
+                case 'l': word = is_signed ? (int64_t) va_arg(args, long) : va_arg(args, unsigned long); break;
+                case 'L': word = is_signed ? (int64_t) va_arg(args, long long) : va_arg(args, unsigned long long); break;
+                case 'j': word = is_signed ? (int64_t) va_arg(args, intmax_t) : va_arg(args, uintmax_t); break;
+                case 'z': word = va_arg(args, size_t); break;
+                case 't': word = va_arg(args, ptrdiff_t); break;
+                default:  word = is_signed ? (int64_t) va_arg(args, int) : va_arg(args, unsigned int); break;
+            }
+            fits = put_word(record, pos, word);
+        } else if (is_float_conversion(c)) {
+            double value = (spec.modifier == 'D') ? (double) va_arg(args, long double) : va_arg(args, double);
+            uint64_t word;
+            memcpy(&word, &value, sizeof(word));
+            fits = put_word(record, pos, word);
+        } else if (c == 's') {
+            fits = put_string(record, pos, va_arg(args, const char*));
+        } else if ((c == 'p') || (c == 'n')) {
+            fits = put_word(record, pos, (uintptr_t) va_arg(args, void*));
+        }
+    }
+    va_end(args);
+
+    log_header header = {(uint32_t) pos, (uint16_t) level, (uint16_t) !fits, log_seq.fetch_add(1), format};
+    memcpy(record, &header, sizeof(header));
+
+    // Copy the record into the ring (it may wrap around), unless the flusher is too far behind.
+    log_ring* ring = get_ring();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t tail = ring->tail.load(std::memory_order_acquire);
+    if (head - tail + pos > LOG_RING_SIZE) {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
         return;
-    
-    va_list args;
-    va_start(args, s);
-    vfprintf(OUTPUT, s, args);
-    fflush(OUTPUT);
+    }
+    size_t offset = head & (LOG_RING_SIZE - 1);
+    size_t first = std::min(pos, LOG_RING_SIZE - offset);
+    memcpy(ring->data + offset, record, first);
+    memcpy(ring->data, record + first, pos - first);
+    ring->head.store(head + pos, std::memory_order_release);
+}
+
+
+/** **************************************
+ * The flusher.
+ * ****************************************/
+
+/** (for internal uses only) Format a record, as printf() would have.
+ * @param  text: return variable (the message is appended). */
+void format_record(const char* record, std::string &text) {
+    log_header header;
+    memcpy(&header, record, sizeof(header));
+    const char* args = record + sizeof(log_header);
+    const char* end = record + header.size;
+    char spec_text[64], buf[LOG_MAX_RECORD + 64];
+
+    const char* p = header.format;
+    log_spec spec;
+    for (const char* next = next_spec(p, spec); next != NULL; p = next, next = next_spec(p, spec)) {
+        // Literal text ("%%" included) up to the specification.
+        for (; p < spec.start; p++) {
+            text += *p;
+            if ((p[0] == '%') && (p[1] == '%'))
+                p++;
+        }
+        int needed = spec.stars * 8;
+        if (is_int_conversion(spec.conversion) || is_float_conversion(spec.conversion) || (spec.conversion == 'p'))
+            needed += 8;
+        if (args + needed > end) {     // Arguments were truncated (strings are checked below).
+            text += "...";
+            return;
+        }
+
+        // Rebuild the specification, with '*' replaced by the recorded values.
+        int len = 0;
+        for (int i=0; (i<spec.length) && (len < (int) sizeof(spec_text) - 24); i++) {
+            if (spec.start[i] == '*') {
+                int64_t value;
+                memcpy(&value, args, sizeof(value));
+                args += 8;
+                len += snprintf(spec_text + len, sizeof(spec_text) - len, "%d", (int) value);
+            } else {
+                spec_text[len++] = spec.start[i];
+            }
+        }
+        spec_text[len] = '\0';
+
+        uint64_t word = 0;
+        char c = spec.conversion;
+        if (is_int_conversion(c) || is_float_conversion(c) || (c == 'p') || (c == 'n')) {
+            memcpy(&word, args, sizeof(word));
+            args += 8;
+        }
+        buf[0] = '\0';
+        if (is_int_conversion(c)) {
+            bool is_signed = (c == 'd') || (c == 'i');
+            switch (spec.modifier) {
+                case 'l': case 'L': case 'j': case 'z': case 't':
+                    if (is_signed)
+                        snprintf(buf, sizeof(buf), spec_text, (long long) word);
+                    else
+                        snprintf(buf, sizeof(buf), spec_text, (unsigned long long) word);
+                    break;
+                default:
+                    if (is_signed)
+                        snprintf(buf, sizeof(buf), spec_text, (int) word);
+                    else
+                        snprintf(buf, sizeof(buf), spec_text, (unsigned int) word);
+                    break;
+            }
+        } else if (is_float_conversion(c)) {
+            double value;
+            memcpy(&value, &word, sizeof(value));
+            if (spec.modifier == 'D')
+                snprintf(buf, sizeof(buf), spec_text, (long double) value);
+            else
+                snprintf(buf, sizeof(buf), spec_text, value);
+        } else if (c == 's') {
+            if (args + 8 > end) {
+                text += "...";
+                return;
+            }
+            uint32_t str_len;
+            memcpy(&str_len, args, sizeof(str_len));
+            std::string str(args + 8, str_len);
+            args += 8 + ((str_len + 7) & ~7);
+            snprintf(buf, sizeof(buf), spec_text, str.c_str());
+        } else if (c == 'p') {
+            snprintf(buf, sizeof(buf), spec_text, (void*) word);
+        } else if (c != 'n') {      // Unknown conversion: kept as text.
+            snprintf(buf, sizeof(buf), "%s", spec_text);
+        }
+        text += buf;
+    }
+    for (; *p != '\0'; p++) {
+        text += *p;
+        if ((p[0] == '%') && (p[1] == '%'))
+            p++;
+    }
+    if (header.truncated)
+        text += "...";
+}
+
+/** (for internal uses only) Drain all rings, and write their records in order (flush_lock held).
+ * @return whether any record was written. */
+bool drain_rings() {
+    std::vector<std::string> records;
+    for (size_t i=0; i<log_rings.size(); ) {
+        log_ring* ring = log_rings[i];
+        bool orphaned = ring->orphaned.load(std::memory_order_acquire);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        while (tail < head) {
+            uint32_t size;
+            char* dest;
+            size_t offset = tail & (LOG_RING_SIZE - 1);
+            size_t first = std::min((size_t) sizeof(size), LOG_RING_SIZE - offset);
+            memcpy(&size, ring->data + offset, first);
+            memcpy((char*) &size + first, ring->data, sizeof(size) - first);
+
+            records.push_back(std::string(size, '\0'));
+            dest = &records.back()[0];
+            first = std::min((size_t) size, LOG_RING_SIZE - offset);
+            memcpy(dest, ring->data + offset, first);
+            memcpy(dest + first, ring->data, size - first);
+            tail += size;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+
+        // A ring is freed once its thread exited, and its last records are taken.
+        if (orphaned) {
+            total_dropped += ring->dropped.load(std::memory_order_relaxed);
+            log_rings.erase(log_rings.begin() + i);
+            delete ring;
+        } else {
+            i++;
+        }
+    }
+
+    unsigned long dropped = total_dropped;
+    for (log_ring* ring : log_rings)
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    if ((records.empty() && (dropped == reported_dropped)) || (LOG_OUTPUT == NULL))
+        return !records.empty();
+
+    // Records of different threads are merged by their sequence numbers.
+    std::sort(records.begin(), records.end(), [](const std::string &a, const std::string &b) {
+        return ((const log_header*) a.data())->seq < ((const log_header*) b.data())->seq;
+    });
+    std::string text;
+    for (const std::string &record : records)
+        format_record(record.data(), text);
+    if (dropped != reported_dropped) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "[WARNING] %lu log message(s) dropped: the log buffers are full.\n", dropped - reported_dropped);
+        text += buf;
+        reported_dropped = dropped;
+    }
+    fwrite(text.data(), 1, text.size(), LOG_OUTPUT);
+    fflush(LOG_OUTPUT);
+    return !records.empty();
+}
+
+/** (for internal uses only) Background flusher: drains the rings until logging stops. */
+void run_flusher() {
+    while (is_async.load()) {
+        bool is_busy;
+        {
+            std::lock_guard<std::mutex> guard(flush_lock);
+            is_busy = drain_rings();
+        }
+        if (!is_busy)
+            usleep(LOG_FLUSH_INTERVAL);
+    }
+}
+
+/** (for internal uses only) Stop the flusher on exit, and write the remaining records. */
+void stop_flusher() {
+    is_async.store(false);
+    if (flusher.joinable())
+        flusher.join();
+    flush_logs();
+}
+
+/** Write all logged records now. */
+void flush_logs() {
+    std::lock_guard<std::mutex> guard(flush_lock);
+    drain_rings();
+}
+
+/** Number of records dropped so far, because the ring of their thread was full. */
+unsigned long dropped_logs() {
+    std::lock_guard<std::mutex> guard(flush_lock);
+    unsigned long dropped = total_dropped;
+    for (log_ring* ring : log_rings)
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    return dropped;
+}
+
+
+void set_log_level(log_level level) {
+    LOG_LEVEL = level;
+}
+
+/** Set the output of logs (NULL for none). */
+void set_log_output(FILE *target) {
+    LOG_OUTPUT = target;
+}
+
+/** Start the flusher: from now on, messages are logged asynchronously (and flushed on exit).
+ * Call it once the process will no longer fork (e.g. after fuse_daemonize()),
+ * as the flusher thread does not survive a fork. */
+void start_log_flusher() {
+    std::call_once(flusher_once, []() {
+        pthread_key_create(&ring_key, orphan_ring);
+        is_async.store(true);
+        flusher = std::thread(run_flusher);
+        atexit(stop_flusher);
+    });
 }
@@ -6,8 +6,37 @@
 enum log_level_t { DEBUG, WARN, ERROR, OFF };
 typedef enum log_level_t log_level;
 
+/** **************************************
+ * Asynchronous logging.
+ * ***************************************/
+/* Callers never format or write: logger() appends a binary record (the format string, which is
+ * always a literal, and the arguments it consumes, with strings copied) into a lock-free ring buffer
+ * of the calling thread, and a background thread formats and flushes the records of all threads,
+ * in the order they were logged. When the ring of a thread is full, records are dropped and counted.
+ * Records are flushed on exit, and by flush_logs() (e.g., on unmount).
+ * Until start_log_flusher() (called after daemonizing), messages are written synchronously.
+ *
+ * The level is tested at the call site (by the logger() macro): filtered messages cost a comparison,
+ * and do not even evaluate their arguments. */
+const int LOG_RING_SIZE      = 1 << 18;     // Bytes of records buffered per thread (a power of two).
+const int LOG_MAX_RECORD     = 4096;        // Longer records are truncated (strings first).
+const int LOG_FLUSH_INTERVAL = 1000;        // Microseconds between flushes, while idle.
+
+extern log_level LOG_LEVEL;
+extern FILE* LOG_OUTPUT;
+
 void set_log_level(log_level level);
-void set_log_output(FILE *level);
-void logger(log_level, char *s, ...);
+void set_log_output(FILE *target);
+void start_log_flusher();
+void log_record(log_level level, const char* format, ...);
+void flush_logs();
+unsigned long dropped_logs();
+
+/** Whether messages of a level are logged (errors are, unless there is no output). */
+inline bool log_enabled(log_level level) {
+    return (LOG_OUTPUT != NULL) && (level != OFF) && ((level >= LOG_LEVEL) || (level == ERROR));
+}
+
+#define logger(level, ...) do { if (log_enabled(level)) log_record(level, __VA_ARGS__); } while (0)
 
 #endif
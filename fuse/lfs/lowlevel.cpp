@@ -0,0 +1,702 @@
+#include "lowlevel.h"
+
+#include "system.h"     /* mount_lfs, unmount_lfs, negotiate_connection */
+#include "metadata.h"   /* get_attributes, check_access */
+#include "file.h"       /* open_file, read_file, write_file, create_file, rename_file, unlink_file, link_file, truncate_file,
+                           copy_file, file_ioctl */
+#include "dir.h"        /* open_directory, read_directory, make_directory, remove_directory, entry_type */
+#include "perm.h"       /* change_permission, change_owner */
+#include "stats.h"      /* fill_statfs, change_timestamps */
+#include "buffer.h"     /* manually_synchronize */
+
+#include "logger.h"
+#include "path.h"
+#include "utility.h"
+#include "blockio.h"
+#include "dirhash.h"
+#include "notify.h"
+#include "metrics.h"
+#include "statsfile.h"
+#include "reclaim.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <atomic>
+#include <shared_mutex>
+
+/** ****************************************
+ * The low-level interface addresses files by i_number: FUSE_ROOT_ID (1) is also the
+ * i_number of the LFS root directory, so fuse_ino_t and i_number are used interchangeably.
+ * Paths are never parsed: each name is resolved in its parent directory only once.
+ * ****************************************/
+
+
+/** (for internal uses only) Record the calling user before entering the LFS core. */
+void begin_request(fuse_req_t req) {
+    const struct fuse_ctx* ctx = fuse_req_ctx(req);
+    set_caller_context(ctx->uid, ctx->gid, ctx->pid, ctx->umask);
+}
+
+/** (for internal uses only) Reply an error (or success, for 0) and leave the LFS core. */
+void reply_err(fuse_req_t req, int flag) {
+    clear_caller_context();
+    fuse_reply_err(req, -flag);
+}
+
+/** (for internal uses only) Fill an entry reply and take a kernel reference on the inode.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int fill_entry(int i_number, struct fuse_entry_param* e) {
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    e->ino = i_number;
+    e->attr_timeout = ATTR_TIMEOUT;
+    e->entry_timeout = ENTRY_TIMEOUT;
+    if (is_stats_inode(i_number))
+        return stats_attributes(i_number, &e->attr);     // Virtual inodes take no reference.
+    hold_inode(i_number);       // Before the check: the object is not freed under the reference.
+    e->generation = inode_generation[i_number];
+    int flag = get_attributes(i_number, &e->attr);
+    if (flag != 0)
+        drop_inode(i_number);
+    return flag;
+}
+
+/** (for internal uses only) Whether a request would change the virtual statistics directory (see statsfile.h). */
+bool touches_stats(fuse_ino_t parent, const char* name) {
+    return is_stats_inode(parent) || (stats_entry_inode(parent, name) != 0);
+}
+
+
+void ll_init(void* userdata, struct fuse_conn_info* conn) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "INIT, %p, %p\n", userdata, conn);
+
+    // Let the kernel splice written pages to us, and splice read replies from the disk file.
+    if (USE_SPLICE)
+        conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_SPLICE_MOVE);
+
+    // Let the kernel prefetch attributes of directory entries while listing directories.
+    conn->want |= conn->capable & (FUSE_CAP_READDIRPLUS | FUSE_CAP_READDIRPLUS_AUTO);
+
+    negotiate_connection(conn);
+
+    mount_lfs();
+}
+
+void ll_destroy(void* userdata) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "DESTROY, %p\n", userdata);
+
+    unmount_lfs();
+}
+
+void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "LOOKUP, %lu, %s\n", parent, name);
+
+    metric_timer timer(OP_LOOKUP);
+    begin_request(req);
+    if (strlen(name) >= MAX_NAME_LEN)
+        return reply_err(req, -ENAMETOOLONG);
+
+    // The virtual statistics directory shadows any ".lfs" entry of the root directory.
+    int i_number = stats_entry_inode(parent, name);
+    bool found = (i_number != 0);
+    if (!found && !is_stats_inode(parent)) {
+        if (!is_live_inode(parent))
+            return reply_err(req, -ENOENT);
+
+        /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+        std::shared_lock <std::shared_mutex> guard(inode_lock(parent));
+        inode* head_inode;
+        get_inode_from_inum(head_inode, parent);
+        if (head_inode->mode != MODE_DIR)
+            return reply_err(req, -ENOTDIR);
+        found = search_directory(head_inode, name, i_number);
+    }
+    struct fuse_entry_param e;
+    if (!found) {
+        // A zero i_number makes the kernel cache the missing name (until the directory changes).
+        memset(&e, 0, sizeof(e));
+        e.ino = 0;
+        e.entry_timeout = NEGATIVE_TIMEOUT;
+        clear_caller_context();
+        fuse_reply_entry(req, &e);
+        return;
+    }
+
+    int flag = fill_entry(i_number, &e);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_entry(req, &e);
+}
+
+void ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "FORGET, %lu, %lu\n", ino, nlookup);
+
+    metric_timer timer(OP_FORGET);
+    drop_inode(ino, nlookup);      // An unlinked object is freed with its last reference.
+    fuse_reply_none(req);
+}
+
+void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "GETATTR, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_GETATTR);
+    begin_request(req);
+    struct stat sbuf;
+    int flag = is_stats_inode(ino) ? stats_attributes(ino, &sbuf) : get_attributes(ino, &sbuf);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_attr(req, &sbuf, ATTR_TIMEOUT);
+}
+
+void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "SETATTR, %lu, %p, %d, %p\n", ino, attr, to_set, fi);
+
+    metric_timer timer(OP_SETATTR);
+    begin_request(req);
+    if (is_stats_inode(ino)) {
+        // Statistics files may only be truncated (as opened by "echo > /.lfs/stats"), which is ignored.
+        if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+            return reply_err(req, -EPERM);
+        struct stat sbuf;
+        int flag = check_stats_access(ino, W_OK);
+        if (flag != 0)
+            return reply_err(req, flag);
+        stats_attributes(ino, &sbuf);
+        clear_caller_context();
+        fuse_reply_attr(req, &sbuf, ATTR_TIMEOUT);
+        return;
+    }
+
+    int flag = 0;
+    if (to_set & FUSE_SET_ATTR_MODE)
+        flag = change_permission(ino, attr->st_mode);
+    if ((flag == 0) && (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)))
+        flag = change_owner(ino, (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : (uid_t) -1,
+                                 (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : (gid_t) -1);
+    if ((flag == 0) && (to_set & FUSE_SET_ATTR_SIZE))
+        flag = truncate_file(ino, attr->st_size);
+    if ((flag == 0) && (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME))) {
+        struct timespec ts[2];
+        ts[0].tv_nsec = ts[1].tv_nsec = UTIME_OMIT;
+        if (to_set & FUSE_SET_ATTR_ATIME) {
+            ts[0] = attr->st_atim;
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+                ts[0].tv_nsec = UTIME_NOW;
+        }
+        if (to_set & FUSE_SET_ATTR_MTIME) {
+            ts[1] = attr->st_mtim;
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+                ts[1].tv_nsec = UTIME_NOW;
+        }
+        flag = change_timestamps(ino, ts);
+    }
+    if (flag != 0)
+        return reply_err(req, flag);
+
+    struct stat sbuf;
+    flag = get_attributes(ino, &sbuf);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_attr(req, &sbuf, ATTR_TIMEOUT);
+}
+
+void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "MKDIR, %lu, %s, %o\n", parent, name, mode);
+
+    metric_timer timer(OP_MKDIR);
+    begin_request(req);
+    if (touches_stats(parent, name))
+        return reply_err(req, -EPERM);
+    int new_inum;
+    int flag = make_directory(parent, name, mode, new_inum);
+    if (flag != 0)
+        return reply_err(req, flag);
+
+    struct fuse_entry_param e;
+    flag = fill_entry(new_inum, &e);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_entry(req, &e);
+}
+
+void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "UNLINK, %lu, %s\n", parent, name);
+
+    metric_timer timer(OP_UNLINK);
+    begin_request(req);
+    if (touches_stats(parent, name))
+        return reply_err(req, -EPERM);
+    reply_err(req, unlink_file(parent, name));
+}
+
+void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "RMDIR, %lu, %s\n", parent, name);
+
+    metric_timer timer(OP_RMDIR);
+    begin_request(req);
+    if (touches_stats(parent, name))
+        return reply_err(req, -EPERM);
+    reply_err(req, remove_directory(parent, name));
+}
+
+void ll_rename(fuse_req_t req, fuse_ino_t parent, const char* name,
+               fuse_ino_t newparent, const char* newname, unsigned int flags) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "RENAME, %lu, %s, %lu, %s, %d\n", parent, name, newparent, newname, flags);
+
+    metric_timer timer(OP_RENAME);
+    begin_request(req);
+    if (touches_stats(parent, name) || touches_stats(newparent, newname))
+        return reply_err(req, -EPERM);
+    reply_err(req, rename_file(parent, name, newparent, newname, flags));
+}
+
+void ll_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char* newname) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "LINK, %lu, %lu, %s\n", ino, newparent, newname);
+
+    metric_timer timer(OP_LINK);
+    begin_request(req);
+    if (is_stats_inode(ino) || touches_stats(newparent, newname))
+        return reply_err(req, -EPERM);
+    int flag = link_file(ino, newparent, newname);
+    if (flag != 0)
+        return reply_err(req, flag);
+
+    struct fuse_entry_param e;
+    flag = fill_entry(ino, &e);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_entry(req, &e);
+}
+
+void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "OPEN, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_OPEN);
+    begin_request(req);
+    if (is_stats_inode(ino)) {
+        int flag = open_stats_file(ino, fi->flags, fi->fh);
+        if (flag != 0)
+            return reply_err(req, flag);
+        fi->direct_io = 1;      // Reads go up to the end of the snapshot, whatever the file size.
+        clear_caller_context();
+        fuse_reply_open(req, fi);
+        return;
+    }
+
+    int flag = open_file(ino, fi->flags);
+    if (flag != 0)
+        return reply_err(req, flag);
+    hold_inode(ino);        // Dropped on release.
+    fi->fh = file_handle(ino, fi->flags);
+    fi->keep_cache = 1;     // Cached pages stay valid across opens (as with kernel_cache).
+    clear_caller_context();
+    fuse_reply_open(req, fi);
+}
+
+void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "READ, %lu, %d, %d, %p\n", ino, size, off, fi);
+
+    metric_timer timer(OP_READ);
+    begin_request(req);
+    char* buf = (char*) malloc(size + 1);
+    if (buf == NULL)
+        return reply_err(req, -ENOMEM);
+
+    if (is_stats_inode(ino)) {
+        int read_len = read_stats_file(fi->fh, buf, size, off);
+        if (read_len < 0) {
+            free(buf);
+            return reply_err(req, read_len);
+        }
+        clear_caller_context();
+        fuse_reply_buf(req, buf, read_len);
+        free(buf);
+        return;
+    }
+
+    // Zero-copy path: on-disk blocks are referenced by file descriptor and spliced by FUSE.
+    if (USE_SPLICE && begin_block_splice()) {
+        struct fuse_bufvec* bufv;
+        int read_len = read_file_buf(ino, size, off, bufv, buf);
+        if (read_len >= 0) {
+            count_metric(COUNT_BYTES_READ, read_len);
+            clear_caller_context();
+            fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+            end_block_splice();
+            free(bufv);
+            free(buf);
+            access_file(ino);
+            return;
+        }
+        end_block_splice();
+        if (read_len != -EAGAIN) {
+            free(buf);
+            return reply_err(req, read_len);
+        }
+    }
+
+    int read_len = read_file(ino, buf, size, off);
+    if (read_len < 0) {
+        free(buf);
+        return reply_err(req, read_len);
+    }
+    count_metric(COUNT_BYTES_READ, read_len);
+    clear_caller_context();
+    fuse_reply_buf(req, buf, read_len);
+    free(buf);
+}
+
+void ll_write(fuse_req_t req, fuse_ino_t ino, const char* buf, size_t size, off_t off, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "WRITE, %lu, %p, %d, %d, %p\n", ino, buf, size, off, fi);
+
+    metric_timer timer(OP_WRITE);
+    begin_request(req);
+    int write_len = is_stats_inode(ino) ? write_stats_file(ino, size) : write_file(ino, buf, size, off);
+    if (write_len < 0)
+        return reply_err(req, write_len);
+    if (!is_stats_inode(ino))
+        count_metric(COUNT_BYTES_WRITTEN, write_len);
+    clear_caller_context();
+    fuse_reply_write(req, write_len);
+}
+
+void ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in, struct fuse_file_info* fi_in,
+                        fuse_ino_t ino_out, off_t off_out, struct fuse_file_info* fi_out, size_t len, int flags) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "COPY_FILE_RANGE, %lu, %d, %p, %lu, %d, %p, %d, %d\n", ino_in, off_in, fi_in, ino_out, off_out, fi_out, len, flags);
+
+    metric_timer timer(OP_COPY_FILE_RANGE);
+    begin_request(req);
+    if (is_stats_inode(ino_in) || is_stats_inode(ino_out))
+        return reply_err(req, -EXDEV);     // Copied by reads and writes instead, as across file systems.
+    if (!(fi_out->fh & FH_WRITABLE))
+        return reply_err(req, -EBADF);
+    ssize_t copied = copy_file(ino_in, off_in, ino_out, off_out, len);
+    if (copied < 0)
+        return reply_err(req, copied);
+    clear_caller_context();
+    fuse_reply_write(req, copied);
+}
+
+void ll_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void* arg, struct fuse_file_info* fi,
+              unsigned flags, const void* in_buf, size_t in_bufsz, size_t out_bufsz) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "IOCTL, %lu, %x, %p, %p, %u, %lu, %lu\n", ino, cmd, arg, fi, flags, in_bufsz, out_bufsz);
+
+    metric_timer timer(OP_IOCTL);
+    // Commands carry fixed-size arguments (see clone.h), which the kernel has copied in.
+    if ((flags & FUSE_IOCTL_COMPAT) || (in_bufsz < _IOC_SIZE((unsigned int) cmd)))
+        return (void) fuse_reply_err(req, EINVAL);
+
+    begin_request(req);
+    if (is_stats_inode(ino))
+        return reply_err(req, -ENOTTY);
+    int flag = file_ioctl(ino, cmd, in_buf, fi->fh & FH_WRITABLE);
+    if (flag != 0)
+        return reply_err(req, flag);
+    clear_caller_context();
+    fuse_reply_ioctl(req, 0, NULL, 0);
+}
+
+void ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "FLUSH, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_FLUSH);
+    fuse_reply_err(req, 0);
+}
+
+void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "RELEASE, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_RELEASE);
+    if (is_stats_inode(ino))
+        release_stats_file(fi->fh);
+    else
+        drop_inode(ino);
+    fuse_reply_err(req, 0);
+}
+
+void ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "FSYNC, %lu, %d, %p\n", ino, datasync, fi);
+
+    metric_timer timer(OP_FSYNC);
+    manually_synchronize();
+    fuse_reply_err(req, 0);
+}
+
+void ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "OPENDIR, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_OPENDIR);
+    begin_request(req);
+    int flag = is_stats_inode(ino) ? ((ino == STATS_DIR_INUM) ? 0 : -ENOTDIR) : open_directory(ino);
+    if (flag != 0)
+        return reply_err(req, flag);
+    hold_inode(ino);        // Dropped on releasedir (virtual inodes take no reference).
+    fi->fh = ino;
+    clear_caller_context();
+    fuse_reply_open(req, fi);
+}
+
+struct ll_readdir_args {
+    fuse_req_t req;
+    char* buf;
+    size_t size;
+    size_t pos;
+};
+
+/** (for internal uses only) Append a directory entry into the reply buffer of readdir. */
+bool ll_readdir_filler(void* ctx, const char* name, int i_number, off_t next_offset) {
+    ll_readdir_args* args = (ll_readdir_args*) ctx;
+    struct stat sbuf;
+    memset(&sbuf, 0, sizeof(sbuf));
+    sbuf.st_ino = i_number;
+    sbuf.st_mode = entry_type(i_number);
+    size_t ent_size = fuse_add_direntry(args->req, args->buf + args->pos, args->size - args->pos,
+                                        name, &sbuf, next_offset);
+    if (ent_size > args->size - args->pos)
+        return true;    // Reply buffer is full: the kernel will continue from the last offset.
+    args->pos += ent_size;
+    return false;
+}
+
+void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "READDIR, %lu, %d, %d, %p\n", ino, size, off, fi);
+
+    metric_timer timer(OP_READDIR);
+    begin_request(req);
+    ll_readdir_args args = {req, (char*) malloc(size + 1), size, 0};
+    if (args.buf == NULL)
+        return reply_err(req, -ENOMEM);
+    int flag = is_stats_inode(ino) ? read_stats_directory(off, ll_readdir_filler, &args)
+                                   : read_directory(ino, off, ll_readdir_filler, &args);
+    if (flag != 0) {
+        free(args.buf);
+        return reply_err(req, flag);
+    }
+    clear_caller_context();
+    fuse_reply_buf(req, args.buf, args.pos);
+    free(args.buf);
+}
+
+struct ll_readdirplus_args {
+    fuse_req_t req;
+    size_t size;
+    size_t pos;
+    std::vector<dir_batch_entry> entries;
+};
+
+/** (for internal uses only) Collect the directory entries that fit into the reply buffer of readdirplus. */
+bool ll_readdirplus_collector(void* ctx, const char* name, int i_number, off_t next_offset) {
+    ll_readdirplus_args* args = (ll_readdirplus_args*) ctx;
+    size_t ent_size = fuse_add_direntry_plus(args->req, NULL, 0, name, NULL, next_offset);
+    if (ent_size > args->size - args->pos)
+        return true;    // Reply buffer is full: the kernel will continue from the last offset.
+    args->pos += ent_size;
+    args->entries.push_back({name, i_number, next_offset});
+    return false;
+}
+
+void ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "READDIRPLUS, %lu, %d, %d, %p\n", ino, size, off, fi);
+
+    metric_timer timer(OP_READDIRPLUS);
+    begin_request(req);
+    ll_readdirplus_args args;
+    args.req = req;
+    args.size = size;
+    args.pos = 0;
+    int flag = is_stats_inode(ino) ? read_stats_directory(off, ll_readdirplus_collector, &args)
+                                   : read_directory(ino, off, ll_readdirplus_collector, &args);
+    if (flag != 0)
+        return reply_err(req, flag);
+
+    // Attributes come from the inode cache, once the directory lock is released.
+    char* buf = (char*) malloc(size + 1);
+    if (buf == NULL)
+        return reply_err(req, -ENOMEM);
+    size_t pos = 0;
+    for (auto &ent : args.entries) {
+        struct fuse_entry_param e;
+        if ((ent.name == ".") || (ent.name == "..")) {
+            // No lookup reference is taken on "." and "..".
+            memset(&e, 0, sizeof(e));
+            e.attr.st_ino = ent.i_number;
+            e.attr.st_mode = S_IFDIR;
+        } else if (fill_entry(ent.i_number, &e) != 0) {
+            continue;   // The entry is removed meanwhile.
+        }
+        pos += fuse_add_direntry_plus(req, buf + pos, size - pos, ent.name.c_str(), &e, ent.next_offset);
+    }
+    clear_caller_context();
+    fuse_reply_buf(req, buf, pos);
+    free(buf);
+}
+
+void ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "RELEASEDIR, %lu, %p\n", ino, fi);
+
+    metric_timer timer(OP_RELEASEDIR);
+    drop_inode(ino);
+    fuse_reply_err(req, 0);
+}
+
+void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "FSYNCDIR, %lu, %d, %p\n", ino, datasync, fi);
+
+    metric_timer timer(OP_FSYNCDIR);
+    manually_synchronize();
+    fuse_reply_err(req, 0);
+}
+
+void ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "STATFS, %lu\n", ino);
+
+    metric_timer timer(OP_STATFS);
+    struct statvfs stbuf;
+    fill_statfs(&stbuf);
+    fuse_reply_statfs(req, &stbuf);
+}
+
+void ll_access(fuse_req_t req, fuse_ino_t ino, int mask) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "ACCESS, %lu, %d\n", ino, mask);
+
+    metric_timer timer(OP_ACCESS);
+    begin_request(req);
+    reply_err(req, is_stats_inode(ino) ? check_stats_access(ino, mask) : check_access(ino, mask));
+}
+
+void ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "CREATE, %lu, %s, %o, %p\n", parent, name, mode, fi);
+
+    metric_timer timer(OP_CREATE);
+    begin_request(req);
+    if (touches_stats(parent, name))
+        return reply_err(req, -EPERM);
+    int new_inum;
+    int flag = create_file(parent, name, mode, new_inum);
+    if (flag != 0)
+        return reply_err(req, flag);
+
+    struct fuse_entry_param e;
+    flag = fill_entry(new_inum, &e);
+    if (flag != 0)
+        return reply_err(req, flag);
+    hold_inode(new_inum);   // Dropped on release.
+    fi->fh = file_handle(new_inum, fi->flags);
+    clear_caller_context();
+    fuse_reply_create(req, &e, fi);
+}
+
+void ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* in_buf, off_t off, struct fuse_file_info* fi) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "WRITE_BUF, %lu, %p, %d, %p\n", ino, in_buf, off, fi);
+
+    metric_timer timer(OP_WRITE);
+    begin_request(req);
+    size_t size = fuse_buf_size(in_buf);
+    const char* data;
+    char* staging = NULL;
+    if ((in_buf->count == 1) && !(in_buf->buf[0].flags & FUSE_BUF_IS_FD)) {
+        // Data already in memory: blocks are appended to the segment buffer right from it.
+        data = (const char*) in_buf->buf[0].mem + in_buf->off;
+        size -= in_buf->off;
+    } else {
+        // Data spliced into a pipe (or scattered): drain it into a single staging buffer.
+        staging = (char*) malloc(size + 1);
+        if (staging == NULL)
+            return reply_err(req, -ENOMEM);
+        struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(size);
+        out_buf.buf[0].mem = staging;
+        ssize_t copied = fuse_buf_copy(&out_buf, in_buf, (enum fuse_buf_copy_flags) 0);
+        if (copied < 0) {
+            free(staging);
+            return reply_err(req, copied);
+        }
+        data = staging;
+        size = copied;
+    }
+
+    int write_len = is_stats_inode(ino) ? write_stats_file(ino, size) : write_file(ino, data, size, off);
+    free(staging);
+    if (write_len < 0)
+        return reply_err(req, write_len);
+    if (!is_stats_inode(ino))
+        count_metric(COUNT_BYTES_WRITTEN, write_len);
+    clear_caller_context();
+    fuse_reply_write(req, write_len);
+}
+
+void ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+    if (DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "FORGET_MULTI, %d, %p\n", count, forgets);
+
+    metric_timer timer(OP_FORGET);
+    for (size_t i = 0; i < count; ++i)
+        drop_inode(forgets[i].ino, forgets[i].nlookup);
+    fuse_reply_none(req);
+}
+
+
+struct fuse_lowlevel_ops ll_ops = {
+    .init         = ll_init,
+    .destroy      = ll_destroy,
+    .lookup       = ll_lookup,
+    .forget       = ll_forget,
+    .getattr      = ll_getattr,
+    .setattr      = ll_setattr,
+    .mkdir        = ll_mkdir,
+    .unlink       = ll_unlink,
+    .rmdir        = ll_rmdir,
+    .rename       = ll_rename,
+    .link         = ll_link,
+    .open         = ll_open,
+    .read         = ll_read,
+    .write        = ll_write,
+    .flush        = ll_flush,
+    .release      = ll_release,
+    .fsync        = ll_fsync,
+    .opendir      = ll_opendir,
+    .readdir      = ll_readdir,
+    .releasedir   = ll_releasedir,
+    .fsyncdir     = ll_fsyncdir,
+    .statfs       = ll_statfs,
+    .access       = ll_access,
+    .create       = ll_create,
+    .ioctl        = ll_ioctl,
+    .write_buf    = ll_write_buf,
+    .forget_multi = ll_forget_multi,
+    .readdirplus  = ll_readdirplus,
+    .copy_file_range = ll_copy_file_range,
+};
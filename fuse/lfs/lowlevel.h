@@ -0,0 +1,8 @@
+#ifndef lowlevel_h
+#define lowlevel_h
+
+#include <fuse_lowlevel.h>  /* fuse_lowlevel_ops, fuse_session */
+
+extern struct fuse_lowlevel_ops ll_ops;
+
+#endif
@@ -1,17 +1,94 @@
 #include "index.h"
+#include "lowlevel.h"
 #include "logger.h"
 #include "path.h"
+#include "notify.h"
+#include "device.h"
 
-/* Project 4 Final Version */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+/* LFS-specific mount options (removed from the arguments before FUSE parses them). */
+struct lfs_options {
+    char* devices;
+};
+
+static const struct fuse_opt lfs_opts[] = {
+    {"devices=%s", offsetof(struct lfs_options, devices), 0},
+    FUSE_OPT_END
+};
+
+/* Project 4 Final Version: served through the low-level (inode-based) FUSE interface.
+ * Besides the standard FUSE options, "-s" runs a single-threaded loop, while
+ * "-o clone_fd" and "-o max_idle_threads=N" configure the multi-threaded loop.
+ * "-o devices=PATH1:PATH2:..." stripes segments over several files or block devices
+ * (given in the same order on every mount), instead of lfs.data in the working directory. */
 int main(int argc, char** argv) {
     set_log_level(DEBUG);
     set_log_output(stdout);
-    generate_prefix(argv[1]);
 
-    int ret; 
+    int ret = 1;
 	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    struct fuse_session* se;
+    struct lfs_options lfs_opt = {NULL};
+
+    if (fuse_opt_parse(&args, &lfs_opt, lfs_opts, NULL) != 0)
+        return 1;
+    if (lfs_opt.devices != NULL) {
+        set_device_paths(lfs_opt.devices);
+        free(lfs_opt.devices);
+    }
+    if (fuse_parse_cmdline(&args, &opts) != 0)
+        return 1;
+    if (opts.show_help) {
+        printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        ret = 0;
+        goto err_out1;
+    } else if (opts.show_version) {
+        printf("FUSE library version %s\n", fuse_pkgversion());
+        fuse_lowlevel_version();
+        ret = 0;
+        goto err_out1;
+    }
+    if (opts.mountpoint == NULL) {
+        printf("usage: %s [options] <mountpoint>\n", argv[0]);
+        goto err_out1;
+    }
+    generate_prefix(opts.mountpoint);
+
+    se = fuse_session_new(&args, &ll_ops, sizeof(ll_ops), NULL);
+    if (se == NULL)
+        goto err_out1;
+    if (fuse_set_signal_handlers(se) != 0)
+        goto err_out2;
+    if (fuse_session_mount(se, opts.mountpoint) != 0)
+        goto err_out3;
+
+    fuse_daemonize(opts.foreground);
+    start_log_flusher();    // Only in the (daemonized) child: threads do not survive the fork.
+    start_kernel_notify(se);
+
+    if (opts.singlethread) {
+        ret = fuse_session_loop(se);
+    } else {
+        config.clone_fd = opts.clone_fd;
+        config.max_idle_threads = opts.max_idle_threads;
+        ret = fuse_session_loop_mt(se, &config);
+    }
 
-    ret = fuse_main(args.argc, args.argv, &ops, NULL);
+    stop_kernel_notify();
+    fuse_session_unmount(se);
+err_out3:
+    fuse_remove_signal_handlers(se);
+err_out2:
+    fuse_session_destroy(se);
+err_out1:
+    free(opts.mountpoint);
 	fuse_opt_free_args(&args);
-	return ret;
-}
\ No newline at end of file
+	return ret ? 1 : 0;
+}
@@ -1,6 +1,8 @@
 #include "metadata.h"
 
 #include "logger.h"
+#include "metrics.h"
+#include "statsfile.h"
 #include "print.h"
 #include "path.h"
 #include "utility.h"
@@ -18,8 +20,12 @@ extern struct options options;
 int o_getattr(const char* path, struct stat* sbuf, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "GETATTR, %s, %p, %p\n", resolve_prefix(path).c_str(), sbuf, fi);
-    
 
+    metric_timer timer(OP_GETATTR);
+
+    int stats_inum = stats_path_inode(path);
+    if (stats_inum != 0)
+        return stats_attributes(stats_inum, sbuf);
     /* ****************************************
      * Resolve path and find file inode structure.
      * ****************************************/
@@ -31,8 +37,20 @@ int o_getattr(const char* path, struct stat* sbuf, struct fuse_file_info* fi) {
         return locate_error;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[i_number]);
+    return get_attributes(i_number, sbuf);
+}
+
+
+/** Fill "struct stat" with attributes of a file / directory.
+ * @param  i_number: i_number of the file / directory.
+ * @param  sbuf: return variable.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int get_attributes(int i_number, struct stat* sbuf) {
+    if (!is_live_inode(i_number))
+        return -ENOENT;
+
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
 
     // Since getattr() is very fundamental, we shall always allow attribute reading.
@@ -47,11 +65,15 @@ int o_getattr(const char* path, struct stat* sbuf, struct fuse_file_info* fi) {
         exit(-1);
     }
 
+    return fill_stat(f_inode, sbuf);
+}
 
-    /* ****************************************
-     * Fill all "struct stat" fields.
-     * ****************************************/
+
+/** Fill all "struct stat" fields from an inode (the caller should hold its lock).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int fill_stat(struct inode* f_inode, struct stat* sbuf) {
     int flag = 0;
+    int i_number = f_inode->i_number;
     memset(sbuf, 0, sizeof(struct stat));
 
     // Basic information.
@@ -68,7 +90,7 @@ int o_getattr(const char* path, struct stat* sbuf, struct fuse_file_info* fi) {
             break;
         case (MODE_MID_INODE):
             logger(ERROR, "[ERROR] Unexpected access to non-head inode #%d.\n", i_number);
-            flag = -EEXIST;  // File does not exist.
+            flag = -ENOENT;  // File does not exist.
             break;
         default:
             logger(ERROR, "[ERROR] Unknown file type in inode #%d.\n", i_number);
@@ -99,8 +121,11 @@ int o_access(const char* path, int mode) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "ACCESS, %s, %d\n", resolve_prefix(path).c_str(), mode);
 
-    /* Get information (uid, gid) of the user who calls LFS interface. */
-    struct fuse_context* user_info = fuse_get_context();
+    metric_timer timer(OP_ACCESS);
+
+    int stats_inum = stats_path_inode(path);
+    if (stats_inum != 0)
+        return check_stats_access(stats_inum, mode);
 
     /* Mode 0 (F_OK): test whether file exists (by default). */
     int i_number;
@@ -111,8 +136,23 @@ int o_access(const char* path, int mode) {
         return locate_error;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[i_number]);
+    return check_access(i_number, mode);
+}
+
+
+/** Test permissions of the calling user on a file / directory.
+ * @param  i_number: i_number of the file / directory.
+ * @param  mode: F_OK, or R_OK / W_OK / X_OK ORed together.
+ * @return flag: 0 if granted, standard negative error codes otherwise. */
+int check_access(int i_number, int mode) {
+    if (!is_live_inode(i_number))
+        return -ENOENT;
+
+    /* Get information (uid, gid) of the user who calls LFS interface. */
+    struct fuse_context* user_info = get_caller_context();
+
+    /* The inode-level fine-grained lock is shared (read-only access) by a shared_lock. */
+    std::shared_lock <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
     
     /* Mode 1~7 (in base-8): test file permissions; may be ORed toghether. */ 
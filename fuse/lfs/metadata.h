@@ -2,8 +2,14 @@
 #define getattr_h
 
 #include <sys/stat.h>  /* stat */
+#include <fuse.h>      /* fuse_file_info */
 
 int o_getattr(const char*, struct stat*, struct fuse_file_info*);
 int o_access(const char*, int);
 
+// Inode-based implementations (shared by the high-level and low-level interfaces).
+int get_attributes(int i_number, struct stat* sbuf);
+int fill_stat(struct inode* f_inode, struct stat* sbuf);
+int check_access(int i_number, int mode);
+
 #endif
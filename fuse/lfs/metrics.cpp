@@ -0,0 +1,252 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+const char* const metric_names[NUM_METRICS] = {
+    "op.lookup", "op.forget", "op.getattr", "op.setattr", "op.access", "op.mkdir", "op.unlink", "op.rmdir",
+    "op.rename", "op.link", "op.chmod", "op.chown", "op.truncate", "op.utimens", "op.open", "op.create",
+    "op.read", "op.write", "op.copy_file_range", "op.ioctl", "op.flush", "op.release", "op.fsync",
+    "op.opendir", "op.readdir", "op.readdirplus", "op.releasedir", "op.fsyncdir", "op.statfs",
+    "stage.locate", "stage.get_block.hit", "stage.get_block.miss", "stage.segment_seal", "stage.checkpoint",
+    "stage.gc", "stage.gc.load", "stage.gc.select", "stage.gc.clean", "stage.gc.scan", "stage.gc.append", "stage.gc.writeback",
+    "wait.segment_lock", "wait.inode_locks",
+};
+
+const char* const counter_names[NUM_COUNTERS] = {
+    "bytes_read", "bytes_written", "disk_reads", "disk_read_bytes", "disk_writes", "disk_write_bytes",
+    "gc_victims", "gc_live_blocks",
+};
+
+/* Records of a thread: only written by their thread, read by render_metrics(). */
+struct metric_shard {
+    std::atomic<unsigned int> epoch;
+    std::atomic<uint64_t> count[NUM_METRICS];
+    std::atomic<uint64_t> total[NUM_METRICS];       // Sum of latencies (ns).
+    std::atomic<uint64_t> max[NUM_METRICS];
+    std::atomic<uint64_t> buckets[NUM_METRICS][HIST_BUCKETS];
+    std::atomic<uint64_t> counters[NUM_COUNTERS];
+};
+
+/* Shards are never freed: those of exited threads are reused (with their records) by new threads. */
+struct shard_slot {
+    metric_shard* shard = NULL;
+    ~shard_slot();
+};
+
+std::mutex shard_lock;
+std::vector<metric_shard*> all_shards, free_shards;
+std::atomic<unsigned int> metric_epoch(0);
+std::atomic<uint64_t> epoch_start(metric_clock());     // At the last reset (or start-up).
+thread_local shard_slot local_shard;
+
+shard_slot::~shard_slot() {
+    if (shard == NULL)
+        return;
+    std::lock_guard<std::mutex> guard(shard_lock);
+    free_shards.push_back(shard);
+}
+
+
+/** Monotonic clock (in nanoseconds). */
+uint64_t metric_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/** (for internal uses only) Add to a record of the calling thread (the single writer). */
+inline void bump(std::atomic<uint64_t> &record, uint64_t amount) {
+    record.store(record.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+/** (for internal uses only) Clear all records of a shard. */
+void clear_shard(metric_shard* shard) {
+    for (int m=0; m<NUM_METRICS; m++) {
+        shard->count[m].store(0, std::memory_order_relaxed);
+        shard->total[m].store(0, std::memory_order_relaxed);
+        shard->max[m].store(0, std::memory_order_relaxed);
+        for (int b=0; b<HIST_BUCKETS; b++)
+            shard->buckets[m][b].store(0, std::memory_order_relaxed);
+    }
+    for (int c=0; c<NUM_COUNTERS; c++)
+        shard->counters[c].store(0, std::memory_order_relaxed);
+}
+
+/** (for internal uses only) Shard of the calling thread, cleared if a reset happened meanwhile. */
+metric_shard* get_shard() {
+    metric_shard* shard = local_shard.shard;
+    if (shard == NULL) {
+        std::lock_guard<std::mutex> guard(shard_lock);
+        if (free_shards.empty()) {
+            shard = new metric_shard;
+            clear_shard(shard);
+            shard->epoch.store(metric_epoch.load(), std::memory_order_release);
+            all_shards.push_back(shard);
+        } else {
+            shard = free_shards.back();
+            free_shards.pop_back();
+        }
+        local_shard.shard = shard;
+    }
+
+    unsigned int epoch = metric_epoch.load(std::memory_order_relaxed);
+    if (shard->epoch.load(std::memory_order_relaxed) != epoch) {
+        clear_shard(shard);
+        shard->epoch.store(epoch, std::memory_order_release);
+    }
+    return shard;
+}
+
+/** (for internal uses only) Histogram bucket of a value. */
+int hist_bucket(uint64_t value) {
+    if (value < (1 << HIST_SUB_BITS))
+        return value;
+    int exp = 63 - __builtin_clzll(value);
+    if (exp > HIST_MAX_EXP)
+        return HIST_BUCKETS - 1;
+    int sub = (value >> (exp - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+    return ((exp - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + sub;
+}
+
+/** (for internal uses only) Largest value of a histogram bucket. */
+uint64_t hist_bucket_max(int bucket) {
+    if (bucket < (1 << HIST_SUB_BITS))
+        return bucket;
+    int exp = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+    uint64_t lowest = ((1 << HIST_SUB_BITS) + sub) << (exp - HIST_SUB_BITS);
+    return lowest + ((uint64_t) 1 << (exp - HIST_SUB_BITS)) - 1;
+}
+
+
+/** Record a latency into the histogram of a metric. */
+void record_metric(lfs_metric metric, uint64_t nanoseconds) {
+    metric_shard* shard = get_shard();
+    bump(shard->count[metric], 1);
+    bump(shard->total[metric], nanoseconds);
+    bump(shard->buckets[metric][hist_bucket(nanoseconds)], 1);
+    if (nanoseconds > shard->max[metric].load(std::memory_order_relaxed))
+        shard->max[metric].store(nanoseconds, std::memory_order_relaxed);
+}
+
+/** Add to a counter. */
+void count_metric(lfs_counter counter, uint64_t amount) {
+    if (!USE_STATS)
+        return;
+    bump(get_shard()->counters[counter], amount);
+}
+
+/** Value of a counter, as recorded by the calling thread only (e.g., to tell whether a call did I/O). */
+uint64_t local_counter(lfs_counter counter) {
+    if (!USE_STATS)
+        return 0;
+    return get_shard()->counters[counter].load(std::memory_order_relaxed);
+}
+
+/** Start over all histograms and counters. */
+void reset_metrics() {
+    std::lock_guard<std::mutex> guard(shard_lock);
+    epoch_start.store(metric_clock());
+    metric_epoch.fetch_add(1);
+}
+
+
+/* Histogram of a metric, summed over all shards. */
+struct metric_summary {
+    uint64_t count, total, max;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+/** (for internal uses only) Value (in microseconds) at a quantile of a summed histogram. */
+double summary_quantile(const metric_summary &sum, double quantile) {
+    uint64_t rank = (uint64_t) (quantile * sum.count + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int b=0; b<HIST_BUCKETS; b++) {
+        seen += sum.buckets[b];
+        if (seen >= rank)
+            return std::min(hist_bucket_max(b), sum.max) / 1000.0;
+    }
+    return sum.max / 1000.0;
+}
+
+/** Render all histograms (those recorded at least once) and counters.
+ * @param  json: a JSON object (on one line), instead of a table; latencies are in microseconds.
+ * @return text: the rendered statistics. */
+std::string render_metrics(bool json) {
+    std::vector<metric_summary> sums(NUM_METRICS);
+    uint64_t counters[NUM_COUNTERS];
+    memset(sums.data(), 0, sizeof(metric_summary) * NUM_METRICS);
+    memset(counters, 0, sizeof(counters));
+    double elapsed;
+    {
+        // Shards of older epochs are cleared by their threads on their next record: skip them.
+        std::lock_guard<std::mutex> guard(shard_lock);
+        unsigned int epoch = metric_epoch.load();
+        elapsed = (metric_clock() - epoch_start.load()) / 1e9;
+        for (metric_shard* shard : all_shards) {
+            if (shard->epoch.load(std::memory_order_acquire) != epoch)
+                continue;
+            for (int m=0; m<NUM_METRICS; m++) {
+                sums[m].count += shard->count[m].load(std::memory_order_relaxed);
+                sums[m].total += shard->total[m].load(std::memory_order_relaxed);
+                sums[m].max = std::max(sums[m].max, shard->max[m].load(std::memory_order_relaxed));
+                for (int b=0; b<HIST_BUCKETS; b++)
+                    sums[m].buckets[b] += shard->buckets[m][b].load(std::memory_order_relaxed);
+            }
+            for (int c=0; c<NUM_COUNTERS; c++)
+                counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::string text;
+    char line[512];
+    if (json) {
+        snprintf(line, sizeof(line), "{\"elapsed_sec\": %.3f, \"metrics\": {", elapsed);
+        text += line;
+    } else {
+        snprintf(line, sizeof(line), "# LFS statistics over %.3f s (latencies in microseconds).\n"
+                 "%-24s %10s %10s %10s %10s %10s %10s %10s\n", elapsed,
+                 "metric", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+        text += line;
+    }
+
+    bool is_first = true;
+    for (int m=0; m<NUM_METRICS; m++) {
+        const metric_summary &sum = sums[m];
+        if (sum.count == 0)
+            continue;
+        double mean = sum.total / 1000.0 / sum.count;
+        if (json)
+            snprintf(line, sizeof(line), "%s\"%s\": {\"count\": %lu, \"mean_us\": %.3f, \"p50_us\": %.3f, "
+                     "\"p90_us\": %.3f, \"p99_us\": %.3f, \"p999_us\": %.3f, \"max_us\": %.3f}",
+                     is_first ? "" : ", ", metric_names[m], sum.count, mean, summary_quantile(sum, 0.5),
+                     summary_quantile(sum, 0.9), summary_quantile(sum, 0.99), summary_quantile(sum, 0.999),
+                     sum.max / 1000.0);
+        else
+            snprintf(line, sizeof(line), "%-24s %10lu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+                     metric_names[m], sum.count, mean, summary_quantile(sum, 0.5), summary_quantile(sum, 0.9),
+                     summary_quantile(sum, 0.99), summary_quantile(sum, 0.999), sum.max / 1000.0);
+        text += line;
+        is_first = false;
+    }
+
+    text += json ? "}, \"counters\": {" : "\ncounter                       value\n";
+    for (int c=0; c<NUM_COUNTERS; c++) {
+        if (json)
+            snprintf(line, sizeof(line), "%s\"%s\": %lu", (c == 0) ? "" : ", ", counter_names[c], counters[c]);
+        else
+            snprintf(line, sizeof(line), "%-24s %10lu\n", counter_names[c], counters[c]);
+        text += line;
+    }
+    if (json)
+        text += "}}\n";
+    return text;
+}
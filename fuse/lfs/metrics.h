@@ -0,0 +1,90 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include "utility.h"
+
+#include <stdint.h>
+#include <string>
+
+/** **************************************
+ * Latency histograms and counters.
+ * ***************************************/
+/* Every request handler (of both the high-level and low-level interfaces) and a few internal
+ * stages are timed into latency histograms; a few counters track bytes and disk accesses.
+ * Each thread records into its own shard (single writer, relaxed atomics: no lock on the hot path),
+ * and the shards are only summed up when the statistics are rendered (see statsfile.h).
+ *
+ * Histograms are log-linear (as HdrHistogram): each power of two is split into 2^HIST_SUB_BITS
+ * buckets, so that percentiles are accurate to 1/2^HIST_SUB_BITS (12.5%) of the value.
+ * A reset starts a new epoch: each shard clears itself on its next record. */
+enum lfs_metric {
+    // Request handlers (latencies from entry to reply).
+    OP_LOOKUP, OP_FORGET, OP_GETATTR, OP_SETATTR, OP_ACCESS, OP_MKDIR, OP_UNLINK, OP_RMDIR,
+    OP_RENAME, OP_LINK, OP_CHMOD, OP_CHOWN, OP_TRUNCATE, OP_UTIMENS, OP_OPEN, OP_CREATE,
+    OP_READ, OP_WRITE, OP_COPY_FILE_RANGE, OP_IOCTL, OP_FLUSH, OP_RELEASE, OP_FSYNC,
+    OP_OPENDIR, OP_READDIR, OP_READDIRPLUS, OP_RELEASEDIR, OP_FSYNCDIR, OP_STATFS,
+    // Internal stages.
+    STAGE_LOCATE,               // Path resolution (high-level interface).
+    STAGE_GET_BLOCK_HIT,        // Block served from memory (segment buffer or cache).
+    STAGE_GET_BLOCK_MISS,       // Block read from a device.
+    STAGE_SEGMENT_SEAL,         // Sealing (and queueing) the active segment.
+    STAGE_CHECKPOINT,
+    STAGE_GC,                   // A whole garbage collection, then its phases:
+    STAGE_GC_LOAD,              //   draining and loading the disk image,
+    STAGE_GC_SELECT,            //   computing utilizations and choosing victims,
+    STAGE_GC_CLEAN,             //   cleaning all victims and rewriting their inodes,
+    STAGE_GC_SCAN,              //   scanning one victim (by a GC worker),
+    STAGE_GC_APPEND,            //   appending the live blocks of one victim,
+    STAGE_GC_WRITEBACK,         //   compressing and writing back the cleaned image, and reloading it.
+    WAIT_SEGMENT_LOCK,          // Lock waits.
+    WAIT_INODE_LOCKS,           // (several inodes at once, see acquire_inode_locks())
+    NUM_METRICS
+};
+
+enum lfs_counter {
+    COUNT_BYTES_READ,           // File data returned to readers.
+    COUNT_BYTES_WRITTEN,        // File data accepted from writers.
+    COUNT_DISK_READS,
+    COUNT_DISK_READ_BYTES,
+    COUNT_DISK_WRITES,
+    COUNT_DISK_WRITE_BYTES,
+    COUNT_GC_VICTIMS,           // Segments cleaned by GC.
+    COUNT_GC_LIVE_BLOCKS,       // Live blocks moved by GC.
+    NUM_COUNTERS
+};
+
+const int HIST_SUB_BITS = 3;
+const int HIST_MAX_EXP  = 40;   // Values (ns) from 2^41 on (~37 minutes) share the last bucket.
+const int HIST_BUCKETS  = (HIST_MAX_EXP - HIST_SUB_BITS + 2) << HIST_SUB_BITS;
+
+uint64_t metric_clock();
+void record_metric(lfs_metric metric, uint64_t nanoseconds);
+void count_metric(lfs_counter counter, uint64_t amount = 1);
+uint64_t local_counter(lfs_counter counter);
+
+std::string render_metrics(bool json);
+void reset_metrics();
+
+/** Time a scope into a histogram (nothing is done without USE_STATS). */
+struct metric_timer {
+    lfs_metric metric;
+    uint64_t start;
+
+    metric_timer(lfs_metric metric) : metric(metric), start(USE_STATS ? metric_clock() : 0) {}
+    ~metric_timer() {
+        if (USE_STATS)
+            record_metric(metric, metric_clock() - start);
+    }
+
+    /** Record the current phase, and time the next one from now on. */
+    void lap(lfs_metric next) {
+        if (!USE_STATS)
+            return;
+        uint64_t now = metric_clock();
+        record_metric(metric, now - start);
+        metric = next;
+        start = now;
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+#include "notify.h"
+
+#include "logger.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <string.h>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+const int NOTICE_INODE  = 1;    // Attributes of an inode (low-level interface).
+const int NOTICE_ENTRY  = 2;    // A name in a directory (low-level interface).
+const int NOTICE_PATH   = 3;    // A path (high-level interface).
+
+struct kernel_notice {
+    int kind;
+    int i_number;                   // Inode (NOTICE_INODE) or parent directory (NOTICE_ENTRY).
+    std::string name;               // Name (NOTICE_ENTRY) or path (NOTICE_PATH).
+};
+
+std::mutex notify_lock;
+std::condition_variable cond_notify;
+std::deque<kernel_notice> pending_notices;
+bool notify_running = false;
+std::thread notify_thread;
+
+// Only one of them is set, depending on the interface LFS is served through.
+struct fuse_session* notify_session = NULL;
+struct fuse* notify_fuse = NULL;
+
+
+/** (for internal uses only) Send a notification to the kernel.
+ * Names or inodes the kernel does not cache (-ENOENT) need no invalidation. */
+void send_notice(const kernel_notice &notice) {
+    int flag = 0;
+    if (notice.kind == NOTICE_INODE)
+        flag = fuse_lowlevel_notify_inval_inode(notify_session, notice.i_number, -1, 0);
+    else if (notice.kind == NOTICE_ENTRY)
+        flag = fuse_lowlevel_notify_inval_entry(notify_session, notice.i_number, notice.name.c_str(), notice.name.length());
+    else if (notice.kind == NOTICE_PATH)
+        flag = fuse_invalidate_path(notify_fuse, notice.name.c_str());
+
+    if ((flag != 0) && (flag != -ENOENT) && DEBUG_PRINT_COMMAND)
+        logger(DEBUG, "[INFO] Kernel notification (kind %d, #%d, %s) failed: %s.\n",
+               notice.kind, notice.i_number, notice.name.c_str(), strerror(-flag));
+}
+
+/** (for internal uses only) Body of the notification thread. */
+void notify_worker() {
+    std::unique_lock<std::mutex> guard(notify_lock);
+    while (true) {
+        while (notify_running && pending_notices.empty())
+            cond_notify.wait(guard);
+        if (!notify_running)
+            break;
+
+        kernel_notice notice = pending_notices.front();
+        pending_notices.pop_front();
+        guard.unlock();
+        send_notice(notice);
+        guard.lock();
+    }
+}
+
+/** (for internal uses only) Queue a notification, unless no interface is started. */
+void queue_notice(int kind, int i_number, const char* name) {
+    std::lock_guard<std::mutex> guard(notify_lock);
+    if (!notify_running)
+        return;
+    if ((kind == NOTICE_PATH) ? (notify_fuse == NULL) : (notify_session == NULL))
+        return;     // Inode numbers are only known to the kernel through the low-level interface.
+    pending_notices.push_back({kind, i_number, (name == NULL) ? "" : name});
+    cond_notify.notify_one();
+}
+
+
+/** Start sending notifications through the low-level interface. */
+void start_kernel_notify(struct fuse_session* se) {
+    std::lock_guard<std::mutex> guard(notify_lock);
+    if (notify_running)
+        return;
+    notify_session = se;
+    notify_fuse = NULL;
+    notify_running = true;
+    notify_thread = std::thread(notify_worker);
+}
+
+/** Start sending notifications through the high-level interface. */
+void start_kernel_notify(struct fuse* f) {
+    std::lock_guard<std::mutex> guard(notify_lock);
+    if (notify_running)
+        return;
+    notify_session = NULL;
+    notify_fuse = f;
+    notify_running = true;
+    notify_thread = std::thread(notify_worker);
+}
+
+/** Stop the notification thread (pending notifications are dropped, as the kernel is going away). */
+void stop_kernel_notify() {
+    {
+        std::lock_guard<std::mutex> guard(notify_lock);
+        if (!notify_running)
+            return;
+        notify_running = false;
+        pending_notices.clear();
+        cond_notify.notify_one();
+    }
+    notify_thread.join();
+    notify_session = NULL;
+    notify_fuse = NULL;
+}
+
+
+/** Invalidate the cached attributes of an inode (its cached pages are kept). */
+void notify_inode(int i_number) {
+    queue_notice(NOTICE_INODE, i_number, NULL);
+}
+
+/** Invalidate a cached name (or negative entry) in a directory. */
+void notify_entry(int par_inum, const char* name) {
+    queue_notice(NOTICE_ENTRY, par_inum, name);
+}
+
+/** Invalidate a cached path (the high-level interface does not expose i_numbers). */
+void notify_path(const char* path) {
+    queue_notice(NOTICE_PATH, 0, path);
+}
@@ -0,0 +1,28 @@
+#ifndef notify_h
+#define notify_h
+
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+
+/** **************************************
+ * Kernel cache invalidation.
+ * ***************************************/
+/* The kernel caches entries (name -> inode), negative entries (missing names) and attributes
+ * for a long time, so that lookups and getattr are mostly served from its dcache.
+ * Whenever LFS changes an inode or a directory entry behind the kernel's back (e.g. renames,
+ * hard links, or inodes reclaimed by the cleaner), it notifies the kernel to drop its copy.
+ * Notifications are queued and sent by a separate thread: the kernel may block them on locks
+ * held by the very request that triggers them. */
+const double ENTRY_TIMEOUT      = 3600.0;   // Validity (in seconds) of names cached by the kernel.
+const double NEGATIVE_TIMEOUT   = 3600.0;   // Validity (in seconds) of missing names cached by the kernel.
+const double ATTR_TIMEOUT       = 3600.0;   // Validity (in seconds) of attributes cached by the kernel.
+
+void start_kernel_notify(struct fuse_session* se);
+void start_kernel_notify(struct fuse* f);
+void stop_kernel_notify();
+
+void notify_inode(int i_number);
+void notify_entry(int par_inum, const char* name);
+void notify_path(const char* path);
+
+#endif
@@ -1,9 +1,12 @@
 #include "path.h"
 
 #include "logger.h"
+#include "metrics.h"
 #include "print.h"
 #include "utility.h"
 #include "blockio.h"
+#include "dirindex.h"
+#include "dirhash.h"
 
 #include <fuse.h>
 #include <string.h>  /* strlen strcat strcpy */
@@ -116,11 +119,74 @@ std::string current_fname(const char* path) {
     return ret;
 }
 
+/** Search a directory for an entry (following its chain of non-head inodes).
+ * @param  head_inode: first inode of the directory.
+ * @param  name: name of the entry.
+ * @param  i_number: return variable (unchanged if the entry does not exist).
+ * @return flag: whether the entry is found. */
+bool search_directory(struct inode* head_inode, const char* name, int &i_number) {
+    if (is_hashed_dir(head_inode))
+        return hashed_dir_lookup(head_inode, name, i_number);
+    if (USE_DIR_INDEX && (head_inode->mode == MODE_DIR)) {
+        dir_slot slot;
+        if (!dir_index_lookup(head_inode, name, slot))
+            return false;
+        i_number = slot.i_number;
+        return true;
+    }
+
+    struct inode* block_inode = head_inode;
+    block_ref ref;
+    while (true) {
+        for (int i=0; i<NUM_INODE_DIRECT; i++) {
+            if (block_inode->direct[i] <= -1)
+                continue;
+            if (block_inode->direct[i] > FILE_SIZE) {
+                if (block_inode->num_direct > i) {
+                    logger(ERROR, "[FATAL ERROR] Corrupt file system on disk: invalid direct[%d] of inode #%d.\n", i, block_inode->i_number);
+                    exit(-1);
+                }
+                if (ERROR_PATH) {
+                    logger(ERROR, "[ERROR] Inode not correctly initialized: invalid direct[%d] of inode #%d.\n", i, block_inode->i_number);
+                    logger(ERROR, "* When searching \'%s\', at inode #%d.\n", name, block_inode->i_number);
+                }
+                continue;
+            }
+            acquire_block(ref, block_inode->direct[i]);
+            const dir_entry* block_dir = (const dir_entry*) ref.data;
+
+            for (int j=0; j<MAX_DIR_ENTRIES; j++) {
+                if (block_dir[j].i_number <= 0)
+                    continue;
+                if ((block_dir[j].i_number > MAX_NUM_INODE) && ERROR_PATH) {
+                    logger(ERROR, "[ERROR] Directory block not correctly initialized: invalid i_number #%d in entry %d.\n", block_dir[j].i_number, j);
+                    logger(ERROR, "* When searching \'%s\', at directory (inode %d, block %d).\n", name, block_inode->i_number, i);
+                }
+
+                if (strcmp(block_dir[j].filename, name) == 0) {
+                    i_number = block_dir[j].i_number;
+                    release_block(ref);
+                    return true;
+                }
+            }
+            release_block(ref);
+        }
+
+        if (block_inode->next_indirect == 0) break;
+
+        if (DEBUG_LOCATE_REPORT)
+            logger(DEBUG, "-- Searching (non-head) inode #%d.\n", block_inode->next_indirect);
+        get_inode_from_inum(block_inode, block_inode->next_indirect);
+    }
+    return false;
+}
+
 /** Traverse an absolute path to retrieve inode number.
  * @param  _path: an absolute path from LFS root.
  * @param  i_number: return variable.
  * @return flag: indicating whether the traversal is successful. */
 int locate(const char* _path, int &i_number) {
+    metric_timer timer(STAGE_LOCATE);
     if (_path[0] != '/') {
         if (ERROR_PATH)
             logger(ERROR, "[ERROR] Function locate() only accepts absolute path from LFS root.\n");
@@ -158,11 +224,10 @@ int locate(const char* _path, int &i_number) {
     clock_gettime(CLOCK_REALTIME, &cur_time);
 
     // Get information (uid, gid) of the user who calls LFS interface.
-    struct fuse_context* user_info = fuse_get_context();
+    struct fuse_context* user_info = get_caller_context();
 
     // Traverse split path from LFS root directory.
     struct inode* block_inode;
-    directory block_dir;
     bool flag;
     std::string target;
 
@@ -201,49 +266,7 @@ int locate(const char* _path, int &i_number) {
             return -EACCES;
         }
 
-        flag = false;
-        while (!flag) {
-            for (int i=0; i<NUM_INODE_DIRECT; i++) {
-                if (block_inode->direct[i] <= -1)
-                    continue;
-                if (block_inode->direct[i] > FILE_SIZE) {
-                    if (block_inode->num_direct > i) {
-                        logger(ERROR, "[FATAL ERROR] Corrupt file system on disk: invalid direct[%d] of inode #%d.\n", i, block_inode->i_number);
-                        exit(-1);
-                    }
-                    if (ERROR_PATH) {
-                        logger(ERROR, "[ERROR] Inode not correctly initialized: invalid direct[%d] of inode #%d.\n", i, block_inode->i_number);
-                        logger(ERROR, "* When locating path \'%s\', at inode #%d.\n", _path, block_inode->i_number);
-                    }
-                    continue;
-                }
-                get_block(block_dir, block_inode->direct[i]);
-
-                for (int j=0; j<MAX_DIR_ENTRIES; j++) {
-                    if (block_dir[j].i_number <= 0)
-                        continue;
-                    if ((block_dir[j].i_number > MAX_NUM_INODE) && ERROR_PATH) {
-                        logger(ERROR, "[ERROR] Directory block not correctly initialized: invalid i_number #%d in entry %d.\n", block_dir[j].i_number, j);
-                        logger(ERROR, "* When locating path \'%s\', at directory (inode %d, block %d).\n", _path, block_inode->i_number, i);
-                    }
-
-                    if (block_dir[j].filename == target) {
-                        cur_inumber = block_dir[j].i_number;
-                        flag = true;
-                        break;
-                    }
-                }
-
-                if (flag) break;
-            }
-            if (flag) break;
-
-            if (block_inode->next_indirect == 0) break;
-
-            get_inode_from_inum(block_inode, block_inode->next_indirect);
-            if (DEBUG_LOCATE_REPORT)
-                logger(DEBUG, "-- Searching (non-head) inode #%d.\n", block_inode->next_indirect);
-        }
+        flag = search_directory(block_inode, target.c_str(), cur_inumber);
 
         if (DEBUG_LOCATE_REPORT)
             if (flag) {
@@ -277,4 +300,15 @@ int locate(const char* _path, int &i_number) {
     }
 
     return 0;
+}
+
+/** Resolve the parent directory of a path, and split out the last component.
+ * @param  path: an absolute path from LFS root.
+ * @param  par_inum: return variable (i_number of the parent directory).
+ * @param  name: return variable (name of the last component).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int locate_parent(const char* path, int &par_inum, std::string &name) {
+    std::string parent_dir = relative_to_absolute(path, "../", 0);
+    name = current_fname(path);
+    return locate(parent_dir.c_str(), par_inum);
 }
\ No newline at end of file
@@ -8,5 +8,7 @@ std::string resolve_prefix(const char*);
 void generate_prefix(const char*);
 std::string current_fname(const char*);
 int locate(const char* path, int &i_number);
+int locate_parent(const char* path, int &par_inum, std::string &name);
+bool search_directory(struct inode* head_inode, const char* name, int &i_number);
 
 #endif
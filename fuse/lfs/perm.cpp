@@ -1,6 +1,7 @@
 #include "perm.h"
 
 #include "logger.h"
+#include "metrics.h"
 #include "print.h"
 #include "path.h"
 #include "utility.h"
@@ -15,13 +16,9 @@ int o_chmod(const char* path, mode_t mode, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "CHMOD, %s, %d, %p\n",
                resolve_prefix(path).c_str(), mode, fi);
-    
-    if (is_full) {
-        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
-        logger(WARN, "====> Cannot proceed to change permission of the file / directory.\n");
-        return -ENOSPC;
-    }
-    
+
+    metric_timer timer(OP_CHMOD);
+
     int fh;
     int locate_err = locate(path, fh);
     if (locate_err != 0) {
@@ -30,12 +27,26 @@ int o_chmod(const char* path, mode_t mode, struct fuse_file_info* fi) {
         return locate_err;
     }
 
+    return change_permission(fh, mode);
+}
+
+/** Change permission bits of a file / directory.
+ * @param  i_number: i_number of the file / directory.
+ * @param  mode: new permission (only the lowest 9 bits are used).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int change_permission(int i_number, mode_t mode) {
+    if (is_full) {
+        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
+        logger(WARN, "====> Cannot proceed to change permission of the file / directory.\n");
+        return -ENOSPC;
+    }
+
     /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[fh]);
+    std::lock_guard <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
 
     inode* block_inode;
-    get_inode_from_inum(block_inode, fh);
+    get_inode_from_inum(block_inode, i_number);
     block_inode->permission = mode & 0777;
     clock_gettime(CLOCK_REALTIME, &block_inode->ctime);
     new_inode_block(block_inode);
@@ -48,12 +59,8 @@ int o_chown(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "CHOWN, %s, %d, %d, %p\n",
                resolve_prefix(path).c_str(), uid, gid, fi);
-    
-    if (is_full) {
-        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
-        logger(WARN, "====> Cannot proceed to change the owner of the file / directory.\n");
-        return -ENOSPC;
-    }
+
+    metric_timer timer(OP_CHOWN);
 
     int fh;
     int locate_err = locate(path, fh);
@@ -63,12 +70,26 @@ int o_chown(const char* path, uid_t uid, gid_t gid, struct fuse_file_info* fi) {
         return locate_err;
     }
 
+    return change_owner(fh, uid, gid);
+}
+
+/** Change the owner of a file / directory.
+ * @param  i_number: i_number of the file / directory.
+ * @param  uid, gid: new owner and group (-1 to keep unchanged).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int change_owner(int i_number, uid_t uid, gid_t gid) {
+    if (is_full) {
+        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
+        logger(WARN, "====> Cannot proceed to change the owner of the file / directory.\n");
+        return -ENOSPC;
+    }
+
     /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[fh]);
+    std::lock_guard <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
 
     inode* block_inode;
-    get_inode_from_inum(block_inode, fh);
+    get_inode_from_inum(block_inode, i_number);
     if (uid != -1)
         block_inode->perm_uid = uid;
     if (gid != -1)
@@ -8,4 +8,8 @@
 int o_chmod(const char*, mode_t, struct fuse_file_info*);
 int o_chown(const char*, uid_t, gid_t, struct fuse_file_info*);
 
+// Inode-based implementations (shared by the high-level and low-level interfaces).
+int change_permission(int i_number, mode_t mode);
+int change_owner(int i_number, uid_t uid, gid_t gid);
+
 #endif
\ No newline at end of file
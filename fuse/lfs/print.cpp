@@ -22,6 +22,9 @@ void print(struct inode* node){
         case (MODE_MID_INODE):
             logger(DEBUG, "MODE\tnon-head inode (-1)\n");
             break;
+        case (MODE_ORPHAN):
+            logger(DEBUG, "MODE\torphan, to be reclaimed (-2)\n");
+            break;
         default:
             logger(DEBUG, "MODE\tunknown (%d)\n", node->mode);
             break;
@@ -114,6 +117,7 @@ void print(struct superblock* sblk) {
     logger(DEBUG, "TOT_SEGMENTS\t%d\n", sblk->tot_segments);
     logger(DEBUG, "BLOCK_SIZE  \t%d\n", sblk->block_size);
     logger(DEBUG, "SEGMENT_SIZE\t%d\n", sblk->segment_size);
+    logger(DEBUG, "NUM_DEVICES \t%d\n", sblk->num_devices);
     logger(DEBUG, "============================ PRINT SUPERBLOCK ====================\n\n");
 }
 
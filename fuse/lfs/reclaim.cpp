@@ -0,0 +1,232 @@
+#include "reclaim.h"
+
+#include "logger.h"
+#include "blockio.h"
+#include "dirindex.h"
+#include "dirhash.h"
+
+#include <string.h>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+std::mutex reclaim_lock;
+std::condition_variable cond_reclaim;
+std::deque<int> pending_orphans;
+bool reclaim_running = false;
+std::thread reclaim_thread;
+
+// References (kernel lookups and open handles) on each object.
+std::atomic<uint64_t> inode_refs[MAX_NUM_INODE];
+
+
+/** (for internal uses only) Queue an orphan for the reclaimer. */
+void queue_orphan(int i_number) {
+    std::lock_guard<std::mutex> guard(reclaim_lock);
+    pending_orphans.push_back(i_number);
+    cond_reclaim.notify_one();
+}
+
+/** Turn an unlinked file / directory into an orphan, to be reclaimed in the background.
+ * @param  head_inode: first inode of the object.
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the object. */
+void orphan_inode(struct inode* head_inode) {
+    if (has_inline_data(head_inode)) {
+        // Orphans have no inline data: direct[] is only read as block pointers from now on.
+        memset(head_inode->direct, -1, sizeof(head_inode->direct));
+        head_inode->fsize_byte = head_inode->fsize_block = 0;
+    }
+    head_inode->mode = MODE_ORPHAN;
+    head_inode->num_links = 0;
+    new_inode_block(head_inode);
+    queue_orphan(head_inode->i_number);
+}
+
+/** Turn the detached tail of an inode chain (e.g. after truncation) into an orphan.
+ * @param  i_number: first (non-head) inode of the detached chain.
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the file. */
+void orphan_chain(int i_number) {
+    struct inode* cur_inode;
+    get_inode_from_inum(cur_inode, i_number);
+    cur_inode->mode = MODE_ORPHAN;
+    new_inode_block(cur_inode);
+    queue_orphan(i_number);
+}
+
+
+/** (for internal uses only) Free an unlinked file / directory: its inode chain is orphaned
+ * (or removed right away, without USE_DEFERRED_RECLAIM).
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the object. */
+void free_object(struct inode* head_inode) {
+    int cur_inum = head_inode->i_number;
+    if (head_inode->mode == MODE_DIR) {
+        evict_dir_index(cur_inum);
+        forget_dir_format(cur_inum);
+    }
+    if (USE_DEFERRED_RECLAIM) {
+        orphan_inode(head_inode);   // The inode chain is removed in the background.
+        return;
+    }
+    do {
+        struct inode* cur_inode;
+        get_inode_from_inum(cur_inode, cur_inum);
+        int next_inum = cur_inode->next_indirect;
+        remove_inode(cur_inum);
+        cur_inum = next_inum;
+    } while (cur_inum != 0);
+}
+
+/** (for internal uses only) Whether an i_number refers to an unlinked (but not yet freed) object. */
+bool is_unlinked(int i_number) {
+    struct inode* head_inode = cached_inode_array + i_number;
+    return (inode_table[i_number] != -1) && (head_inode->num_links == 0)
+           && ((head_inode->mode == MODE_FILE) || (head_inode->mode == MODE_DIR));
+}
+
+/** Take references on an object (kernel lookups, or an open handle).
+ * [CAUTION] Take them before checking that the object exists: an object found unlinked and
+ *           unreferenced may be freed at any time, and is then released by drop_inode(). */
+void hold_inode(int i_number, uint64_t count) {
+    if ((i_number > 0) && (i_number < MAX_NUM_INODE))
+        inode_refs[i_number] += count;
+}
+
+/** Drop references on an object (as the kernel forgets it, or a handle is released): the last one frees it if it is unlinked. */
+void drop_inode(int i_number, uint64_t count) {
+    if ((i_number <= 0) || (i_number >= MAX_NUM_INODE) || (inode_refs[i_number].fetch_sub(count) != count))
+        return;
+    std::lock_guard <std::shared_mutex> guard(inode_lock(i_number));
+    if (inode_refs[i_number] != 0)
+        return;
+    if (is_unlinked(i_number)) {
+        free_object(cached_inode_array + i_number);
+        if (DEBUG_BLOCKIO)
+            logger(DEBUG, "Freed unlinked inode #%d after its last reference.\n", i_number);
+    } else if (USE_DIR_INDEX && (cached_inode_array[i_number].mode == MODE_DIR)) {
+        // The kernel evicted the directory: its index is released, and rebuilt on its next use.
+        // Modifiers of the index hold the inode lock, so none of them is half-way through it.
+        evict_dir_index(i_number);
+    }
+}
+
+/** Release an object whose last link is removed: it is freed now, or by drop_inode() if it is still referenced.
+ * @param  head_inode: first inode of the object.
+ * [CAUTION] The caller should hold the (exclusive) inode lock of the object. */
+void release_unlinked(struct inode* head_inode) {
+    head_inode->num_links = 0;
+    if (inode_refs[head_inode->i_number] == 0) {
+        free_object(head_inode);
+        return;
+    }
+    new_inode_block(head_inode);    // Persist the unlink: it is freed on the next mount otherwise.
+}
+
+
+/** (for internal uses only) Remove up to RECLAIM_BATCH inodes of an orphan chain.
+ * The orphan is rewritten before the inodes it no longer points to are removed, so that a crash
+ * in between may leak them, but never leaves the orphan pointing to removed inodes.
+ * @return bool: whether the orphan is completely reclaimed. */
+bool reclaim_batch(int i_number) {
+    std::lock_guard <std::shared_mutex> guard(inode_lock(i_number));
+    struct inode* orphan;
+    get_inode_from_inum(orphan, i_number);
+    if ((inode_table[i_number] == -1) || (orphan->mode != MODE_ORPHAN))
+        return true;
+
+    reserve_segment_space(1, RECLAIM_BATCH + 1);
+    std::vector<int> batch;
+    while ((orphan->next_indirect != 0) && (batch.size() < RECLAIM_BATCH)) {
+        struct inode* next_inode;
+        get_inode_from_inum(next_inode, orphan->next_indirect);
+        batch.push_back(orphan->next_indirect);
+        orphan->next_indirect = next_inode->next_indirect;
+    }
+
+    bool done = (orphan->next_indirect == 0);
+    if (!done)
+        new_inode_block(orphan);
+    for (int inum : batch)
+        remove_inode(inum);
+    if (done)
+        remove_inode(i_number);
+
+    if (DEBUG_BLOCKIO)
+        logger(DEBUG, "Reclaimed %lu inode(s) of orphan #%d (done = %d).\n", batch.size() + done, i_number, done);
+    return done;
+}
+
+/** (for internal uses only) Body of the reclaimer thread. */
+void reclaim_worker() {
+    std::unique_lock<std::mutex> guard(reclaim_lock);
+    while (true) {
+        while (reclaim_running && pending_orphans.empty())
+            cond_reclaim.wait(guard);
+        if (!reclaim_running)
+            break;
+
+        int i_number = pending_orphans.front();
+        pending_orphans.pop_front();
+        guard.unlock();
+        bool done = reclaim_batch(i_number);
+        guard.lock();
+        if (!done)
+            pending_orphans.push_back(i_number);    // Let other orphans make progress as well.
+    }
+}
+
+
+/** Start the reclaimer, and queue the orphans found in the inode array (after mounting).
+ * Objects still unlinked (see release_unlinked()) are orphaned first. An orphan that is still referenced by a live inode belongs to a truncation that was not
+ * committed before a crash: it is restored as an ordinary (non-head) inode instead. */
+void start_reclaimer() {
+    // No reference survives a mount: free the objects unlinked while they were referenced.
+    for (int i=1; i<MAX_NUM_INODE; i++) {
+        inode_refs[i] = 0;
+        if ((cached_inode_array[i].i_number == i) && is_unlinked(i))
+            free_object(cached_inode_array + i);
+    }
+
+    std::vector<bool> referenced(MAX_NUM_INODE, false);
+    for (int i=1; i<MAX_NUM_INODE; i++) {
+        struct inode* cur_inode = cached_inode_array + i;
+        if ((inode_table[i] != -1) && (cur_inode->i_number == i) && (cur_inode->mode != MODE_ORPHAN)
+            && (cur_inode->next_indirect > 0) && (cur_inode->next_indirect < MAX_NUM_INODE))
+            referenced[cur_inode->next_indirect] = true;
+    }
+
+    std::lock_guard<std::mutex> guard(reclaim_lock);
+    if (reclaim_running)
+        return;
+    pending_orphans.clear();
+    for (int i=1; i<MAX_NUM_INODE; i++) {
+        struct inode* cur_inode = cached_inode_array + i;
+        if ((inode_table[i] == -1) || (cur_inode->i_number != i) || (cur_inode->mode != MODE_ORPHAN))
+            continue;
+        if (referenced[i]) {
+            cur_inode->mode = MODE_MID_INODE;
+            new_inode_block(cur_inode);
+        } else {
+            pending_orphans.push_back(i);
+        }
+    }
+    if (!pending_orphans.empty())
+        logger(DEBUG, "[INFO] Resuming reclamation of %lu orphan(s).\n", pending_orphans.size());
+
+    reclaim_running = true;
+    reclaim_thread = std::thread(reclaim_worker);
+}
+
+/** Stop the reclaimer (before unmounting). Remaining orphans are reclaimed after the next mount. */
+void stop_reclaimer() {
+    {
+        std::lock_guard<std::mutex> guard(reclaim_lock);
+        if (!reclaim_running)
+            return;
+        reclaim_running = false;
+        cond_reclaim.notify_one();
+    }
+    reclaim_thread.join();
+    pending_orphans.clear();
+}
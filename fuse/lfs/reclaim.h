@@ -0,0 +1,33 @@
+#ifndef reclaim_h
+#define reclaim_h
+
+#include "utility.h"
+
+#include <stdint.h>
+
+/** **************************************
+ * Deferred reclamation of unlinked and truncated files.
+ * ***************************************/
+/* Unlink and truncate only detach the inodes to be freed: the first inode of the detached chain
+ * is rewritten as an orphan (mode MODE_ORPHAN), which takes O(1) work in the foreground.
+ * A background thread then removes the rest of the chain (and with it, the data blocks) in
+ * batches, and finally the orphan itself. Orphans are ordinary inodes in the log, so they form
+ * a persistent orphan list: on mount, all orphans are queued again, and reclamation resumes. */
+const int RECLAIM_BATCH = 64;       // Chain inodes removed at a time (holding the orphan's lock).
+
+void orphan_inode(struct inode* head_inode);
+void orphan_chain(int i_number);
+
+/* An object may still be referenced (by kernel lookups and open handles) after its last link is
+ * removed, and POSIX requires it to stay readable and writable through those references. Removing
+ * the last link only sets num_links to 0 (the object keeps its mode, and is no longer found by name);
+ * the object is freed once its last reference is dropped. Objects left unlinked by an unmount
+ * or a crash hold no reference any more, and are freed on the next mount. */
+void hold_inode(int i_number, uint64_t count = 1);
+void drop_inode(int i_number, uint64_t count = 1);
+void release_unlinked(struct inode* head_inode);
+
+void start_reclaimer();
+void stop_reclaimer();
+
+#endif
@@ -1,10 +1,12 @@
 #include "stats.h"
 
 #include "logger.h"
+#include "metrics.h"
 #include "print.h"
 #include "utility.h"
 #include "path.h"
 #include "blockio.h"
+#include "dirhash.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -12,7 +14,9 @@
 int o_statfs(const char* path, struct statvfs* stbuf) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "STATFS, %s, %p\n", resolve_prefix(path).c_str(), stbuf);
-    
+
+    metric_timer timer(OP_STATFS);
+
     int inum;
     int locate_err = locate(path, inum);
     if (locate_err != 0) {
@@ -21,10 +25,13 @@ int o_statfs(const char* path, struct statvfs* stbuf) {
         return locate_err;
     }
 
-    /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inum]);
-    /* This will be automatically released on each exit path. */
+    fill_statfs(stbuf);
+    return 0;
+}
 
+/** Fill "struct statvfs" with statistics of LFS. */
+void fill_statfs(struct statvfs* stbuf) {
+    memset(stbuf, 0, sizeof(struct statvfs));
     stbuf->f_bsize = stbuf->f_frsize = BLOCK_SIZE;
     stbuf->f_blocks = 0;
     stbuf->f_bfree = stbuf->f_bavail = BLOCKS_IN_SEGMENT * TOT_SEGMENTS - stbuf->f_blocks;
@@ -32,22 +39,16 @@ int o_statfs(const char* path, struct statvfs* stbuf) {
     stbuf->f_ffree = stbuf->f_favail = MAX_NUM_INODE - count_inode - 1;
     stbuf->f_fsid = 0;
     stbuf->f_flag = 0;
-    stbuf->f_namemax = MAX_FILENAME_LEN - 1;
-
-    return 0;
+    stbuf->f_namemax = (USE_HASHED_DIR ? MAX_NAME_LEN : MAX_FILENAME_LEN) - 1;
 }
 
 int o_utimens(const char* path, const struct timespec ts[2], struct fuse_file_info *fi) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "UTIMENS, %s, %p, %p\n",
                resolve_prefix(path).c_str(), &ts, fi);
-    
-    if (is_full) {
-        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
-        logger(WARN, "====> Cannot proceed to update timestamps.\n");
-        return -ENOSPC;
-    }
-    
+
+    metric_timer timer(OP_UTIMENS);
+
     int inum;
     int locate_err = locate(path, inum);
     if (locate_err != 0) {
@@ -56,15 +57,33 @@ int o_utimens(const char* path, const struct timespec ts[2], struct fuse_file_in
         return locate_err;
     }
 
+    return change_timestamps(inum, ts);
+}
+
+/** Set access and modification time of a file / directory.
+ * @param  i_number: i_number of the file / directory.
+ * @param  ts: new atime (ts[0]) and mtime (ts[1]); UTIME_NOW and UTIME_OMIT are supported.
+ * @return flag: 0 on success, standard negative error codes on error. */
+int change_timestamps(int i_number, const struct timespec ts[2]) {
+    if (is_full) {
+        logger(WARN, "[WARNING] The file system is already full: please expand the disk size.\n* Garbage collection fails because it cannot release any blocks.\n");
+        logger(WARN, "====> Cannot proceed to update timestamps.\n");
+        return -ENOSPC;
+    }
+
     /* The inode-level fine-grained lock is added by a lock_guard. */
-    std::lock_guard <std::mutex> guard(inode_lock[inum]);
+    std::lock_guard <std::shared_mutex> guard(inode_lock(i_number));
     /* This will be automatically released on each exit path. */
 
     inode* block_inode;
-    get_inode_from_inum(block_inode, inum);
+    get_inode_from_inum(block_inode, i_number);
 
-    block_inode->atime = ts[0];
-    block_inode->mtime = ts[1];
+    struct timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+    if (ts[0].tv_nsec != UTIME_OMIT)
+        block_inode->atime = (ts[0].tv_nsec == UTIME_NOW) ? cur_time : ts[0];
+    if (ts[1].tv_nsec != UTIME_OMIT)
+        block_inode->mtime = (ts[1].tv_nsec == UTIME_NOW) ? cur_time : ts[1];
 
     new_inode_block(block_inode);
 
@@ -7,4 +7,8 @@
 int o_statfs(const char*, struct statvfs*);
 int o_utimens(const char*, const struct timespec[2], struct fuse_file_info*);
 
+// Inode-based implementations (shared by the high-level and low-level interfaces).
+void fill_statfs(struct statvfs* stbuf);
+int change_timestamps(int i_number, const struct timespec ts[2]);
+
 #endif
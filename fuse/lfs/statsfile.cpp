@@ -0,0 +1,135 @@
+#include "statsfile.h"
+
+#include "metrics.h"
+#include "logger.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+
+/** Whether an i_number refers to the virtual statistics directory or files. */
+bool is_stats_inode(uint64_t i_number) {
+    return (i_number >= STATS_DIR_INUM) && (i_number <= STATS_JSON_INUM);
+}
+
+/** Resolve a path of the high-level interface, if it names a virtual statistics file / directory.
+ * @return i_number: the virtual i_number, or 0 for any other path. */
+int stats_path_inode(const char* path) {
+    if (strcmp(path, "/" STATS_DIR_NAME) == 0)
+        return STATS_DIR_INUM;
+    if (strcmp(path, "/" STATS_DIR_NAME "/stats") == 0)
+        return STATS_TEXT_INUM;
+    if (strcmp(path, "/" STATS_DIR_NAME "/stats.json") == 0)
+        return STATS_JSON_INUM;
+    return 0;
+}
+
+/** Resolve a name of the low-level interface, if it names a virtual statistics file / directory.
+ * @return i_number: the virtual i_number, or 0 for any other entry. */
+int stats_entry_inode(uint64_t par_inum, const char* name) {
+    if (par_inum == ROOT_DIR_INUMBER)
+        return (strcmp(name, STATS_DIR_NAME) == 0) ? STATS_DIR_INUM : 0;
+    if (par_inum != STATS_DIR_INUM)
+        return 0;
+    if (strcmp(name, "stats") == 0)
+        return STATS_TEXT_INUM;
+    if (strcmp(name, "stats.json") == 0)
+        return STATS_JSON_INUM;
+    return 0;
+}
+
+/** Fill "struct stat" for a virtual statistics file / directory (owned by the mounting user).
+ * Files report a size of 0: they are read with direct I/O, up to the end of their snapshot. */
+int stats_attributes(int i_number, struct stat* sbuf) {
+    memset(sbuf, 0, sizeof(struct stat));
+    sbuf->st_ino = i_number;
+    if (i_number == STATS_DIR_INUM) {
+        sbuf->st_mode = S_IFDIR | 0555;
+        sbuf->st_nlink = 2;
+    } else {
+        sbuf->st_mode = S_IFREG | 0644;
+        sbuf->st_nlink = 1;
+    }
+    sbuf->st_uid = getuid();
+    sbuf->st_gid = getgid();
+    sbuf->st_blksize = BLOCK_SIZE;
+
+    struct timespec cur_time;
+    clock_gettime(CLOCK_REALTIME, &cur_time);
+    sbuf->st_atim = sbuf->st_mtim = sbuf->st_ctim = cur_time;
+    return 0;
+}
+
+/** Test permissions of the calling user: anyone reads, only the mounting user (or root) resets.
+ * @param  mode: F_OK, or R_OK / W_OK / X_OK ORed together.
+ * @return flag: 0 if granted, standard negative error codes otherwise. */
+int check_stats_access(int i_number, int mode) {
+    if (i_number == STATS_DIR_INUM)
+        return (mode & W_OK) ? -EACCES : 0;
+    if (mode & X_OK)
+        return -EACCES;
+    uid_t uid = get_caller_context()->uid;
+    if ((mode & W_OK) && (uid != 0) && (uid != getuid()))
+        return -EACCES;
+    return 0;
+}
+
+/** Open a virtual statistics file: a snapshot is rendered if it is opened for reading.
+ * @param  handle: return variable (the snapshot, to be passed to read_stats_file()).
+ * @return flag: 0 on success, standard negative error codes on error. */
+int open_stats_file(int i_number, int flags, uint64_t &handle) {
+    handle = 0;
+    if (i_number == STATS_DIR_INUM)
+        return -EISDIR;
+    int open_perm = flags & O_ACCMODE;
+    int flag = check_stats_access(i_number, (open_perm == O_RDONLY) ? R_OK : ((open_perm == O_WRONLY) ? W_OK : (R_OK | W_OK)));
+    if (flag != 0) {
+        if (ERROR_PERM)
+            logger(ERROR, "[ERROR] Permission denied: not allowed to reset statistics.\n");
+        return flag;
+    }
+    if (open_perm != O_WRONLY)
+        handle = (uint64_t) new std::string(render_metrics(i_number == STATS_JSON_INUM));
+    return 0;
+}
+
+/** Read the snapshot of a virtual statistics file.
+ * @return length: number of bytes read, or standard negative error codes on error. */
+int read_stats_file(uint64_t handle, char* buf, size_t size, off_t offset) {
+    if (handle == 0)
+        return -EBADF;
+    const std::string* snapshot = (const std::string*) handle;
+    if (offset >= (off_t) snapshot->size())
+        return 0;
+    size_t len = std::min(size, (size_t) (snapshot->size() - offset));
+    memcpy(buf, snapshot->data() + offset, len);
+    return len;
+}
+
+/** Write into a virtual statistics file: whatever is written, all statistics are reset.
+ * @return length: number of bytes "written", or standard negative error codes on error. */
+int write_stats_file(int i_number, size_t size) {
+    if (i_number == STATS_DIR_INUM)
+        return -EISDIR;
+    reset_metrics();
+    return size;
+}
+
+/** Drop the snapshot of a virtual statistics file (if any). */
+void release_stats_file(uint64_t handle) {
+    delete (std::string*) handle;
+}
+
+/** List the virtual statistics directory (see read_directory()). */
+int read_stats_directory(off_t offset, dir_visitor_t visit, void* ctx) {
+    const char* names[] = {".", "..", "stats", "stats.json"};
+    const int inums[] = {STATS_DIR_INUM, ROOT_DIR_INUMBER, STATS_TEXT_INUM, STATS_JSON_INUM};   // Under the root.
+    for (int i=std::max(offset, (off_t) 0); i<4; i++)
+        if (visit(ctx, names[i], inums[i], i+1))
+            return 0;
+    return 0;
+}
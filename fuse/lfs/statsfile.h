@@ -0,0 +1,37 @@
+#ifndef statsfile_h
+#define statsfile_h
+
+#include "utility.h"
+#include "dir.h"
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+/** **************************************
+ * Virtual statistics files.
+ * ***************************************/
+/* The root directory holds a virtual directory ".lfs" (not listed, and never stored on disk),
+ * with two files rendering the histograms and counters of metrics.h:
+ *   /.lfs/stats        a table (latencies in microseconds),
+ *   /.lfs/stats.json   the same statistics, as a JSON object.
+ * Writing anything into either file (e.g. "echo > /.lfs/stats") resets all statistics.
+ * The files are served with direct I/O: a snapshot is rendered on open, and read from by offset.
+ * Virtual i_numbers follow the real ones, so that both interfaces can tell them apart. */
+#define STATS_DIR_NAME ".lfs"
+const int STATS_DIR_INUM  = MAX_NUM_INODE;
+const int STATS_TEXT_INUM = MAX_NUM_INODE + 1;
+const int STATS_JSON_INUM = MAX_NUM_INODE + 2;
+
+bool is_stats_inode(uint64_t i_number);
+int stats_path_inode(const char* path);
+int stats_entry_inode(uint64_t par_inum, const char* name);
+
+int stats_attributes(int i_number, struct stat* sbuf);
+int check_stats_access(int i_number, int mode);
+int open_stats_file(int i_number, int flags, uint64_t &handle);
+int read_stats_file(uint64_t handle, char* buf, size_t size, off_t offset);
+int write_stats_file(int i_number, size_t size);
+void release_stats_file(uint64_t handle);
+int read_stats_directory(off_t offset, dir_visitor_t visit, void* ctx);
+
+#endif
@@ -6,6 +6,13 @@
 #include "blockio.h"
 #include "path.h"
 #include "wbcache.h"
+#include "dirindex.h"
+#include "dirhash.h"
+#include "notify.h"
+#include "reclaim.h"
+#include "compress.h"
+#include "dedup.h"
+#include "device.h"
 
 #include <unistd.h>
 #include <stdlib.h>
@@ -19,11 +26,42 @@ void* o_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "INIT, %p, %p\n", conn, cfg);
 
-    (void) conn;
 	cfg->kernel_cache = 1;
+    negotiate_connection(conn);
 
+    // Names and attributes are cached for long: LFS notifies the kernel of changes behind its back.
+    cfg->entry_timeout = ENTRY_TIMEOUT;
+    cfg->negative_timeout = NEGATIVE_TIMEOUT;
+    cfg->attr_timeout = ATTR_TIMEOUT;
+    start_kernel_notify(fuse_get_context()->fuse);
+
+    mount_lfs();
+	return NULL;
+}
+
+/** Negotiate request sizes and caching with the kernel (shared by the high-level and low-level interfaces).
+ * With the writeback cache, small writes are coalesced in the kernel page cache, which owns
+ * the size and mtime of open files. Since it also reads (and writes back) pages on behalf of
+ * any opener, read / write permissions are only checked on open. */
+void negotiate_connection(struct fuse_conn_info* conn) {
+    writeback_cache = USE_WRITEBACK_CACHE && (conn->capable & FUSE_CAP_WRITEBACK_CACHE);
+    if (writeback_cache)
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+
+    // The kernel sizes its requests (reads included) by max_write.
+    // (max_read can only be lowered, by the "-o max_read" mount option.)
+    conn->max_write = MAX_REQUEST_SIZE;
+}
+
+/** Create / load LFS from the disk file (shared by the high-level and low-level interfaces). */
+void mount_lfs() {
     /* Initialize cache first. */
     init_cache();
+    forget_segment_extents();
+    forget_dedup_index();
+    clear_dir_indexes();
+    clear_dir_formats();
+    reset_inode_pack();
 
     /* Retrive system time (for atime updates). */
     struct timespec cur_time;
@@ -37,24 +75,15 @@ void* o_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
     /* ****************************************
      * Create / open LFS from disk.
      * ****************************************/
-    std::string _lfs_path = current_working_dir;
-    _lfs_path += "lfs.data";
-    lfs_path = (char*) malloc(_lfs_path.length() + 2);
-    strcpy(lfs_path, _lfs_path.c_str());
+    std::string default_path = current_working_dir;
+    default_path += "lfs.data";
 
-    if (access(lfs_path, R_OK) != 0) {    // Disk file does not exist.
-        logger(DEBUG, "[INFO] Disk file (lfs.data) does not exist. Try to create it and initialize to 0.\n");
+    if (open_devices(default_path.c_str())) {    // Disk file does not exist.
+        logger(DEBUG, "[INFO] Disk file (%s) does not exist. Try to create it and initialize to 0.\n", lfs_path);
         
         initialize_disk_file();
         logger(DEBUG, "[INFO] Successfully initialized the file system.\n");
     } else {
-        // Try to open an existing file.
-        int file_handle = open(lfs_path, O_RDWR);
-        if (file_handle <= 0) {
-            logger(ERROR, "[FATAL ERROR] Fail to open existing disk file (lfs.data). Please contact administrator.\n");
-            exit(-1);
-        }
-        close(file_handle);
         logger(DEBUG, "[INFO] Successfully found an existing file system.\n");
 
         load_from_disk_file();
@@ -64,14 +93,23 @@ void* o_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
         print_inode_table();
     }
 
-	return NULL;
+    // Resume reclaiming orphans (unlinked or truncated before the last unmount or crash).
+    start_reclaimer();
 }
 
 
 void o_destroy(void* private_data) {
     if (DEBUG_PRINT_COMMAND)
         logger(DEBUG, "DESTROY, %p\n", private_data);
-    
+
+    stop_kernel_notify();
+    unmount_lfs();
+}
+
+/** Save LFS to the disk file (shared by the high-level and low-level interfaces). */
+void unmount_lfs() {
+    stop_reclaimer();
+
     // Save LFS to disk.
     add_segbuf_metadata();
     
@@ -83,6 +121,10 @@ void o_destroy(void* private_data) {
     generate_checkpoint();
 
     flush_cache();
+    close_devices();
+
+    clear_dir_indexes();
+    clear_dir_formats();
 
     /* For debugging purposes only.
         print_inode_table();
@@ -90,27 +132,18 @@ void o_destroy(void* private_data) {
     For debugging purposes only. */
     
     logger(DEBUG, "[INFO] Successfully saved current state to disk and exited.\n");
+    flush_logs();
 }
 
 
 /** Initialize basic LFS structures into a disk file. */
 void initialize_disk_file() {
-    // Create a file.
-    int file_handle = open(lfs_path, O_RDWR | O_CREAT, 0777);
-    if (file_handle <= 0) {
-        logger(ERROR, "[FATAL ERROR] Fail to create a new disk file (lfs.data).\n");
+    // The files read as 0 until segments are written (see release_disk_range()).
+    if (format_devices() != 0) {
+        logger(ERROR, "[FATAL ERROR] Fail to format the disk file (%s).\n", lfs_path);
         exit(-1);
     }
-
-    // Fill 0 into the file.
-    char* buf = (char*) malloc(FILE_SIZE);
-    memset(buf, 0, FILE_SIZE);
-    pwrite(file_handle, buf, FILE_SIZE, 0);
-    free(buf);
-
-    // Must close file after formatting.
-    close(file_handle); 
-    logger(DEBUG, "[INFO] Successfully created a new disk file (lfs.data).\n");
+    logger(DEBUG, "[INFO] Successfully created a new disk file (%s) on %d device(s).\n", lfs_path, num_devices);
 
 
     // Initialize global state variables.
@@ -130,7 +163,8 @@ void initialize_disk_file() {
         tot_blocks   : BLOCKS_IN_SEGMENT * TOT_SEGMENTS,
         tot_segments : TOT_SEGMENTS,
         block_size   : BLOCK_SIZE,
-        segment_size : SEGMENT_SIZE
+        segment_size : SEGMENT_SIZE,
+        num_devices  : num_devices
     };
     write_superblock(&init_sblock);
     print(&init_sblock);
@@ -139,10 +173,14 @@ void initialize_disk_file() {
     struct inode* root_inode;
     file_initialize(root_inode, MODE_DIR, 0777);
 
-    buf = (char*) malloc(BLOCK_SIZE);
-    memset(buf, 0, BLOCK_SIZE);
-    file_add_data(root_inode, buf);
-    free(buf);
+    if (USE_HASHED_DIR) {
+        hashed_dir_init(root_inode);
+    } else {
+        char* buf = (char*) malloc(BLOCK_SIZE);
+        memset(buf, 0, BLOCK_SIZE);
+        file_add_data(root_inode, buf);
+        free(buf);
+    }
 
     new_inode_block(root_inode);
     if (USE_CACHE)
@@ -159,6 +197,17 @@ void initialize_disk_file() {
 
 /** Load LFS structure data from an existing disk file. */
 void load_from_disk_file() {
+    /* Segments must be striped the same way as they were written. */
+    struct superblock sblock;
+    memset(&sblock, 0, sizeof(sblock));
+    read_superblock(&sblock);
+    int sblock_devices = (sblock.num_devices == 0) ? 1 : sblock.num_devices;
+    if ((sblock.tot_segments != TOT_SEGMENTS) || (sblock_devices != num_devices)) {
+        logger(ERROR, "[FATAL ERROR] Superblock mismatch: %d device(s) given, but the file system is striped over %d.\n",
+               num_devices, sblock_devices);
+        exit(-1);
+    }
+
     /* (A) Read the (newer) checkpoint. */
     checkpoints ckpt;
     read_checkpoints(&ckpt);
@@ -197,16 +246,22 @@ void load_from_disk_file() {
     imap_entry im_entry;
     int newest_seg = -1, newest_sec = 0, newest_nsec = 0, newest_block = 0, newest_imap_index = 0;
     for (int seg=0; seg<TOT_SEGMENTS; seg++) {
-        segment_summary seg_sum;
-        read_segment_summary(&seg_sum, seg);
-        memcpy(&cached_segsum[seg], &seg_sum, sizeof(seg_sum));
-
         struct segment_metadata seg_metadata;
         read_segment_metadata(&seg_metadata, seg);
         int seg_sec   = seg_metadata.update_sec;
         int seg_nsec  = seg_metadata.update_nsec;
         int seg_block = seg_metadata.cur_block;
-        int seg_imap_index;
+        int seg_imap_index = DATA_BLOCKS_IN_SEGMENT;     // Unless a free imap entry is found below.
+
+        // Never written (or released) segments read as 0: skip the rest of them.
+        if ((seg_sec == 0) && (seg_nsec == 0)) {
+            memset(&cached_segsum[seg], 0, sizeof(segment_summary));
+            continue;
+        }
+
+        segment_summary seg_sum;
+        read_segment_summary(&seg_sum, seg);
+        memcpy(&cached_segsum[seg], &seg_sum, sizeof(seg_sum));
 
         read_segment_imap(imap, seg);
         bool is_inode_deleted[MAX_NUM_INODE];
@@ -245,7 +300,11 @@ void load_from_disk_file() {
 
     /* (C) Restore segment buffer. */
     // Restore block pointers (i.e., cur_segment and cur_block).
-    if ((newest_block == DATA_BLOCKS_IN_SEGMENT-1) || (newest_imap_index == DATA_BLOCKS_IN_SEGMENT)) {
+    if (newest_seg == -1) {
+        // No segment holds an imap: keep the position of the checkpoint (e.g. an image whose
+        // segments were released), which was validated above.
+        logger(WARN, "[WARNING] No written segment is found: resuming from the checkpoint.\n");
+    } else if ((newest_block == DATA_BLOCKS_IN_SEGMENT-1) || (newest_imap_index == DATA_BLOCKS_IN_SEGMENT)) {
         cur_segment = newest_seg;
         get_next_free_segment();
     } else {
@@ -263,10 +322,11 @@ void load_from_disk_file() {
     print_inode_table();
     for (int i=1; i<=count_inode; i++) {
         if (inode_table[i] >= 0) {
-            get_block(&inode_block, inode_table[i]);
+            get_inode_block(&inode_block, inode_table[i]);
             cached_inode_array[i] = inode_block;
         }
     }
+    rebuild_shared_blocks();    // Before any GC: shared blocks may be live through other owners.
 
     /* (E) (optional) Do a thorough garbage collection for better performance. */
     if (DO_GARBCOL_ON_START) {
@@ -6,6 +6,10 @@
 void* o_init(struct fuse_conn_info*, struct fuse_config*);
 void o_destroy(void*);
 
+void negotiate_connection(struct fuse_conn_info* conn);
+void mount_lfs();
+void unmount_lfs();
+
 void initialize_disk_file();
 void load_from_disk_file();
 
@@ -0,0 +1,126 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../clone.h"
+using namespace std;
+const int BLOCK = 1024;
+const int N = 2048;         // Blocks of the source file.
+string content(size_t len, int seed) {
+    string s(len, 0);
+    unsigned int x = seed;
+    for (char& c : s) {
+        x = x * 1103515245 + 12345;
+        c = (char) (x >> 16);
+    }
+    return s;
+}
+string read_all(const char* path) {
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    struct stat st;
+    assert(fstat(fd, &st) == 0);
+    string s(st.st_size, 0);
+    assert(pread(fd, &s[0], s.size(), 0) == (ssize_t) s.size());
+    close(fd);
+    return s;
+}
+int clone_range(int dest_fd, ino_t src_ino, off_t src_off, size_t len, off_t dest_off) {
+    struct lfs_clone_range range = {(uint64_t) src_ino, (uint64_t) src_off, (uint64_t) len, (uint64_t) dest_off};
+    return ioctl(dest_fd, LFS_IOC_CLONE_RANGE, &range);
+}
+int main() {
+    string data = content((size_t) N * BLOCK + 123, 1);
+    int src = open("clone_src.dat", O_CREAT | O_RDWR, 0644);
+    assert(src >= 0);
+    assert(pwrite(src, data.data(), data.size(), 0) == (ssize_t) data.size());
+    struct stat st;
+    assert(fstat(src, &st) == 0);
+    ino_t src_ino = st.st_ino;
+
+    // copy_file_range: a whole copy, and one at offsets that are not congruent (copied, not shared).
+    int dst = open("clone_dst.dat", O_CREAT | O_RDWR | O_TRUNC, 0644);
+    assert(dst >= 0);
+    off_t in = 0, out = 0;
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = copy_file_range(src, &in, dst, &out, left, 0);
+        assert(n > 0);
+        left -= n;
+    }
+    if (read_all("clone_dst.dat") != data) {
+        printf("Wrong content after copy_file_range.\n");
+        return 1;
+    }
+    in = 100; out = (off_t) data.size() + 7;
+    assert(copy_file_range(src, &in, dst, &out, 5 * BLOCK, 0) == 5 * BLOCK);
+    assert(read_all("clone_dst.dat").substr(data.size() + 7) == data.substr(100, 5 * BLOCK));
+
+    // Writes to either file after the copy leave the other one unchanged (copy on write).
+    string patch(BLOCK, 'p');
+    assert(pwrite(dst, patch.data(), BLOCK, 3 * BLOCK) == BLOCK);
+    if (read_all("clone_src.dat") != data) {
+        printf("Wrong source content after writing to the copy.\n");
+        return 1;
+    }
+    assert(pwrite(src, patch.data(), BLOCK, 9 * BLOCK) == BLOCK);
+    assert(read_all("clone_dst.dat").substr(9 * BLOCK, BLOCK) == data.substr(9 * BLOCK, BLOCK));
+
+    // Clones by inode number (LFS_IOC_CLONE_RANGE): a whole file, and a range within a file.
+    data.replace(9 * BLOCK, BLOCK, patch);
+    int cl = open("clone_ioc.dat", O_CREAT | O_RDWR | O_TRUNC, 0644);
+    assert(cl >= 0);
+    assert(clone_range(cl, src_ino, 0, 0, 0) == 0);
+    if (read_all("clone_ioc.dat") != data) {
+        printf("Wrong content after LFS_IOC_CLONE_RANGE.\n");
+        return 1;
+    }
+    assert(fstat(cl, &st) == 0);
+    assert(clone_range(cl, st.st_ino, 0, 4 * BLOCK, 16 * BLOCK) == 0);
+    assert(read_all("clone_ioc.dat").substr(16 * BLOCK, 4 * BLOCK) == data.substr(0, 4 * BLOCK));
+
+    // Failure paths: overlapping ranges, unaligned clones, and handles or files that do not allow it.
+    in = 0; out = BLOCK;
+    assert((copy_file_range(src, &in, src, &out, 4 * BLOCK, 0) == -1) && (errno == EINVAL));
+    assert((clone_range(cl, src_ino, 10, BLOCK, 0) == -1) && (errno == EINVAL));
+    assert((clone_range(cl, 999999999, 0, BLOCK, 0) == -1) && (errno == EBADF));
+    int ro = open("clone_ioc.dat", O_RDONLY);
+    assert(ro >= 0);
+    assert((clone_range(ro, src_ino, 0, BLOCK, 0) == -1) && (errno == EBADF));
+    in = 0; out = 0;
+    assert((copy_file_range(src, &in, ro, &out, BLOCK, 0) == -1) && (errno == EBADF));
+    close(ro);
+
+    // The source is checked for reading, even though it is named by its inode number.
+    assert(fchmod(src, 0600) == 0);
+    assert(fchmod(cl, 0666) == 0);
+    pid_t pid = fork();
+    if (pid == 0) {
+        if ((geteuid() == 0) && (setuid(65534) != 0))
+            _exit(2);
+        if (geteuid() != 0)
+            assert(fchmod(src, 0) == 0 || errno == EPERM);
+        int fd = open("clone_ioc.dat", O_RDWR);
+        if (fd < 0)
+            _exit(3);
+        _exit(((clone_range(fd, src_ino, 0, BLOCK, 0) == -1) && (errno == EACCES)) ? 0 : 1);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+        printf("Wrong permission check of LFS_IOC_CLONE_RANGE.\n");
+        return 1;
+    }
+    assert(fchmod(src, 0644) == 0);
+
+    close(src);
+    close(dst);
+    close(cl);
+    assert(unlink("clone_src.dat") == 0);
+    assert(unlink("clone_dst.dat") == 0);
+    assert(unlink("clone_ioc.dat") == 0);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+using namespace std;
+const int BLOCK = 1024;
+const int N = 3000;         // Blocks per file (more than fit in one segment).
+void pattern(char* buf, int kind) {
+    // Few distinct blocks: most blocks of both files are duplicates.
+    for (int k = 0; k < BLOCK; ++k)
+        buf[k] = (char) ((kind * 31 + k) % 251);
+}
+bool check(const char* path, int n, int skip, char fill) {
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    char buf[BLOCK], expect[BLOCK];
+    for (int i = 0; i < n; ++i) {
+        if (i == skip)
+            memset(expect, fill, BLOCK);
+        else
+            pattern(expect, i % 5);
+        assert(pread(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+        if (memcmp(buf, expect, BLOCK) != 0) {
+            printf("Wrong content of %s at block %d.\n", path, i);
+            return false;
+        }
+    }
+    close(fd);
+    return true;
+}
+int main() {
+    char buf[BLOCK];
+    const char* names[2] = {"dedup1.dat", "dedup2.dat"};
+    for (int f = 0; f < 2; ++f) {
+        int fd = open(names[f], O_CREAT | O_RDWR, 0644);
+        assert(fd >= 0);
+        for (int i = 0; i < N; ++i) {
+            pattern(buf, i % 5);
+            assert(pwrite(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+        }
+        fsync(fd);
+        close(fd);
+    }
+    if (!check(names[0], N, -1, 0) || !check(names[1], N, -1, 0))
+        return 1;
+
+    // Overwriting a shared block changes one file only (copy on write).
+    int fd = open(names[0], O_RDWR);
+    assert(fd >= 0);
+    memset(buf, 'w', BLOCK);
+    assert(pwrite(fd, buf, BLOCK, 10 * BLOCK) == BLOCK);
+    close(fd);
+    if (!check(names[0], N, 10, 'w') || !check(names[1], N, -1, 0))
+        return 1;
+
+    // Removing one file keeps the blocks it shared with the other.
+    assert(unlink(names[0]) == 0);
+    if (!check(names[1], N, -1, 0))
+        return 1;
+
+    // Zeros are deduplicated as well; partial blocks are not mixed up with full ones.
+    fd = open(names[0], O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    memset(buf, 0, BLOCK);
+    for (int i = 0; i < 100; ++i)
+        assert(pwrite(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+    pattern(buf, 1);
+    assert(pwrite(fd, buf, BLOCK / 2, 100 * BLOCK) == BLOCK / 2);
+    char back[BLOCK];
+    assert(pread(fd, back, BLOCK, 100 * BLOCK) == BLOCK / 2);
+    assert(memcmp(back, buf, BLOCK / 2) == 0);
+    close(fd);
+    assert(unlink(names[0]) == 0);
+    assert(unlink(names[1]) == 0);
+    return 0;
+}
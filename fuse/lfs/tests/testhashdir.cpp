@@ -0,0 +1,113 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+using namespace std;
+string name_of(int i) {
+    // Variable-length names, up to the longest one allowed (255 bytes).
+    string s = "entry-" + to_string(i) + "-";
+    s += string((i * 37) % (255 - s.size() + 1), 'a' + i % 26);
+    return s;
+}
+int renameat2_(const char* from, const char* to, unsigned int flags) {
+    return syscall(SYS_renameat2, AT_FDCWD, from, AT_FDCWD, to, flags);
+}
+set<string> list_dir(const char* path) {
+    set<string> names;
+    DIR* dir = opendir(path);
+    assert(dir != NULL);
+    while (struct dirent* e = readdir(dir))
+        if (strcmp(e->d_name, ".") && strcmp(e->d_name, ".."))
+            assert(names.insert(e->d_name).second);     // Each entry is listed once.
+    closedir(dir);
+    return names;
+}
+int main(int argc, char* argv[]) {
+    int n = (argc > 1) ? atoi(argv[1]) : 5000;
+    system("mkdir ./hashed");
+    assert(chdir("hashed") == 0);
+
+    set<string> expect;
+    for (int i = 0; i < n; ++i) {
+        int fd = open(name_of(i).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        assert(fd >= 0);
+        assert(pwrite(fd, &i, sizeof(i), 0) == sizeof(i));
+        close(fd);
+        expect.insert(name_of(i));
+    }
+    if (list_dir(".") != expect) {
+        printf("Wrong listing of a directory with %d entries.\n", n);
+        return 1;
+    }
+
+    // Lookups of existing and missing names.
+    struct stat st;
+    for (int i = 0; i < n; i += 7) {
+        int fd = open(name_of(i).c_str(), O_RDONLY), v = -1;
+        assert(fd >= 0);
+        assert((pread(fd, &v, sizeof(v), 0) == sizeof(v)) && (v == i));
+        close(fd);
+    }
+    assert((stat("entry-missing", &st) == -1) && (errno == ENOENT));
+    assert((open(name_of(3).c_str(), O_CREAT | O_EXCL | O_RDWR, 0644) == -1) && (errno == EEXIST));
+    assert((open(string(256, 'x').c_str(), O_CREAT | O_RDWR, 0644) == -1) && (errno == ENAMETOOLONG));
+
+    // Removing half of the entries leaves the others (and frees room for new ones).
+    for (int i = 0; i < n; i += 2) {
+        assert(unlink(name_of(i).c_str()) == 0);
+        expect.erase(name_of(i));
+    }
+    assert((unlink(name_of(0).c_str()) == -1) && (errno == ENOENT));
+    for (int i = n; i < n + n / 4; ++i) {
+        int fd = open(name_of(i).c_str(), O_CREAT | O_RDWR, 0644);
+        assert(fd >= 0);
+        close(fd);
+        expect.insert(name_of(i));
+    }
+    if (list_dir(".") != expect) {
+        printf("Wrong listing after removals.\n");
+        return 1;
+    }
+
+    // Renames: exchange, no-replace and overwrite, with their failure paths.
+    string a = name_of(1), b = name_of(3);
+    ino_t ino_a, ino_b;
+    assert(stat(a.c_str(), &st) == 0); ino_a = st.st_ino;
+    assert(stat(b.c_str(), &st) == 0); ino_b = st.st_ino;
+    assert(renameat2_(a.c_str(), b.c_str(), RENAME_EXCHANGE) == 0);
+    assert((stat(a.c_str(), &st) == 0) && (st.st_ino == ino_b));
+    assert((stat(b.c_str(), &st) == 0) && (st.st_ino == ino_a));
+    assert((renameat2_(a.c_str(), "entry-missing", RENAME_EXCHANGE) == -1) && (errno == ENOENT));
+    assert((renameat2_(a.c_str(), b.c_str(), RENAME_NOREPLACE) == -1) && (errno == EEXIST));
+    assert((renameat2_(a.c_str(), b.c_str(), RENAME_NOREPLACE | RENAME_EXCHANGE) == -1) && (errno == EINVAL));
+    assert((stat(a.c_str(), &st) == 0) && (st.st_ino == ino_b));
+    assert(rename(a.c_str(), b.c_str()) == 0);
+    assert((stat(a.c_str(), &st) == -1) && (errno == ENOENT));
+    assert((stat(b.c_str(), &st) == 0) && (st.st_ino == ino_b));
+    expect.erase(a);
+
+    // A failed link leaves the link count unchanged.
+    string c = name_of(5);
+    assert(link(b.c_str(), c.c_str()) == -1 && (errno == EEXIST));
+    assert((stat(b.c_str(), &st) == 0) && (st.st_nlink == 1));
+    assert(link(b.c_str(), "linked") == 0);
+    assert((stat(b.c_str(), &st) == 0) && (st.st_nlink == 2));
+    expect.insert("linked");
+    if (list_dir(".") != expect) {
+        printf("Wrong listing after renames.\n");
+        return 1;
+    }
+
+    // A non-empty directory cannot be removed; an emptied one can.
+    assert(chdir("..") == 0);
+    assert((rmdir("hashed") == -1) && (errno == ENOTEMPTY));
+    for (const string& s : expect)
+        assert(unlink(("hashed/" + s).c_str()) == 0);
+    assert(list_dir("hashed").empty());
+    assert(rmdir("hashed") == 0);
+    return 0;
+}
@@ -0,0 +1,75 @@
+// Round trip of the segment compressor (unlike the other tests, it does not need a mount point).
+// Build: g++ -O2 -D_FILE_OFFSET_BITS=64 -DFUSE_USE_VERSION=32 testlz.cpp ../liblfs.a -lfuse3 -lpthread -o testlz
+#include <bits/stdc++.h>
+#include "../compress.h"
+using namespace std;
+
+void round_trip(const vector<char>& src, const char* what) {
+    vector<char> packed(src.size() + src.size() / 255 + 16);
+    int length = lz_compress(src.data(), src.size(), packed.data(), packed.size());
+    if (length < 0) {
+        printf("Wrong compression of %s (%d bytes).\n", what, (int) src.size());
+        exit(1);
+    }
+    vector<char> out(src.size() + 1, 'x');
+    int out_length = lz_decompress(packed.data(), length, out.data(), src.size());
+    if ((out_length != (int) src.size()) || !equal(src.begin(), src.end(), out.begin())) {
+        printf("Wrong round trip of %s (%d bytes).\n", what, (int) src.size());
+        exit(1);
+    }
+    assert(out[src.size()] == 'x');     // Nothing written past the output.
+}
+
+int main() {
+    mt19937 rng(42);
+
+    // Short inputs (below the minimum match and the last literals).
+    for (int len = 0; len <= 32; len++) {
+        vector<char> src(len);
+        for (auto& c : src) c = rng() % 4;
+        round_trip(src, "a short input");
+    }
+
+    // Incompressible data: does not fit in less than its size, but round-trips with room.
+    vector<char> noise(BLOCK_SIZE);
+    for (auto& c : noise) c = rng();
+    vector<char> small(BLOCK_SIZE - 1);
+    assert(lz_compress(noise.data(), BLOCK_SIZE, small.data(), BLOCK_SIZE - 1) < 0);
+    round_trip(noise, "random data");
+
+    // Runs: a single byte, long runs (lengths over 15 and 255), and repeated patterns.
+    round_trip(vector<char>(BLOCK_SIZE, 'a'), "a run");
+    vector<char> runs;
+    for (int len : {1, 3, 4, 5, 15, 16, 19, 255, 270, 300, 1000})
+        runs.insert(runs.end(), len, 'a' + len % 26);
+    round_trip(runs, "runs");
+    vector<char> pattern(BLOCK_SIZE);
+    for (int i = 0; i < BLOCK_SIZE; i++) pattern[i] = "abcdefg"[i % 7];
+    round_trip(pattern, "a repeated pattern");
+    int length = lz_compress(pattern.data(), BLOCK_SIZE, small.data(), BLOCK_SIZE - 1);
+    assert((length > 0) && (length < BLOCK_SIZE / 8));
+
+    // Segment-size inputs: all zeros, and mixed blocks (text, noise, runs; matches beyond 64 KB).
+    round_trip(vector<char>(SEGMENT_SIZE, 0), "an empty segment");
+    vector<char> segment(SEGMENT_SIZE);
+    for (int b = 0; b < SEGMENT_SIZE / BLOCK_SIZE; b++) {
+        char* block = segment.data() + b * BLOCK_SIZE;
+        for (int i = 0; i < BLOCK_SIZE; i++)
+            block[i] = (b % 3 == 0) ? (char) rng() : (b % 3 == 1) ? "lfs segment "[(i + b) % 12] : (char) (i / 100);
+    }
+    round_trip(segment, "a segment");
+
+    // A whole segment image, as sealed: compressed blocks are found again at the same addresses.
+    vector<char> image(SEGMENT_SIZE);
+    int size = compress_segment(segment.data(), image.data());
+    assert((size > 0) && (size < DATA_BLOCKS_IN_SEGMENT * BLOCK_SIZE));
+    expand_segment(image.data());
+    assert(memcmp(image.data(), segment.data(), DATA_BLOCKS_IN_SEGMENT * BLOCK_SIZE) == 0);
+    for (int i = 0; i < SEGMENT_SIZE; i++) segment[i] = rng();
+    assert(compress_segment(segment.data(), image.data()) == 0);   // Stored raw.
+    expand_segment(image.data());
+    assert(memcmp(image.data(), segment.data(), DATA_BLOCKS_IN_SEGMENT * BLOCK_SIZE) == 0);
+
+    printf("LZ round trips OK.\n");
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+using namespace std;
+const int BLOCK = 1024;
+const int N = 8192;         // Blocks of the large file (8 MB, i.e. a long inode chain).
+char block_of(int i, int k) {
+    return (char) ('a' + (i * 7 + k) % 26);
+}
+void fill(char* buf, int i) {
+    for (int k = 0; k < BLOCK; ++k)
+        buf[k] = block_of(i, k);
+}
+int main() {
+    char buf[BLOCK], expect[BLOCK];
+
+    // An unlinked file stays readable and writable through an open descriptor.
+    int fd = open("orphan.dat", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    for (int i = 0; i < N; ++i) {
+        fill(buf, i);
+        assert(pwrite(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+    }
+    assert(unlink("orphan.dat") == 0);
+    struct stat st;
+    assert((stat("orphan.dat", &st) == -1) && (errno == ENOENT));
+    for (int i = 0; i < N; i += 97) {
+        fill(expect, i);
+        assert(pread(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+        if (memcmp(buf, expect, BLOCK) != 0) {
+            printf("Wrong content of unlinked file at block %d.\n", i);
+            return 1;
+        }
+    }
+    memset(buf, 'z', BLOCK);
+    assert(pwrite(fd, buf, BLOCK, 5 * BLOCK) == BLOCK);
+    assert(pread(fd, expect, BLOCK, 5 * BLOCK) == BLOCK);
+    assert(memcmp(buf, expect, BLOCK) == 0);
+    assert((fstat(fd, &st) == 0) && (st.st_nlink == 0));
+    close(fd);      // The file is reclaimed in the background from now on.
+
+    // The name can be reused at once, and never shows the old data.
+    fd = open("orphan.dat", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    assert((fstat(fd, &st) == 0) && (st.st_size == 0));
+    close(fd);
+    assert(unlink("orphan.dat") == 0);
+
+    // Truncating a large file (then extending it) reads zeros, not the detached blocks.
+    fd = open("truncated.dat", O_CREAT | O_RDWR, 0644);
+    assert(fd >= 0);
+    for (int i = 0; i < N; ++i) {
+        fill(buf, i);
+        assert(pwrite(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+    }
+    assert(ftruncate(fd, 3 * BLOCK + 10) == 0);
+    assert(ftruncate(fd, (off_t) N * BLOCK) == 0);
+    fill(expect, 2);
+    assert(pread(fd, buf, BLOCK, 2 * BLOCK) == BLOCK);
+    assert(memcmp(buf, expect, BLOCK) == 0);
+    for (int i = 4; i < N; i += 211) {
+        assert(pread(fd, buf, BLOCK, (off_t) i * BLOCK) == BLOCK);
+        for (int k = 0; k < BLOCK; ++k)
+            if (buf[k] != 0) {
+                printf("Wrong content of truncated file at block %d.\n", i);
+                return 1;
+            }
+    }
+    close(fd);
+    assert(unlink("truncated.dat") == 0);
+
+    // A removed directory accepts no new entry, even through a handle that is still open.
+    system("mkdir ./orphan_dir");
+    int dir_fd = open("orphan_dir", O_RDONLY | O_DIRECTORY);
+    assert(dir_fd >= 0);
+    assert(rmdir("orphan_dir") == 0);
+    assert((openat(dir_fd, "f", O_CREAT | O_RDWR, 0644) == -1) && (errno == ENOENT));
+    assert((mkdirat(dir_fd, "d", 0755) == -1) && (errno == ENOENT));
+    close(dir_fd);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <bits/stdc++.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+using namespace std;
+// Usage: testpunch <path of lfs.data>, in the mount point of a freshly formatted LFS.
+const int BLOCK = 1024;
+const long long MB = 1 << 20;
+long long allocated(const char* image) {
+    struct stat st;
+    assert(stat(image, &st) == 0);
+    return (long long) st.st_blocks * 512;
+}
+void write_file(const char* path, long long size, int seed) {
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    assert(fd >= 0);
+    char buf[BLOCK];
+    for (long long off = 0; off < size; off += BLOCK) {
+        for (int k = 0; k < BLOCK; ++k)
+            buf[k] = (char) ((off / BLOCK * 13 + k + seed) % 253 + 1);
+        assert(pwrite(fd, buf, BLOCK, off) == BLOCK);
+    }
+    fsync(fd);
+    close(fd);
+}
+bool check_file(const char* path, long long size, int seed) {
+    int fd = open(path, O_RDONLY);
+    assert(fd >= 0);
+    char buf[BLOCK];
+    for (long long off = 0; off < size; off += BLOCK) {
+        assert(pread(fd, buf, BLOCK, off) == BLOCK);
+        for (int k = 0; k < BLOCK; ++k)
+            if (buf[k] != (char) ((off / BLOCK * 13 + k + seed) % 253 + 1)) {
+                printf("Wrong content of %s at offset %lld.\n", path, off);
+                return false;
+            }
+    }
+    close(fd);
+    return true;
+}
+int main(int argc, char* argv[]) {
+    assert(argc > 1);
+    const char* image = argv[1];
+    struct stat st;
+    assert(stat(image, &st) == 0);
+    long long image_size = st.st_size;
+
+    // A fresh image is sparse: only the written segments, superblock and checkpoints take space.
+    long long fresh = allocated(image);
+    if (fresh > image_size / 4) {
+        printf("Wrong allocation of a fresh image: %lld of %lld bytes.\n", fresh, image_size);
+        return 1;
+    }
+
+    // Overwrite more data than the image holds: the cleaner has to free (and release) segments.
+    write_file("kept.dat", 4 * MB, 7);
+    for (int round = 0; round < 6; ++round) {
+        write_file("churn.dat", 24 * MB, round);
+        if (!check_file("churn.dat", 24 * MB, round))
+            return 1;
+        assert(unlink("churn.dat") == 0);
+    }
+    if (!check_file("kept.dat", 4 * MB, 7))
+        return 1;
+
+    // Released segments are holes again: the image never takes more than its size.
+    sync();
+    long long used = allocated(image);
+    if (used > image_size) {
+        printf("Wrong allocation after cleaning: %lld of %lld bytes.\n", used, image_size);
+        return 1;
+    }
+    assert(unlink("kept.dat") == 0);
+    return 0;
+}
@@ -3,11 +3,21 @@
 #include "logger.h"
 #include "print.h"
 #include "blockio.h"
+#include "compress.h"
+#include "device.h"
+#include "metrics.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>       /* BLKZEROOUT */
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <memory>
 #include <algorithm>
 #include <set>
 
@@ -16,10 +26,12 @@ char segment_buffer[SEGMENT_SIZE];
 char segment_bitmap[TOT_SEGMENTS];
 bool is_full;
 int inode_table[MAX_NUM_INODE];
+std::atomic<uint64_t> inode_generation[MAX_NUM_INODE];
 int count_inode;
 int cur_segment, cur_block;
 int next_checkpoint, next_imap_index;
 struct timespec last_ckpt_update_time;
+bool writeback_cache = false;
 
 segment_summary cached_segsum[TOT_SEGMENTS];
 inode cached_inode_array[MAX_NUM_INODE];
@@ -40,46 +52,60 @@ std::vector<pending_block> pending_block_buffer;
  * @return length: actual length of reading / writing; -1 on error.
  * ****************************************/
 
-/** Read a block into the buffer. */
+/** Read a block into the buffer (decompressed, if its segment is compressed). */
 int read_block(void* buf, int block_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = block_addr * BLOCK_SIZE;
-    int read_length = pread(file_handle, buf, BLOCK_SIZE, file_offset);
-    close(file_handle);
-    
-    return read_length;
+    return read_data_blocks(buf, block_addr, 1);
 }
 
 /** Write a block into disk file (not recommended). */
 int write_block(void* buf, int block_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = block_addr * BLOCK_SIZE;
-    int write_length = pwrite(file_handle, buf, BLOCK_SIZE, file_offset);
-    close(file_handle);
-    
-    return write_length;
+    return disk_pwrite(buf, BLOCK_SIZE, (off_t) block_addr * BLOCK_SIZE);
 }
 
 /** Read a segment into the buffer (not usual). */
 int read_segment(void* buf, int segment_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = segment_addr * SEGMENT_SIZE;
-    int read_length = pread(file_handle, buf, SEGMENT_SIZE, file_offset);
-    close(file_handle);
-    
+    int read_length = disk_pread(buf, SEGMENT_SIZE, (off_t) segment_addr * SEGMENT_SIZE);
+    if (USE_COMPRESSION)
+        expand_segment((char*) buf);
     return read_length;
 }
 
-/** Write a segment into disk file. */
+/** Write a segment into disk file (by the writer of its device, with USE_WRITE_QUEUES).
+ * A compressed segment only writes the used part of its data region, and its metadata. */
 int write_segment(void* buf, int segment_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = segment_addr * SEGMENT_SIZE;
-    int write_length = pwrite(file_handle, buf, SEGMENT_SIZE, file_offset);
-    close(file_handle);
-    
-    return write_length;
+    if (!USE_COMPRESSION && !USE_WRITE_QUEUES)
+        return disk_pwrite(buf, SEGMENT_SIZE, (off_t) segment_addr * SEGMENT_SIZE);
+
+    std::vector<char> image(SEGMENT_SIZE);
+    if (USE_COMPRESSION) {
+        compress_segment((const char*) buf, image.data());
+        remember_segment_extents(segment_addr, image.data());
+    } else {
+        memcpy(image.data(), buf, SEGMENT_SIZE);
+    }
+    if (!USE_WRITE_QUEUES)
+        return write_segment_image(image.data(), segment_addr);
+    queue_segment_write(segment_addr, image);
+    return SEGMENT_SIZE;
 }
 
+/** Write a segment image (laid out by compress_segment(), or raw) into disk file.
+ * The unused part of a compressed data region is released instead of written, if possible. */
+int write_segment_image(const char* image, int segment_addr) {
+    off_t file_offset = (off_t) segment_addr * SEGMENT_SIZE;
+    int size = ((const struct segment_metadata*) (image + SEGMETA_OFFSET))->compressed_size;
+    if (size == 0)
+        return disk_pwrite(image, SEGMENT_SIZE, file_offset);
+
+    int write_length = disk_pwrite(image, size, file_offset);
+    if (write_length < 0)
+        return -1;
+    disk_release(file_offset + size, IMAP_OFFSET - size, false);
+    int meta_length = disk_pwrite(image + IMAP_OFFSET, SEGMENT_SIZE - IMAP_OFFSET, file_offset + IMAP_OFFSET);
+    if (meta_length < 0)
+        return -1;
+    return write_length + meta_length;
+}
 
 
 /** **************************************
@@ -92,35 +118,17 @@ int write_segment(void* buf, int segment_addr) {
 
 /** Read inode map of the segment (covering roughly 8 blocks, i.e. #1008 ~ #1015). */
 int read_segment_imap(void* buf, int segment_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = segment_addr * SEGMENT_SIZE + IMAP_OFFSET;
-    
-    int read_length = pread(file_handle, buf, IMAP_SIZE, file_offset);
-    close(file_handle);
-    
-    return read_length;
+    return disk_pread(buf, IMAP_SIZE, (off_t) segment_addr * SEGMENT_SIZE + IMAP_OFFSET);
 }
 
 /** Read segment summary of the segment (covering roughly 8 blocks, i.e. #1016 ~ #1023). */
 int read_segment_summary(void* buf, int segment_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = segment_addr * SEGMENT_SIZE + SUMMARY_OFFSET;
-    
-    int read_length = pread(file_handle, buf, SUMMARY_SIZE, file_offset);
-    close(file_handle);
-    
-    return read_length;
+    return disk_pread(buf, SUMMARY_SIZE, (off_t) segment_addr * SEGMENT_SIZE + SUMMARY_OFFSET);
 }
 
 /** Read segment metadata of the segment (covering last several bytes). */
 int read_segment_metadata(void* buf, int segment_addr) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int file_offset = segment_addr * SEGMENT_SIZE + SEGMETA_OFFSET;
-    
-    int read_length = pread(file_handle, buf, SEGMETA_SIZE, file_offset);
-    close(file_handle);
-    
-    return read_length;
+    return disk_pread(buf, SEGMETA_SIZE, (off_t) segment_addr * SEGMENT_SIZE + SEGMETA_OFFSET);
 }
 
 
@@ -133,53 +141,127 @@ int read_segment_metadata(void* buf, int segment_addr) {
 
 /** Read checkpoints of LFS (covering 1 block, at #CHECKPOINT_ADDR). */
 int read_checkpoints(void* buf) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int read_length = pread(file_handle, buf, CHECKPOINT_SIZE, CHECKPOINT_ADDR);
-    close(file_handle);
-    return read_length;
+    return disk_pread(buf, CHECKPOINT_SIZE, CHECKPOINT_ADDR);
 }
 
 /** Write checkpoints of LFS (covering 1 block, at #CHECKPOINT_ADDR). */
 int write_checkpoints(void* buf) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int write_length = pwrite(file_handle, buf, CHECKPOINT_SIZE, CHECKPOINT_ADDR);
-    close(file_handle);
-    return write_length;
+    return disk_pwrite(buf, CHECKPOINT_SIZE, CHECKPOINT_ADDR);
 }
 
 /** Read superblock of LFS (covering 1 block, at #SUPERBLOCK_ADDR). */
 int read_superblock(void* buf) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int read_length = pread(file_handle, buf, SUPERBLOCK_SIZE, SUPERBLOCK_ADDR);
-    close(file_handle);
-    return read_length;
+    return disk_pread(buf, SUPERBLOCK_SIZE, SUPERBLOCK_ADDR);
 }
 
 /** Write superblock of LFS (covering 1 block, at #SUPERBLOCK_ADDR). */
 int write_superblock(void* buf) {
-    int file_handle = open(lfs_path, O_RDWR);
-    int write_length = pwrite(file_handle, buf, SUPERBLOCK_SIZE, SUPERBLOCK_ADDR);
-    close(file_handle);
-    return write_length;
+    return disk_pwrite(buf, SUPERBLOCK_SIZE, SUPERBLOCK_ADDR);
 }
 
 
+/** **************************************
+ * Sparse disk image (see USE_SPARSE_IMAGE).
+ * Free segments hold no data on the host: they are released instead of being written with 0.
+ * Unwritten ranges read as 0, so that a never-written segment looks like a freshly formatted one.
+ * ***************************************/
+
+/** Size a new disk file (or device), without writing it.
+ * @return 0 on success, -1 on error. */
+int format_disk_file(int file_handle, off_t size) {
+    if (ftruncate(file_handle, size) == 0)
+        return 0;
+    return release_disk_range(file_handle, 0, size);     // Not a regular file (e.g. a block device).
+}
+
+/** Release a range of the disk file: it reads as 0 afterwards, and its space is returned to the host.
+ * Regular files punch a hole; block devices zero the range out, which discards (TRIMs) the blocks
+ * when the device supports it. Where neither is supported, 0 is written instead.
+ * @param  must_zero: whether the range should read as 0 (otherwise, it is left as is if it cannot be released).
+ * @return 0 on success, -1 on error. */
+int release_disk_range(int file_handle, off_t offset, off_t length, bool must_zero) {
+    if (length <= 0)
+        return 0;
+    struct stat file_stat;
+    if (USE_SPARSE_IMAGE && (fstat(file_handle, &file_stat) == 0)) {
+        if (S_ISBLK(file_stat.st_mode)) {
+            uint64_t range[2] = {(uint64_t) offset, (uint64_t) length};
+            if (ioctl(file_handle, BLKZEROOUT, range) == 0)
+                return 0;
+        } else if (fallocate(file_handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0) {
+            return 0;
+        }
+    }
+
+    if (!must_zero)
+        return -1;
+    static const char zeros[SEGMENT_SIZE] = {0};
+    while (length > 0) {
+        off_t len = (length < SEGMENT_SIZE) ? length : SEGMENT_SIZE;
+        if (pwrite(file_handle, zeros, len, offset) != len)
+            return -1;
+        offset += len;
+        length -= len;
+    }
+    return 0;
+}
+
+/** Release a free segment of the disk file.
+ * @param  segment_addr: segment address (= seg). */
+int release_segment(int segment_addr) {
+    return disk_release((off_t) segment_addr * SEGMENT_SIZE, SEGMENT_SIZE);
+}
+
 /** **************************************
  * Timestamp and permission utilities.
  * ***************************************/
-/** Update atime according to FUNC_ATIME_ flags */
-void update_atime(struct inode* cur_inode, struct timespec &new_time) {
-    if (!FUNC_ATIME_FILE) return;
+/** Whether a file is stored inline, in the direct[] area of its inode (see INLINE_DATA_SIZE). */
+bool has_inline_data(const struct inode* f_inode) {
+    return (f_inode->mode == MODE_FILE) && (f_inode->num_direct == 0) && (f_inode->fsize_byte > 0);
+}
+
+/** Whether an i_number refers to an existing file / directory (neither removed nor orphaned). */
+bool is_live_inode(int i_number) {
+    return (i_number > 0) && (i_number < MAX_NUM_INODE) && (inode_table[i_number] != -1)
+           && (cached_inode_array[i_number].mode != MODE_ORPHAN);
+}
+
+/** Whether an inode address (from inode_table or an imap) refers to a slot of an inode pack. */
+bool is_packed_inode(int inode_addr) {
+    return inode_addr >= INODE_PACK_BASE;
+}
+
+/** Address of a packed inode, given its inode pack and slot. */
+int packed_inode_addr(int block_addr, int slot) {
+    return INODE_PACK_BASE + block_addr * INODES_PER_PACK + slot;
+}
+
+/** Block address of the inode pack holding a packed inode. */
+int inode_pack_block(int inode_addr) {
+    return (inode_addr - INODE_PACK_BASE) / INODES_PER_PACK;
+}
+
+/** Slot of a packed inode within its inode pack. */
+int inode_pack_slot(int inode_addr) {
+    return (inode_addr - INODE_PACK_BASE) % INODES_PER_PACK;
+}
+
+/** Whether update_atime() would change the inode (so that readers can skip writing it back). */
+bool atime_needs_update(struct inode* cur_inode, struct timespec &new_time) {
+    if (!FUNC_ATIME_FILE) return false;
     if (FUNC_ATIME_REL) {
-        if ((cur_inode->atime.tv_sec < cur_inode->mtime.tv_sec)
+        return (cur_inode->atime.tv_sec < cur_inode->mtime.tv_sec)
             || (cur_inode->atime.tv_sec < cur_inode->ctime.tv_sec)
-            || (new_time.tv_sec - cur_inode->atime.tv_sec > FUNC_ATIME_REL_THRES))
-            { cur_inode->atime = new_time;
-              cur_inode->ctime = new_time; }
-    } else {
-        cur_inode->atime = new_time;
-        cur_inode->ctime = new_time;
+            || (new_time.tv_sec - cur_inode->atime.tv_sec > FUNC_ATIME_REL_THRES);
     }
+    return true;
+}
+
+/** Update atime according to FUNC_ATIME_ flags */
+void update_atime(struct inode* cur_inode, struct timespec &new_time) {
+    if (!atime_needs_update(cur_inode, new_time)) return;
+    cur_inode->atime = new_time;
+    cur_inode->ctime = new_time;
 
     // Trace checkpoint updates (every CKPT_UPDATE_INTERVAL seconds).
     if (new_time.tv_sec - last_ckpt_update_time.tv_sec >= CKPT_UPDATE_INTERVAL) {
@@ -189,6 +271,28 @@ void update_atime(struct inode* cur_inode, struct timespec &new_time) {
     }
 }
 
+thread_local struct fuse_context caller_context;
+thread_local bool has_caller_context = false;
+
+struct fuse_context* get_caller_context() {
+    if (has_caller_context)
+        return &caller_context;
+    return fuse_get_context();
+}
+
+void set_caller_context(uid_t uid, gid_t gid, pid_t pid, mode_t umask) {
+    memset(&caller_context, 0, sizeof(caller_context));
+    caller_context.uid   = uid;
+    caller_context.gid   = gid;
+    caller_context.pid   = pid;
+    caller_context.umask = umask;
+    has_caller_context = true;
+}
+
+void clear_caller_context() {
+    has_caller_context = false;
+}
+
 bool verify_permission(int mode, struct inode* f_inode, struct fuse_context* u_info, bool enable) {
     if (!enable) {
         return true;
@@ -209,14 +313,30 @@ bool verify_permission(int mode, struct inode* f_inode, struct fuse_context* u_i
  * ***************************************/
 std::mutex io_lock;
 std::mutex counter_lock;
-std::mutex inode_lock[MAX_NUM_INODE];
+
+/* Number of inode lock stripes: a power of two, at least INODE_LOCK_STRIPES_PER_CPU per CPU. */
+int count_inode_lock_stripes() {
+    int num_cpus = std::thread::hardware_concurrency();
+    if (num_cpus <= 0) num_cpus = 1;
+
+    int stripes = 1;
+    while (stripes < num_cpus * INODE_LOCK_STRIPES_PER_CPU)
+        stripes <<= 1;
+    return stripes;
+}
+const int inode_lock_mask = count_inode_lock_stripes() - 1;
+std::unique_ptr<std::shared_mutex[]> inode_lock_stripes(new std::shared_mutex[inode_lock_mask + 1]);
 
 std::mutex segment_lock;
 std::condition_variable cond_segment;
 bool segment_busy = false;
 
+std::atomic<unsigned int> segment_seq(0);
+std::atomic<unsigned int> buffer_seq(0);
+
 
 void acquire_segment_lock() {
+    metric_timer timer(WAIT_SEGMENT_LOCK);
     std::unique_lock<std::mutex> u_segment_lock(segment_lock);
     while (segment_busy) {
         cond_segment.wait(u_segment_lock);
@@ -236,4 +356,77 @@ void acquire_counter_lock() {
 
 void release_counter_lock() {
     counter_lock.unlock();
+}
+
+/** Mark the start / end of sealing and replacing the active segment buffer.
+ * [CAUTION] Must be called with the segment lock held, and never nested. */
+void begin_segment_switch() {
+    segment_seq.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void end_segment_switch() {
+    segment_seq.fetch_add(1, std::memory_order_release);
+}
+
+/** Mark the start / end of rewriting an addressable block of the segment buffer in place.
+ * The start is sequentially consistent: a rewrite either sees the references taken into the
+ * segment buffer, or the references see the rewrite (see blockio.cpp).
+ * [CAUTION] Must be called with the segment lock held, and never nested. */
+void begin_buffer_rewrite() {
+    buffer_seq.fetch_add(1);
+}
+
+void end_buffer_rewrite() {
+    buffer_seq.fetch_add(1, std::memory_order_release);
+}
+
+
+std::atomic<int> splice_readers(0);
+
+/** Pin the disk file for a splice reply.
+ * @return flag: true if pinned, and false if a GC is on-going (do not splice). */
+bool begin_block_splice() {
+    splice_readers.fetch_add(1);
+    if (is_doing_gc || !USE_SPLICE || (device_fd(0) < 0)) {
+        splice_readers.fetch_sub(1);
+        return false;
+    }
+    return true;
+}
+
+void end_block_splice() {
+    splice_readers.fetch_sub(1);
+}
+
+/** Wait until all splice replies are done (is_doing_gc must be set beforehand). */
+void drain_block_splices() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (splice_readers.load() > 0)
+        std::this_thread::yield();
+}
+
+
+/** Retrieve the (striped) reader/writer lock of an inode. */
+std::shared_mutex& inode_lock(int i_number) {
+    return inode_lock_stripes[i_number & inode_lock_mask];
+}
+
+/** Exclusively lock several inodes at once (e.g., parents and children in rename).
+ * Stripes are acquired in increasing order, so that concurrent callers cannot deadlock. */
+void acquire_inode_locks(const std::set<int> &i_numbers) {
+    metric_timer timer(WAIT_INODE_LOCKS);
+    std::set<int> stripes;
+    for (auto it:i_numbers)
+        stripes.insert(it & inode_lock_mask);
+    for (auto it:stripes)
+        inode_lock_stripes[it].lock();
+}
+
+void release_inode_locks(const std::set<int> &i_numbers) {
+    std::set<int> stripes;
+    for (auto it:i_numbers)
+        stripes.insert(it & inode_lock_mask);
+    for (auto it:stripes)
+        inode_lock_stripes[it].unlock();
 }
\ No newline at end of file
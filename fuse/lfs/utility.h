@@ -1,8 +1,11 @@
 #pragma once
 
 #include <sys/stat.h>   /* struct timespec */
+#include <stddef.h>     /* offsetof */
 #include <fuse.h>       /* sturct fuse_context */
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
 #include <vector>
 #include <set>
 #include <condition_variable>
@@ -59,6 +62,31 @@ struct inode {
 const int MODE_FILE         = 1;
 const int MODE_DIR          = 2;
 const int MODE_MID_INODE    = -1;
+const int MODE_ORPHAN       = -2;   // Unlinked or detached inode, waiting for reclamation (see reclaim.h).
+bool is_live_inode(int i_number);
+
+/* Inline data: a small file is stored in the direct[] area of its head inode, without data blocks.
+ * Such a file has a positive size but no direct blocks (num_direct = 0); it is moved into blocks
+ * as soon as it grows beyond INLINE_DATA_SIZE bytes. */
+const int INLINE_DATA_SIZE  = sizeof(int) * NUM_INODE_DIRECT;
+bool has_inline_data(const struct inode* f_inode);
+
+/* Compact inodes: an inode with few direct[] pointers in use is written into a fixed-size slot,
+ * several per log block (an inode pack), instead of a whole block. Its imap entry addresses
+ * (block, slot) as INODE_PACK_BASE + block * INODES_PER_PACK + slot, so that addresses below
+ * INODE_PACK_BASE are still plain block addresses. A slot holds the inode header, next_indirect,
+ * and the used prefix of direct[]; larger inodes (e.g. mid inodes of long files, which play the
+ * role of index blocks) keep a whole block. */
+const int INODES_PER_PACK       = 4;
+const int PACKED_INODE_SIZE     = BLOCK_SIZE / INODES_PER_PACK;
+const int PACKED_INODE_HEAD     = offsetof(struct inode, direct);
+const int PACKED_INODE_DIRECT   = (PACKED_INODE_SIZE - PACKED_INODE_HEAD - 3*sizeof(int)) / sizeof(int);
+const int INODE_PACK_BASE       = TOT_SEGMENTS * BLOCKS_IN_SEGMENT;
+const int SUMMARY_INODE_PACK    = -2;   // direct_index of an inode pack in the segment summary.
+bool is_packed_inode(int inode_addr);
+int packed_inode_addr(int block_addr, int slot);
+int inode_pack_block(int inode_addr);
+int inode_pack_slot(int inode_addr);
 
 
 const int MAX_FILENAME_LEN  = 60;
@@ -78,7 +106,7 @@ typedef struct dir_entry directory[MAX_DIR_ENTRIES];
 const int DATA_BLOCKS_IN_SEGMENT    = BLOCKS_IN_SEGMENT - 16;
 const int IMAP_SIZE                 = 8 * (BLOCK_SIZE-16);
 const int SUMMARY_SIZE              = 8 * (BLOCK_SIZE-16);
-const int SEGMETA_SIZE              = 12;
+const int SEGMETA_SIZE              = 16;
 const int IMAP_OFFSET               = SEGMENT_SIZE - 16*BLOCK_SIZE;
 const int SUMMARY_OFFSET            = SEGMENT_SIZE - 16*BLOCK_SIZE + IMAP_SIZE;
 const int SEGMETA_OFFSET            = SEGMENT_SIZE - 16*BLOCK_SIZE + IMAP_SIZE + SUMMARY_SIZE;
@@ -111,6 +139,7 @@ struct segment_metadata {
     int update_sec;         // The second part of last update time of the segment.
     int update_nsec;        // The nano-second part of last update time of the segment.
     int cur_block;          // Next available block within the segment.
+    int compressed_size;    // Bytes used by the compressed data region (0 if raw, see compress.h).
 };
 
 
@@ -119,7 +148,7 @@ struct segment_metadata {
  * ***************************************/
 
 const int SUPERBLOCK_ADDR = TOT_SEGMENTS * SEGMENT_SIZE;
-const int SUPERBLOCK_SIZE = 20;
+const int SUPERBLOCK_SIZE = 24;
 /** Superblock: recording basic information (constants) about LFS.
  */
 struct superblock {
@@ -128,6 +157,7 @@ struct superblock {
     int tot_segments;       // [CONST] Maximum number of segments.
     int block_size;         // [CONST] Size of a block (in bytes, usu. 1024 kB).
     int segment_size;       // [CONST] Size of a segment (in bytes).
+    int num_devices;        // [CONST] Number of devices segments are striped over (0 stands for 1, see device.h).
 };
 
 
@@ -159,6 +189,7 @@ int write_block(void* buf, int block_addr);
 
 int read_segment(void* buf, int segment_addr);
 int write_segment(void* buf, int segment_addr);
+int write_segment_image(const char* image, int segment_addr);
 
 int read_segment_imap(void* buf, int segment_addr);
 int read_segment_summary(void* buf, int segment_addr);
@@ -170,16 +201,21 @@ int write_checkpoints(void* buf);
 int read_superblock(void* buf);
 int write_superblock(void* buf);
 
+int format_disk_file(int file_handle, off_t size);
+int release_disk_range(int file_handle, off_t offset, off_t length, bool must_zero = true);
+int release_segment(int segment_addr);
+
 
 /** **************************************
  * Global state variables.
  * ***************************************/
-extern char* lfs_path;                              // File handle should be local: only store the path.
+extern char* lfs_path;                              // Path of the (first) device: see device.h.
 extern char segment_buffer[SEGMENT_SIZE];
 extern char segment_bitmap[TOT_SEGMENTS];
 extern bool is_full;
 extern int inode_table[MAX_NUM_INODE];
 extern int count_inode;
+extern std::atomic<uint64_t> inode_generation[MAX_NUM_INODE];  // Bumped whenever an i_number is allocated.
 extern int cur_segment, cur_block;                  // cur_block is the NEXT available block.
 extern int next_checkpoint, next_imap_index;
 extern struct timespec last_ckpt_update_time;       // Record the last time to update checkpoints.
@@ -187,6 +223,8 @@ extern struct timespec last_ckpt_update_time;       // Record the last time to u
 extern segment_summary cached_segsum[TOT_SEGMENTS]; // In-memory segment summary.
 extern inode cached_inode_array[MAX_NUM_INODE];     // In-memory inode array.
 
+extern bool writeback_cache;                        // Whether the kernel caches writes (see negotiate_connection).
+
 extern bool is_doing_gc;                            // Whether a GC is on-going.
 extern bool allow_gc;                               // Whether GC is allowed (no recursive GC).
 
@@ -239,6 +277,7 @@ const bool FUNC_ATIME_DIR       = 0;        // Enable atime update for directori
 const bool FUNC_ATIME_FILE      = 0;        // Enable atime update for files.
 const bool FUNC_ATIME_REL       = 1;        // Enable relative atime (as with -relatime).
 const int FUNC_ATIME_REL_THRES  = 3600;     // Threshold interval for updating (relative) atime.
+bool atime_needs_update(struct inode* cur_inode, struct timespec &new_time);
 void update_atime(struct inode* cur_inode, struct timespec &new_time);
 
 const bool ENABLE_PERMISSION    = 1;        // Whether to enable permission control or not.
@@ -249,18 +288,56 @@ const int PERM_WRITE            = 2;        // Write permission (W_OK).
 const int PERM_EXEC             = 1;        // Execute permission (X_OK)
 bool verify_permission(int mode, struct inode* f_inode, struct fuse_context* u_info, bool enable);
 
+// Information (uid, gid) of the user who calls LFS interface.
+// The high-level API provides it by fuse_get_context(), while the low-level API (lowlevel.cpp)
+// has to set it for each request; always retrieve it by get_caller_context().
+struct fuse_context* get_caller_context();
+void set_caller_context(uid_t uid, gid_t gid, pid_t pid, mode_t umask);
+void clear_caller_context();
+
 
 /** **************************************
  * Public variable locks.
  * ***************************************/
 extern std::mutex io_lock;
-extern std::mutex inode_lock[MAX_NUM_INODE];
+
+// Inode locks are reader/writer locks: reads and stats share, modifications exclude.
+// They are striped: inodes are hashed onto a power-of-two table sized to the number of CPUs.
+// [CAUTION] Inodes may share a stripe, so never hold one inode lock while acquiring another;
+//           use acquire_inode_locks() to take several of them in a deadlock-free order.
+const int INODE_LOCK_STRIPES_PER_CPU = 64;
+std::shared_mutex& inode_lock(int i_number);
+void acquire_inode_locks(const std::set<int> &i_numbers);
+void release_inode_locks(const std::set<int> &i_numbers);
 
 void acquire_segment_lock();
 void release_segment_lock();
 void acquire_counter_lock();
 void release_counter_lock();
 
+// Sequence counter of the active segment buffer (a seqlock).
+// It is odd while the buffer is sealed and replaced, so that get_block() only has to
+// synchronize with writers when a switch overlaps the read (see blockio.cpp).
+extern std::atomic<unsigned int> segment_seq;
+void begin_segment_switch();
+void end_segment_switch();
+
+// Sequence counter of the blocks of the segment buffer that change in place (a seqlock).
+// It is odd while an addressable block of the buffer is rewritten (see rewrite_in_place()):
+// only reads from the segment buffer synchronize with it, not reads of sealed segments.
+extern std::atomic<unsigned int> buffer_seq;
+void begin_buffer_rewrite();
+void end_buffer_rewrite();
+
+// Replies that reference on-disk blocks by file descriptor (splice) pin the disk file,
+// because the kernel only reads it after the handler returns.
+// Garbage collection rewrites the disk file, so it waits for all pins to be released;
+// conversely, no pin can be taken while a GC is on-going (callers fall back to copying).
+extern std::atomic<int> splice_readers;
+bool begin_block_splice();
+void end_block_splice();
+void drain_block_splices();
+
 
 /** **************************************
  * Garbage collection.
@@ -269,6 +346,7 @@ const int CLEAN_THRESHOLD   = (int) (0.80*TOT_SEGMENTS);
 const int CLEAN_THORO_THRES = (int) (0.96*TOT_SEGMENTS);
 const int CLEAN_NUM         = (int) (0.3*TOT_SEGMENTS);
 const int CLEAN_BELOW_UTIL  = (int) (0.01*BLOCKS_IN_SEGMENT);
+const int GC_WORKERS        = 8;        // Threads scanning victims and compressing cleaned segments (at most one per core).
 
 const bool DO_GARBCOL_ON_START = 1;     // Force a thorough garbage collection on start of LFS.
 
@@ -287,4 +365,18 @@ const int CLEAN_NORM_FAIL   = (int) (0.65*TOT_SEGMENTS);
 const int CLEAN_THORO_FAIL  = (int) (0.85*TOT_SEGMENTS);
 
 const bool USE_CACHE        = true;
+const bool USE_SPLICE       = true;     // Reply on-disk blocks by file descriptor, so that the kernel can splice.
+const bool USE_DIR_INDEX    = true;     // Keep an in-memory (name -> slot) index for each directory.
+const bool USE_HASHED_DIR   = true;     // Create new directories in the hashed format (see dirhash.h).
+const bool USE_INLINE_DATA  = true;     // Store small files inside their inodes (see INLINE_DATA_SIZE).
+const bool USE_COMPACT_INODES = true;   // Pack small inodes several per block (see INODES_PER_PACK).
+const bool USE_INPLACE_METADATA = true; // Rewrite unsealed directory blocks in place (see file_rewrite()).
+const bool USE_DEFERRED_RECLAIM = true; // Free unlinked / truncated inode chains in the background.
+const bool USE_COMPRESSION  = true;     // Compress data blocks of segments written to disk (see compress.h).
+const bool USE_DEDUP        = true;     // Share identical blocks of file data (see dedup.h).
+const bool USE_SPARSE_IMAGE = true;     // Punch holes for free segments, instead of writing 0 (see release_disk_range()).
+const bool USE_WRITE_QUEUES = true;     // Write sealed segments from per-device queues (see device.h).
+const bool USE_STATS        = true;     // Time requests and internal stages (see metrics.h).
+const bool USE_WRITEBACK_CACHE = true;  // Let the kernel coalesce small writes in its page cache.
+const int MAX_REQUEST_SIZE  = 1 << 20;  // Largest write request (the kernel also bounds reads by it).
 const bool GC_CONCURRENCY   = false;
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include "wbcache.h"
+#include "compress.h"
+#include "device.h"
 
 std::map <int, int> m;
 std::priority_queue <pii, std::vector <pii>, std::greater <pii> > heap;
@@ -17,14 +19,16 @@ std::lock_guard <std::mutex> guard(io_lock);
         metablocks[i].timestamp = ++T;
     } else {
         i = evict();
+        if (i < 0) {
+            // All cachelines are pinned: read the block alone.
+            read_data_blocks(buf, block_addr, 1);
+            return BLOCK_SIZE;
+        }
 
-        int file_handle = open(lfs_path, O_RDWR);
-        int file_offset = cacheline_idx * CACHELINE_SIZE;
-        int read_length = pread(file_handle, cache + i * CACHELINE_SIZE,
-                                CACHELINE_SIZE, file_offset);
-        close(file_handle);
+        // Blocks of compressed segments are cached decompressed.
+        read_data_blocks(cache + i * CACHELINE_SIZE, cacheline_idx * BLOCKS_PER_CACHELINE, BLOCKS_PER_CACHELINE);
         m[cacheline_idx] = i;
-        metablocks[i] = (cacheline_metadata) {cacheline_idx, ++T, false};
+        metablocks[i] = (cacheline_metadata) {cacheline_idx, ++T, false, 0};
         if (!inheap[i]) {
             inheap[i] = 1;
             heap.push(std::make_pair(T, i));
@@ -37,6 +41,53 @@ std::lock_guard <std::mutex> guard(io_lock);
     return BLOCK_SIZE;
 }
 
+bool read_block_if_cached(void* buf, int block_addr) {
+std::lock_guard <std::mutex> guard(io_lock);
+    int cacheline_idx = block_addr / BLOCKS_PER_CACHELINE;
+    std::map <int, int>::iterator it = m.find(cacheline_idx);
+    if (it == m.end())
+        return false;
+
+    // Blocks that are not cached are up-to-date on disk (dirty cachelines are never dropped).
+    int i = it->second;
+    metablocks[i].timestamp = ++T;
+    memcpy(buf, cache + i * CACHELINE_SIZE
+              + block_addr % BLOCKS_PER_CACHELINE * BLOCK_SIZE,
+              BLOCK_SIZE * sizeof(char));
+    return true;
+}
+
+const char* pin_block_through_cache(int block_addr, int &cacheline) {
+std::lock_guard <std::mutex> guard(io_lock);
+    int cacheline_idx = block_addr / BLOCKS_PER_CACHELINE, i;
+    if (m.find(cacheline_idx) != m.end()) {
+        i = m[cacheline_idx];
+        metablocks[i].timestamp = ++T;
+    } else {
+        i = evict();
+        if (i < 0)
+            return NULL;    // All cachelines are pinned: the caller copies the block instead.
+
+        // Blocks of compressed segments are cached decompressed.
+        read_data_blocks(cache + i * CACHELINE_SIZE, cacheline_idx * BLOCKS_PER_CACHELINE, BLOCKS_PER_CACHELINE);
+        m[cacheline_idx] = i;
+        metablocks[i] = (cacheline_metadata) {cacheline_idx, ++T, false, 0};
+        if (!inheap[i]) {
+            inheap[i] = 1;
+            heap.push(std::make_pair(T, i));
+        }
+    }
+
+    metablocks[i].pins++;
+    cacheline = i;
+    return cache + i * CACHELINE_SIZE + block_addr % BLOCKS_PER_CACHELINE * BLOCK_SIZE;
+}
+
+void unpin_cacheline(int cacheline) {
+std::lock_guard <std::mutex> guard(io_lock);
+    metablocks[cacheline].pins--;
+}
+
 int write_block_through_cache(void* buf, int block_addr) {
 std::lock_guard <std::mutex> guard(io_lock);
     // not used, do nothing
@@ -50,6 +101,13 @@ std::lock_guard <std::mutex> guard(io_lock);
 }
 
 int write_segment_through_cache(void* buf, int segment_addr) {
+    // Compressed segments are written through: cachelines hold decompressed blocks,
+    // which cannot be written back at their offsets in the disk file.
+    // The segment is compressed (into a private image) before io_lock is taken: the lock is only
+    // held to publish the cachelines, so that reads through the cache are not stalled meanwhile.
+    if (USE_COMPRESSION)
+        write_segment(buf, segment_addr);
+
 std::lock_guard <std::mutex> guard(io_lock);
     int first_cacheline_idx = CACHELINES_PER_SEGMENT * segment_addr;
     for (int j = 0; j < CACHELINES_PER_SEGMENT; ++j) {
@@ -58,11 +116,17 @@ std::lock_guard <std::mutex> guard(io_lock);
         if (m.find(cacheline_idx) != m.end()) {
             i = m[cacheline_idx];
             metablocks[i].timestamp = ++T;
-            metablocks[i].dirty = true;
+            metablocks[i].dirty = !USE_COMPRESSION;
         } else {
             i = evict();
+            if (i < 0) {
+                // All cachelines are pinned: the cacheline is written through instead of cached.
+                if (!USE_COMPRESSION)
+                    disk_pwrite((char*) buf + j * CACHELINE_SIZE, CACHELINE_SIZE, (off_t) cacheline_idx * CACHELINE_SIZE);
+                continue;
+            }
             m[cacheline_idx] = i;
-            metablocks[i] = (cacheline_metadata) {cacheline_idx, ++T, true};
+            metablocks[i] = (cacheline_metadata) {cacheline_idx, ++T, !USE_COMPRESSION, 0};
             if (!inheap[i]) {
                 inheap[i] = 1;
                 heap.push(std::make_pair(T, i));
@@ -75,6 +139,7 @@ std::lock_guard <std::mutex> guard(io_lock);
 
 int evict() {
     int r;
+    int pinned = 0;     // Pinned cachelines met so far (all of them are pinned after NUM_CACHELINE).
     while (1) {
         std::pair <int, int> u = heap.top();
         heap.pop();
@@ -86,40 +151,46 @@ int evict() {
                 --inheap[u.second];
             continue;
         }
+        if (metablocks[u.second].pins > 0) {
+            // Pinned by a block reference: treat it as recently used.
+            metablocks[u.second].timestamp = ++T;
+            heap.push(std::make_pair(T, u.second));
+            if (++pinned > NUM_CACHELINE)
+                return -1;
+            continue;
+        }
         r = u.second;
         --inheap[r];
         break;
     }
     if (metablocks[r].dirty) {
-        int file_handle = open(lfs_path, O_RDWR);
         int file_offset = metablocks[r].cacheline_idx * CACHELINE_SIZE;
-        pwrite(file_handle, cache + r * CACHELINE_SIZE, CACHELINE_SIZE, file_offset);
-        fsync(file_handle);
-        close(file_handle);
+        disk_pwrite(cache + r * CACHELINE_SIZE, CACHELINE_SIZE, file_offset);
+        sync_devices();
     }
     m.erase(metablocks[r].cacheline_idx);
     return r;
 }
 
 void init_cache() {
+std::lock_guard <std::mutex> guard(io_lock);
     m.clear();
     while (heap.size()) heap.pop();
     for (int i = 0; i < NUM_CACHELINE; ++i) {
         inheap[i] = 1;
-        metablocks[i] = (cacheline_metadata) {-1, i, false};
+        metablocks[i] = (cacheline_metadata) {-1, i, false, 0};
         heap.push(std::make_pair(0, i));
     }
     T = NUM_CACHELINE;
 }
 
 void flush_cache() {
-    int file_handle = open(lfs_path, O_RDWR);
+std::lock_guard <std::mutex> guard(io_lock);
     for (int i = 0; i < NUM_CACHELINE; ++i) {
         int file_offset = metablocks[i].cacheline_idx * CACHELINE_SIZE;
         if (metablocks[i].dirty)
-            pwrite(file_handle, cache + i * CACHELINE_SIZE,
-                   CACHELINE_SIZE, file_offset);
+            disk_pwrite(cache + i * CACHELINE_SIZE,
+                        CACHELINE_SIZE, file_offset);
     }
-    fsync(file_handle);
-    close(file_handle);
+    sync_devices();
 }
\ No newline at end of file
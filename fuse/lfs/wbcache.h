@@ -12,6 +12,14 @@ typedef std::pair <int, int> pii;
 
 int read_block_through_cache(void* buf, int block_addr);
 
+// Read a block only if its cacheline is cached (without loading it).
+bool read_block_if_cached(void* buf, int block_addr);
+
+// Pin the cacheline of a block (loading it if necessary) and return a pointer to the block.
+// A pinned cacheline is never evicted until it is unpinned.
+const char* pin_block_through_cache(int block_addr, int &cacheline);
+void unpin_cacheline(int cacheline);
+
 // not used
 int write_block_through_cache(void* buf, int block_addr);
 
@@ -33,6 +41,7 @@ struct cacheline_metadata {
     int cacheline_idx;
     int timestamp;                  // for LRU
     bool dirty;                     // for segment buffer
+    int pins;                       // number of block references (not evictable if positive)
 };
 
 extern std::map <int, int> m;       // blockaddr -> cache block idx
@@ -51,6 +60,7 @@ extern char cache[CACHE_SIZE];
 extern int T;                       // counter
 
 int evict(/*int n*/);                   // n: # contiguous blocks to evict
+                                        // -1 if all cachelines are pinned (bypass the cache then)
 
 void init_cache();
 